@@ -0,0 +1,179 @@
+/**
+ * @file adapt.c
+ * @author Mark Lehane (markdlehane@gmail.com)
+ * @brief Adaptive policy functions.
+ * @details This module tunes the debounce and concurrency of a rule as
+ * it runs. Three exponentially weighted moving averages (weight 1/8, as
+ * TCP smooths its round trip time) are kept: the gap between the
+ * changes of a burst, the run time of the command and the interval
+ * between the times runs were wanted. The debounce has to outlast the
+ * gaps within a burst or one logical save runs twice, and a slow
+ * command is worth waiting a little longer for, so it is the larger of
+ * twice the gap and a tenth of the run time. The concurrency is the
+ * number of runs that overlap when runs are wanted at the measured
+ * interval and take the measured time (Little's law). A slow command
+ * alone is no reason to run more at once, so the concurrency is only
+ * raised after a run had to wait for a job slot. Both are kept within
+ * the configured bounds.
+ *
+ * @version 0.1
+ * @date 2025-12-16
+ *
+ * @copyright Copyright (c) 2025, Mark D Lehane.
+ *
+ */
+
+#include "adapt.h"
+
+// Local constants.
+#define EWMA_SHIFT 3
+#define GAP_FACTOR 2
+#define RUNTIME_SHARE 10
+
+/**
+ * @brief Fold a sample into a moving average.
+ *
+ * @param average The average, 0 before the first sample.
+ * @param sample The sample.
+ */
+static void ewma(uint64_t *average, uint64_t sample) {
+    if (*average == 0) {
+        *average = sample;
+    }
+    else {
+        *average = (uint64_t)((int64_t)*average + ((int64_t)sample - (int64_t)*average) / (1 << EWMA_SHIFT));
+    }
+}
+
+/**
+ * @brief Set the policy of a rule from its averages.
+ *
+ * @param rule The rule.
+ */
+static void adapt_policy(watch_rule_t *rule) {
+    rule_adapt_t *adapt = &rule->adapt;
+
+    uint64_t debounce = adapt->gap * GAP_FACTOR;
+    if (adapt->runtime / RUNTIME_SHARE > debounce) {
+        debounce = adapt->runtime / RUNTIME_SHARE;
+    }
+    debounce /= 1000;
+    if (debounce < adapt->min) {
+        debounce = adapt->min;
+    }
+    else if (debounce > adapt->max) {
+        debounce = adapt->max;
+    }
+    rule->policy.debounce = (unsigned)debounce;
+
+    uint64_t jobs = 1;
+    if (adapt->interval) {
+        jobs = (adapt->runtime + adapt->interval - 1) / adapt->interval;
+    }
+    if (jobs > rule->policy.jobs && !adapt->waited) {
+        jobs = rule->policy.jobs;
+    }
+    if (jobs < 1) {
+        jobs = 1;
+    }
+    else if (jobs > adapt->max_jobs) {
+        jobs = adapt->max_jobs;
+    }
+    rule->policy.jobs = (unsigned)jobs;
+}
+
+/**
+ * @brief Start adapting the policy of a rule.
+ * @details The configured debounce is the starting point and the
+ * configured concurrency the most allowed; runs start one at a time.
+ *
+ * @param rule The rule.
+ */
+void adapt_init(watch_rule_t *rule) {
+    rule_adapt_t *adapt = &rule->adapt;
+
+    adapt->max_jobs = rule->policy.jobs;
+    adapt->gap = (uint64_t)rule->policy.debounce * 1000 / GAP_FACTOR;
+    adapt->runtime = 0;
+    adapt->interval = 0;
+    adapt->last_event = 0;
+    adapt->last_run = 0;
+    adapt->waiting = 0;
+    adapt->waited = false;
+    adapt_policy(rule);
+}
+
+/**
+ * @brief Measure the gap since the previous change event.
+ * @details Changes in the same read share a time and say nothing about
+ * the gap; gaps longer than the longest debounce separate bursts.
+ *
+ * @param rule The rule.
+ * @param now The time of the change.
+ */
+void adapt_event(watch_rule_t *rule, uint64_t now) {
+    rule_adapt_t *adapt = &rule->adapt;
+
+    if (adapt->last_event && now > adapt->last_event) {
+        uint64_t gap = now - adapt->last_event;
+        if (gap <= (uint64_t)adapt->max * 1000) {
+            ewma(&adapt->gap, gap);
+            adapt_policy(rule);
+        }
+    }
+    adapt->last_event = now;
+}
+
+/**
+ * @brief Note that the next run is waiting for one of the rule's slots.
+ *
+ * @param rule The rule.
+ * @param since The time the run was wanted.
+ */
+void adapt_wait(watch_rule_t *rule, uint64_t since) {
+    if (rule->adapt.waiting == 0) {
+        rule->adapt.waiting = since;
+    }
+}
+
+/**
+ * @brief Measure the interval since the previous run was wanted.
+ * @details A run that waited for a slot, the rule's own or a shared
+ * one, was wanted when it began to wait, so the wait does not stretch
+ * the interval.
+ *
+ * @param rule The rule.
+ * @param now The time of the run.
+ * @param queued The time the run began to wait for a shared slot, or 0.
+ */
+void adapt_run(watch_rule_t *rule, uint64_t now, uint64_t queued) {
+    rule_adapt_t *adapt = &rule->adapt;
+    uint64_t wanted = now;
+
+    if (queued && queued < wanted) {
+        wanted = queued;
+    }
+    if (adapt->waiting && adapt->waiting < wanted) {
+        wanted = adapt->waiting;
+    }
+    adapt->waited = queued || adapt->waiting;
+    adapt->waiting = 0;
+    if (adapt->last_run && wanted > adapt->last_run) {
+        ewma(&adapt->interval, wanted - adapt->last_run);
+    }
+    adapt->last_run = wanted;
+    adapt_policy(rule);
+}
+
+/**
+ * @brief Measure the run time of a command.
+ *
+ * @param rule The rule.
+ * @param runtime The run time in microseconds.
+ */
+void adapt_exit(watch_rule_t *rule, uint64_t runtime) {
+    ewma(&rule->adapt.runtime, runtime ? runtime : 1);
+    adapt_policy(rule);
+}
+
+/* End. */
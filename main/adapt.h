@@ -0,0 +1,33 @@
+/**
+ * @file adapt.h
+ * @author Mark Lehane (markdlehane@gmail.com)
+ * @brief Adaptive policy interface.
+ * @details Sets the debounce and concurrency of a rule from its
+ * measured change gaps and run times.
+ *
+ * @version 0.1
+ * @date 2025-12-16
+ *
+ * @copyright Copyright (c) 2025, Mark D Lehane.
+ *
+ */
+
+#ifndef ADAPT_H
+#define ADAPT_H
+
+#include <stdint.h>
+
+#include "rules.h"
+
+// A rule adapts when it has debounce bounds.
+#define ADAPTIVE(rule) ((rule)->adapt.max != 0)
+
+extern void adapt_init(watch_rule_t *rule);
+extern void adapt_event(watch_rule_t *rule, uint64_t now);
+extern void adapt_wait(watch_rule_t *rule, uint64_t since);
+extern void adapt_run(watch_rule_t *rule, uint64_t now, uint64_t queued);
+extern void adapt_exit(watch_rule_t *rule, uint64_t runtime);
+
+#endif
+
+/* End. */
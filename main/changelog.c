@@ -0,0 +1,284 @@
+/**
+ * @file changelog.c
+ * @author Mark Lehane (markdlehane@gmail.com)
+ * @brief Change log functions.
+ * @details This module keeps the paths that changed, each once, in the
+ * order they last changed, stamped with a clock that counts changes. A
+ * client asks for the paths changed since a token it was given, and
+ * gets them with a new token to ask with next time. The log holds at
+ * most a fixed number of paths: the one that changed longest ago makes
+ * way for a new one, and the clock of the latest it dropped is the
+ * oldest token it can still answer; an older token, or one from another
+ * watcher, is told to walk the tree itself. The paths are in an open
+ * addressing hash table for deduplication and on a list in change
+ * order, so a change costs O(1) and a query the number of paths it
+ * returns.
+ *
+ * @version 0.1
+ * @date 2025-12-30
+ *
+ * @copyright Copyright (c) 2025, Mark D Lehane.
+ *
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "changelog.h"
+
+/**
+ * @brief A changed path.
+ *
+ */
+typedef struct changelog_entry_s {
+    uint64_t hash;
+    uint64_t tick;                      // The clock when the path last changed.
+    struct changelog_entry_s *older;    // The path that changed before it.
+    struct changelog_entry_s *newer;    // The path that changed after it.
+    char path[];
+
+} changelog_entry_t;
+
+// Local data.
+static changelog_entry_t **s_slots = NULL;
+static size_t s_capacity = 0;
+static size_t s_count = 0;
+static size_t s_max = 0;
+static changelog_entry_t *s_oldest = NULL;
+static changelog_entry_t *s_newest = NULL;
+static uint64_t s_tick = 0;
+static uint64_t s_floor = 0;
+static uint64_t s_instance = 0;
+
+/**
+ * @brief Hash a path (64 bit FNV-1a).
+ *
+ * @param path The path.
+ * @return uint64_t The hash.
+ */
+static uint64_t hash_path(const char *path) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    while (*path) {
+        hash ^= (unsigned char)*path++;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/**
+ * @brief Find the slot for a path.
+ *
+ * @param path The path.
+ * @param hash The hash of the path.
+ * @return size_t The slot holding the path, or the empty slot where it belongs.
+ */
+static size_t find_slot(const char *path, uint64_t hash) {
+    size_t mask = s_capacity - 1;
+    size_t slot = hash & mask;
+    while (s_slots[slot] && (s_slots[slot]->hash != hash || strcmp(s_slots[slot]->path, path) != 0)) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+/**
+ * @brief Take an entry off the change order list.
+ *
+ * @param entry The entry.
+ */
+static void unlink_entry(changelog_entry_t *entry) {
+    if (entry->older) {
+        entry->older->newer = entry->newer;
+    }
+    else {
+        s_oldest = entry->newer;
+    }
+    if (entry->newer) {
+        entry->newer->older = entry->older;
+    }
+    else {
+        s_newest = entry->older;
+    }
+}
+
+/**
+ * @brief Put an entry at the new end of the change order list.
+ *
+ * @param entry The entry.
+ */
+static void append_entry(changelog_entry_t *entry) {
+    entry->older = s_newest;
+    entry->newer = NULL;
+    if (s_newest) {
+        s_newest->newer = entry;
+    }
+    else {
+        s_oldest = entry;
+    }
+    s_newest = entry;
+}
+
+/**
+ * @brief Empty a slot, moving up the entries that probed past it.
+ *
+ * @param slot The slot.
+ */
+static void remove_slot(size_t slot) {
+    size_t mask = s_capacity - 1;
+    size_t hole = slot;
+
+    s_slots[hole] = NULL;
+    for (size_t next = (hole + 1) & mask; s_slots[next]; next = (next + 1) & mask) {
+        size_t home = s_slots[next]->hash & mask;
+        // The entry stays unless its home lies cyclically after the hole.
+        bool stays = hole <= next ? (home > hole && home <= next) : (home > hole || home <= next);
+        if (!stays) {
+            s_slots[hole] = s_slots[next];
+            s_slots[next] = NULL;
+            hole = next;
+        }
+    }
+}
+
+/**
+ * @brief Drop the path that changed longest ago.
+ *
+ */
+static void evict(void) {
+    changelog_entry_t *entry = s_oldest;
+
+    unlink_entry(entry);
+    remove_slot(find_slot(entry->path, entry->hash));
+    s_floor = entry->tick;
+    s_count--;
+    free(entry);
+}
+
+/**
+ * @brief Start the change log.
+ *
+ * @param max The most paths to keep.
+ * @return bool False if the number is out of range or memory is exhausted.
+ */
+bool changelog_init(unsigned max) {
+    struct timespec now;
+
+    if (max == 0 || max > CHANGELOG_MAX) {
+        printf("--change-log must be between 1 and %d\n", CHANGELOG_MAX);
+        return false;
+    }
+    s_capacity = 16;
+    while (s_capacity < (size_t)max * 2) {
+        s_capacity *= 2;
+    }
+    s_slots = calloc(s_capacity, sizeof(*s_slots));
+    if (s_slots == NULL) {
+        perror("Failed to allocate the change log");
+        s_capacity = 0;
+        return false;
+    }
+    s_max = max;
+    s_tick = 0;
+    s_floor = 0;
+    // Tokens name the watcher, so one from an earlier watcher is never taken as current.
+    clock_gettime(CLOCK_REALTIME, &now);
+    s_instance = ((uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec) ^ ((uint64_t)getpid() << 32);
+    return true;
+}
+
+/**
+ * @brief Check if the change log is kept.
+ *
+ * @return bool True if changes are being logged.
+ */
+bool changelog_enabled(void) {
+    return s_slots != NULL;
+}
+
+/**
+ * @brief Log a change to a path.
+ *
+ * @param path The changed path, or NULL if it is not known.
+ */
+void changelog_add(const char *path) {
+    if (s_slots == NULL || path == NULL) {
+        return;
+    }
+    uint64_t hash = hash_path(path);
+    size_t slot = find_slot(path, hash);
+    changelog_entry_t *entry = s_slots[slot];
+    if (entry) {
+        unlink_entry(entry);
+    }
+    else {
+        size_t len = strlen(path) + 1;
+        entry = malloc(sizeof(*entry) + len);
+        if (entry == NULL) {
+            return;
+        }
+        memcpy(entry->path, path, len);
+        entry->hash = hash;
+        if (s_count == s_max) {
+            evict();
+            slot = find_slot(path, hash);
+        }
+        s_slots[slot] = entry;
+        s_count++;
+    }
+    entry->tick = ++s_tick;
+    append_entry(entry);
+}
+
+/**
+ * @brief Report the paths changed since a token.
+ * @details The reply is the new token, then either the paths, the most
+ * recent first, or "full" if the changes since the token are not all
+ * known and the client has to walk the tree.
+ *
+ * @param fp The output stream.
+ * @param token The token from an earlier reply, or NULL for none.
+ */
+void changelog_since(FILE *fp, const char *token) {
+    uint64_t instance;
+    uint64_t tick;
+    int end = 0;
+
+    if (s_slots == NULL) {
+        fputs("error no change log, start the watcher with --control and --change-log\n", fp);
+        return;
+    }
+    bool known = token && sscanf(token, "c:%" SCNx64 ":%" SCNu64 "%n", &instance, &tick, &end) == 2 &&
+                 token[end] == '\0' && instance == s_instance && tick <= s_tick && tick >= s_floor;
+    fprintf(fp, "token c:%" PRIx64 ":%" PRIu64 "\n", s_instance, s_tick);
+    if (!known) {
+        fputs("full\n", fp);
+        return;
+    }
+    for (const changelog_entry_t *entry = s_newest; entry && entry->tick > tick; entry = entry->older) {
+        fprintf(fp, "%s\n", entry->path);
+    }
+}
+
+/**
+ * @brief Release the change log.
+ *
+ */
+void changelog_free(void) {
+    while (s_oldest) {
+        changelog_entry_t *entry = s_oldest;
+        s_oldest = entry->newer;
+        free(entry);
+    }
+    free(s_slots);
+    s_slots = NULL;
+    s_newest = NULL;
+    s_capacity = 0;
+    s_count = 0;
+}
+
+/* End. */
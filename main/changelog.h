@@ -0,0 +1,33 @@
+/**
+ * @file changelog.h
+ * @author Mark Lehane (markdlehane@gmail.com)
+ * @brief Change log interface.
+ * @details The paths changed since a token, for clients that poll the
+ * control socket rather than walk the tree.
+ *
+ * @version 0.1
+ * @date 2025-12-30
+ *
+ * @copyright Copyright (c) 2025, Mark D Lehane.
+ *
+ */
+
+#ifndef CHANGELOG_H
+#define CHANGELOG_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+// The default and greatest number of paths kept.
+#define CHANGELOG_DEFAULT_MAX 65536
+#define CHANGELOG_MAX (1 << 24)
+
+extern bool changelog_init(unsigned max);
+extern bool changelog_enabled(void);
+extern void changelog_add(const char *path);
+extern void changelog_since(FILE *fp, const char *token);
+extern void changelog_free(void);
+
+#endif
+
+/* End. */
@@ -0,0 +1,343 @@
+/**
+ * @file changeset.c
+ * @author Mark Lehane (markdlehane@gmail.com)
+ * @brief Change set functions.
+ * @details This module coalesces the paths reported by change events
+ * into a set of distinct paths, so that a burst of writes to one file
+ * is one entry. The set is an open addressing hash table keyed by path
+ * that doubles when half full, and is emptied when the changes it
+ * holds have been handed to a run. Each rule has its own set.
+ *
+ * The memory of a set (its table and paths) is capped, so a storm over
+ * millions of files cannot grow it without bound. At the cap the set
+ * degrades: first each path is replaced by its directory, which
+ * coalesces a directory of changed files into one entry, and if the
+ * directories still do not fit the set holds no paths at all, only the
+ * fact that anything may have changed.
+ *
+ * @version 0.1
+ * @date 2025-12-10
+ *
+ * @copyright Copyright (c) 2025, Mark D Lehane.
+ *
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <linux/limits.h>
+
+#include "changeset.h"
+
+/**
+ * @brief A change set entry.
+ *
+ */
+typedef struct change_entry_s {
+    char *path;             // NULL for an empty slot.
+    uint64_t hash;
+
+} change_entry_t;
+
+/**
+ * @brief A change set.
+ *
+ */
+struct changeset_s {
+    change_entry_t *table;
+    size_t capacity;
+    size_t used;
+    size_t bytes;           // Memory held by the table and its paths.
+    CHANGESET_LEVEL level;
+
+};
+
+// Local constants.
+#define CHANGESET_MIN_CAPACITY 64
+
+// Local data.
+static size_t s_max_bytes = CHANGESET_DEFAULT_MAX_BYTES;
+
+/**
+ * @brief Hash a path (64 bit FNV-1a).
+ *
+ * @param path The path.
+ * @return uint64_t The hash.
+ */
+static uint64_t hash_path(const char *path) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    while (*path) {
+        hash ^= (unsigned char)*path++;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/**
+ * @brief Find the slot for a path.
+ *
+ * @param table The table to search.
+ * @param capacity The table capacity (a power of two).
+ * @param path The path.
+ * @param hash The hash of the path.
+ * @return change_entry_t* The entry holding the path, or the empty slot where it belongs.
+ */
+static change_entry_t *find_slot(change_entry_t *table, size_t capacity, const char *path, uint64_t hash) {
+    size_t mask = capacity - 1;
+    size_t slot = hash & mask;
+    while (table[slot].path && (table[slot].hash != hash || strcmp(table[slot].path, path) != 0)) {
+        slot = (slot + 1) & mask;
+    }
+    return &table[slot];
+}
+
+/**
+ * @brief Grow the table.
+ *
+ * @param set The change set.
+ * @param capacity The new capacity (a power of two).
+ * @return bool False if memory is exhausted.
+ */
+static bool grow(changeset_t *set, size_t capacity) {
+    change_entry_t *table = calloc(capacity, sizeof(*table));
+    if (table == NULL) {
+        return false;
+    }
+    for (size_t i = 0; i < set->capacity; i++) {
+        if (set->table[i].path) {
+            *find_slot(table, capacity, set->table[i].path, set->table[i].hash) = set->table[i];
+        }
+    }
+    free(set->table);
+    set->bytes += (capacity - set->capacity) * sizeof(*table);
+    set->table = table;
+    set->capacity = capacity;
+    return true;
+}
+
+/**
+ * @brief Set the most memory each change set may hold.
+ *
+ * @param bytes The cap in bytes.
+ */
+void changeset_limit(size_t bytes) {
+    s_max_bytes = bytes;
+}
+
+/**
+ * @brief Create an empty change set.
+ *
+ * @return changeset_t* The change set, or NULL if memory is exhausted.
+ */
+changeset_t *changeset_new(void) {
+    return calloc(1, sizeof(changeset_t));
+}
+
+/**
+ * @brief Put a path in the table, within the memory cap.
+ *
+ * @param set The change set.
+ * @param path The path.
+ * @return int 1 if the path was added, 0 if it was already there, -1 if it does not fit.
+ */
+static int insert(changeset_t *set, const char *path) {
+    size_t len = strlen(path) + 1;
+
+    if ((set->used + 1) * 2 > set->capacity) {
+        size_t capacity = set->capacity ? set->capacity * 2 : CHANGESET_MIN_CAPACITY;
+        if (set->bytes + (capacity - set->capacity) * sizeof(change_entry_t) + len > s_max_bytes ||
+            !grow(set, capacity)) {
+            return -1;
+        }
+    }
+    uint64_t hash = hash_path(path);
+    change_entry_t *entry = find_slot(set->table, set->capacity, path, hash);
+    if (entry->path) {
+        return 0;
+    }
+    if (set->bytes + len > s_max_bytes || (entry->path = strdup(path)) == NULL) {
+        return -1;
+    }
+    entry->hash = hash;
+    set->used++;
+    set->bytes += len;
+    return 1;
+}
+
+/**
+ * @brief Return the directory of a path.
+ *
+ * @param path The path.
+ * @param dir Receives the directory, PATH_MAX bytes.
+ * @return const char* The directory.
+ */
+static const char *parent(const char *path, char *dir) {
+    const char *slash = strrchr(path, '/');
+
+    if (slash == NULL) {
+        return path;
+    }
+    size_t len = slash == path ? 1 : (size_t)(slash - path);
+    memcpy(dir, path, len);
+    dir[len] = '\0';
+    return dir;
+}
+
+/**
+ * @brief Release the table and its paths.
+ *
+ * @param set The change set.
+ */
+static void release(changeset_t *set) {
+    changeset_clear(set);
+    free(set->table);
+    set->table = NULL;
+    set->capacity = 0;
+    set->bytes = 0;
+}
+
+/**
+ * @brief Replace each path in the set by its directory.
+ *
+ * @param set The change set.
+ * @return bool True if the directories fit within the cap.
+ */
+static bool coarsen(changeset_t *set) {
+    change_entry_t *table = set->table;
+    size_t capacity = set->capacity;
+    char dir[PATH_MAX];
+    bool fits = true;
+
+    set->table = NULL;
+    set->capacity = 0;
+    set->used = 0;
+    set->bytes = 0;
+    set->level = CHANGESET_DIRS;
+    for (size_t i = 0; i < capacity; i++) {
+        if (table[i].path) {
+            fits = fits && insert(set, parent(table[i].path, dir)) >= 0;
+            free(table[i].path);
+        }
+    }
+    free(table);
+    return fits;
+}
+
+/**
+ * @brief Add a path to the change set.
+ * @details A path that does not fit degrades the set, first to
+ * directories and then to holding no paths.
+ *
+ * @param set The change set.
+ * @param path The changed path.
+ * @return bool True if the path was not already in the set.
+ */
+bool changeset_add(changeset_t *set, const char *path) {
+    char dir[PATH_MAX];
+    int added = -1;
+
+    if (set->level == CHANGESET_ALL) {
+        return false;
+    }
+    if (set->level == CHANGESET_PATHS) {
+        added = insert(set, path);
+        if (added < 0 && !coarsen(set)) {
+            set->level = CHANGESET_ALL;
+        }
+    }
+    if (set->level == CHANGESET_DIRS && added < 0) {
+        added = insert(set, parent(path, dir));
+    }
+    if (added < 0) {
+        release(set);
+        set->level = CHANGESET_ALL;
+        return true;
+    }
+    return added > 0;
+}
+
+/**
+ * @brief Call a function for each path in the change set.
+ *
+ * @param set The change set.
+ * @param fn The function to call.
+ * @param context Passed to the function.
+ */
+void changeset_each(const changeset_t *set, changeset_fn fn, void *context) {
+    for (size_t i = 0; i < set->capacity; i++) {
+        if (set->table[i].path) {
+            fn(set->table[i].path, context);
+        }
+    }
+}
+
+/**
+ * @brief Print a path on its own line.
+ *
+ */
+static void print_path(const char *path, void *context) {
+    fprintf((FILE *)context, "%s\n", path);
+}
+
+/**
+ * @brief Print each path in the change set on its own line.
+ *
+ * @param set The change set.
+ * @param fp The output stream.
+ */
+void changeset_print(const changeset_t *set, FILE *fp) {
+    changeset_each(set, print_path, fp);
+    fflush(fp);
+}
+
+/**
+ * @brief Return the number of paths in the change set.
+ *
+ * @param set The change set.
+ * @return unsigned long The path count.
+ */
+unsigned long changeset_count(const changeset_t *set) {
+    return (unsigned long)set->used;
+}
+
+/**
+ * @brief Return how far the change set has degraded.
+ *
+ * @param set The change set.
+ * @return CHANGESET_LEVEL What the entries stand for.
+ */
+CHANGESET_LEVEL changeset_level(const changeset_t *set) {
+    return set->level;
+}
+
+/**
+ * @brief Empty the change set.
+ * @details The table is kept for the next changes, which are paths again.
+ *
+ * @param set The change set.
+ */
+void changeset_clear(changeset_t *set) {
+    for (size_t i = 0; i < set->capacity; i++) {
+        if (set->table[i].path) {
+            set->bytes -= strlen(set->table[i].path) + 1;
+            free(set->table[i].path);
+            set->table[i].path = NULL;
+        }
+    }
+    set->used = 0;
+    set->level = CHANGESET_PATHS;
+}
+
+/**
+ * @brief Release a change set.
+ *
+ * @param set The change set, may be NULL.
+ */
+void changeset_free(changeset_t *set) {
+    if (set) {
+        release(set);
+        free(set);
+    }
+}
+
+/* End. */
@@ -0,0 +1,61 @@
+/**
+ * @file changeset.h
+ * @author Mark Lehane (markdlehane@gmail.com)
+ * @brief Change set interface.
+ * @details The set of distinct paths changed since the last run.
+ *
+ * @version 0.1
+ * @date 2025-12-10
+ *
+ * @copyright Copyright (c) 2025, Mark D Lehane.
+ *
+ */
+
+#ifndef CHANGESET_H
+#define CHANGESET_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// The default memory cap of a change set (bytes).
+#define CHANGESET_DEFAULT_MAX_BYTES (8UL << 20)
+
+/**
+ * @brief Enum used to identify what the entries of a change set stand for.
+ *
+ */
+typedef enum changeset_level_e {
+    CHANGESET_PATHS = 0,    // Each changed path.
+    CHANGESET_DIRS,         // The directories holding the changed paths.
+    CHANGESET_ALL           // No entries, anything may have changed.
+
+} CHANGESET_LEVEL;
+
+/**
+ * @brief A set of changed paths (opaque).
+ *
+ */
+typedef struct changeset_s changeset_t;
+
+/**
+ * @brief Change set iteration callback.
+ *
+ * @param path The changed path.
+ * @param context The caller's context.
+ */
+typedef void (*changeset_fn)(const char *path, void *context);
+
+extern void changeset_limit(size_t bytes);
+extern changeset_t *changeset_new(void);
+extern bool changeset_add(changeset_t *set, const char *path);
+extern void changeset_each(const changeset_t *set, changeset_fn fn, void *context);
+extern void changeset_print(const changeset_t *set, FILE *fp);
+extern unsigned long changeset_count(const changeset_t *set);
+extern CHANGESET_LEVEL changeset_level(const changeset_t *set);
+extern void changeset_clear(changeset_t *set);
+extern void changeset_free(changeset_t *set);
+
+#endif
+
+/* End. */
@@ -0,0 +1,543 @@
+/**
+ * @file chunks.c
+ * @author Mark Lehane (markdlehane@gmail.com)
+ * @brief Content-defined chunk functions.
+ * @details A command that processes a large file whole does work in
+ * proportion to the file, however little of it changed. This module
+ * cuts each file of a rule into chunks where a rolling hash of the
+ * bytes says so (the gear hash of FastCDC), 8kB on average, and keeps
+ * the hash of each chunk. As the cut points follow the content, an
+ * edit changes only the chunks around it, even when it moves the rest
+ * of the file. The chunks of the new content whose hash was not in the
+ * file before are the ranges reported to the command.
+ *
+ * The file is read through a buffer of several chunks rather than
+ * mapped, so a file cut short while it is read is just shorter. The
+ * rolling hash is a shift and an add a byte with no branch but the cut
+ * test, which the compiler keeps in registers; it is the read, not the
+ * hash, that costs.
+ *
+ * @version 0.1
+ * @date 2026-01-01
+ *
+ * @copyright Copyright (c) 2025, Mark D Lehane.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <sys/stat.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <ftw.h>
+
+#include "chunks.h"
+
+/**
+ * @brief The chunks of a file.
+ *
+ */
+typedef struct chunks_file_s {
+    uint64_t key;               // Hash of the path.
+    uint64_t size;              // Size of the file when it was chunked.
+    size_t count;               // Number of chunks.
+    uint64_t *hashes;           // The chunk hashes, in file order.
+    char path[];
+
+} chunks_file_t;
+
+/**
+ * @brief The chunk hashes of the files of a rule.
+ *
+ */
+struct chunks_s {
+    chunks_file_t **slots;
+    size_t capacity;
+    size_t used;
+
+};
+
+/**
+ * @brief A chunk of the file being read.
+ *
+ */
+typedef struct chunk_s {
+    uint64_t offset;
+    uint32_t length;
+    uint64_t hash;
+
+} chunk_t;
+
+/**
+ * @brief The chunks of the file being read.
+ *
+ */
+typedef struct chunk_list_s {
+    chunk_t *chunks;
+    size_t count;
+    size_t capacity;
+
+} chunk_list_t;
+
+// Local constants.
+#define CHUNK_MIN (2 * 1024)
+#define CHUNK_MAX (64 * 1024)
+#define CHUNK_CUT_BITS 13               // A cut every 2^13 bytes (8kB) past the minimum, on average.
+#define TABLE_MIN_CAPACITY 64
+#define SEED_MAX_FDS 32
+
+// Local data.
+static uint64_t s_gear[256];
+static bool s_geared = false;
+static unsigned char s_buf[4 * CHUNK_MAX];
+static chunk_list_t s_list = {0};
+static chunks_t **s_seeding = NULL;
+static int s_seed_depth = 0;
+
+/**
+ * @brief Hash a string (64 bit FNV-1a).
+ *
+ * @param text The string.
+ * @return uint64_t The hash.
+ */
+static uint64_t hash_path(const char *text) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    while (*text) {
+        hash ^= (unsigned char)*text++;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/**
+ * @brief Hash some bytes.
+ *
+ * @param data The bytes.
+ * @param len The number of bytes.
+ * @return uint64_t The hash, never 0.
+ */
+static uint64_t hash_bytes(const unsigned char *data, size_t len) {
+    uint64_t hash = 0xcbf29ce484222325ULL ^ len;
+    size_t i = 0;
+
+    for (; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ word) * 0x9e3779b97f4a7c15ULL;
+        hash ^= hash >> 32;
+    }
+    for (; i < len; i++) {
+        hash = (hash ^ data[i]) * 0x100000001b3ULL;
+    }
+    return hash ? hash : 1;
+}
+
+/**
+ * @brief Fill the gear table with fixed pseudo-random values.
+ * @details The values are the same in every watcher, so the cut points
+ * of a file are too.
+ *
+ */
+static void gear_init(void) {
+    uint64_t state = 0x6a09e667f3bcc909ULL;
+
+    for (int index = 0; index < 256; index++) {
+        // splitmix64.
+        uint64_t value = (state += 0x9e3779b97f4a7c15ULL);
+        value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+        s_gear[index] = value ^ (value >> 31);
+    }
+    s_geared = true;
+}
+
+/**
+ * @brief Find the length of the chunk at the start of some bytes.
+ *
+ * @param data The bytes.
+ * @param len The number of bytes, all that is left of the file or at
+ * least CHUNK_MAX.
+ * @return size_t The chunk length.
+ */
+static size_t cut(const unsigned char *data, size_t len) {
+    uint64_t hash = 0;
+    size_t end = len < CHUNK_MAX ? len : CHUNK_MAX;
+
+    if (len <= CHUNK_MIN) {
+        return len;
+    }
+    for (size_t i = CHUNK_MIN; i < end; i++) {
+        hash = (hash << 1) + s_gear[data[i]];
+        // The high bits of the hash depend on the last 64 bytes.
+        if ((hash >> (64 - CHUNK_CUT_BITS)) == 0) {
+            return i + 1;
+        }
+    }
+    return end;
+}
+
+/**
+ * @brief Add a chunk to the list.
+ *
+ * @param list The list.
+ * @param chunk The chunk.
+ * @return bool False if memory is exhausted.
+ */
+static bool list_add(chunk_list_t *list, chunk_t chunk) {
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity ? list->capacity * 2 : 256;
+        chunk_t *chunks = realloc(list->chunks, capacity * sizeof(*chunks));
+        if (chunks == NULL) {
+            return false;
+        }
+        list->chunks = chunks;
+        list->capacity = capacity;
+    }
+    list->chunks[list->count++] = chunk;
+    return true;
+}
+
+/**
+ * @brief Cut a file into chunks.
+ * @details The buffer is topped up whenever less than the largest
+ * chunk is left in it, so every chunk is hashed in one piece.
+ *
+ * @param fd The open file.
+ * @param list Receives the chunks.
+ * @return bool False if the file could not be read.
+ */
+static bool chunk_file(int fd, chunk_list_t *list) {
+    size_t have = 0;
+    size_t start = 0;
+    uint64_t offset = 0;
+    bool eof = false;
+
+    if (!s_geared) {
+        gear_init();
+    }
+    list->count = 0;
+    while (!eof || start < have) {
+        if (!eof && have - start < CHUNK_MAX) {
+            memmove(s_buf, s_buf + start, have - start);
+            offset += start;
+            have -= start;
+            start = 0;
+            while (have < sizeof(s_buf)) {
+                ssize_t got = read(fd, s_buf + have, sizeof(s_buf) - have);
+                if (got < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (got < 0) {
+                    return false;
+                }
+                if (got == 0) {
+                    eof = true;
+                    break;
+                }
+                have += (size_t)got;
+            }
+            continue;
+        }
+        size_t len = cut(s_buf + start, have - start);
+        chunk_t chunk = { offset + start, (uint32_t)len, hash_bytes(s_buf + start, len) };
+        if (!list_add(list, chunk)) {
+            return false;
+        }
+        start += len;
+    }
+    return true;
+}
+
+/**
+ * @brief Find the slot for a path.
+ *
+ * @param store The store.
+ * @param path The path.
+ * @param key The hash of the path.
+ * @return size_t The slot holding the path, or the empty slot where it belongs.
+ */
+static size_t find_slot(const chunks_t *store, const char *path, uint64_t key) {
+    size_t mask = store->capacity - 1;
+    size_t slot = key & mask;
+
+    while (store->slots[slot] && (store->slots[slot]->key != key || strcmp(store->slots[slot]->path, path) != 0)) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+/**
+ * @brief Find the entry of a file, adding it if it is new.
+ *
+ * @param store The store, created if NULL.
+ * @param path The path.
+ * @param added Receives true if the entry is new.
+ * @return chunks_file_t* The entry, or NULL if memory is exhausted.
+ */
+static chunks_file_t *find_file(chunks_t **store, const char *path, bool *added) {
+    chunks_t *chunks = *store;
+    uint64_t key = hash_path(path);
+
+    if (chunks == NULL && (chunks = *store = calloc(1, sizeof(*chunks))) == NULL) {
+        return NULL;
+    }
+    if ((chunks->used + 1) * 2 > chunks->capacity) {
+        size_t capacity = chunks->capacity ? chunks->capacity * 2 : TABLE_MIN_CAPACITY;
+        chunks_t grown = { calloc(capacity, sizeof(chunks_file_t *)), capacity, chunks->used };
+        if (grown.slots == NULL) {
+            return NULL;
+        }
+        for (size_t slot = 0; slot < chunks->capacity; slot++) {
+            if (chunks->slots[slot]) {
+                grown.slots[find_slot(&grown, chunks->slots[slot]->path, chunks->slots[slot]->key)] = chunks->slots[slot];
+            }
+        }
+        free(chunks->slots);
+        *chunks = grown;
+    }
+    size_t slot = find_slot(chunks, path, key);
+    *added = chunks->slots[slot] == NULL;
+    if (*added) {
+        size_t len = strlen(path) + 1;
+        chunks_file_t *file = calloc(1, sizeof(*file) + len);
+        if (file == NULL) {
+            return NULL;
+        }
+        memcpy(file->path, path, len);
+        file->key = key;
+        chunks->slots[slot] = file;
+        chunks->used++;
+    }
+    return chunks->slots[slot];
+}
+
+/**
+ * @brief Keep the chunks just read as those of a file.
+ *
+ * @param file The entry of the file.
+ * @param list The chunks.
+ * @param size The size of the file.
+ */
+static void keep(chunks_file_t *file, const chunk_list_t *list, uint64_t size) {
+    uint64_t *hashes = list->count ? malloc(list->count * sizeof(*hashes)) : NULL;
+
+    if (list->count && hashes == NULL) {
+        return;
+    }
+    for (size_t index = 0; index < list->count; index++) {
+        hashes[index] = list->chunks[index].hash;
+    }
+    free(file->hashes);
+    file->hashes = hashes;
+    file->count = list->count;
+    file->size = size;
+}
+
+/**
+ * @brief Check if a file has the same chunks as before.
+ *
+ * @param file The entry of the file.
+ * @param list The chunks now.
+ * @return bool True if the hashes are the same, in the same order.
+ */
+static bool unchanged(const chunks_file_t *file, const chunk_list_t *list) {
+    if (file->count != list->count) {
+        return false;
+    }
+    for (size_t index = 0; index < list->count; index++) {
+        if (file->hashes[index] != list->chunks[index].hash) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Write the ranges of the chunks that were not in a file before.
+ * @details The old hashes go in a set for the lookups; adjacent new
+ * chunks make one range.
+ *
+ * @param fp The output stream.
+ * @param file The entry of the file, with its old chunks.
+ * @param list The chunks now.
+ * @return bool False if memory is exhausted.
+ */
+static bool write_ranges(FILE *fp, const chunks_file_t *file, const chunk_list_t *list) {
+    size_t capacity = 16;
+    uint64_t *set;
+    uint64_t start = 0;
+    uint64_t end = 0;
+    bool open = false;
+    const char *separator = "";
+
+    while (capacity < file->count * 2) {
+        capacity *= 2;
+    }
+    set = calloc(capacity, sizeof(*set));
+    if (set == NULL) {
+        return false;
+    }
+    // Chunk hashes are never 0, which marks an empty slot.
+    for (size_t index = 0; index < file->count; index++) {
+        size_t slot = file->hashes[index] & (capacity - 1);
+        while (set[slot] && set[slot] != file->hashes[index]) {
+            slot = (slot + 1) & (capacity - 1);
+        }
+        set[slot] = file->hashes[index];
+    }
+    for (size_t index = 0; index < list->count; index++) {
+        const chunk_t *chunk = &list->chunks[index];
+        size_t slot = chunk->hash & (capacity - 1);
+        while (set[slot] && set[slot] != chunk->hash) {
+            slot = (slot + 1) & (capacity - 1);
+        }
+        if (set[slot]) {
+            continue;
+        }
+        if (open && chunk->offset == end) {
+            end += chunk->length;
+            continue;
+        }
+        if (open) {
+            fprintf(fp, "%s%" PRIu64 ":%" PRIu64, separator, start, end - start);
+            separator = ",";
+        }
+        start = chunk->offset;
+        end = chunk->offset + chunk->length;
+        open = true;
+    }
+    if (open) {
+        fprintf(fp, "%s%" PRIu64 ":%" PRIu64, separator, start, end - start);
+    }
+    free(set);
+    return true;
+}
+
+/**
+ * @brief Read the chunks of a file.
+ *
+ * @param path The path.
+ * @param size Receives the size of the file.
+ * @return bool False if the path is not a regular file that could be read.
+ */
+static bool read_chunks(const char *path, uint64_t *size) {
+    struct stat st;
+    int fd = open(path, O_RDONLY | O_CLOEXEC | O_NOCTTY | O_NONBLOCK);
+    bool ok = false;
+
+    if (fd == -1) {
+        return false;
+    }
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        ok = chunk_file(fd, &s_list);
+    }
+    close(fd);
+    *size = 0;
+    for (size_t index = 0; ok && index < s_list.count; index++) {
+        *size += s_list.chunks[index].length;
+    }
+    return ok;
+}
+
+/**
+ * @brief Report the changed byte ranges of a path.
+ * @details The line is the path, its size and the ranges of new content
+ * as OFFSET:LENGTH separated by commas, tab separated. The ranges are
+ * empty if content was only removed or moved, and a file not seen
+ * before is one range. For a path that cannot be compared, such as a
+ * directory, the size and the ranges are "*". A file whose content is
+ * the same has no line. The chunks are kept for the next change.
+ *
+ * @param store The chunks of the rule, created if NULL.
+ * @param path The changed path.
+ * @param fp The output stream.
+ */
+void chunks_update(chunks_t **store, const char *path, FILE *fp) {
+    uint64_t size;
+    bool added = false;
+    chunks_file_t *file;
+
+    if (!read_chunks(path, &size) || (file = find_file(store, path, &added)) == NULL) {
+        fprintf(fp, "%s\t*\t*\n", path);
+        return;
+    }
+    if (added) {
+        fprintf(fp, "%s\t%" PRIu64 "\t0:%" PRIu64 "\n", path, size, size);
+    }
+    else if (!unchanged(file, &s_list)) {
+        fprintf(fp, "%s\t%" PRIu64 "\t", path, size);
+        if (!write_ranges(fp, file, &s_list)) {
+            fputc('*', fp);
+        }
+        fputc('\n', fp);
+    }
+    keep(file, &s_list, size);
+}
+
+/**
+ * @brief Record the chunks of one file found by the seeding walk.
+ *
+ * @param path The path.
+ * @param st The status of the path.
+ * @param type The kind of path.
+ * @param ftw The depth of the path.
+ * @return int FTW_CONTINUE, or FTW_SKIP_SUBTREE below the top directory of a rule that is not recursive.
+ */
+static int seed_path(const char *path, const struct stat *st, int type, struct FTW *ftw) {
+    uint64_t size;
+    bool added;
+
+    if (type == FTW_D && ftw->level > s_seed_depth) {
+        return FTW_SKIP_SUBTREE;
+    }
+    if (type == FTW_F && S_ISREG(st->st_mode) && read_chunks(path, &size)) {
+        chunks_file_t *file = find_file(s_seeding, path, &added);
+        if (file) {
+            keep(file, &s_list, size);
+        }
+    }
+    return FTW_CONTINUE;
+}
+
+/**
+ * @brief Record the chunks of the files of a rule's target.
+ * @details Used when the watch starts, so that the first change of a
+ * file is measured against the content it had then.
+ *
+ * @param store The chunks of the rule, created if NULL.
+ * @param target The file or directory.
+ * @param recursive Record the files of the whole tree.
+ */
+void chunks_seed(chunks_t **store, const char *target, bool recursive) {
+    s_seeding = store;
+    s_seed_depth = recursive ? INT32_MAX : 0;
+    nftw(target, seed_path, SEED_MAX_FDS, FTW_PHYS | FTW_ACTIONRETVAL);
+    s_seeding = NULL;
+}
+
+/**
+ * @brief Release the chunk hashes of a rule.
+ *
+ * @param store The store, or NULL.
+ */
+void chunks_free(chunks_t *store) {
+    if (store == NULL) {
+        return;
+    }
+    for (size_t slot = 0; slot < store->capacity; slot++) {
+        if (store->slots[slot]) {
+            free(store->slots[slot]->hashes);
+            free(store->slots[slot]);
+        }
+    }
+    free(store->slots);
+    free(store);
+}
+
+/* End. */
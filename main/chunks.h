@@ -0,0 +1,33 @@
+/**
+ * @file chunks.h
+ * @author Mark Lehane (markdlehane@gmail.com)
+ * @brief Content-defined chunk interface.
+ * @details The byte ranges of a changed file that hold new content,
+ * found by comparing its chunks with those it had at the last run.
+ *
+ * @version 0.1
+ * @date 2026-01-01
+ *
+ * @copyright Copyright (c) 2025, Mark D Lehane.
+ *
+ */
+
+#ifndef CHUNKS_H
+#define CHUNKS_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+/**
+ * @brief The chunk hashes of the files of a rule (opaque).
+ *
+ */
+typedef struct chunks_s chunks_t;
+
+extern void chunks_seed(chunks_t **store, const char *target, bool recursive);
+extern void chunks_update(chunks_t **store, const char *path, FILE *fp);
+extern void chunks_free(chunks_t *store);
+
+#endif
+
+/* End. */
@@ -0,0 +1,322 @@
+/**
+ * @file config.c
+ * @author Mark Lehane (markdlehane@gmail.com)
+ * @brief Config file functions.
+ * @details The config file holds rules, one section each:
+ *
+ *     # Rebuild when the sources change.
+ *     [build]
+ *     file = src
+ *     recursive
+ *     exec = make -C build
+ *     debounce = 200
+ *
+ * The section name is the rule name and each line sets a rule option by
+ * its long command line name, a bare name being a flag. A value may be
+ * quoted to keep its outer spaces. The file is loaded whole or not at
+ * all, so an edit with a mistake in it leaves the running rules alone.
+ * The directory holding the file is watched rather than the file, as
+ * editors often save by writing a new file and renaming it into place.
+ *
+ * @version 0.1
+ * @date 2025-12-28
+ *
+ * @copyright Copyright (c) 2025, Mark D Lehane.
+ *
+ */
+
+#include <sys/inotify.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <linux/limits.h>
+
+#include "config.h"
+
+// Local constants.
+#define CONFIG_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO)
+#define CONFIG_MASK (CONFIG_EVENTS | IN_MASK_ADD)
+
+// Local data.
+static int s_inotify_instance = -1;
+static int s_watch = -1;
+static bool s_verbose = false;
+static char s_dir[PATH_MAX];
+static char s_name[NAME_MAX + 1];
+
+/**
+ * @brief Strip the leading and trailing white space of a line.
+ *
+ * @param text The line, changed in place.
+ * @return char* The start of the stripped text.
+ */
+static char *trim(char *text) {
+    while (*text == ' ' || *text == '\t') {
+        text++;
+    }
+    size_t len = strlen(text);
+    while (len && strchr(" \t\r\n", text[len - 1])) {
+        text[--len] = '\0';
+    }
+    return text;
+}
+
+/**
+ * @brief Start a rule from a section line.
+ *
+ * @param text The line, from its opening bracket.
+ * @param rules The rules so far.
+ * @param count The number of rules so far.
+ * @param error Receives what is wrong with the section.
+ * @return watch_rule_t* The rule, or NULL if the section is not valid.
+ */
+static watch_rule_t *section(char *text, watch_rule_t **rules, int count, const char **error) {
+    char *end = strchr(text, ']');
+
+    if (end == NULL || end[1] != '\0') {
+        *error = "expected [NAME]";
+        return NULL;
+    }
+    *end = '\0';
+    char *name = trim(text + 1);
+    if (*name == '\0') {
+        *error = "the rule has no name";
+        return NULL;
+    }
+    for (int index = 0; index < count; index++) {
+        if (strcmp(rules[index]->name, name) == 0) {
+            *error = "the rule is given twice";
+            return NULL;
+        }
+    }
+    if (count == WATCH_MAX_RULES) {
+        *error = "too many rules";
+        return NULL;
+    }
+    watch_rule_t *rule = rule_alloc();
+    if (rule && !rule_option(rule, "name", name)) {
+        rule_destroy(rule);
+        rule = NULL;
+    }
+    if (rule == NULL) {
+        *error = "the rule could not be made";
+        return NULL;
+    }
+    rule->configured = true;
+    return rule;
+}
+
+/**
+ * @brief Set a rule option from an option line.
+ *
+ * @param rule The rule.
+ * @param text The line.
+ * @return bool True if the option and its value are valid.
+ */
+static bool option(watch_rule_t *rule, char *text) {
+    char *value = strchr(text, '=');
+
+    if (value) {
+        *value = '\0';
+        value = trim(value + 1);
+        size_t len = strlen(value);
+        if (len >= 2 && value[0] == '"' && value[len - 1] == '"') {
+            value[len - 1] = '\0';
+            value++;
+        }
+    }
+    return rule_option(rule, trim(text), value);
+}
+
+/**
+ * @brief Read the rules of a config file.
+ * @details The rules are not added to the rule table. On failure none
+ * are returned and the line at fault is reported.
+ *
+ * @param path The config file.
+ * @param rules Receives the rules, room for WATCH_MAX_RULES.
+ * @param count Receives the number of rules.
+ * @return bool True if the whole file is valid.
+ */
+bool config_load(const char *path, watch_rule_t **rules, int *count) {
+    char *line = NULL;
+    size_t cap = 0;
+    int number = 0;
+    bool ok = true;
+    watch_rule_t *rule = NULL;
+    char where[PATH_MAX + 64];
+
+    *count = 0;
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "Unable to open config '%s': %s\n", path, strerror(errno));
+        return false;
+    }
+    while (ok && getline(&line, &cap, fp) != -1) {
+        char *text = trim(line);
+        const char *error = NULL;
+        number++;
+        if (*text == '\0' || *text == '#' || *text == ';') {
+            continue;
+        }
+        snprintf(where, sizeof(where), "Config '%s' line %d", path, number);
+        rule_where(where);
+        if (*text == '[') {
+            rule = section(text, rules, *count, &error);
+            if (rule) {
+                rules[(*count)++] = rule;
+            }
+        }
+        else if (rule == NULL) {
+            error = "options must follow a [NAME]";
+        }
+        else if (!option(rule, text)) {
+            // The option has said what is wrong with it.
+            ok = false;
+            if (!rule_reported()) {
+                error = "invalid option";
+            }
+        }
+        if (error) {
+            fprintf(stderr, "%s: %s\n", where, error);
+            ok = false;
+        }
+    }
+    free(line);
+    fclose(fp);
+    for (int index = 0; ok && index < *count; index++) {
+        snprintf(where, sizeof(where), "Config '%s' rule [%s]", path, rules[index]->name);
+        rule_where(where);
+        if (rules[index]->target == NULL) {
+            fprintf(stderr, "%s has no file\n", where);
+            ok = false;
+        }
+        else if (!procsignal_valid(&rules[index]->signal)) {
+            ok = false;
+        }
+    }
+    rule_where(NULL);
+    if (!ok) {
+        for (int index = 0; index < *count; index++) {
+            rule_destroy(rules[index]);
+        }
+        *count = 0;
+    }
+    return ok;
+}
+
+/**
+ * @brief Add the rules of a config file to the rule table.
+ *
+ * @param path The config file.
+ * @return bool True if the file is valid and every rule was added.
+ */
+bool config_rules(const char *path) {
+    watch_rule_t *rules[WATCH_MAX_RULES];
+    int count;
+    bool ok = config_load(path, rules, &count);
+
+    for (int index = 0; index < count; index++) {
+        if (ok && !rule_adopt(rules[index])) {
+            ok = false;
+        }
+        if (rules[index]->index == -1) {
+            rule_destroy(rules[index]);
+        }
+    }
+    return ok;
+}
+
+/**
+ * @brief Watch the config file for changes.
+ *
+ * @param inf The inotify handle.
+ * @param path The config file.
+ * @param verbose True if verbose output should be made.
+ * @return bool True if the file is being watched.
+ */
+bool config_watch(int inf, const char *path, bool verbose) {
+    const char *name = strrchr(path, '/');
+    size_t dir_len = name == NULL ? 1 : name == path ? 1 : (size_t)(name - path);
+
+    name = name ? name + 1 : path;
+    if (dir_len >= sizeof(s_dir) || strlen(name) >= sizeof(s_name)) {
+        fprintf(stderr, "Config path '%s' is too long\n", path);
+        return false;
+    }
+    // A bare name is in the working directory, the root keeps its separator.
+    memcpy(s_dir, name == path ? "." : path, dir_len);
+    s_dir[dir_len] = '\0';
+    strcpy(s_name, name);
+    s_inotify_instance = inf;
+    s_verbose = verbose;
+    s_watch = inotify_add_watch(inf, s_dir, CONFIG_MASK);
+    if (s_watch == -1) {
+        fprintf(stderr, "Unable to watch config '%s': %s\n", path, strerror(errno));
+        return false;
+    }
+    if (verbose) {
+        printf("Watching config '%s' - %d\n", path, s_watch);
+    }
+    return true;
+}
+
+/**
+ * @brief Look for a change to the config file in a buffer of events.
+ * @details The directory watch may be shared with the rules; when it
+ * is removed under the config it is made again.
+ *
+ * @param buf The raw events buffer.
+ * @param len The number of bytes in the buffer.
+ * @return bool True if the config file was written or replaced.
+ */
+bool config_events(const char *buf, ssize_t len) {
+    ssize_t i = 0;
+    bool changed = false;
+
+    while (s_watch != -1 && i < len) {
+        const struct inotify_event *event = (const struct inotify_event *)&buf[i];
+        i += sizeof(struct inotify_event) + event->len;
+        if (event->wd != s_watch) {
+            continue;
+        }
+        if (event->mask & IN_IGNORED) {
+            s_watch = inotify_add_watch(s_inotify_instance, s_dir, CONFIG_MASK);
+            if (s_watch == -1) {
+                fprintf(stderr, "Unable to watch config directory '%s': %s\n", s_dir, strerror(errno));
+            }
+            else if (s_verbose) {
+                printf("Watching config directory '%s' again - %d\n", s_dir, s_watch);
+            }
+        }
+        else if ((event->mask & CONFIG_EVENTS) && event->len && strcmp(event->name, s_name) == 0) {
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+/**
+ * @brief Return the events the config asks for on a watch descriptor.
+ *
+ * @param wd The watch descriptor.
+ * @return uint32_t The inotify mask, 0 if the watch is not the config directory's.
+ */
+uint32_t config_mask(int wd) {
+    return (s_watch != -1 && wd == s_watch) ? CONFIG_EVENTS : 0;
+}
+
+/**
+ * @brief Stop watching the config file.
+ *
+ */
+void config_shutdown(void) {
+    if (s_watch != -1) {
+        inotify_rm_watch(s_inotify_instance, s_watch);
+        s_watch = -1;
+    }
+    s_inotify_instance = -1;
+}
+
+/* End. */
@@ -0,0 +1,33 @@
+/**
+ * @file config.h
+ * @author Mark Lehane (markdlehane@gmail.com)
+ * @brief Config file interface.
+ * @details Rules read from a file, which is watched so that edits are
+ * picked up by the running watcher.
+ *
+ * @version 0.1
+ * @date 2025-12-28
+ *
+ * @copyright Copyright (c) 2025, Mark D Lehane.
+ *
+ */
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "rules.h"
+
+extern bool config_load(const char *path, watch_rule_t **rules, int *count);
+extern bool config_rules(const char *path);
+extern bool config_watch(int inf, const char *path, bool verbose);
+extern bool config_events(const char *buf, ssize_t len);
+extern uint32_t config_mask(int wd);
+extern void config_shutdown(void);
+
+#endif
+
+/* End. */
@@ -0,0 +1,568 @@
+/**
+ * @file control.c
+ * @author Mark Lehane (markdlehane@gmail.com)
+ * @brief Control socket functions.
+ * @details This module listens on a Unix domain stream socket. A client
+ * sends one request line and gets the reply, after which the watcher
+ * closes the connection, so `nc -U PATH` is enough to ask. The
+ * requests are:
+ *
+ *   stats      the statistics report, as for SIGUSR1.
+ *   json       the statistics as a JSON document.
+ *   top [N]    the N (default all) heaviest paths and directories.
+ *   since [T]  the token to ask with next time, then the paths changed
+ *              since token T, or "full" if they are not all known.
+ *   hash [P]   the tree hash of path P and of each of its entries, or
+ *              of each hashed target.
+ *   wait [R]   waits for the next run (of rule R) that starts after the
+ *              request, then answers "ok RULE STATUS SECONDS" once it
+ *              has finished.
+ *   help       the list of requests.
+ *
+ * The sockets are non-blocking and served from the watcher's poll loop
+ * so a slow client never holds up the events. A reply is built in
+ * memory and sent as the client takes it, and a client that has not
+ * taken all of it within CONTROL_SEND_TIMEOUT is dropped. A waiting
+ * client keeps its connection, and is answered by the engine when the
+ * run finishes.
+ *
+ * The watcher is also the client for a wait, so a script can block on
+ * a run with watchf --wait PATH rather than sleep.
+ *
+ * @version 0.1
+ * @date 2025-12-22
+ *
+ * @copyright Copyright (c) 2025, Mark D Lehane.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "control.h"
+#include "stats.h"
+#include "hot.h"
+#include "rules.h"
+#include "changelog.h"
+#include "merkle.h"
+
+// Local constants.
+#define CONTROL_LINE_MAX 256
+#define CONTROL_BACKLOG 8
+#define CONTROL_SEND_TIMEOUT 5000000    // Longest a reply may take to send (us).
+
+/**
+ * @brief A connected client.
+ *
+ */
+typedef struct control_client_s {
+    int fd;                     // The connection, -1 when the slot is free.
+    size_t len;                 // Bytes of the request read so far.
+    char line[CONTROL_LINE_MAX];
+    bool waiting;               // Waiting for a run to finish.
+    char *rule;                 // The rule waited on, NULL for any.
+    uint64_t after;             // The latest run started when the wait began.
+    char *reply;                // The part of the reply the socket would not take, or NULL.
+    size_t reply_len;           // Length of the unsent part.
+    size_t reply_sent;          // Bytes of the unsent part sent since.
+    uint64_t reply_by;          // Time the reply must be sent by, 0 until first polled.
+
+} control_client_t;
+
+// Local data.
+static int s_listen = -1;
+static char s_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+static control_client_t s_clients[CONTROL_MAX_CLIENTS];
+static bool s_verbose = false;
+static uint64_t s_runs = 0;
+
+/**
+ * @brief Start listening on the control socket.
+ * @details A socket left behind by an earlier watcher is replaced; any
+ * other file at the path is an error.
+ *
+ * @param path The socket path, or NULL for no control socket.
+ * @param verbose True if verbose output should be made.
+ * @return bool True if listening, or there is no socket to listen on.
+ */
+bool control_init(const char *path, bool verbose) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    struct stat st;
+
+    for (int slot = 0; slot < CONTROL_MAX_CLIENTS; slot++) {
+        s_clients[slot].fd = -1;
+    }
+    if (path == NULL) {
+        return true;
+    }
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Control socket path too long '%s'\n", path);
+        return false;
+    }
+    if (lstat(path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            fprintf(stderr, "'%s' exists and is not a socket\n", path);
+            return false;
+        }
+        unlink(path);
+    }
+    strcpy(addr.sun_path, path);
+    s_listen = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (s_listen == -1) {
+        perror("Failed to create the control socket");
+        return false;
+    }
+    if (bind(s_listen, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(s_listen, CONTROL_BACKLOG) == -1) {
+        perror("Failed to listen on the control socket");
+        close(s_listen);
+        s_listen = -1;
+        return false;
+    }
+    // The statistics name paths, so only the owner may ask.
+    chmod(path, 0600);
+    strcpy(s_path, path);
+    s_verbose = verbose;
+    if (verbose) {
+        printf("Control socket '%s'\n", path);
+    }
+    return true;
+}
+
+/**
+ * @brief Close a client connection.
+ *
+ * @param client The client.
+ */
+static void client_close(control_client_t *client) {
+    close(client->fd);
+    free(client->rule);
+    free(client->reply);
+    client->fd = -1;
+    client->len = 0;
+    client->waiting = false;
+    client->rule = NULL;
+    client->reply = NULL;
+}
+
+/**
+ * @brief Fill in the handles to poll.
+ * @details A client with a reply still to send is polled for room to
+ * send it, and dropped if it has run out of time.
+ *
+ * @param fds Receives the handles, with room for CONTROL_MAX_FDS.
+ * @param now The engine time in microseconds.
+ * @return int The number of handles.
+ */
+int control_poll_fds(struct pollfd *fds, uint64_t now) {
+    int count = 0;
+
+    if (s_listen == -1) {
+        return 0;
+    }
+    fds[count++] = (struct pollfd){ .fd = s_listen, .events = POLLIN };
+    for (int slot = 0; slot < CONTROL_MAX_CLIENTS; slot++) {
+        control_client_t *client = &s_clients[slot];
+        if (client->fd != -1 && client->reply) {
+            if (client->reply_by == 0) {
+                client->reply_by = now + CONTROL_SEND_TIMEOUT;
+            }
+            else if (now >= client->reply_by) {
+                if (s_verbose) {
+                    puts("Control client too slow to take its reply");
+                }
+                client_close(client);
+                continue;
+            }
+        }
+        if (client->fd != -1) {
+            fds[count++] = (struct pollfd){ .fd = client->fd, .events = client->reply ? POLLOUT : POLLIN };
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief Send as much of a buffer as the socket will take.
+ *
+ * @param client The client.
+ * @param buf The data.
+ * @param len The length of the data.
+ * @param sent The bytes already sent, updated.
+ * @return bool False if the client has gone.
+ */
+static bool client_send(control_client_t *client, const char *buf, size_t len, size_t *sent) {
+    while (*sent < len) {
+        ssize_t n = send(client->fd, buf + *sent, len - *sent, MSG_NOSIGNAL);
+        if (n > 0) {
+            *sent += (size_t)n;
+        }
+        else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return true;
+        }
+        else if (n == 0 || errno != EINTR) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Send a reply and close the connection.
+ * @details What the socket will not take now is kept and sent as the
+ * client makes room for it, see client_flush.
+ *
+ * @param client The client.
+ * @param reply The reply.
+ * @param len The length of the reply.
+ */
+static void client_reply(control_client_t *client, const char *reply, size_t len) {
+    size_t sent = 0;
+
+    client->waiting = false;
+    if (client_send(client, reply, len, &sent) && sent < len && (client->reply = malloc(len - sent)) != NULL) {
+        memcpy(client->reply, reply + sent, len - sent);
+        client->reply_len = len - sent;
+        client->reply_sent = 0;
+        client->reply_by = 0;
+        return;
+    }
+    client_close(client);
+}
+
+/**
+ * @brief Send more of a reply, closing the connection once it is all sent.
+ *
+ * @param client The client.
+ */
+static void client_flush(control_client_t *client) {
+    if (!client_send(client, client->reply, client->reply_len, &client->reply_sent) ||
+        client->reply_sent == client->reply_len) {
+        client_close(client);
+    }
+}
+
+/**
+ * @brief Start a wait for the next run.
+ *
+ * @param client The client.
+ * @param rule The rule name, or NULL for any rule.
+ * @return const char* NULL if the client is waiting, otherwise the error to reply with.
+ */
+static const char *client_wait(control_client_t *client, const char *rule) {
+    bool found = rule == NULL;
+
+    for (int index = 0; !found && index < rule_count(); index++) {
+        found = !rule_at(index)->retired && strcmp(rule_at(index)->name, rule) == 0;
+    }
+    if (!found) {
+        return "error unknown rule\n";
+    }
+    if (rule && (client->rule = strdup(rule)) == NULL) {
+        return "error out of memory\n";
+    }
+    client->waiting = true;
+    client->after = s_runs;
+    return NULL;
+}
+
+/**
+ * @brief Answer a request.
+ *
+ * @param client The client.
+ * @param now The engine time in microseconds.
+ * @param watches The number of active watches.
+ */
+static void client_request(control_client_t *client, uint64_t now, unsigned watches) {
+    char *reply = NULL;
+    size_t len = 0;
+    char *request = client->line;
+    char *argument = strchr(request, ' ');
+
+    if (argument) {
+        *argument++ = '\0';
+    }
+    if (s_verbose) {
+        printf("Control request '%s'\n", request);
+    }
+    if (strcmp(request, "wait") == 0) {
+        const char *error = client_wait(client, argument && *argument ? argument : NULL);
+        if (error) {
+            client_reply(client, error, strlen(error));
+        }
+        return;
+    }
+    FILE *fp = open_memstream(&reply, &len);
+    if (fp == NULL) {
+        client_close(client);
+        return;
+    }
+    if (strcmp(request, "stats") == 0) {
+        stats_dump(fp, now, watches);
+    }
+    else if (strcmp(request, "json") == 0) {
+        stats_json(fp, now, watches);
+    }
+    else if (strcmp(request, "top") == 0) {
+        if (!hot_enabled()) {
+            fputs("error not tracking, start the watcher with --top\n", fp);
+        }
+        else {
+            hot_dump(fp, argument ? (unsigned)strtoul(argument, NULL, 10) : HOT_MAX_ENTRIES);
+        }
+    }
+    else if (strcmp(request, "since") == 0) {
+        changelog_since(fp, argument && *argument ? argument : NULL);
+    }
+    else if (strcmp(request, "hash") == 0) {
+        merkle_query(fp, argument && *argument ? argument : NULL);
+    }
+    else if (strcmp(request, "help") == 0) {
+        fputs("stats\njson\ntop [N]\nsince [TOKEN]\nhash [PATH]\nwait [RULE]\nhelp\n", fp);
+    }
+    else {
+        fprintf(fp, "error unknown request '%s'\n", request);
+    }
+    fclose(fp);
+    client_reply(client, reply, len);
+    free(reply);
+}
+
+/**
+ * @brief Read from a client, answering once its request line is in.
+ *
+ * @param client The client.
+ * @param now The engine time in microseconds.
+ * @param watches The number of active watches.
+ */
+static void client_read(control_client_t *client, uint64_t now, unsigned watches) {
+    if (client->waiting) {
+        // Only the end of the connection matters now.
+        char discard[CONTROL_LINE_MAX];
+        ssize_t n = read(client->fd, discard, sizeof(discard));
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+            client_close(client);
+        }
+        return;
+    }
+    ssize_t n = read(client->fd, client->line + client->len, sizeof(client->line) - 1 - client->len);
+    if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+        return;
+    }
+    if (n > 0) {
+        client->len += (size_t)n;
+    }
+    client->line[client->len] = '\0';
+    char *end = strpbrk(client->line, "\r\n");
+    if (end) {
+        *end = '\0';
+    }
+    else if (n > 0 && client->len < sizeof(client->line) - 1) {
+        // Wait for the rest of the line.
+        return;
+    }
+    if (n < 0 || client->len == 0) {
+        client_close(client);
+        return;
+    }
+    client_request(client, now, watches);
+}
+
+/**
+ * @brief Accept a new client.
+ *
+ */
+static void control_accept(void) {
+    int fd = accept4(s_listen, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd == -1) {
+        return;
+    }
+    for (int slot = 0; slot < CONTROL_MAX_CLIENTS; slot++) {
+        if (s_clients[slot].fd == -1) {
+            s_clients[slot].fd = fd;
+            s_clients[slot].len = 0;
+            return;
+        }
+    }
+    static const char busy[] = "error busy\n";
+    send(fd, busy, sizeof(busy) - 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+    close(fd);
+}
+
+/**
+ * @brief Serve the handles that poll found ready.
+ *
+ * @param fds The handles filled in by control_poll_fds.
+ * @param count The number of handles.
+ * @param now The engine time in microseconds.
+ * @param watches The number of active watches.
+ */
+void control_events(const struct pollfd *fds, int count, uint64_t now, unsigned watches) {
+    for (int index = 1; index < count; index++) {
+        if (fds[index].revents == 0) {
+            continue;
+        }
+        for (int slot = 0; slot < CONTROL_MAX_CLIENTS; slot++) {
+            if (s_clients[slot].fd == fds[index].fd && s_clients[slot].reply) {
+                client_flush(&s_clients[slot]);
+                break;
+            }
+            if (s_clients[slot].fd == fds[index].fd) {
+                client_read(&s_clients[slot], now, watches);
+                break;
+            }
+        }
+    }
+    if (count && (fds[0].revents & POLLIN)) {
+        control_accept();
+    }
+}
+
+/**
+ * @brief Number a run that is starting.
+ *
+ * @return uint64_t The run number, for control_run_end.
+ */
+uint64_t control_run_begin(void) {
+    return ++s_runs;
+}
+
+/**
+ * @brief Answer the clients waiting for a run that has finished.
+ * @details Only clients that began waiting before the run started, and
+ * on its rule or on any, are answered.
+ *
+ * @param rule The rule name.
+ * @param run The run number.
+ * @param status The exit status, 128 and the signal for a command killed by one.
+ * @param runtime The run time in microseconds.
+ */
+void control_run_end(const char *rule, uint64_t run, int status, uint64_t runtime) {
+    char reply[CONTROL_LINE_MAX];
+
+    for (int slot = 0; slot < CONTROL_MAX_CLIENTS; slot++) {
+        control_client_t *client = &s_clients[slot];
+        if (client->fd != -1 && client->waiting && run > client->after &&
+            (client->rule == NULL || strcmp(client->rule, rule) == 0)) {
+            int len = snprintf(reply, sizeof(reply), "ok %s %d %.3f\n", rule, status, (double)runtime / 1e6);
+            client_reply(client, reply, len < (int)sizeof(reply) ? (size_t)len : sizeof(reply) - 1);
+        }
+    }
+}
+
+/**
+ * @brief Wait for the next run of a watcher, as its client.
+ * @details The reply is reported on stdout.
+ *
+ * @param path The control socket of the watcher.
+ * @param rule The rule to wait on, or NULL for any rule.
+ * @param timeout The longest to wait (ms), 0 for ever.
+ * @return int The exit status of the run, EXIT_FAILURE if the wait
+ * failed, or WATCH_EXIT_TIMEOUT if it timed out.
+ */
+int control_wait(const char *path, const char *rule, unsigned timeout) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    char reply[CONTROL_LINE_MAX];
+    char request[CONTROL_LINE_MAX];
+    size_t len = 0;
+    struct timespec started;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Control socket path too long '%s'\n", path);
+        return EXIT_FAILURE;
+    }
+    if (rule && strlen(rule) > CONTROL_LINE_MAX - 8) {
+        fprintf(stderr, "Rule name too long '%s'\n", rule);
+        return EXIT_FAILURE;
+    }
+    strcpy(addr.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        fprintf(stderr, "Unable to connect to '%s': %s\n", path, strerror(errno));
+        if (fd != -1) {
+            close(fd);
+        }
+        return EXIT_FAILURE;
+    }
+    int request_len = snprintf(request, sizeof(request), "wait%s%s\n", rule ? " " : "", rule ? rule : "");
+    if (send(fd, request, (size_t)request_len, MSG_NOSIGNAL) != request_len) {
+        fprintf(stderr, "Unable to send to '%s': %s\n", path, strerror(errno));
+        close(fd);
+        return EXIT_FAILURE;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    while (len < sizeof(reply) - 1) {
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        int wait_ms = -1;
+        if (timeout) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            long spent = (now.tv_sec - started.tv_sec) * 1000 + (now.tv_nsec - started.tv_nsec) / 1000000;
+            wait_ms = spent >= (long)timeout ? 0 : (int)(timeout - (unsigned)spent);
+        }
+        int ready = poll(&pfd, 1, wait_ms);
+        if (ready == 0) {
+            close(fd);
+            puts("Timed out waiting for a run.");
+            return WATCH_EXIT_TIMEOUT;
+        }
+        if (ready < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        ssize_t n = read(fd, reply + len, sizeof(reply) - 1 - len);
+        if (n <= 0) {
+            break;
+        }
+        len += (size_t)n;
+    }
+    close(fd);
+    reply[len] = '\0';
+
+    char name[CONTROL_LINE_MAX];
+    int status;
+    double seconds;
+    if (sscanf(reply, "ok %255s %d %lf", name, &status, &seconds) == 3) {
+        printf("Rule %s finished with status %d in %.3fs\n", name, status, seconds);
+        return status;
+    }
+    reply[strcspn(reply, "\n")] = '\0';
+    fprintf(stderr, "Wait failed: %s\n", len ? reply : "the watcher closed the connection");
+    return EXIT_FAILURE;
+}
+
+/**
+ * @brief Close the clients and remove the control socket.
+ * @details Clients still waiting are told the watch has ended, as far
+ * as their sockets will take it now.
+ *
+ */
+void control_shutdown(void) {
+    static const char ended[] = "error the watch has ended\n";
+
+    for (int slot = 0; slot < CONTROL_MAX_CLIENTS; slot++) {
+        if (s_clients[slot].fd != -1 && s_clients[slot].waiting) {
+            client_reply(&s_clients[slot], ended, sizeof(ended) - 1);
+        }
+        if (s_clients[slot].fd != -1) {
+            client_close(&s_clients[slot]);
+        }
+    }
+    if (s_listen != -1) {
+        close(s_listen);
+        unlink(s_path);
+        s_listen = -1;
+    }
+}
+
+/* End. */
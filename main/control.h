@@ -0,0 +1,38 @@
+/**
+ * @file control.h
+ * @author Mark Lehane (markdlehane@gmail.com)
+ * @brief Control socket interface.
+ * @details A local socket on which a running watcher answers requests
+ * for its statistics.
+ *
+ * @version 0.1
+ * @date 2025-12-22
+ *
+ * @copyright Copyright (c) 2025, Mark D Lehane.
+ *
+ */
+
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <poll.h>
+
+// The most clients served at once, including those waiting for a run.
+#define CONTROL_MAX_CLIENTS 32
+
+// The most handles the control socket polls, the listener and its clients.
+#define CONTROL_MAX_FDS (CONTROL_MAX_CLIENTS + 1)
+
+extern bool control_init(const char *path, bool verbose);
+extern int control_poll_fds(struct pollfd *fds, uint64_t now);
+extern void control_events(const struct pollfd *fds, int count, uint64_t now, unsigned watches);
+extern uint64_t control_run_begin(void);
+extern void control_run_end(const char *rule, uint64_t run, int status, uint64_t runtime);
+extern int control_wait(const char *path, const char *rule, unsigned timeout);
+extern void control_shutdown(void);
+
+#endif
+
+/* End. */
@@ -0,0 +1,454 @@
+/**
+ * @file hot.c
+ * @author Mark Lehane (markdlehane@gmail.com)
+ * @brief Heavy hitters functions.
+ * @details This module finds the paths, and the directories holding
+ * them, that produce the most change events, using the space-saving
+ * algorithm: a table of at most K counters, where a path that is not
+ * in a full table takes over the smallest counter, adding one to it
+ * and remembering the old count as its possible overcount. Any path
+ * seen more than N/K times out of N is guaranteed to be in the table
+ * and its count is never under the truth. The counters form a min-heap
+ * so the smallest is always at the root, and a hash index finds the
+ * counter of a path, so each event costs O(log K). Each entry also
+ * counts the runs its changes set off.
+ *
+ * @version 0.1
+ * @date 2025-12-22
+ *
+ * @copyright Copyright (c) 2025, Mark D Lehane.
+ *
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "hot.h"
+#include "stats.h"
+
+/**
+ * @brief A counter.
+ *
+ */
+typedef struct hot_entry_s {
+    char *key;                  // The path, NULL while unused.
+    uint64_t hash;
+    unsigned long count;        // Events counted, an upper bound on the truth.
+    unsigned long error;        // Most the count may be over by.
+    unsigned long runs;         // Runs the path's changes set off.
+    unsigned long run_seq;      // The last run counted, so a run counts once.
+    int heap;                   // Position in the heap.
+    int next;                   // Next entry in the hash chain, or -1.
+
+} hot_entry_t;
+
+/**
+ * @brief A table of counters.
+ *
+ */
+typedef struct hot_table_s {
+    hot_entry_t *entries;
+    int *heap;                  // Entry indexes, least count first.
+    int *buckets;               // Hash chain heads, -1 for none.
+    int capacity;
+    int used;
+    int mask;                   // Bucket count - 1.
+
+} hot_table_t;
+
+// Local data.
+static hot_table_t s_paths = {0};
+static hot_table_t s_dirs = {0};
+static unsigned long s_run_seq = 0;
+
+/**
+ * @brief Hash a string (64 bit FNV-1a), as far as a length.
+ *
+ * @param key The string.
+ * @param len The length to hash.
+ * @return uint64_t The hash.
+ */
+static uint64_t hash_key(const char *key, size_t len) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    while (len--) {
+        hash ^= (unsigned char)*key++;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/**
+ * @brief Allocate a table.
+ *
+ * @param table The table.
+ * @param capacity The number of counters.
+ * @return bool False if memory is exhausted.
+ */
+static bool table_init(hot_table_t *table, int capacity) {
+    int buckets = 1;
+    while (buckets < capacity * 2) {
+        buckets <<= 1;
+    }
+    table->entries = calloc((size_t)capacity, sizeof(*table->entries));
+    table->heap = calloc((size_t)capacity, sizeof(*table->heap));
+    table->buckets = malloc((size_t)buckets * sizeof(*table->buckets));
+    if (table->entries == NULL || table->heap == NULL || table->buckets == NULL) {
+        return false;
+    }
+    memset(table->buckets, -1, (size_t)buckets * sizeof(*table->buckets));
+    table->capacity = capacity;
+    table->used = 0;
+    table->mask = buckets - 1;
+    return true;
+}
+
+/**
+ * @brief Release a table.
+ *
+ * @param table The table.
+ */
+static void table_free(hot_table_t *table) {
+    for (int index = 0; index < table->used; index++) {
+        free(table->entries[index].key);
+    }
+    free(table->entries);
+    free(table->heap);
+    free(table->buckets);
+    memset(table, 0, sizeof(*table));
+}
+
+/**
+ * @brief Find the counter for a key.
+ *
+ * @param table The table.
+ * @param key The key.
+ * @param len The length of the key.
+ * @param hash The hash of the key.
+ * @return int The entry index, or -1 if the key is not counted.
+ */
+static int table_find(const hot_table_t *table, const char *key, size_t len, uint64_t hash) {
+    for (int index = table->buckets[hash & (uint64_t)table->mask]; index != -1; index = table->entries[index].next) {
+        const hot_entry_t *entry = &table->entries[index];
+        if (entry->hash == hash && strncmp(entry->key, key, len) == 0 && entry->key[len] == '\0') {
+            return index;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Remove an entry from its hash chain.
+ *
+ * @param table The table.
+ * @param index The entry index.
+ */
+static void table_unlink(hot_table_t *table, int index) {
+    int *link = &table->buckets[table->entries[index].hash & (uint64_t)table->mask];
+    while (*link != index) {
+        link = &table->entries[*link].next;
+    }
+    *link = table->entries[index].next;
+}
+
+/**
+ * @brief Swap two heap positions.
+ *
+ * @param table The table.
+ * @param a A heap position.
+ * @param b Another heap position.
+ */
+static void heap_swap(hot_table_t *table, int a, int b) {
+    int *heap = table->heap;
+    int swap = heap[a];
+    heap[a] = heap[b];
+    heap[b] = swap;
+    table->entries[heap[a]].heap = a;
+    table->entries[heap[b]].heap = b;
+}
+
+/**
+ * @brief Move a new counter up the heap to its place.
+ *
+ * @param table The table.
+ * @param pos The heap position of the counter.
+ */
+static void sift_up(hot_table_t *table, int pos) {
+    while (pos > 0) {
+        int parent = (pos - 1) / 2;
+        if (table->entries[table->heap[parent]].count <= table->entries[table->heap[pos]].count) {
+            return;
+        }
+        heap_swap(table, pos, parent);
+        pos = parent;
+    }
+}
+
+/**
+ * @brief Move a counter down the heap after its count went up.
+ *
+ * @param table The table.
+ * @param pos The heap position of the counter.
+ */
+static void sift_down(hot_table_t *table, int pos) {
+    int *heap = table->heap;
+    for (;;) {
+        int least = pos;
+        int left = pos * 2 + 1;
+        int right = left + 1;
+        if (left < table->used && table->entries[heap[left]].count < table->entries[heap[least]].count) {
+            least = left;
+        }
+        if (right < table->used && table->entries[heap[right]].count < table->entries[heap[least]].count) {
+            least = right;
+        }
+        if (least == pos) {
+            return;
+        }
+        heap_swap(table, pos, least);
+        pos = least;
+    }
+}
+
+/**
+ * @brief Count a key.
+ * @details A new key takes a free counter, or the smallest one once
+ * the table is full.
+ *
+ * @param table The table.
+ * @param key The key.
+ * @param len The length of the key.
+ * @return hot_entry_t* The counter, or NULL if memory is exhausted.
+ */
+static hot_entry_t *table_count(hot_table_t *table, const char *key, size_t len) {
+    uint64_t hash = hash_key(key, len);
+    int index = table_find(table, key, len, hash);
+
+    if (index == -1) {
+        char *copy = strndup(key, len);
+        if (copy == NULL) {
+            return NULL;
+        }
+        hot_entry_t *entry;
+        if (table->used < table->capacity) {
+            index = table->used;
+            entry = &table->entries[index];
+            entry->heap = table->used;
+            table->heap[table->used++] = index;
+            entry->count = 0;
+            entry->error = 0;
+        }
+        else {
+            // The smallest counter goes to the new key, which may have had its count.
+            index = table->heap[0];
+            entry = &table->entries[index];
+            table_unlink(table, index);
+            free(entry->key);
+            entry->error = entry->count;
+        }
+        entry->key = copy;
+        entry->hash = hash;
+        entry->runs = 0;
+        entry->run_seq = 0;
+        entry->next = table->buckets[hash & (uint64_t)table->mask];
+        table->buckets[hash & (uint64_t)table->mask] = index;
+    }
+    hot_entry_t *entry = &table->entries[index];
+    entry->count++;
+    if (entry->count == 1) {
+        sift_up(table, entry->heap);
+    }
+    else {
+        sift_down(table, entry->heap);
+    }
+    return entry;
+}
+
+/**
+ * @brief Return the length of the directory part of a path.
+ *
+ * @param path The path.
+ * @return size_t The length, 0 if the path has no directory part.
+ */
+static size_t dir_length(const char *path) {
+    const char *slash = strrchr(path, '/');
+    if (slash == NULL) {
+        return 0;
+    }
+    return slash == path ? 1 : (size_t)(slash - path);
+}
+
+/**
+ * @brief Start tracking the heavy hitters.
+ *
+ * @param entries The number of paths, and of directories, to keep.
+ * @return bool False if the number is out of range or memory is exhausted.
+ */
+bool hot_init(unsigned entries) {
+    if (entries == 0 || entries > HOT_MAX_ENTRIES) {
+        printf("--top must be between 1 and %d\n", HOT_MAX_ENTRIES);
+        return false;
+    }
+    if (!table_init(&s_paths, (int)entries) || !table_init(&s_dirs, (int)entries)) {
+        perror("Failed to allocate the heavy hitters");
+        hot_free();
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Check if the heavy hitters are tracked.
+ *
+ * @return bool True if tracking.
+ */
+bool hot_enabled(void) {
+    return s_paths.capacity != 0;
+}
+
+/**
+ * @brief Count a change event on a path and its directory.
+ *
+ * @param path The changed path, may be NULL if it is not known.
+ */
+void hot_event(const char *path) {
+    if (path && hot_enabled()) {
+        table_count(&s_paths, path, strlen(path));
+        size_t len = dir_length(path);
+        if (len) {
+            table_count(&s_dirs, path, len);
+        }
+    }
+}
+
+/**
+ * @brief Start counting the paths of a run.
+ *
+ */
+void hot_run_begin(void) {
+    s_run_seq++;
+}
+
+/**
+ * @brief Count a run against a changed path and its directory.
+ * @details A changeset_fn; each entry counts a run once however many
+ * of its paths were in it. Paths no longer in the table are not
+ * counted.
+ *
+ * @param path The changed path.
+ * @param context Not used.
+ */
+void hot_ran(const char *path, void *context) {
+    (void)context;
+    if (!hot_enabled()) {
+        return;
+    }
+    size_t len = strlen(path);
+    int index = table_find(&s_paths, path, len, hash_key(path, len));
+    if (index != -1 && s_paths.entries[index].run_seq != s_run_seq) {
+        s_paths.entries[index].run_seq = s_run_seq;
+        s_paths.entries[index].runs++;
+    }
+    len = dir_length(path);
+    index = len ? table_find(&s_dirs, path, len, hash_key(path, len)) : -1;
+    if (index != -1 && s_dirs.entries[index].run_seq != s_run_seq) {
+        s_dirs.entries[index].run_seq = s_run_seq;
+        s_dirs.entries[index].runs++;
+    }
+}
+
+/**
+ * @brief Order counters by descending count (qsort comparator).
+ *
+ */
+static int by_count(const void *a, const void *b) {
+    const hot_entry_t *x = *(hot_entry_t * const *)a;
+    const hot_entry_t *y = *(hot_entry_t * const *)b;
+    return (x->count < y->count) - (x->count > y->count);
+}
+
+/**
+ * @brief Rank the counters of a table.
+ *
+ * @param table The table.
+ * @param ranked Receives the counters, largest first.
+ * @param limit The most counters to rank.
+ * @return int The number ranked.
+ */
+static int table_rank(const hot_table_t *table, const hot_entry_t **ranked, unsigned limit) {
+    for (int index = 0; index < table->used; index++) {
+        ranked[index] = &table->entries[index];
+    }
+    qsort(ranked, (size_t)table->used, sizeof(ranked[0]), by_count);
+    return (unsigned)table->used < limit ? table->used : (int)limit;
+}
+
+/**
+ * @brief Report the heaviest paths and directories.
+ * @details Each line is the event count, with the most it may be over
+ * by, the runs set off and the path.
+ *
+ * @param fp The output stream.
+ * @param limit The most entries of each kind to report.
+ */
+void hot_dump(FILE *fp, unsigned limit) {
+    static const hot_entry_t *ranked[HOT_MAX_ENTRIES];
+    const struct { const char *kind; const hot_table_t *table; } tables[] = {
+        { "path", &s_paths }, { "dir", &s_dirs }
+    };
+
+    for (size_t kind = 0; kind < sizeof(tables) / sizeof(tables[0]); kind++) {
+        int count = table_rank(tables[kind].table, ranked, limit);
+        for (int index = 0; index < count; index++) {
+            fprintf(fp, "hot %s events=%lu error=%lu runs=%lu %s\n", tables[kind].kind,
+                ranked[index]->count, ranked[index]->error, ranked[index]->runs, ranked[index]->key);
+        }
+    }
+}
+
+/**
+ * @brief Write the heaviest paths of a table as a JSON array.
+ *
+ * @param fp The output stream.
+ * @param table The table.
+ * @param limit The most entries to write.
+ */
+static void table_json(FILE *fp, const hot_table_t *table, unsigned limit) {
+    static const hot_entry_t *ranked[HOT_MAX_ENTRIES];
+    int count = table_rank(table, ranked, limit);
+
+    fputc('[', fp);
+    for (int index = 0; index < count; index++) {
+        fprintf(fp, "%s{\"events\":%lu,\"error\":%lu,\"runs\":%lu,\"path\":", index ? "," : "",
+            ranked[index]->count, ranked[index]->error, ranked[index]->runs);
+        stats_json_string(fp, ranked[index]->key);
+        fputc('}', fp);
+    }
+    fputc(']', fp);
+}
+
+/**
+ * @brief Write the heaviest paths and directories as a JSON object.
+ *
+ * @param fp The output stream.
+ * @param limit The most entries of each kind to write.
+ */
+void hot_json(FILE *fp, unsigned limit) {
+    fputs("{\"paths\":", fp);
+    table_json(fp, &s_paths, limit);
+    fputs(",\"dirs\":", fp);
+    table_json(fp, &s_dirs, limit);
+    fputc('}', fp);
+}
+
+/**
+ * @brief Stop tracking and release the counters.
+ *
+ */
+void hot_free(void) {
+    table_free(&s_paths);
+    table_free(&s_dirs);
+}
+
+/* End. */
@@ -0,0 +1,35 @@
+/**
+ * @file hot.h
+ * @author Mark Lehane (markdlehane@gmail.com)
+ * @brief Heavy hitters interface.
+ * @details Tracks the files and directories that change most, and how
+ * many runs they set off, in a fixed amount of memory.
+ *
+ * @version 0.1
+ * @date 2025-12-22
+ *
+ * @copyright Copyright (c) 2025, Mark D Lehane.
+ *
+ */
+
+#ifndef HOT_H
+#define HOT_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+// The most entries kept for paths, and again for directories.
+#define HOT_MAX_ENTRIES 1024
+
+extern bool hot_init(unsigned entries);
+extern bool hot_enabled(void);
+extern void hot_event(const char *path);
+extern void hot_run_begin(void);
+extern void hot_ran(const char *path, void *context);
+extern void hot_dump(FILE *fp, unsigned limit);
+extern void hot_json(FILE *fp, unsigned limit);
+extern void hot_free(void);
+
+#endif
+
+/* End. */
@@ -0,0 +1,477 @@
+/**
+ * @file journal.c
+ * @author Mark Lehane (markdlehane@gmail.com)
+ * @brief Event journal functions.
+ * @details This module records everything the watch loop reads so that a
+ * misbehaving watcher can be reproduced later with --replay. The journal
+ * is a compact binary stream:-
+ *
+ *   header: "WFJ" version(1 byte) varint(start time, s) varint(rules)
+ *           then for each rule varint(len) target
+ *   record: type(1 byte) varint(delta time, us) payload
+ *
+ * where the payload depends on the record type:-
+ *
+ *   JR_EVENTS   varint(len) raw inotify buffer
+ *   JR_SIGNAL   varint(signal number)
+ *   JR_EXIT     varint(pid) varint(wait status) varint(run time, us) varint(rule)
+ *   JR_WATCH    varint(wd) varint(rule mask) varint(len) path
+ *   JR_RESCAN   varint(changed paths) varint(rule mask)
+ *   JR_ARRIVED  varint(rule)
+ *   JR_LAG      varint(bytes waiting in the kernel queue)
+ *
+ * A rule mask has bit n set for the rule with index n. A lag record is
+ * written before a read whenever the queue depth differs from the last
+ * one recorded, so that a replay batches and degrades the same way.
+ *
+ * The reader trusts no length in the stream. An events record may be no
+ * larger than the largest read the watcher makes and must hold whole
+ * events, and a path no longer than PATH_MAX.
+ *
+ * Unsigned LEB128 varints keep the common case (small deltas, small
+ * numbers) to one or two bytes.
+ *
+ * @version 0.1
+ * @date 2025-12-04
+ *
+ * @copyright Copyright (c) 2025, Mark D Lehane.
+ *
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "journal.h"
+#include "watch.h"
+
+// Local constants.
+#define JOURNAL_MAGIC "WFJ"
+#define JOURNAL_VERSION 3
+#define JOURNAL_BUFFER (64 * 1024)
+
+// Local data.
+static FILE *s_journal = NULL;
+static uint64_t s_journal_start = 0;
+static uint64_t s_journal_last = 0;
+
+/**
+ * @brief Write an unsigned LEB128 varint.
+ *
+ * @param fp The output stream.
+ * @param value The value to write.
+ */
+static void put_varint(FILE *fp, uint64_t value) {
+    do {
+        unsigned char byte = value & 0x7f;
+        value >>= 7;
+        if (value) {
+            byte |= 0x80;
+        }
+        fputc(byte, fp);
+    } while (value);
+}
+
+/**
+ * @brief Read an unsigned LEB128 varint.
+ *
+ * @param fp The input stream.
+ * @param value Receives the value.
+ * @return bool True on success, false on a truncated stream.
+ */
+static bool get_varint(FILE *fp, uint64_t *value) {
+    uint64_t result = 0;
+    int shift = 0;
+    for (;;) {
+        int byte = fgetc(fp);
+        if (byte == EOF || shift > 63) {
+            return false;
+        }
+        result |= (uint64_t)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            break;
+        }
+        shift += 7;
+    }
+    *value = result;
+    return true;
+}
+
+/**
+ * @brief Write a record header with the time since the last record.
+ *
+ * @param type The record type.
+ */
+static void put_header(JOURNAL_REC type) {
+    uint64_t now = watch_clock_us() - s_journal_start;
+    fputc(type, s_journal);
+    put_varint(s_journal, now - s_journal_last);
+    s_journal_last = now;
+}
+
+/**
+ * @brief Open a journal for recording.
+ *
+ * @param path The journal file name.
+ * @param targets The watch target of each rule, stored in the journal header.
+ * @param count The number of rules.
+ * @return bool True if the journal was opened.
+ */
+bool journal_open(const char *path, const char *const *targets, int count) {
+    s_journal = fopen(path, "wb");
+    if (s_journal == NULL) {
+        perror("Failed to open journal");
+    }
+    else {
+        setvbuf(s_journal, NULL, _IOFBF, JOURNAL_BUFFER);
+        fputs(JOURNAL_MAGIC, s_journal);
+        fputc(JOURNAL_VERSION, s_journal);
+        put_varint(s_journal, (uint64_t)time(NULL));
+        put_varint(s_journal, (uint64_t)count);
+        for (int rule = 0; rule < count; rule++) {
+            size_t len = targets[rule] ? strlen(targets[rule]) : 0;
+            put_varint(s_journal, len);
+            fwrite(targets[rule], 1, len, s_journal);
+        }
+        s_journal_start = watch_clock_us();
+        s_journal_last = 0;
+    }
+    return s_journal != NULL;
+}
+
+/**
+ * @brief Check if a journal is being recorded.
+ *
+ * @return bool True if recording.
+ */
+bool journal_recording(void) {
+    return s_journal != NULL;
+}
+
+/**
+ * @brief Record a raw inotify buffer.
+ *
+ * @param buf The buffer as read from the inotify handle.
+ * @param len The number of bytes read.
+ */
+void journal_events(const char *buf, size_t len) {
+    if (s_journal) {
+        put_header(JR_EVENTS);
+        put_varint(s_journal, len);
+        fwrite(buf, 1, len, s_journal);
+    }
+}
+
+/**
+ * @brief Record a signal.
+ *
+ * @param signo The signal number.
+ */
+void journal_signal(int signo) {
+    if (s_journal) {
+        put_header(JR_SIGNAL);
+        put_varint(s_journal, (uint64_t)signo);
+    }
+}
+
+/**
+ * @brief Record a child process exit.
+ *
+ * @param pid The child process id.
+ * @param status The wait status of the child.
+ * @param runtime The child run time in microseconds.
+ * @param rule The index of the rule that ran the child.
+ */
+void journal_exit(int pid, int status, uint64_t runtime, int rule) {
+    if (s_journal) {
+        put_header(JR_EXIT);
+        put_varint(s_journal, (uint64_t)pid);
+        put_varint(s_journal, (uint64_t)(unsigned)status);
+        put_varint(s_journal, runtime);
+        put_varint(s_journal, (uint64_t)rule);
+    }
+}
+
+/**
+ * @brief Record a watch registration.
+ *
+ * @param wd The watch descriptor.
+ * @param path The watched path.
+ * @param rules The mask of rules that share the watch.
+ */
+void journal_watch(int wd, const char *path, uint64_t rules) {
+    if (s_journal) {
+        size_t len = strlen(path);
+        put_header(JR_WATCH);
+        put_varint(s_journal, (uint64_t)wd);
+        put_varint(s_journal, rules);
+        put_varint(s_journal, len);
+        fwrite(path, 1, len, s_journal);
+    }
+}
+
+/**
+ * @brief Record the outcome of a tree rescan.
+ *
+ * @param changed The number of changed paths found.
+ * @param rules The mask of rules with changes.
+ */
+void journal_rescan(long changed, uint64_t rules) {
+    if (s_journal) {
+        put_header(JR_RESCAN);
+        put_varint(s_journal, (uint64_t)changed);
+        put_varint(s_journal, rules);
+    }
+}
+
+/**
+ * @brief Record the arrival of an awaited target.
+ *
+ * @param rule The index of the rule that was waiting.
+ */
+void journal_arrived(int rule) {
+    if (s_journal) {
+        put_header(JR_ARRIVED);
+        put_varint(s_journal, (uint64_t)rule);
+    }
+}
+
+/**
+ * @brief Record the depth of the kernel queue.
+ *
+ * @param bytes The bytes waiting to be read.
+ */
+void journal_lag(unsigned long bytes) {
+    if (s_journal) {
+        put_header(JR_LAG);
+        put_varint(s_journal, bytes);
+    }
+}
+
+/**
+ * @brief Flush the journal to disk.
+ *
+ */
+void journal_flush(void) {
+    if (s_journal) {
+        fflush(s_journal);
+    }
+}
+
+/**
+ * @brief Close the journal.
+ *
+ */
+void journal_close(void) {
+    if (s_journal) {
+        fclose(s_journal);
+        s_journal = NULL;
+    }
+}
+
+/**
+ * @brief Read a variable length payload into the reader buffer.
+ *
+ * @param reader The journal reader.
+ * @param limit The largest payload the record may hold.
+ * @param len Receives the payload length.
+ * @return bool True on success, false on a truncated or oversized payload.
+ */
+static bool get_payload(journal_reader_t *reader, size_t limit, size_t *len) {
+    uint64_t size;
+    if (!get_varint(reader->fp, &size) || size > limit) {
+        return false;
+    }
+    if (size >= reader->cap) {
+        char *buf = realloc(reader->buf, size + 1);
+        if (buf == NULL) {
+            return false;
+        }
+        reader->buf = buf;
+        reader->cap = size + 1;
+    }
+    if (fread(reader->buf, 1, size, reader->fp) != size) {
+        return false;
+    }
+    reader->buf[size] = '\0';
+    *len = size;
+    return true;
+}
+
+/**
+ * @brief Check that a buffer holds only whole inotify events.
+ *
+ * @param buf The events buffer.
+ * @param len The length of the buffer.
+ * @return bool True if every event, name included, lies within the buffer.
+ */
+static bool whole_events(const char *buf, size_t len) {
+    size_t offset = 0;
+    while (offset < len) {
+        struct inotify_event event;
+        if (len - offset < sizeof(event)) {
+            return false;
+        }
+        memcpy(&event, buf + offset, sizeof(event));
+        if (event.len > len - offset - sizeof(event)) {
+            return false;
+        }
+        offset += sizeof(event) + event.len;
+    }
+    return true;
+}
+
+/**
+ * @brief Read the rule targets from the journal header.
+ *
+ * @param reader The journal reader.
+ * @param count The number of rules.
+ * @return bool True on success.
+ */
+static bool get_targets(journal_reader_t *reader, int count) {
+    size_t len;
+
+    for (reader->rules = 0; reader->rules < count; reader->rules++) {
+        if (!get_payload(reader, PATH_MAX, &len)) {
+            return false;
+        }
+        reader->targets[reader->rules] = strdup(reader->buf);
+        if (reader->targets[reader->rules] == NULL) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Open a journal for replay.
+ *
+ * @param reader The reader state to initialise.
+ * @param path The journal file name.
+ * @return bool True if the journal was opened and the header is valid.
+ */
+bool journal_reader_open(journal_reader_t *reader, const char *path) {
+    char magic[4] = {0};
+    uint64_t started, count;
+    int version;
+
+    memset(reader, 0, sizeof(*reader));
+    reader->fp = fopen(path, "rb");
+    if (reader->fp == NULL) {
+        perror("Failed to open journal");
+        return false;
+    }
+    setvbuf(reader->fp, NULL, _IOFBF, JOURNAL_BUFFER);
+    if (fread(magic, 1, 3, reader->fp) != 3 || strcmp(magic, JOURNAL_MAGIC) != 0) {
+        fprintf(stderr, "'%s' is not a watchf journal\n", path);
+    }
+    else if ((version = fgetc(reader->fp)) != JOURNAL_VERSION) {
+        fprintf(stderr, "'%s' has an unsupported journal version\n", path);
+    }
+    else if (!get_varint(reader->fp, &started) || !get_varint(reader->fp, &count) ||
+             count > WATCH_MAX_RULES || !get_targets(reader, (int)count)) {
+        fprintf(stderr, "'%s' has a truncated header\n", path);
+    }
+    else {
+        reader->started = started;
+        return true;
+    }
+    journal_reader_close(reader);
+    return false;
+}
+
+/**
+ * @brief Read the next record from a journal.
+ *
+ * @param reader The journal reader.
+ * @param rec Receives the decoded record.
+ * @return int 1 if a record was read, 0 at the end of the journal, -1 on error.
+ */
+int journal_read(journal_reader_t *reader, journal_rec_t *rec) {
+    uint64_t delta, value, status, runtime, rule;
+
+    int type = fgetc(reader->fp);
+    if (type == EOF) {
+        return 0;
+    }
+    if (!get_varint(reader->fp, &delta)) {
+        return -1;
+    }
+    memset(rec, 0, sizeof(*rec));
+    reader->ts += delta;
+    rec->type = (JOURNAL_REC)type;
+    rec->ts = reader->ts;
+
+    switch (type) {
+        case JR_EVENTS:
+            if (!get_payload(reader, WATCH_MAX_READ, &rec->len) || !whole_events(reader->buf, rec->len)) {
+                return -1;
+            }
+            rec->data = reader->buf;
+            break;
+        case JR_SIGNAL:
+        case JR_LAG:
+            if (!get_varint(reader->fp, &value)) {
+                return -1;
+            }
+            rec->value = (int64_t)value;
+            break;
+        case JR_RESCAN:
+            if (!get_varint(reader->fp, &value) || !get_varint(reader->fp, &rec->rules)) {
+                return -1;
+            }
+            rec->value = (int64_t)value;
+            break;
+        case JR_EXIT:
+            if (!get_varint(reader->fp, &value) || !get_varint(reader->fp, &status) ||
+                !get_varint(reader->fp, &runtime) || !get_varint(reader->fp, &rule)) {
+                return -1;
+            }
+            rec->value = (int64_t)value;
+            rec->status = (int64_t)status;
+            rec->runtime = runtime;
+            rec->rules = 1ULL << (rule % WATCH_MAX_RULES);
+            break;
+        case JR_ARRIVED:
+            if (!get_varint(reader->fp, &rule)) {
+                return -1;
+            }
+            rec->rules = 1ULL << (rule % WATCH_MAX_RULES);
+            break;
+        case JR_WATCH:
+            if (!get_varint(reader->fp, &value) || !get_varint(reader->fp, &rec->rules) ||
+                !get_payload(reader, PATH_MAX, &rec->len)) {
+                return -1;
+            }
+            rec->value = (int64_t)value;
+            rec->data = reader->buf;
+            break;
+        default:
+            fprintf(stderr, "Unknown journal record type %d\n", type);
+            return -1;
+    }
+    return 1;
+}
+
+/**
+ * @brief Close a journal reader.
+ *
+ * @param reader The journal reader.
+ */
+void journal_reader_close(journal_reader_t *reader) {
+    if (reader->fp) {
+        fclose(reader->fp);
+        reader->fp = NULL;
+    }
+    free(reader->buf);
+    reader->buf = NULL;
+    reader->cap = 0;
+    for (int rule = 0; rule < reader->rules; rule++) {
+        free(reader->targets[rule]);
+        reader->targets[rule] = NULL;
+    }
+    reader->rules = 0;
+}
+
+/* End. */
@@ -0,0 +1,94 @@
+/**
+ * @file journal.h
+ * @author Mark Lehane (markdlehane@gmail.com)
+ * @brief Event journal interface.
+ * @details Records the raw inputs of the watch loop (inotify buffers,
+ * signals, watch registrations and child exits) to a compact binary
+ * journal and reads them back for replay.
+ *
+ * @version 0.1
+ * @date 2025-12-04
+ *
+ * @copyright Copyright (c) 2025, Mark D Lehane.
+ *
+ */
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <linux/limits.h>
+
+#include "watch.h"
+
+/**
+ * @brief Enum used to identify journal record types.
+ *
+ */
+typedef enum journal_rec_e {
+    JR_EVENTS = 1,      // Raw buffer read from the inotify handle.
+    JR_SIGNAL,          // Signal read from the signal handle.
+    JR_EXIT,            // Child process exit.
+    JR_WATCH,           // Watch descriptor registration.
+    JR_RESCAN,          // Tree rescan after a change storm.
+    JR_ARRIVED,         // An awaited target arrived.
+    JR_LAG,             // Bytes waiting in the kernel queue.
+    JR_MAX
+
+} JOURNAL_REC;
+
+/**
+ * @brief A decoded journal record.
+ * @details The data pointer refers to storage owned by the reader and
+ * is only valid until the next call to journal_read().
+ *
+ */
+typedef struct journal_rec_s {
+    JOURNAL_REC type;
+    uint64_t ts;        // Microseconds since the start of the journal.
+    int64_t value;      // Watch descriptor, signal number, child pid, changed paths or lag.
+    int64_t status;     // Child wait status.
+    uint64_t runtime;   // Child run time in microseconds.
+    uint64_t rules;     // Mask of the rules the record applies to.
+    size_t len;         // Length of the data.
+    char *data;         // Events buffer or watched path.
+
+} journal_rec_t;
+
+/**
+ * @brief Journal reader state.
+ *
+ */
+typedef struct journal_reader_s {
+    FILE *fp;
+    uint64_t ts;
+    char *buf;
+    size_t cap;
+    uint64_t started;               // Realtime start of the recording (seconds).
+    char *targets[WATCH_MAX_RULES]; // The recorded watch target of each rule.
+    int rules;                      // The number of recorded rules.
+
+} journal_reader_t;
+
+extern bool journal_open(const char *path, const char *const *targets, int count);
+extern bool journal_recording(void);
+extern void journal_events(const char *buf, size_t len);
+extern void journal_signal(int signo);
+extern void journal_exit(int pid, int status, uint64_t runtime, int rule);
+extern void journal_watch(int wd, const char *path, uint64_t rules);
+extern void journal_lag(unsigned long bytes);
+extern void journal_rescan(long changed, uint64_t rules);
+extern void journal_arrived(int rule);
+extern void journal_flush(void);
+extern void journal_close(void);
+
+extern bool journal_reader_open(journal_reader_t *reader, const char *path);
+extern int journal_read(journal_reader_t *reader, journal_rec_t *rec);
+extern void journal_reader_close(journal_reader_t *reader);
+
+#endif
+
+/* End. */
@@ -17,10 +17,18 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdbool.h>
 #include <linux/limits.h>
 #include <getopt.h>
 
+#include "watch.h"
+#include "rules.h"
+#include "tune.h"
+#include "config.h"
+#include "control.h"
+#include "changelog.h"
+
 /* Build number data. */
 static const char *VERSION_NO = "0.1.0";
 static const char *BUILD_NO = "141";
@@ -48,11 +56,59 @@ typedef enum opt_idents_e {
     OID_EXEC,
     OID_ONCE,
     OID_VERBOSE,
+    OID_RECORD,
+    OID_REPLAY,
+    OID_FAST,
+    OID_DEBOUNCE,
+    OID_MAX_LATENCY,
+    OID_JOBS,
+    OID_TUNE,
+    OID_RECURSIVE,
+    OID_STORM_RATE,
+    OID_STORM_QUIET,
+    OID_TIMEOUT,
+    OID_PRINT_CHANGES,
+    OID_AWAIT,
+    OID_RATE,
+    OID_ADAPTIVE,
+    OID_BACKGROUND,
+    OID_PRESSURE,
+    OID_STATS_JSON,
+    OID_NICE,
+    OID_IOPRIO,
+    OID_CPUS,
+    OID_CPU_MAX,
+    OID_MEMORY_MAX,
+    OID_CGROUP,
+    OID_PIN,
+    OID_TOP,
+    OID_CONTROL,
+    OID_METRICS_FILE,
+    OID_METRICS_INTERVAL,
+    OID_FOLLOW_SYMLINKS,
+    OID_IF_SIZE,
+    OID_IF_MATCH,
+    OID_IF_LINE,
+    OID_IF_RANGE,
+    OID_SLOTS,
+    OID_PRIORITY,
+    OID_WEIGHT,
+    OID_INTERACTIVE,
+    OID_CONFIG,
+    OID_CHANGES_MAX,
+    OID_SIGNAL,
+    OID_SIGNAL_TO,
+    OID_WAIT,
+    OID_WAIT_RULE,
+    OID_CHANGE_LOG,
+    OID_IF_TREE_CHANGED,
+    OID_CHANGED_RANGES,
+    OID_PROFILE,
     OID_END
 
 } opt_idents_t;
 
-static const char *s_short_opts = "hf:se:1v";
+static const char *s_short_opts = "hf:se:1vj:rt:pa";
 
 static struct option s_long_options[] = {
     { "help",       no_argument,        NULL,   '?' },
@@ -63,6 +119,54 @@ static struct option s_long_options[] = {
     { "exec",       required_argument,  NULL,   'e' },
     { "once",       no_argument,        NULL,   '1' },
     { "verbose",    no_argument,        NULL,   'v' },
+    { "record",     required_argument,  NULL,   0   },
+    { "replay",     required_argument,  NULL,   0   },
+    { "fast",       no_argument,        NULL,   0   },
+    { "debounce",   required_argument,  NULL,   0   },
+    { "max-latency",required_argument,  NULL,   0   },
+    { "jobs",       required_argument,  NULL,   'j' },
+    { "tune",       required_argument,  NULL,   0   },
+    { "recursive",  no_argument,        NULL,   'r' },
+    { "storm-rate", required_argument,  NULL,   0   },
+    { "storm-quiet",required_argument,  NULL,   0   },
+    { "timeout",    required_argument,  NULL,   't' },
+    { "print-changes", no_argument,     NULL,   'p' },
+    { "await",      no_argument,        NULL,   'a' },
+    { "rate",       required_argument,  NULL,   0   },
+    { "adaptive",   required_argument,  NULL,   0   },
+    { "background", no_argument,        NULL,   0   },
+    { "pressure",   required_argument,  NULL,   0   },
+    { "stats-json", required_argument,  NULL,   0   },
+    { "nice",       required_argument,  NULL,   0   },
+    { "ioprio",     required_argument,  NULL,   0   },
+    { "cpus",       required_argument,  NULL,   0   },
+    { "cpu-max",    required_argument,  NULL,   0   },
+    { "memory-max", required_argument,  NULL,   0   },
+    { "cgroup",     required_argument,  NULL,   0   },
+    { "pin",        required_argument,  NULL,   0   },
+    { "top",        required_argument,  NULL,   0   },
+    { "control",    required_argument,  NULL,   0   },
+    { "metrics-file", required_argument, NULL,  0   },
+    { "metrics-interval", required_argument, NULL, 0 },
+    { "follow-symlinks", no_argument,   NULL,   0   },
+    { "if-size",    required_argument,  NULL,   0   },
+    { "if-match",   required_argument,  NULL,   0   },
+    { "if-line",    required_argument,  NULL,   0   },
+    { "if-range",   required_argument,  NULL,   0   },
+    { "slots",      required_argument,  NULL,   0   },
+    { "priority",   required_argument,  NULL,   0   },
+    { "weight",     required_argument,  NULL,   0   },
+    { "interactive", no_argument,       NULL,   0   },
+    { "config",     required_argument,  NULL,   0   },
+    { "changes-max", required_argument, NULL,   0   },
+    { "signal",     required_argument,  NULL,   0   },
+    { "signal-to",  required_argument,  NULL,   0   },
+    { "wait",       required_argument,  NULL,   0   },
+    { "wait-rule",  required_argument,  NULL,   0   },
+    { "change-log", required_argument,  NULL,   0   },
+    { "if-tree-changed", no_argument,   NULL,   0   },
+    { "changed-ranges", no_argument,    NULL,   0   },
+    { "profile",    no_argument,        NULL,   0   },
     { NULL,         no_argument,        NULL,   0   } 
 };
 
@@ -70,33 +174,271 @@ static const char *s_option_help[] = {
     "-?,-h,--help   displays this message.",
     "--version      displays the version and build number of this program.",
     "--path         displays the program path on stdout.",
-    "--file,-f      activates the monitor unit.",
+    "--file,-f      activates the monitor unit. Each -f with its -e is a rule; give several",
+    "               to watch several targets. --exec, --debounce, --max-latency, --jobs,",
+    "               --rate, --adaptive, --background, --nice, --ioprio, --cpus, --cpu-max,",
+    "               --memory-max, --recursive, --follow-symlinks, --await, --priority,",
+    "               --weight, --interactive, --signal, --signal-to, --changed-ranges and the",
+    "               --if-* predicates",
+    "               apply to the rule of the latest -f.",
     "--stdin,-s     read stdin rather than a file.",
     "--exec,-e      program to execute upon a change event",
-    "--once,-1      waits for a single change, default is a continuous scan.",
+    "--once,-1      waits for a single change, default is a continuous scan. The command",
+    "               runs once the change settles and its status is returned. Without a",
+    "               command --once just waits until the target has been quiet for the",
+    "               --debounce period after a change, then exits with status 0.",
     "--verbose,-v   prints debug information and event data to stdout",
+    "--record FILE  records every event, signal and command exit to a journal.",
+    "--replay FILE  replays a journal through the watcher instead of watching.",
+    "--fast         replays as fast as possible rather than at the recorded speed.",
+    "--debounce MS  quiet period before the command runs, default 100ms.",
+    "--max-latency MS  longest a change waits for a run during constant changes, default no limit.",
+    "--jobs,-j N    maximum number of concurrent runs, default 1.",
+    "--slots N      job slots shared by all the rules, default 64. Due rules compete for",
+    "               them by lane, then --priority, then weighted fair queuing.",
+    "--priority N   dispatch priority of the rule, 0 (default) to 9, highest first.",
+    "--weight W     the rule's share of contended slots, 1 (default) to 1000, charged",
+    "               by the measured run time of its command.",
+    "--interactive  runs the rule in the interactive lane, which goes first and keeps",
+    "               one of the --slots free for it.",
+    "--tune FILE    simulates a journal over a grid of policies; --debounce, --max-latency",
+    "               and --jobs then take comma separated lists of values to try. The",
+    "               journal does not keep the other rule options, so each rule is",
+    "               simulated without its --rate, --adaptive, --priority and --weight,",
+    "               and without contention for the shared --slots.",
+    "--recursive,-r watches every directory in the tree below a directory.",
+    "--follow-symlinks  with --recursive, also watches the directories that links in the",
+    "               tree point at, once each, reporting changes under every path to them.",
+    "--storm-rate N changes per second that start a change storm, default 1000, 0 disables.",
+    "               During a storm events are drained unread and, once quiet, one rescan",
+    "               against a snapshot of the target decides whether to run. The snapshot is",
+    "               taken at the start and holds about 300 bytes a path of the target.",
+    "--storm-quiet MS  quiet period that ends a change storm, default 500ms.",
+    "--timeout,-t MS   with --once or --wait, gives up waiting after MS and exits with status 2.",
+    "--print-changes,-p  prints the changed paths, one per line, when they settle.",
+    "--changed-ranges  gives the rule's command, on its standard input, a line for each",
+    "               changed file: the path, its size and the OFFSET:LENGTH byte ranges of",
+    "               new content, tab separated, found by content-defined chunking.",
+    "--changes-max BYTES[k|m|g]  most memory each rule's changed paths may take, default",
+    "               8m. Past it the directories of the changes are kept instead, and past",
+    "               that the whole target is taken as changed.",
+    "--await,-a     the target need not exist yet; fires as soon as it has been created",
+    "               and closed after writing, then watches it as usual.",
+    "--rate N/INTERVAL[:BURST]  at most N runs per INTERVAL (ms, or with an ms, s or m",
+    "               unit), allowing bursts of BURST runs, default N. A run held back takes",
+    "               every change made while it waits. SIGUSR1 reports the statistics.",
+    "--adaptive MIN:MAX  sets the debounce between MIN and MAX ms, and the concurrency up to",
+    "               --jobs, from the measured change gaps and command run times.",
+    "--background   defers the rule's runs while the host is over a --pressure threshold.",
+    "--pressure cpu:P,memory:P,io:P  pressure stall thresholds (% of time stalled, 10s",
+    "               average) above which background rules wait.",
+    "--stats-json FILE  writes the statistics, with the resources each rule's runs used,",
+    "               as JSON to FILE on SIGUSR1 and when the watch ends.",
+    "--nice N       runs the rule's command at nice value N (-20 to 19).",
+    "--ioprio CLASS[:LEVEL]  runs the rule's command at I/O priority idle, be or rt, with",
+    "               LEVEL 0 (highest) to 7.",
+    "--cpus LIST    runs the rule's command on the CPUs in LIST, e.g. 2-3,6.",
+    "--cpu-max QUOTA[/PERIOD]  limits the rule's command to QUOTA us of CPU time per PERIOD us",
+    "               (default 100000), in its own cgroup under --cgroup.",
+    "--memory-max BYTES[k|m|g]  limits the memory of the rule's command, in its own cgroup.",
+    "--cgroup DIR   a delegated cgroup v2 directory; each rule's runs go in DIR/rule-N.",
+    "--pin CPU      pins the watcher to CPU; commands without --cpus run on the others.",
+    "--profile      measures the watcher's own stages (read, decode, filter, dispatch,",
+    "               spawn) with CPU cycles, instructions, context switches and page",
+    "               faults where perf_event_open is allowed, and time, for the statistics.",
+    "--top K        tracks the K paths and K directories with the most change events (in",
+    "               bounded memory) and the runs they set off, for the statistics.",
+    "--control PATH answers 'stats', 'json', 'top [N]', 'since [TOKEN]', 'hash [PATH]',",
+    "               'wait [RULE]' and 'help' requests on a Unix socket at PATH, e.g.",
+    "               echo top 5 | nc -U PATH.",
+    "--change-log N keeps the latest N changed paths, default 65536, for 'since' requests:",
+    "               the paths changed since a token and a new token. 0 keeps none.",
+    "--wait PATH    connects to the watcher with --control PATH and waits for the next run",
+    "               to start and finish, then exits with the run's status.",
+    "--wait-rule NAME  with --wait, waits for a run of the rule NAME only.",
+    "--if-size MIN[:MAX]  runs the rule only if a changed file's size (bytes, with an",
+    "               optional k, m or g) is from MIN to MAX; :MAX gives no lower bound.",
+    "--if-match REGEX  runs the rule only if a changed file's content matches REGEX",
+    "               (POSIX extended, matched line by line).",
+    "--if-line TEXT runs the rule only if a changed file has a line that is exactly TEXT.",
+    "--if-range OFFSET[:LENGTH]  runs the rule only if those bytes of a changed file",
+    "               differ from when the file was last tested, or the watch started.",
+    "--if-tree-changed  runs the rule only if the hash of its target's tree, over the",
+    "               content of every file and the names, changed: not for a file saved",
+    "               unchanged. The hashes of the tree are kept for 'hash' requests.",
+    "--metrics-file PATH  rewrites Prometheus metrics to PATH (for the node_exporter",
+    "               textfile collector) every --metrics-interval MS, default 15000ms.",
+    "--signal SIG   sends SIG (a name such as HUP, or a number) on change, from the watcher",
+    "               itself, before the rule's command; with no -e it is the whole action.",
+    "--signal-to PROC  the process to signal: a pid, a pid file (a path holding a /) or a",
+    "               process name. It is found once and held by a pidfd, and found again",
+    "               if it has gone, such as after the daemon restarts.",
+    "--config FILE  adds the rules in FILE, a [NAME] section each with file = PATH and",
+    "               the rule options as OPTION = VALUE. The rules are reloaded when FILE",
+    "               is saved, or on SIGHUP; unchanged targets keep their watches.",
     NULL
 };
 
-/* Filename pointer for watched file. */
-static const char *s_watch_target = NULL;
-static const char *s_exec_command = NULL;
+/* Options for the watcher, the watched files and commands are rules. */
+static watch_opts_t s_opts = {
+    .continuous = true,
+    .storm_rate = WATCH_DEFAULT_STORM_RATE,
+    .storm_quiet = WATCH_DEFAULT_STORM_QUIET,
+    .pin = -1,
+    .metrics_interval = WATCH_DEFAULT_METRICS_INTERVAL,
+    .changes_max = CHANGESET_DEFAULT_MAX_BYTES,
+    .change_log = CHANGELOG_DEFAULT_MAX
+};
+static watch_rule_t *s_rule = NULL;
 static bool s_watch_stdin = false;
-static bool s_continuous = true;
-static bool s_verbose = false;
+
+/* A client waiting on a watcher's runs. */
+static const char *s_wait_socket = NULL;
+static const char *s_wait_rule = NULL;
+
+/* Policy values, lists of values when tuning. */
+static tune_grid_t s_grid = {0};
+static const char *s_tune_file = NULL;
+
+/**
+ * @brief Parse a comma separated list of unsigned values.
+ * 
+ * @param arg The option argument.
+ * @param values Receives the values.
+ * @param count Receives the number of values.
+ * @return bool True if the list is valid.
+ */
+static bool parse_list(const char *arg, unsigned *values, int *count) {
+    char *end;
+    *count = 0;
+    do {
+        unsigned long value = strtoul(arg, &end, 10);
+        if (end == arg || (*end != ',' && *end != '\0') || *count == TUNE_MAX_VALUES) {
+            printf("Invalid value list '%s'\n", arg);
+            return false;
+        }
+        values[(*count)++] = (unsigned)value;
+        arg = end + 1;
+    } while (*end == ',');
+    return true;
+}
+
+/**
+ * @brief Parse a single unsigned value.
+ * 
+ * @param arg The option argument.
+ * @param value Receives the value.
+ * @return bool True if the value is valid.
+ */
+static bool parse_number(const char *arg, unsigned *value) {
+    char *end;
+    unsigned long number = strtoul(arg, &end, 10);
+    if (end == arg || *end != '\0') {
+        printf("Invalid number '%s'\n", arg);
+        return false;
+    }
+    *value = (unsigned)number;
+    return true;
+}
 
 /**
- * @brief Watch a file, files or a directory for changes.
- * @details The routine wathes a file, files or directory for changes
- * and executes a command for each change.
+ * @brief Parse a size in bytes.
+ * @details A number with an optional k, m or g unit.
  * 
- * @param file_pattern A pointer to the file pattern to scan for changes.
- * @param executable A pointer to the command to execute.
- * @param continuous If true the program scans continuously, otherwise scans once.
- * @param verbose Report events and debug information.
- * @return int 0 on success.
+ * @param arg The option argument.
+ * @param value Receives the size.
+ * @return bool True if the size is valid.
  */
-extern int watch_for_changes(const char *file_pattern, const char *executable, bool continuous, bool verbose);
+static bool parse_bytes(const char *arg, size_t *value) {
+    char *end;
+    unsigned long long bytes = strtoull(arg, &end, 10);
+    const char *units = "kmg";
+    const char *unit = *end ? strchr(units, *end | 0x20) : NULL;
+
+    if (unit) {
+        bytes <<= 10 * (unit - units + 1);
+        end++;
+    }
+    if (end == arg || *end != '\0') {
+        printf("Invalid size '%s', expected BYTES[k|m|g]\n", arg);
+        return false;
+    }
+    *value = (size_t)bytes;
+    return true;
+}
+
+/**
+ * @brief Check a policy option has a single value for a live watch.
+ * 
+ * @param name The option name, for error reports.
+ * @param count The number of values.
+ * @return bool True if there is at most one value.
+ */
+static bool single_value(const char *name, int count) {
+    if (count > 1) {
+        printf("--%s takes a list of values only with --tune\n", name);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Return the rule that rule options apply to.
+ * @details A target or command for a rule that already has one starts
+ * the next rule, so -f and -e may be given in either order.
+ * 
+ * @param start True to start a new rule.
+ * @return watch_rule_t* The rule, or NULL if no more rules can be made.
+ */
+static watch_rule_t *current_rule(bool start) {
+    if (s_rule == NULL || start) {
+        s_rule = rule_new();
+    }
+    return s_rule;
+}
+
+/**
+ * @brief Apply a policy option to the current rule.
+ * @details A list of values is only for the tuner, which takes the
+ * whole grid, so it leaves the rule alone.
+ * 
+ * @param name The option name.
+ * @param value The option value.
+ * @param count The number of values in the list.
+ * @return bool True if the option is valid.
+ */
+static bool rule_policy(const char *name, const char *value, int count) {
+    watch_rule_t *rule = current_rule(false);
+    return rule != NULL && (count > 1 || rule_option(rule, name, value));
+}
+
+/**
+ * @brief Check the rules are complete enough to watch.
+ * 
+ * @return bool True if every rule has a target, and a command when watching continuously.
+ */
+static bool rules_complete(void) {
+    // A config file may start empty and have rules added later.
+    if ((rule_count() == 0 && s_opts.config == NULL) || s_watch_stdin) {
+        puts("Please supply a filename pattern to watch for changes.");
+        return false;
+    }
+    for (int index = 0; index < rule_count(); index++) {
+        const watch_rule_t *rule = rule_at(index);
+        if (rule->target == NULL) {
+            puts("Please supply a filename pattern to watch for changes.");
+            return false;
+        }
+        if (!procsignal_valid(&rule->signal)) {
+            return false;
+        }
+        if (rule->command == NULL && rule->signal.signo == 0 && s_opts.continuous) {
+            puts("Please supply a command to execute on file chaneg.");
+            return false;
+        }
+    }
+    return true;
+}
 
 /**
  * @brief Report the program path on stdout.
@@ -180,6 +522,21 @@ int main(int argc, char **argv) {
                 else if (c == 'v') {
                     option_index = OID_VERBOSE;
                 }
+                else if (c == 'j') {
+                    option_index = OID_JOBS;
+                }
+                else if (c == 'r') {
+                    option_index = OID_RECURSIVE;
+                }
+                else if (c == 't') {
+                    option_index = OID_TIMEOUT;
+                }
+                else if (c == 'p') {
+                    option_index = OID_PRINT_CHANGES;
+                }
+                else if (c == 'a') {
+                    option_index = OID_AWAIT;
+                }
 
                 // Process the selected option.
                 switch(option_index) {
@@ -196,22 +553,187 @@ int main(int argc, char **argv) {
                         run = false;
                         break;
                     case OID_FILE:
-                        s_watch_target = optarg;
+                        current_rule(s_rule != NULL && s_rule->target != NULL);
+                        run = s_rule != NULL && rule_option(s_rule, "file", optarg);
                         s_watch_stdin = false;
                         break;
                     case OID_STDIN:
-                        s_watch_target = NULL;
                         s_watch_stdin = true;
                         break;
                     case OID_EXEC:
-                        s_exec_command = optarg;
+                        current_rule(s_rule != NULL && s_rule->command != NULL);
+                        run = s_rule != NULL && rule_option(s_rule, "exec", optarg);
                         break;
                     case OID_ONCE:
-                        s_continuous = false;
+                        s_opts.continuous = false;
                         break;
                     case OID_VERBOSE:
-                        s_verbose = true;
+                        s_opts.verbose = true;
+                        break;
+                    case OID_RECORD:
+                        s_opts.record_file = optarg;
+                        break;
+                    case OID_REPLAY:
+                        s_opts.replay_file = optarg;
+                        break;
+                    case OID_FAST:
+                        s_opts.replay_fast = true;
+                        break;
+                    case OID_DEBOUNCE:
+                        run = parse_list(optarg, s_grid.debounce, &s_grid.debounce_count) &&
+                              rule_policy("debounce", optarg, s_grid.debounce_count);
+                        break;
+                    case OID_MAX_LATENCY:
+                        run = parse_list(optarg, s_grid.max_latency, &s_grid.max_latency_count) &&
+                              rule_policy("max-latency", optarg, s_grid.max_latency_count);
+                        break;
+                    case OID_JOBS:
+                        run = parse_list(optarg, s_grid.jobs, &s_grid.jobs_count);
+                        for (int job = 0; run && job < s_grid.jobs_count; job++) {
+                            if (s_grid.jobs[job] == 0 || s_grid.jobs[job] > WATCH_MAX_JOBS) {
+                                printf("--jobs must be between 1 and %d\n", WATCH_MAX_JOBS);
+                                run = false;
+                            }
+                        }
+                        run = run && rule_policy("jobs", optarg, s_grid.jobs_count);
+                        break;
+                    case OID_TUNE:
+                        s_tune_file = optarg;
+                        break;
+                    case OID_RECURSIVE:
+                        run = current_rule(false) != NULL && rule_option(s_rule, "recursive", NULL);
+                        break;
+                    case OID_FOLLOW_SYMLINKS:
+                        run = current_rule(false) != NULL && rule_option(s_rule, "follow-symlinks", NULL);
+                        break;
+                    case OID_SLOTS:
+                        run = parse_number(optarg, &s_opts.slots);
+                        if (run && (s_opts.slots == 0 || s_opts.slots > WATCH_MAX_JOBS)) {
+                            printf("--slots must be between 1 and %d\n", WATCH_MAX_JOBS);
+                            run = false;
+                        }
+                        break;
+                    case OID_PRIORITY:
+                    case OID_WEIGHT:
+                        run = current_rule(false) != NULL && rule_option(s_rule, s_long_options[option_index].name, optarg);
+                        break;
+                    case OID_INTERACTIVE:
+                        run = current_rule(false) != NULL && rule_option(s_rule, "interactive", NULL);
+                        break;
+                    case OID_CHANGES_MAX:
+                        run = parse_bytes(optarg, &s_opts.changes_max);
+                        if (run && s_opts.changes_max < 4096) {
+                            printf("--changes-max must be at least 4k\n");
+                            run = false;
+                        }
+                        break;
+                    case OID_CONFIG:
+                        if (s_opts.config) {
+                            puts("Only one --config can be given");
+                            run = false;
+                            break;
+                        }
+                        s_opts.config = optarg;
+                        run = config_rules(optarg);
+                        break;
+                    case OID_SIGNAL:
+                    case OID_SIGNAL_TO:
+                        run = current_rule(false) != NULL && rule_option(s_rule, s_long_options[option_index].name, optarg);
+                        break;
+                    case OID_IF_SIZE:
+                    case OID_IF_MATCH:
+                    case OID_IF_LINE:
+                    case OID_IF_RANGE:
+                        run = current_rule(false) != NULL && rule_option(s_rule, s_long_options[option_index].name, optarg);
+                        break;
+                    case OID_IF_TREE_CHANGED:
+                        run = current_rule(false) != NULL && rule_option(s_rule, "if-tree-changed", NULL);
+                        break;
+                    case OID_CHANGED_RANGES:
+                        run = current_rule(false) != NULL && rule_option(s_rule, "changed-ranges", NULL);
+                        break;
+                    case OID_STORM_RATE:
+                        run = parse_number(optarg, &s_opts.storm_rate);
+                        break;
+                    case OID_STORM_QUIET:
+                        run = parse_number(optarg, &s_opts.storm_quiet);
+                        break;
+                    case OID_TIMEOUT:
+                        run = parse_number(optarg, &s_opts.timeout);
+                        break;
+                    case OID_PRINT_CHANGES:
+                        s_opts.print_changes = true;
+                        break;
+                    case OID_AWAIT:
+                        run = current_rule(false) != NULL && rule_option(s_rule, "await", NULL);
+                        break;
+                    case OID_RATE:
+                        run = current_rule(false) != NULL && rule_option(s_rule, "rate", optarg);
+                        break;
+                    case OID_ADAPTIVE:
+                        run = current_rule(false) != NULL && rule_option(s_rule, "adaptive", optarg);
                         break;
+                    case OID_BACKGROUND:
+                        run = current_rule(false) != NULL && rule_option(s_rule, "background", NULL);
+                        break;
+                    case OID_PRESSURE:
+                        s_opts.pressure = optarg;
+                        break;
+                    case OID_STATS_JSON:
+                        s_opts.stats_json = optarg;
+                        break;
+                    case OID_NICE:
+                        run = current_rule(false) != NULL && rule_option(s_rule, "nice", optarg);
+                        break;
+                    case OID_IOPRIO:
+                        run = current_rule(false) != NULL && rule_option(s_rule, "ioprio", optarg);
+                        break;
+                    case OID_CPUS:
+                        run = current_rule(false) != NULL && rule_option(s_rule, "cpus", optarg);
+                        break;
+                    case OID_CPU_MAX:
+                        run = current_rule(false) != NULL && rule_option(s_rule, "cpu-max", optarg);
+                        break;
+                    case OID_MEMORY_MAX:
+                        run = current_rule(false) != NULL && rule_option(s_rule, "memory-max", optarg);
+                        break;
+                    case OID_CGROUP:
+                        s_opts.cgroup = optarg;
+                        break;
+                    case OID_PROFILE:
+                        s_opts.profile = true;
+                        break;
+                    case OID_TOP:
+                        run = parse_number(optarg, &s_opts.top);
+                        break;
+                    case OID_CONTROL:
+                        s_opts.control = optarg;
+                        break;
+                    case OID_CHANGE_LOG:
+                        run = parse_number(optarg, &s_opts.change_log);
+                        break;
+                    case OID_WAIT:
+                        s_wait_socket = optarg;
+                        break;
+                    case OID_WAIT_RULE:
+                        s_wait_rule = optarg;
+                        break;
+                    case OID_METRICS_FILE:
+                        s_opts.metrics_file = optarg;
+                        break;
+                    case OID_METRICS_INTERVAL:
+                        run = parse_number(optarg, &s_opts.metrics_interval);
+                        if (run && s_opts.metrics_interval == 0) {
+                            printf("--metrics-interval must be at least 1ms\n");
+                            run = false;
+                        }
+                        break;
+                    case OID_PIN: {
+                        unsigned cpu;
+                        run = parse_number(optarg, &cpu);
+                        s_opts.pin = (int)cpu;
+                        break;
+                    }
                     default:
                         printf("?? getopt returned character code 0%o ??\n", c);
                         run = false;
@@ -220,21 +742,43 @@ int main(int argc, char **argv) {
             }
         }
         // Report the operation mode.
+        if (run && s_wait_rule != NULL && s_wait_socket == NULL) {
+            puts("--wait-rule needs --wait");
+            run = false;
+        }
+        if (run && s_wait_socket != NULL) {
+            ret = control_wait(s_wait_socket, s_wait_rule, s_opts.timeout);
+            run = false;
+        }
+        if (run && s_tune_file != NULL) {
+            ret = tune_journal(s_tune_file, &s_grid);
+            run = false;
+        }
         if (run) {
-            if (s_watch_target == NULL) {
-                puts("Please supply a filename pattern to watch for changes.");
-            }
-            else if (s_exec_command == NULL) {
-                puts("Please supply a command to execute on file chaneg.");
+            run = single_value("debounce", s_grid.debounce_count) &&
+                  single_value("max-latency", s_grid.max_latency_count) &&
+                  single_value("jobs", s_grid.jobs_count);
+        }
+        if (run) {
+            if (s_opts.replay_file != NULL) {
+                // A replay takes its events from the journal, the command is optional.
+                ret = watch_for_changes(&s_opts);
             }
-            else {
-                if (s_verbose) {
-                    printf("%s watch for change on %s\n", s_continuous ? "Continuous" : "Single", s_watch_target);
-                    printf("Execute '%s' on event.\n", s_exec_command);
+            else if (rules_complete()) {
+                for (int index = 0; s_opts.verbose && index < rule_count(); index++) {
+                    const watch_rule_t *rule = rule_at(index);
+                    printf("%s watch for change on %s\n", s_opts.continuous ? "Continuous" : "Single", rule->target);
+                    if (rule->command) {
+                        printf("Execute '%s' on event.\n", rule->command);
+                    }
+                    if (rule->signal.signo) {
+                        printf("Send SIG%s on event.\n", procsignal_name(rule->signal.signo));
+                    }
                 }
-                ret = watch_for_changes(s_watch_target, s_exec_command, s_continuous, s_verbose);
+                ret = watch_for_changes(&s_opts);
             }
         }
+        rules_free();
     }
     return ret;
 }
@@ -0,0 +1,749 @@
+/**
+ * @file merkle.c
+ * @author Mark Lehane (markdlehane@gmail.com)
+ * @brief Merkle tree functions.
+ * @details This module keeps a hash for each path under the targets of
+ * the rules that ask for one. A file's hash is that of its content, a
+ * link's that of where it points, and a directory's combines the names
+ * and hashes of its entries, so the hash of a target changes when any
+ * file under it changes content or any path is added, removed or
+ * renamed, and not when a file is saved unchanged.
+ *
+ * A directory's value is the sum of a mix of each entry's name and
+ * hash. A sum does not depend on the order of the entries, and one
+ * entry's part can be taken out and put back in, so when a file is
+ * hashed again only the directories above it are updated, each in
+ * O(1): a change costs the file's read and O(depth), not a walk of
+ * the tree. The hashes are 64 bit and not cryptographic; they tell a
+ * change from a no-op save, not a change from an attack.
+ *
+ * The nodes are in an open addressing hash table by path, and each
+ * directory links its entries so a removed one can be dropped with its
+ * tree. The changed paths are hashed again when a rule is due rather
+ * than on every event, so a file written in many pieces is read once.
+ *
+ * @version 0.1
+ * @date 2025-12-31
+ *
+ * @copyright Copyright (c) 2025, Mark D Lehane.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <sys/stat.h>
+#include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+
+#include "merkle.h"
+
+/**
+ * @brief Enum used to identify the kind of path a node stands for.
+ *
+ */
+typedef enum node_type_e {
+    NODE_MISSING = 0,   // A target that does not exist (yet).
+    NODE_FILE,
+    NODE_DIR,
+    NODE_LINK,
+    NODE_OTHER
+
+} NODE_TYPE;
+
+/**
+ * @brief A hashed path.
+ *
+ */
+typedef struct merkle_node_s {
+    uint64_t key;                   // Hash of the path.
+    uint64_t name;                  // Hash of the last component of the path.
+    uint64_t value;                 // Content hash, or the sum of a directory's entries.
+    uint32_t pass;                  // The latest listing that found it.
+    uint8_t type;                   // NODE_TYPE.
+    bool listed;                    // A directory whose entries are in the tree.
+    bool recurse;                   // A directory whose subdirectories are listed too.
+    unsigned roots;                 // Rules with the path as their target.
+    struct merkle_node_s *parent;   // The directory holding it, or NULL for a target.
+    struct merkle_node_s *child;    // The first entry of a directory.
+    struct merkle_node_s *prev;     // The entry before it in its directory.
+    struct merkle_node_s *next;     // The entry after it in its directory.
+    char path[];
+
+} merkle_node_t;
+
+// Local constants.
+#define TABLE_MIN_CAPACITY 1024
+#define READ_CHUNK (64 * 1024)
+#define MIX_PRIME 0x9e3779b97f4a7c15ULL
+
+// Local data.
+static merkle_node_t **s_slots = NULL;
+static size_t s_capacity = 0;
+static size_t s_count = 0;
+static uint32_t s_pass = 0;
+static char s_path[PATH_MAX];
+static unsigned char s_buf[READ_CHUNK];
+
+// Forward declarations.
+static void list_dir(merkle_node_t *node, int fd, MERKLE_SCOPE scope);
+
+/**
+ * @brief Hash a string (64 bit FNV-1a).
+ *
+ * @param text The string.
+ * @return uint64_t The hash.
+ */
+static uint64_t hash_path(const char *text) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    while (*text) {
+        hash ^= (unsigned char)*text++;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/**
+ * @brief Spread the bits of a value (the splitmix64 finaliser).
+ *
+ * @param value The value.
+ * @return uint64_t The mixed value.
+ */
+static uint64_t mix(uint64_t value) {
+    value ^= value >> 30;
+    value *= 0xbf58476d1ce4e5b9ULL;
+    value ^= value >> 27;
+    value *= 0x94d049bb133111ebULL;
+    value ^= value >> 31;
+    return value;
+}
+
+/**
+ * @brief The hash of a node, from its kind and value.
+ *
+ * @param node The node.
+ * @return uint64_t The hash.
+ */
+static uint64_t digest(const merkle_node_t *node) {
+    return mix(node->value + node->type * MIX_PRIME);
+}
+
+/**
+ * @brief The part of a node in the value of its directory.
+ *
+ * @param node The node.
+ * @return uint64_t The name and hash of the node, mixed.
+ */
+static uint64_t contribution(const merkle_node_t *node) {
+    return mix(node->name ^ digest(node));
+}
+
+/**
+ * @brief Find the slot for a path.
+ *
+ * @param path The path.
+ * @param key The hash of the path.
+ * @return size_t The slot holding the path, or the empty slot where it belongs.
+ */
+static size_t find_slot(const char *path, uint64_t key) {
+    size_t mask = s_capacity - 1;
+    size_t slot = key & mask;
+    while (s_slots[slot] && (s_slots[slot]->key != key || strcmp(s_slots[slot]->path, path) != 0)) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+/**
+ * @brief Empty a slot, moving up the nodes that probed past it.
+ *
+ * @param slot The slot.
+ */
+static void remove_slot(size_t slot) {
+    size_t mask = s_capacity - 1;
+    size_t hole = slot;
+
+    s_slots[hole] = NULL;
+    for (size_t next = (hole + 1) & mask; s_slots[next]; next = (next + 1) & mask) {
+        size_t home = s_slots[next]->key & mask;
+        // The node stays unless its home lies cyclically after the hole.
+        bool stays = hole <= next ? (home > hole && home <= next) : (home > hole || home <= next);
+        if (!stays) {
+            s_slots[hole] = s_slots[next];
+            s_slots[next] = NULL;
+            hole = next;
+        }
+    }
+}
+
+/**
+ * @brief Double the table.
+ *
+ * @return bool False if memory is exhausted.
+ */
+static bool table_grow(void) {
+    size_t capacity = s_capacity ? s_capacity * 2 : TABLE_MIN_CAPACITY;
+    merkle_node_t **slots = calloc(capacity, sizeof(*slots));
+    merkle_node_t **old = s_slots;
+    size_t old_capacity = s_capacity;
+
+    if (slots == NULL) {
+        return false;
+    }
+    s_slots = slots;
+    s_capacity = capacity;
+    for (size_t slot = 0; slot < old_capacity; slot++) {
+        if (old[slot]) {
+            s_slots[find_slot(old[slot]->path, old[slot]->key)] = old[slot];
+        }
+    }
+    free(old);
+    return true;
+}
+
+/**
+ * @brief Find the node of a path.
+ *
+ * @param path The path.
+ * @return merkle_node_t* The node, or NULL if the path is not hashed.
+ */
+static merkle_node_t *find(const char *path) {
+    if (s_slots == NULL) {
+        return NULL;
+    }
+    return s_slots[find_slot(path, hash_path(path))];
+}
+
+/**
+ * @brief Add a node for a path, not yet in any directory.
+ *
+ * @param path The path.
+ * @return merkle_node_t* The node, or NULL if memory is exhausted.
+ */
+static merkle_node_t *node_new(const char *path) {
+    size_t len = strlen(path) + 1;
+    const char *base = strrchr(path, '/');
+    merkle_node_t *node;
+
+    if ((s_count + 1) * 2 > s_capacity && !table_grow()) {
+        return NULL;
+    }
+    node = calloc(1, sizeof(*node) + len);
+    if (node == NULL) {
+        return NULL;
+    }
+    memcpy(node->path, path, len);
+    node->key = hash_path(path);
+    node->name = hash_path(base && base[1] ? base + 1 : path);
+    s_slots[find_slot(path, node->key)] = node;
+    s_count++;
+    return node;
+}
+
+/**
+ * @brief Set the kind and value of a node, updating the directories above.
+ * @details Each directory takes out the old part of the entry below it
+ * and puts in the new one, and stops once its own hash is unchanged.
+ *
+ * @param node The node.
+ * @param type The kind of path.
+ * @param value The value.
+ */
+static void set_node(merkle_node_t *node, uint8_t type, uint64_t value) {
+    while (node->type != type || node->value != value) {
+        merkle_node_t *parent = node->parent;
+        uint64_t before = parent ? contribution(node) : 0;
+        node->type = type;
+        node->value = value;
+        if (parent == NULL) {
+            break;
+        }
+        value = parent->value - before + contribution(node);
+        type = parent->type;
+        node = parent;
+    }
+}
+
+/**
+ * @brief Put a node in a directory.
+ *
+ * @param dir The directory.
+ * @param node The node.
+ */
+static void attach(merkle_node_t *dir, merkle_node_t *node) {
+    node->parent = dir;
+    node->prev = NULL;
+    node->next = dir->child;
+    if (dir->child) {
+        dir->child->prev = node;
+    }
+    dir->child = node;
+    set_node(dir, dir->type, dir->value + contribution(node));
+}
+
+/**
+ * @brief Take a node out of its directory.
+ *
+ * @param node The node.
+ */
+static void detach(merkle_node_t *node) {
+    merkle_node_t *dir = node->parent;
+
+    if (dir == NULL) {
+        return;
+    }
+    if (node->prev) {
+        node->prev->next = node->next;
+    }
+    else {
+        dir->child = node->next;
+    }
+    if (node->next) {
+        node->next->prev = node->prev;
+    }
+    node->parent = NULL;
+    node->prev = NULL;
+    node->next = NULL;
+    set_node(dir, dir->type, dir->value - contribution(node));
+}
+
+/**
+ * @brief Release a node that is in no directory, with its entries.
+ * @details A target of another rule is kept, with its tree, as the
+ * root of its own.
+ *
+ * @param node The node.
+ */
+static void release(merkle_node_t *node) {
+    if (node->roots) {
+        return;
+    }
+    while (node->child) {
+        merkle_node_t *child = node->child;
+        node->child = child->next;
+        child->parent = NULL;
+        child->prev = NULL;
+        child->next = NULL;
+        release(child);
+    }
+    remove_slot(find_slot(node->path, node->key));
+    s_count--;
+    free(node);
+}
+
+/**
+ * @brief Empty a directory node.
+ * @details The caller sets the new value.
+ *
+ * @param node The node.
+ */
+static void clear(merkle_node_t *node) {
+    while (node->child) {
+        merkle_node_t *child = node->child;
+        node->child = child->next;
+        child->parent = NULL;
+        child->prev = NULL;
+        child->next = NULL;
+        release(child);
+    }
+    node->listed = false;
+}
+
+/**
+ * @brief Drop a path that has gone.
+ * @details A target stays in the table, as missing until it is back.
+ *
+ * @param node The node.
+ */
+static void drop(merkle_node_t *node) {
+    if (node->roots) {
+        clear(node);
+        set_node(node, NODE_MISSING, 0);
+        return;
+    }
+    detach(node);
+    release(node);
+}
+
+/**
+ * @brief Hash the content of a file.
+ * @details A file that cannot be read is stood in for by its size and
+ * modification time.
+ *
+ * @param dirfd The directory the name is relative to, or AT_FDCWD.
+ * @param name The file name.
+ * @param st The status of the file.
+ * @return uint64_t The hash.
+ */
+static uint64_t hash_file(int dirfd, const char *name, const struct stat *st) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    uint64_t total = 0;
+    size_t len;
+    int fd = openat(dirfd, name, O_RDONLY | O_NOCTTY | O_CLOEXEC);
+
+    if (fd < 0) {
+        return mix((uint64_t)st->st_size ^ mix((uint64_t)st->st_mtim.tv_sec * 1000000000 + (uint64_t)st->st_mtim.tv_nsec));
+    }
+    do {
+        ssize_t got = 0;
+        size_t i = 0;
+        len = 0;
+        // Whole chunks keep the words aligned from one chunk to the next.
+        while (len < sizeof(s_buf) && (got = read(fd, s_buf + len, sizeof(s_buf) - len)) > 0) {
+            len += (size_t)got;
+        }
+        for (; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t)) {
+            uint64_t word;
+            memcpy(&word, s_buf + i, sizeof(word));
+            hash = (hash ^ word) * MIX_PRIME;
+            hash ^= hash >> 32;
+        }
+        for (; i < len; i++) {
+            hash = (hash ^ s_buf[i]) * 0x100000001b3ULL;
+        }
+        total += len;
+    } while (len == sizeof(s_buf));
+    close(fd);
+    return mix(hash ^ total);
+}
+
+/**
+ * @brief The kind of path from its status.
+ *
+ * @param st The status.
+ * @return uint8_t The NODE_TYPE.
+ */
+static uint8_t node_type(const struct stat *st) {
+    if (S_ISREG(st->st_mode)) {
+        return NODE_FILE;
+    }
+    if (S_ISDIR(st->st_mode)) {
+        return NODE_DIR;
+    }
+    if (S_ISLNK(st->st_mode)) {
+        return NODE_LINK;
+    }
+    return NODE_OTHER;
+}
+
+/**
+ * @brief The value of a path that is not a directory.
+ *
+ * @param dirfd The directory the name is relative to, or AT_FDCWD.
+ * @param name The name.
+ * @param st The status of the path.
+ * @param type The kind of path.
+ * @return uint64_t The value.
+ */
+static uint64_t leaf_value(int dirfd, const char *name, const struct stat *st, uint8_t type) {
+    char target[PATH_MAX];
+    ssize_t len;
+
+    switch (type) {
+        case NODE_FILE:
+            return hash_file(dirfd, name, st);
+        case NODE_LINK:
+            len = readlinkat(dirfd, name, target, sizeof(target) - 1);
+            target[len > 0 ? len : 0] = '\0';
+            return hash_path(target);
+        case NODE_OTHER:
+            return mix((uint64_t)st->st_mode ^ ((uint64_t)st->st_rdev << 32));
+        default:
+            return 0;
+    }
+}
+
+/**
+ * @brief Bring a node up to date with its path.
+ * @details A directory is listed if it is a target or lies in a
+ * recursive one, the first time it is seen and then when asked again.
+ *
+ * @param node The node.
+ * @param dirfd The directory the name is relative to, or AT_FDCWD.
+ * @param name The name of the path.
+ * @param st The status of the path.
+ * @param scope How much of a directory to hash again.
+ * @param again Hash the content again, or list the directory again.
+ */
+static void visit(merkle_node_t *node, int dirfd, const char *name, const struct stat *st, MERKLE_SCOPE scope, bool again) {
+    uint8_t type = node_type(st);
+
+    if (type != node->type) {
+        clear(node);
+        set_node(node, type, type == NODE_DIR ? 0 : leaf_value(dirfd, name, st, type));
+    }
+    else if (type != NODE_DIR && again) {
+        set_node(node, type, leaf_value(dirfd, name, st, type));
+    }
+    if (type != NODE_DIR || (node->listed && !again)) {
+        return;
+    }
+    if (node->roots || (node->parent && node->parent->recurse)) {
+        int fd = openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd >= 0) {
+            list_dir(node, fd, scope);
+        }
+    }
+}
+
+/**
+ * @brief List a directory into its node.
+ * @details New entries are added and hashed, those not found are
+ * dropped. The content of the files already known is hashed again for
+ * MERKLE_DIR and MERKLE_TREE, and the subdirectories already known are
+ * listed again for MERKLE_TREE.
+ *
+ * @param node The node.
+ * @param fd The open directory, closed on return.
+ * @param scope How much to hash again.
+ */
+static void list_dir(merkle_node_t *node, int fd, MERKLE_SCOPE scope) {
+    DIR *dir = fdopendir(fd);
+    uint32_t pass = ++s_pass;
+    size_t len = strlen(node->path);
+    struct dirent *entry;
+
+    if (dir == NULL) {
+        close(fd);
+        return;
+    }
+    // The root directory has no name to join with a separator.
+    if (len == 1 && node->path[0] == '/') {
+        len = 0;
+    }
+    while ((entry = readdir(dir)) != NULL) {
+        struct stat st;
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        if (len + strlen(entry->d_name) + 2 > sizeof(s_path) ||
+            fstatat(dirfd(dir), entry->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+            continue;
+        }
+        // The buffer is shared with the listings below, so it is built afresh for each entry.
+        memcpy(s_path, node->path, len);
+        s_path[len] = '/';
+        strcpy(s_path + len + 1, entry->d_name);
+        merkle_node_t *child = find(s_path);
+        if (child == NULL && (child = node_new(s_path)) == NULL) {
+            continue;
+        }
+        if (child->parent == NULL) {
+            // A new entry, or a target of another rule found in this tree.
+            attach(node, child);
+        }
+        child->recurse |= node->recurse;
+        child->pass = pass;
+        bool again = S_ISDIR(st.st_mode) ? scope == MERKLE_TREE : scope != MERKLE_PATH;
+        visit(child, dirfd(dir), entry->d_name, &st, scope == MERKLE_TREE ? MERKLE_TREE : MERKLE_PATH, again);
+    }
+    closedir(dir);
+    for (merkle_node_t *child = node->child, *next; child; child = next) {
+        next = child->next;
+        if (child->pass != pass) {
+            drop(child);
+        }
+    }
+    node->listed = true;
+}
+
+/**
+ * @brief The status of the path of a node.
+ * @details A target is followed if it is a link, as its watch is.
+ *
+ * @param node The node.
+ * @param st Receives the status.
+ * @return bool True if the path exists.
+ */
+static bool stat_node(const merkle_node_t *node, struct stat *st) {
+    return (node->roots ? stat(node->path, st) : lstat(node->path, st)) == 0;
+}
+
+/**
+ * @brief Hash the tree of a rule's target.
+ * @details A target that does not exist hashes as missing until it is
+ * created. A target already in the tree of another rule shares its
+ * nodes; a recursive one lists all the way down from then on.
+ *
+ * @param root The target.
+ * @param recursive Hash the whole tree rather than the top directory.
+ * @return bool False if memory is exhausted.
+ */
+bool merkle_take(const char *root, bool recursive) {
+    merkle_node_t *node = find(root);
+    bool deeper = recursive && node && !node->recurse;
+    struct stat st;
+
+    if (node == NULL && (node = node_new(root)) == NULL) {
+        perror("Failed to allocate the tree hashes");
+        return false;
+    }
+    node->roots++;
+    node->recurse |= recursive;
+    if (stat_node(node, &st)) {
+        visit(node, AT_FDCWD, root, &st, deeper ? MERKLE_TREE : MERKLE_PATH, deeper);
+    }
+    return true;
+}
+
+/**
+ * @brief Stop hashing the tree of a rule's target.
+ * @details The nodes are kept while another rule's tree holds them.
+ *
+ * @param root The target.
+ */
+void merkle_drop(const char *root) {
+    merkle_node_t *node = find(root);
+
+    if (node == NULL || node->roots == 0) {
+        return;
+    }
+    if (--node->roots == 0 && node->parent == NULL) {
+        release(node);
+    }
+}
+
+/**
+ * @brief Find the nearest hashed directory above a path.
+ *
+ * @param path The path.
+ * @return merkle_node_t* The node, or NULL if none is hashed.
+ */
+static merkle_node_t *find_above(const char *path) {
+    size_t len = strlen(path);
+    merkle_node_t *node = NULL;
+
+    if (len >= sizeof(s_path)) {
+        return NULL;
+    }
+    memcpy(s_path, path, len + 1);
+    while (node == NULL && len > 1) {
+        while (len > 1 && s_path[len - 1] != '/') {
+            len--;
+        }
+        // Keep the separator only for the root directory.
+        s_path[len > 1 ? --len : len] = '\0';
+        node = find(s_path);
+    }
+    return node;
+}
+
+/**
+ * @brief Hash a changed path again.
+ * @details A path that has gone is dropped with its tree. A new one
+ * has the nearest hashed directory above it listed again, which adds
+ * the directories made on the way to it and takes in any entries
+ * removed or renamed there since.
+ *
+ * @param path The changed path.
+ * @param scope How much of a directory to hash again.
+ * @return bool False if the path lies outside the hashed trees, such
+ * as under a followed link, so the change could not be hashed.
+ */
+bool merkle_update(const char *path, MERKLE_SCOPE scope) {
+    merkle_node_t *node = find(path);
+    struct stat st;
+
+    if (node == NULL) {
+        merkle_node_t *dir = find_above(path);
+        if (dir == NULL || dir->type != NODE_DIR || !dir->listed) {
+            return false;
+        }
+        if (stat_node(dir, &st)) {
+            visit(dir, AT_FDCWD, dir->path, &st, MERKLE_PATH, true);
+        }
+        else {
+            drop(dir);
+        }
+        // Created and gone again, the tree is as it was.
+        return find(path) != NULL || lstat(path, &st) != 0;
+    }
+    if (!stat_node(node, &st)) {
+        drop(node);
+        return true;
+    }
+    visit(node, AT_FDCWD, path, &st, scope, true);
+    return true;
+}
+
+/**
+ * @brief Get the hash of a path.
+ *
+ * @param path The path.
+ * @param hash Receives the hash.
+ * @return bool False if the path is not hashed.
+ */
+bool merkle_hash(const char *path, uint64_t *hash) {
+    const merkle_node_t *node = find(path);
+
+    if (node == NULL) {
+        return false;
+    }
+    *hash = digest(node);
+    return true;
+}
+
+/**
+ * @brief Report the hashes of a path and its entries.
+ * @details Without a path, the targets are reported. A client can go
+ * down from a target to whichever entries differ from what it last
+ * saw. The hashes are those of when the rules were last due.
+ *
+ * @param fp The output stream.
+ * @param path The path, or NULL for the targets.
+ */
+void merkle_query(FILE *fp, const char *path) {
+    const merkle_node_t *node;
+
+    if (s_count == 0) {
+        fputs("error no tree is hashed, give a rule --if-tree-changed\n", fp);
+        return;
+    }
+    if (path == NULL) {
+        for (size_t slot = 0; slot < s_capacity; slot++) {
+            node = s_slots[slot];
+            if (node && node->roots) {
+                fprintf(fp, "%016" PRIx64 " %s\n", digest(node), node->path);
+            }
+        }
+        return;
+    }
+    node = find(path);
+    if (node == NULL) {
+        fprintf(fp, "error '%s' is not in a hashed tree\n", path);
+        return;
+    }
+    fprintf(fp, "%016" PRIx64 " %s\n", digest(node), node->path);
+    for (const merkle_node_t *child = node->child; child; child = child->next) {
+        fprintf(fp, "%016" PRIx64 " %s\n", digest(child), child->path);
+    }
+}
+
+/**
+ * @brief Get the number of hashed paths.
+ *
+ * @return unsigned long The number of nodes.
+ */
+unsigned long merkle_count(void) {
+    return s_count;
+}
+
+/**
+ * @brief Release the tree hashes.
+ *
+ */
+void merkle_free(void) {
+    for (size_t slot = 0; slot < s_capacity; slot++) {
+        free(s_slots[slot]);
+    }
+    free(s_slots);
+    s_slots = NULL;
+    s_capacity = 0;
+    s_count = 0;
+}
+
+/* End. */
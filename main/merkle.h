@@ -0,0 +1,44 @@
+/**
+ * @file merkle.h
+ * @author Mark Lehane (markdlehane@gmail.com)
+ * @brief Merkle tree interface.
+ * @details A hash of every watched tree that changes when, and only
+ * when, a file in it changes content or a path is added, removed or
+ * renamed, kept up to date path by path as the changes settle.
+ *
+ * @version 0.1
+ * @date 2025-12-31
+ *
+ * @copyright Copyright (c) 2025, Mark D Lehane.
+ *
+ */
+
+#ifndef MERKLE_H
+#define MERKLE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * @brief Enum used to say how much of a changed path to hash again.
+ *
+ */
+typedef enum merkle_scope_e {
+    MERKLE_PATH = 0,    // The path itself, and a directory's entries.
+    MERKLE_DIR,         // As well, the content of every file in a directory.
+    MERKLE_TREE         // Every path under the directory.
+
+} MERKLE_SCOPE;
+
+extern bool merkle_take(const char *root, bool recursive);
+extern void merkle_drop(const char *root);
+extern bool merkle_update(const char *path, MERKLE_SCOPE scope);
+extern bool merkle_hash(const char *path, uint64_t *hash);
+extern void merkle_query(FILE *fp, const char *path);
+extern unsigned long merkle_count(void);
+extern void merkle_free(void);
+
+#endif
+
+/* End. */
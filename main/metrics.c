@@ -0,0 +1,229 @@
+/**
+ * @file metrics.c
+ * @author Mark Lehane (markdlehane@gmail.com)
+ * @brief Prometheus metrics functions.
+ * @details This module writes the watch and rule statistics in the
+ * Prometheus text exposition format. The watcher rewrites the file on a
+ * timer (see stats_save, which renames a complete file into place) so
+ * the node_exporter textfile collector never reads half a file. Rules
+ * are labelled by name and target; times are in seconds, as Prometheus
+ * expects, and run times and latencies are histograms so quantiles can
+ * be taken across hosts.
+ *
+ * @version 0.1
+ * @date 2025-12-24
+ *
+ * @copyright Copyright (c) 2025, Mark D Lehane.
+ *
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "metrics.h"
+#include "stats.h"
+#include "rules.h"
+
+// Local constants.
+#define MAX_USER_WATCHES "/proc/sys/fs/inotify/max_user_watches"
+
+/**
+ * @brief Write a label value, escaped.
+ *
+ * @param fp The output stream.
+ * @param text The value.
+ */
+static void label_value(FILE *fp, const char *text) {
+    fputc('"', fp);
+    for (const char *c = text ? text : ""; *c; c++) {
+        if (*c == '\\' || *c == '"') {
+            fputc('\\', fp);
+            fputc(*c, fp);
+        }
+        else if (*c == '\n') {
+            fputs("\\n", fp);
+        }
+        else {
+            fputc(*c, fp);
+        }
+    }
+    fputc('"', fp);
+}
+
+/**
+ * @brief Write the labels of a rule.
+ *
+ * @param fp The output stream.
+ * @param rule The rule.
+ */
+static void rule_labels(FILE *fp, const watch_rule_t *rule) {
+    fputs("rule=", fp);
+    label_value(fp, rule->name);
+    fputs(",target=", fp);
+    label_value(fp, rule->target);
+}
+
+/**
+ * @brief Write the help and type lines of a metric.
+ *
+ * @param fp The output stream.
+ * @param name The metric name.
+ * @param type The metric type.
+ * @param help The description.
+ */
+static void metric_header(FILE *fp, const char *name, const char *type, const char *help) {
+    fprintf(fp, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+/**
+ * @brief Write one sample of a metric for each rule.
+ *
+ * @param fp The output stream.
+ * @param name The metric name.
+ * @param type The metric type.
+ * @param help The description.
+ * @param offset The offset of the unsigned long counter in the rule.
+ */
+static void rule_metric(FILE *fp, const char *name, const char *type, const char *help, size_t offset) {
+    metric_header(fp, name, type, help);
+    for (int index = 0; index < rule_count(); index++) {
+        const watch_rule_t *rule = rule_at(index);
+        if (rule->retired) {
+            continue;
+        }
+        fprintf(fp, "%s{", name);
+        rule_labels(fp, rule);
+        fprintf(fp, "} %lu\n", *(const unsigned long *)((const char *)rule + offset));
+    }
+}
+
+/**
+ * @brief Write a histogram for each rule.
+ *
+ * @param fp The output stream.
+ * @param name The metric name.
+ * @param help The description.
+ * @param offset The offset of the histogram in the rule.
+ */
+static void rule_histogram(FILE *fp, const char *name, const char *help, size_t offset) {
+    metric_header(fp, name, "histogram", help);
+    for (int index = 0; index < rule_count(); index++) {
+        const watch_rule_t *rule = rule_at(index);
+        const rule_histogram_t *histogram = (const rule_histogram_t *)((const char *)rule + offset);
+        unsigned long cumulative = 0;
+        if (rule->retired) {
+            continue;
+        }
+        for (int bucket = 0; bucket < RULE_BUCKETS; bucket++) {
+            cumulative += histogram->buckets[bucket];
+            fprintf(fp, "%s_bucket{", name);
+            rule_labels(fp, rule);
+            fprintf(fp, ",le=\"%g\"} %lu\n", (double)stats_bucket_bound(bucket) / 1e6, cumulative);
+        }
+        fprintf(fp, "%s_bucket{", name);
+        rule_labels(fp, rule);
+        fprintf(fp, ",le=\"+Inf\"} %lu\n%s_sum{", histogram->count, name);
+        rule_labels(fp, rule);
+        fprintf(fp, "} %.6f\n%s_count{", (double)histogram->sum / 1e6, name);
+        rule_labels(fp, rule);
+        fprintf(fp, "} %lu\n", histogram->count);
+    }
+}
+
+/**
+ * @brief Write the watch and rule statistics as Prometheus metrics.
+ *
+ * @param fp The output stream.
+ * @param now The engine time in microseconds.
+ * @param watches The number of active watches.
+ */
+void metrics_write(FILE *fp, uint64_t now, unsigned watches) {
+    stats_sample_queue();
+    const watch_stats_t *stats = stats_global();
+    uint64_t up = now > stats->started ? now - stats->started : 0;
+    unsigned long limit = 0;
+
+    FILE *proc = fopen(MAX_USER_WATCHES, "r");
+    if (proc) {
+        if (fscanf(proc, "%lu", &limit) != 1) {
+            limit = 0;
+        }
+        fclose(proc);
+    }
+
+    metric_header(fp, "watchf_up_seconds", "gauge", "Time since the watch started.");
+    fprintf(fp, "watchf_up_seconds %.3f\n", (double)up / 1e6);
+    metric_header(fp, "watchf_watches", "gauge", "Active inotify watches.");
+    fprintf(fp, "watchf_watches %u\n", watches);
+    if (limit) {
+        metric_header(fp, "watchf_max_user_watches", "gauge", "The kernel limit on inotify watches per user.");
+        fprintf(fp, "watchf_max_user_watches %lu\n", limit);
+    }
+    metric_header(fp, "watchf_queue_bytes", "gauge", "Bytes of events waiting in the kernel queue.");
+    fprintf(fp, "watchf_queue_bytes %lu\n", stats->queued);
+    metric_header(fp, "watchf_queue_bytes_max", "gauge", "Most bytes seen waiting in the kernel queue.");
+    fprintf(fp, "watchf_queue_bytes_max %lu\n", stats->queued_max);
+    metric_header(fp, "watchf_behind_total", "counter", "Times the watcher fell behind the kernel queue.");
+    fprintf(fp, "watchf_behind_total %lu\n", stats->behind);
+    metric_header(fp, "watchf_reads_total", "counter", "Buffers read from the kernel queue.");
+    fprintf(fp, "watchf_reads_total %lu\n", stats->reads);
+    metric_header(fp, "watchf_events_total", "counter", "Change events seen.");
+    fprintf(fp, "watchf_events_total %lu\n", stats->events);
+    metric_header(fp, "watchf_events_by_type_total", "counter", "Events read, by inotify event type.");
+    for (int bit = 0; bit < STATS_EVENT_TYPES; bit++) {
+        if (stats_event_type(bit)) {
+            fprintf(fp, "watchf_events_by_type_total{type=\"%s\"} %lu\n", stats_event_type(bit), stats->types[bit]);
+        }
+    }
+    metric_header(fp, "watchf_overflows_total", "counter", "Kernel queue overflows.");
+    fprintf(fp, "watchf_overflows_total %lu\n", stats->overflows);
+    metric_header(fp, "watchf_storms_total", "counter", "Change storms seen.");
+    fprintf(fp, "watchf_storms_total %lu\n", stats->storms);
+    metric_header(fp, "watchf_rescans_total", "counter", "Rescans that ended a change storm.");
+    fprintf(fp, "watchf_rescans_total %lu\n", stats->rescans);
+
+    rule_metric(fp, "watchf_rule_events_total", "counter", "Change events seen by the rule.",
+        offsetof(watch_rule_t, stats.events));
+    rule_metric(fp, "watchf_rule_runs_total", "counter", "Commands dispatched.",
+        offsetof(watch_rule_t, stats.runs));
+    rule_metric(fp, "watchf_rule_failures_total", "counter", "Runs that exited with a non-zero status.",
+        offsetof(watch_rule_t, stats.failures));
+    rule_metric(fp, "watchf_rule_suppressed_total", "counter", "Runs held back by the rate limit.",
+        offsetof(watch_rule_t, stats.suppressed));
+    rule_metric(fp, "watchf_rule_merged_total", "counter", "Change events merged into a held run.",
+        offsetof(watch_rule_t, stats.merged));
+    rule_metric(fp, "watchf_rule_deferred_total", "counter", "Runs deferred by host pressure.",
+        offsetof(watch_rule_t, stats.deferred));
+    rule_metric(fp, "watchf_rule_queued_total", "counter", "Due runs that waited for a job slot.",
+        offsetof(watch_rule_t, stats.queued));
+    rule_metric(fp, "watchf_rule_filtered_total", "counter", "Runs skipped as no change met the predicate.",
+        offsetof(watch_rule_t, stats.filtered));
+    rule_metric(fp, "watchf_rule_changes_coarsened_total", "counter",
+        "Change sets cut down to directories at the memory cap.", offsetof(watch_rule_t, stats.coarsened));
+    rule_metric(fp, "watchf_rule_changes_collapsed_total", "counter",
+        "Change sets given up for the whole target at the memory cap.", offsetof(watch_rule_t, stats.collapsed));
+    metric_header(fp, "watchf_rule_running", "gauge", "Commands running.");
+    for (int index = 0; index < rule_count(); index++) {
+        if (!rule_at(index)->retired) {
+            fputs("watchf_rule_running{", fp);
+            rule_labels(fp, rule_at(index));
+            fprintf(fp, "} %u\n", rule_at(index)->running);
+        }
+    }
+    metric_header(fp, "watchf_rule_pending", "gauge", "Change events waiting for a run.");
+    for (int index = 0; index < rule_count(); index++) {
+        if (!rule_at(index)->retired) {
+            fputs("watchf_rule_pending{", fp);
+            rule_labels(fp, rule_at(index));
+            fprintf(fp, "} %d\n", rule_at(index)->pending);
+        }
+    }
+    rule_histogram(fp, "watchf_rule_runtime_seconds", "Command run times.",
+        offsetof(watch_rule_t, stats.runtime));
+    rule_histogram(fp, "watchf_rule_latency_seconds", "Times from the first change of a run to its start.",
+        offsetof(watch_rule_t, stats.latency));
+    rule_histogram(fp, "watchf_rule_queue_seconds", "Times due runs waited for a job slot.",
+        offsetof(watch_rule_t, stats.queue));
+}
+
+/* End. */
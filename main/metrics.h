@@ -0,0 +1,25 @@
+/**
+ * @file metrics.h
+ * @author Mark Lehane (markdlehane@gmail.com)
+ * @brief Prometheus metrics interface.
+ * @details Writes the statistics in the Prometheus text format, for the
+ * node_exporter textfile collector.
+ *
+ * @version 0.1
+ * @date 2025-12-24
+ *
+ * @copyright Copyright (c) 2025, Mark D Lehane.
+ *
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+extern void metrics_write(FILE *fp, uint64_t now, unsigned watches);
+
+#endif
+
+/* End. */
@@ -0,0 +1,302 @@
+/**
+ * @file pathwait.c
+ * @author Mark Lehane (markdlehane@gmail.com)
+ * @brief Path arrival functions.
+ * @details inotify cannot watch a path that does not exist, so this
+ * module watches the nearest existing ancestor of the target instead.
+ * When the next component of the path appears as a directory the watch
+ * moves down to it; if the watched ancestor is removed the watch moves
+ * back up. The target has arrived when it is moved into place, when it
+ * is created as a directory, or when it is closed after being created
+ * for writing. The directory watch reports the close for its children,
+ * so there is no window between the create and a watch on the file.
+ *
+ * The kernel hands out one watch per inode, so the ancestor may already
+ * be watched for a rule, for the config file or for another wait. The
+ * wait adds its events to that watch, and when it moves on it puts back
+ * the mask of the others rather than removing a watch they still need.
+ *
+ * @version 0.1
+ * @date 2025-12-12
+ *
+ * @copyright Copyright (c) 2025, Mark D Lehane.
+ *
+ */
+
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <linux/limits.h>
+
+#include "pathwait.h"
+#include "journal.h"
+#include "tree.h"
+#include "config.h"
+
+/**
+ * @brief A wait for a path to arrive.
+ *
+ */
+struct pathwait_s {
+    int inotify_instance;
+    int watch;                      // The ancestor watch, or -1.
+    bool verbose;
+    bool arrived;
+    char target[PATH_MAX];
+    char ancestor[PATH_MAX];
+    char next[NAME_MAX + 1];        // The next component below the ancestor.
+    bool next_is_final;
+    dev_t dev;                      // The watched ancestor, to put its mask back.
+    ino_t ino;
+    pathwait_t *link;               // The next wait.
+
+};
+
+// Local constants.
+#define ANCESTOR_EVENTS (IN_CREATE | IN_MOVED_TO | IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF)
+#define ANCESTOR_MASK (ANCESTOR_EVENTS | IN_ONLYDIR | IN_MASK_ADD)
+#define DESCEND_LIMIT 64
+
+// Local data.
+static pathwait_t *s_waits = NULL;
+
+/**
+ * @brief Find the nearest existing ancestor directory of the target.
+ * @details Also works out the name of the next path component below it.
+ *
+ * @param wait The path wait.
+ * @return bool True if the target itself exists.
+ */
+static bool find_ancestor(pathwait_t *wait) {
+    struct stat st;
+    const char *rest;
+
+    if (stat(wait->target, &st) == 0) {
+        return true;
+    }
+    snprintf(wait->ancestor, sizeof(wait->ancestor), "%s", wait->target);
+    for (;;) {
+        char *slash = strrchr(wait->ancestor, '/');
+        if (slash == NULL) {
+            // A relative path with no directory part lives in the current directory.
+            strcpy(wait->ancestor, ".");
+            rest = wait->target;
+            break;
+        }
+        if (slash == wait->ancestor) {
+            wait->ancestor[1] = '\0';
+        }
+        else {
+            *slash = '\0';
+        }
+        if (stat(wait->ancestor, &st) == 0 && S_ISDIR(st.st_mode)) {
+            rest = wait->target + strlen(wait->ancestor);
+            while (*rest == '/') {
+                rest++;
+            }
+            break;
+        }
+        if (slash == wait->ancestor) {
+            return false;
+        }
+    }
+
+    // The next component is everything up to the following separator.
+    size_t len = strcspn(rest, "/");
+    if (len > NAME_MAX) {
+        len = NAME_MAX;
+    }
+    memcpy(wait->next, rest, len);
+    wait->next[len] = '\0';
+    wait->next_is_final = rest[len] == '\0' || rest[len + strspn(rest + len, "/")] == '\0';
+    return false;
+}
+
+/**
+ * @brief Let go of the ancestor watch.
+ * @details A watch shared with the rules, the config file or another
+ * wait is kept with their events only. When the ancestor has been
+ * removed or moved its path no longer names the watched inode, so the
+ * mask cannot be put back; the kernel ends a removed watch itself.
+ *
+ * @param wait The path wait.
+ */
+static void release(pathwait_t *wait) {
+    uint32_t mask = tree_mask(wait->watch) | config_mask(wait->watch);
+    struct stat st;
+
+    for (const pathwait_t *other = s_waits; other; other = other->link) {
+        if (other != wait && other->watch == wait->watch) {
+            mask |= ANCESTOR_EVENTS;
+        }
+    }
+    if (mask == 0) {
+        inotify_rm_watch(wait->inotify_instance, wait->watch);
+    }
+    else if (stat(wait->ancestor, &st) == 0 && st.st_dev == wait->dev && st.st_ino == wait->ino) {
+        inotify_add_watch(wait->inotify_instance, wait->ancestor, mask);
+    }
+    wait->watch = -1;
+}
+
+/**
+ * @brief Move the watch to the nearest existing ancestor.
+ * @details Directories can appear faster than their events are read,
+ * so after each move the next component is checked again.
+ *
+ * @param wait The path wait.
+ */
+static void descend(pathwait_t *wait) {
+    for (int tries = 0; tries < DESCEND_LIMIT && !wait->arrived; tries++) {
+        if (wait->watch != -1) {
+            release(wait);
+        }
+        if (find_ancestor(wait)) {
+            wait->arrived = true;
+            break;
+        }
+        wait->watch = inotify_add_watch(wait->inotify_instance, wait->ancestor, ANCESTOR_MASK);
+        if (wait->watch == -1) {
+            // The ancestor went away between the stat and the watch.
+            continue;
+        }
+        struct stat st;
+        if (stat(wait->ancestor, &st) == 0) {
+            wait->dev = st.st_dev;
+            wait->ino = st.st_ino;
+        }
+        // The arrival is recorded in its own right; a watch shared with the rules keeps theirs.
+        if (tree_path(wait->watch) == NULL) {
+            journal_watch(wait->watch, wait->ancestor, 0);
+        }
+        if (wait->verbose) {
+            printf("Waiting for '%s' in '%s' - %d\n", wait->next, wait->ancestor, wait->watch);
+        }
+
+        // Check for the next component appearing before the watch was in place.
+        char path[PATH_MAX];
+        if (snprintf(path, sizeof(path), "%s/%s", wait->ancestor, wait->next) >= (int)sizeof(path) || stat(path, &st) != 0) {
+            break;
+        }
+        if (wait->next_is_final) {
+            wait->arrived = true;
+        }
+    }
+}
+
+/**
+ * @brief Start a wait for a path to arrive.
+ *
+ * @param inf The inotify handle.
+ * @param target The path to wait for.
+ * @param verbose True if verbose output should be made.
+ * @return pathwait_t* The wait, or NULL if no ancestor of the path can be watched.
+ */
+pathwait_t *pathwait_init(int inf, const char *target, bool verbose) {
+    pathwait_t *wait = calloc(1, sizeof(*wait));
+    if (wait == NULL) {
+        perror("Failed to allocate a path wait");
+        return NULL;
+    }
+    wait->inotify_instance = inf;
+    wait->watch = -1;
+    wait->verbose = verbose;
+    snprintf(wait->target, sizeof(wait->target), "%s", target);
+    descend(wait);
+    if (!wait->arrived && wait->watch == -1) {
+        perror("Failed to watch for the target to arrive");
+        free(wait);
+        return NULL;
+    }
+    wait->link = s_waits;
+    s_waits = wait;
+    return wait;
+}
+
+/**
+ * @brief Check if the target has arrived.
+ *
+ * @param wait The path wait.
+ * @return bool True once the target exists and has been written.
+ */
+bool pathwait_arrived(const pathwait_t *wait) {
+    return wait->arrived;
+}
+
+/**
+ * @brief Follow the target down its path from a buffer of inotify events.
+ *
+ * @param wait The path wait.
+ * @param buf The raw events buffer.
+ * @param len The number of bytes in the buffer.
+ * @return bool True if the target has arrived.
+ */
+bool pathwait_events(pathwait_t *wait, const char *buf, ssize_t len) {
+    ssize_t i = 0;
+
+    while (i < len && !wait->arrived) {
+        const struct inotify_event *event = (const struct inotify_event *)&buf[i];
+        i += sizeof(struct inotify_event) + event->len;
+        if (event->wd != wait->watch) {
+            continue;
+        }
+        if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+            // The ancestor went, move back up the path.
+            if (event->mask & IN_IGNORED) {
+                wait->watch = -1;
+            }
+            descend(wait);
+        }
+        else if (event->len && strcmp(event->name, wait->next) == 0) {
+            if (!wait->next_is_final) {
+                if ((event->mask & IN_ISDIR) && (event->mask & (IN_CREATE | IN_MOVED_TO))) {
+                    descend(wait);
+                }
+            }
+            else if ((event->mask & (IN_MOVED_TO | IN_CLOSE_WRITE)) ||
+                     ((event->mask & IN_CREATE) && (event->mask & IN_ISDIR))) {
+                wait->arrived = true;
+            }
+        }
+    }
+    return wait->arrived;
+}
+
+/**
+ * @brief Return the events the waits ask for on a watch descriptor.
+ *
+ * @param wd The watch descriptor.
+ * @return uint32_t The inotify mask, 0 if no wait is watching an ancestor with it.
+ */
+uint32_t pathwait_mask(int wd) {
+    for (const pathwait_t *wait = s_waits; wait; wait = wait->link) {
+        if (wd != -1 && wait->watch == wd) {
+            return ANCESTOR_EVENTS;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Let go of the ancestor watch and release the wait.
+ *
+ * @param wait The path wait, may be NULL.
+ */
+void pathwait_shutdown(pathwait_t *wait) {
+    if (wait) {
+        for (pathwait_t **link = &s_waits; *link; link = &(*link)->link) {
+            if (*link == wait) {
+                *link = wait->link;
+                break;
+            }
+        }
+        if (wait->watch != -1) {
+            release(wait);
+        }
+        free(wait);
+    }
+}
+
+/* End. */
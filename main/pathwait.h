@@ -0,0 +1,36 @@
+/**
+ * @file pathwait.h
+ * @author Mark Lehane (markdlehane@gmail.com)
+ * @brief Path arrival interface.
+ * @details Waits for a path that does not exist yet by watching its
+ * nearest existing ancestor.
+ *
+ * @version 0.1
+ * @date 2025-12-12
+ *
+ * @copyright Copyright (c) 2025, Mark D Lehane.
+ *
+ */
+
+#ifndef PATHWAIT_H
+#define PATHWAIT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * @brief A wait for a path to arrive (opaque).
+ *
+ */
+typedef struct pathwait_s pathwait_t;
+
+extern pathwait_t *pathwait_init(int inf, const char *target, bool verbose);
+extern bool pathwait_arrived(const pathwait_t *wait);
+extern bool pathwait_events(pathwait_t *wait, const char *buf, ssize_t len);
+extern uint32_t pathwait_mask(int wd);
+extern void pathwait_shutdown(pathwait_t *wait);
+
+#endif
+
+/* End. */
@@ -0,0 +1,399 @@
+/**
+ * @file placement.c
+ * @author Mark Lehane (markdlehane@gmail.com)
+ * @brief Run placement functions.
+ * @details A heavy command run at the priority and on the CPUs of the
+ * watcher competes with the event reader. This module sets up where
+ * the commands of each rule run and applies it in the child between
+ * the fork and the exec: the nice value, the I/O priority, the CPU
+ * affinity and, given a delegated cgroup v2 directory, a child cgroup
+ * per rule holding its cpu.max and memory.max limits. The child moves
+ * itself into the cgroup of its rule, so the limits cover the whole
+ * command. When the watcher is pinned to a CPU, commands without CPUs
+ * of their own run on the rest, leaving that CPU to the watcher.
+ *
+ * @version 0.1
+ * @date 2025-12-20
+ *
+ * @copyright Copyright (c) 2025, Mark D Lehane.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/stat.h>
+#include <sched.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <linux/limits.h>
+
+#include "placement.h"
+
+/**
+ * @brief Where the commands of a rule run.
+ *
+ */
+typedef struct place_s {
+    bool affinity;              // The CPU set is applied.
+    cpu_set_t cpus;             // The CPUs the command may run on.
+    int procs;                  // The cgroup.procs file of the rule cgroup, or -1.
+    char cgroup[PATH_MAX];      // The rule cgroup directory, or empty.
+
+} place_t;
+
+// Local constants.
+#define IOPRIO_WHO_PROCESS 1
+
+// Local data.
+static place_t s_places[WATCH_MAX_RULES];
+static cpu_set_t s_run_cpus;
+static bool s_pinned = false;
+static int s_count = 0;
+static const char *s_cgroup = NULL;
+static bool s_delegated = false;
+
+/**
+ * @brief Parse a CPU list.
+ * @details The form is a comma separated list of CPUs and ranges, for
+ * example 0,2-3.
+ *
+ * @param list The text.
+ * @param cpus Receives the CPUs.
+ * @return bool True if the list is valid.
+ */
+static bool parse_cpus(const char *list, cpu_set_t *cpus) {
+    const char *text = list;
+
+    CPU_ZERO(cpus);
+    while (*text) {
+        char *end;
+        unsigned long first = strtoul(text, &end, 10);
+        unsigned long last = first;
+        if (end == text) {
+            break;
+        }
+        if (*end == '-') {
+            text = end + 1;
+            last = strtoul(text, &end, 10);
+            if (end == text) {
+                break;
+            }
+        }
+        if (last < first || last >= CPU_SETSIZE) {
+            break;
+        }
+        for (unsigned long cpu = first; cpu <= last; cpu++) {
+            CPU_SET(cpu, cpus);
+        }
+        if (*end == '\0') {
+            return true;
+        }
+        if (*end != ',') {
+            break;
+        }
+        text = end + 1;
+    }
+    printf("Invalid CPU list '%s', expected CPU[-CPU][,...]\n", list);
+    return false;
+}
+
+/**
+ * @brief Write a value to a cgroup interface file.
+ *
+ * @param dir The cgroup directory.
+ * @param name The interface file name.
+ * @param value The value.
+ * @return bool True if the value was written.
+ */
+static bool cgroup_write(const char *dir, const char *name, const char *value) {
+    char path[PATH_MAX];
+
+    if (snprintf(path, sizeof(path), "%s/%s", dir, name) >= (int)sizeof(path)) {
+        fprintf(stderr, "Cgroup path too long '%s'\n", dir);
+        return false;
+    }
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd == -1) {
+        fprintf(stderr, "Unable to open '%s': %s\n", path, strerror(errno));
+        return false;
+    }
+    ssize_t len = (ssize_t)strlen(value);
+    bool ok = write(fd, value, (size_t)len) == len;
+    if (!ok) {
+        fprintf(stderr, "Unable to write '%s' to '%s': %s\n", value, path, strerror(errno));
+    }
+    close(fd);
+    return ok;
+}
+
+/**
+ * @brief Create the cgroup of a rule and set its limits.
+ *
+ * @param root The delegated cgroup directory.
+ * @param rule The rule.
+ * @param place The placement of the rule.
+ * @param verbose True if verbose output should be made.
+ * @return bool True if the cgroup is ready.
+ */
+static bool cgroup_create(const char *root, const watch_rule_t *rule, place_t *place, bool verbose) {
+    const rule_place_t *config = &rule->place;
+    char value[64];
+
+    if (snprintf(place->cgroup, sizeof(place->cgroup), "%s/rule-%d", root, rule->index + 1) >= (int)sizeof(place->cgroup)) {
+        fprintf(stderr, "Cgroup path too long '%s'\n", root);
+        place->cgroup[0] = '\0';
+        return false;
+    }
+    if (mkdir(place->cgroup, 0755) == -1 && errno != EEXIST) {
+        fprintf(stderr, "Unable to create cgroup '%s': %s\n", place->cgroup, strerror(errno));
+        place->cgroup[0] = '\0';
+        return false;
+    }
+    // With the controllers handed down, a rule without a limit is set back to none.
+    if (config->cpu_quota || s_delegated) {
+        if (config->cpu_quota) {
+            snprintf(value, sizeof(value), "%u %u", config->cpu_quota, config->cpu_period);
+        }
+        else {
+            snprintf(value, sizeof(value), "max");
+        }
+        if (!cgroup_write(place->cgroup, "cpu.max", value)) {
+            return false;
+        }
+    }
+    if (config->memory_max || s_delegated) {
+        if (config->memory_max) {
+            snprintf(value, sizeof(value), "%llu", config->memory_max);
+        }
+        else {
+            snprintf(value, sizeof(value), "max");
+        }
+        if (!cgroup_write(place->cgroup, "memory.max", value)) {
+            return false;
+        }
+    }
+    char procs[PATH_MAX];
+    if (snprintf(procs, sizeof(procs), "%s/cgroup.procs", place->cgroup) >= (int)sizeof(procs)) {
+        fprintf(stderr, "Cgroup path too long '%s'\n", place->cgroup);
+        return false;
+    }
+    place->procs = open(procs, O_WRONLY | O_CLOEXEC);
+    if (place->procs == -1) {
+        fprintf(stderr, "Unable to open '%s': %s\n", procs, strerror(errno));
+        return false;
+    }
+    if (verbose) {
+        printf("Rule %s runs in cgroup '%s'\n", rule->name, place->cgroup);
+    }
+    return true;
+}
+
+/**
+ * @brief Set the CPUs a rule's commands run on.
+ *
+ * @param rule The rule.
+ * @param place The placement of the rule.
+ * @return bool True if the CPU list is valid.
+ */
+static bool place_affinity(const watch_rule_t *rule, place_t *place) {
+    place->affinity = false;
+    if (rule->place.cpus) {
+        if (!parse_cpus(rule->place.cpus, &place->cpus)) {
+            return false;
+        }
+        place->affinity = true;
+    }
+    else if (s_pinned) {
+        place->cpus = s_run_cpus;
+        place->affinity = true;
+    }
+    return true;
+}
+
+/**
+ * @brief Set up the placement of every rule and pin the watcher.
+ * @details The open cgroup.procs files are inherited by each child but
+ * closed by its exec.
+ *
+ * @param pin The CPU reserved for the watcher, or -1.
+ * @param cgroup The delegated cgroup v2 directory, or NULL.
+ * @param verbose True if verbose output should be made.
+ * @return bool True if every rule can be placed.
+ */
+bool placement_init(int pin, const char *cgroup, bool verbose) {
+    s_count = rule_count();
+    for (int index = 0; index < s_count; index++) {
+        s_places[index].affinity = false;
+        s_places[index].procs = -1;
+        s_places[index].cgroup[0] = '\0';
+    }
+
+    if (sched_getaffinity(0, sizeof(s_run_cpus), &s_run_cpus) == -1) {
+        perror("Unable to read the CPU affinity");
+        return false;
+    }
+    if (pin >= 0) {
+        cpu_set_t watcher;
+        if (pin >= CPU_SETSIZE || !CPU_ISSET(pin, &s_run_cpus)) {
+            fprintf(stderr, "CPU %d is not available to pin to\n", pin);
+            return false;
+        }
+        CPU_ZERO(&watcher);
+        CPU_SET(pin, &watcher);
+        if (sched_setaffinity(0, sizeof(watcher), &watcher) == -1) {
+            perror("Unable to pin the watcher");
+            return false;
+        }
+        // Commands keep off the watcher's CPU, unless it is the only one.
+        if (CPU_COUNT(&s_run_cpus) > 1) {
+            CPU_CLR(pin, &s_run_cpus);
+        }
+        s_pinned = true;
+        if (verbose) {
+            printf("Watcher pinned to CPU %d, commands run on %d CPUs\n", pin, CPU_COUNT(&s_run_cpus));
+        }
+    }
+
+    bool limits = false;
+    for (int index = 0; index < s_count; index++) {
+        const watch_rule_t *rule = rule_at(index);
+        if (!place_affinity(rule, &s_places[index])) {
+            return false;
+        }
+        limits |= rule->place.cpu_quota || rule->place.memory_max;
+    }
+
+    if (cgroup == NULL) {
+        if (limits) {
+            fputs("--cpu-max and --memory-max need a --cgroup directory\n", stderr);
+            return false;
+        }
+        return true;
+    }
+    // Hand the controllers down to the rule cgroups.
+    s_cgroup = cgroup;
+    if (limits && !cgroup_write(cgroup, "cgroup.subtree_control", "+cpu +memory")) {
+        return false;
+    }
+    s_delegated = limits;
+    for (int index = 0; index < s_count; index++) {
+        if (!cgroup_create(cgroup, rule_at(index), &s_places[index], verbose)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Check that a rule can be placed.
+ *
+ * @param rule The rule.
+ * @param cgroup The delegated cgroup v2 directory, or NULL.
+ * @return bool True if its CPUs are valid and any limits have a cgroup.
+ */
+bool placement_check(const watch_rule_t *rule, const char *cgroup) {
+    cpu_set_t cpus;
+
+    if (rule->place.cpus && !parse_cpus(rule->place.cpus, &cpus)) {
+        return false;
+    }
+    if ((rule->place.cpu_quota || rule->place.memory_max) && cgroup == NULL) {
+        fputs("--cpu-max and --memory-max need a --cgroup directory\n", stderr);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Place a rule added or changed by a reload.
+ * @details The rule's cgroup is kept, with its limits set afresh, so
+ * commands still running in it are undisturbed.
+ *
+ * @param rule The rule.
+ * @param verbose True if verbose output should be made.
+ * @return bool True if the rule is placed.
+ */
+bool placement_update(const watch_rule_t *rule, bool verbose) {
+    place_t *place = &s_places[rule->index];
+
+    while (s_count <= rule->index) {
+        s_places[s_count].affinity = false;
+        s_places[s_count].procs = -1;
+        s_places[s_count].cgroup[0] = '\0';
+        s_count++;
+    }
+    if (place->procs != -1) {
+        close(place->procs);
+        place->procs = -1;
+    }
+    if (!place_affinity(rule, place)) {
+        return false;
+    }
+    if (s_cgroup == NULL) {
+        return true;
+    }
+    if (!s_delegated && (rule->place.cpu_quota || rule->place.memory_max)) {
+        if (!cgroup_write(s_cgroup, "cgroup.subtree_control", "+cpu +memory")) {
+            return false;
+        }
+        s_delegated = true;
+    }
+    return cgroup_create(s_cgroup, rule, place, verbose);
+}
+
+/**
+ * @brief Apply the placement of a rule to the calling process.
+ * @details Called in the child before it runs the command. A placement
+ * that cannot be applied is reported and the command runs anyway.
+ *
+ * @param rule The rule.
+ */
+void placement_apply(const watch_rule_t *rule) {
+    const rule_place_t *config = &rule->place;
+    const place_t *place = rule->index < s_count ? &s_places[rule->index] : NULL;
+
+    if (place && place->procs != -1 && write(place->procs, "0", 1) != 1) {
+        fprintf(stderr, "Unable to join cgroup '%s': %s\n", place->cgroup, strerror(errno));
+    }
+    if (config->niced && setpriority(PRIO_PROCESS, 0, config->nice) == -1) {
+        perror("Unable to set the nice value");
+    }
+    if (config->ioprio && syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, config->ioprio) == -1) {
+        perror("Unable to set the I/O priority");
+    }
+    if (place && place->affinity && sched_setaffinity(0, sizeof(place->cpus), &place->cpus) == -1) {
+        perror("Unable to set the CPU affinity");
+    }
+}
+
+/**
+ * @brief Release the rule cgroups.
+ * @details A cgroup still holding a process cannot be removed and is
+ * left in place.
+ *
+ */
+void placement_shutdown(void) {
+    for (int index = 0; index < s_count; index++) {
+        place_t *place = &s_places[index];
+        if (place->procs != -1) {
+            close(place->procs);
+            place->procs = -1;
+        }
+        if (place->cgroup[0]) {
+            rmdir(place->cgroup);
+            place->cgroup[0] = '\0';
+        }
+    }
+    s_count = 0;
+    s_pinned = false;
+    s_cgroup = NULL;
+    s_delegated = false;
+}
+
+/* End. */
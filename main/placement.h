@@ -0,0 +1,31 @@
+/**
+ * @file placement.h
+ * @author Mark Lehane (markdlehane@gmail.com)
+ * @brief Run placement interface.
+ * @details Runs the commands of each rule at its own priority, on its
+ * own CPUs and within its own cgroup limits, and keeps a CPU for the
+ * watcher.
+ *
+ * @version 0.1
+ * @date 2025-12-20
+ *
+ * @copyright Copyright (c) 2025, Mark D Lehane.
+ *
+ */
+
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include <stdbool.h>
+
+#include "rules.h"
+
+extern bool placement_init(int pin, const char *cgroup, bool verbose);
+extern bool placement_check(const watch_rule_t *rule, const char *cgroup);
+extern bool placement_update(const watch_rule_t *rule, bool verbose);
+extern void placement_apply(const watch_rule_t *rule);
+extern void placement_shutdown(void);
+
+#endif
+
+/* End. */
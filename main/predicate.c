@@ -0,0 +1,462 @@
+/**
+ * @file predicate.c
+ * @author Mark Lehane (markdlehane@gmail.com)
+ * @brief Trigger predicate functions.
+ * @details Many commands begin with a test of the changed file (is it
+ * big enough, does it hold a marker, did its header change) and exit
+ * early, so most runs would start a process to do nothing. This module
+ * makes those tests in the watcher before a run is started: a size
+ * range, a pattern in the content, a marker line and a byte range that
+ * must have changed since it was last seen.
+ *
+ * The content is mapped rather than read. Literal patterns and marker
+ * lines are found with memmem, which the C library vectorises, and
+ * only other patterns go to the regular expression matcher. A file cut
+ * short while it is being scanned would fault on the mapping, so the
+ * scan recovers from SIGBUS and treats the file as not passing; its
+ * next change is tested again.
+ *
+ * @version 0.1
+ * @date 2025-12-26
+ *
+ * @copyright Copyright (c) 2025, Mark D Lehane.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <setjmp.h>
+#include <signal.h>
+
+#include "predicate.h"
+#include "rules.h"
+
+/**
+ * @brief A path and the hash of its byte range.
+ *
+ */
+typedef struct seen_entry_s {
+    uint64_t path;              // Hash of the path, 0 for an empty slot.
+    uint64_t content;           // Hash of the range.
+
+} seen_entry_t;
+
+/**
+ * @brief The last seen content hashes of a byte range.
+ *
+ */
+struct predicate_seen_s {
+    seen_entry_t *entries;
+    size_t capacity;
+    size_t used;
+
+};
+
+// Local constants.
+#define SEEN_MIN_CAPACITY 64
+#define PATTERN_SPECIALS ".[]()*+?{}|^$\\"
+
+// Local data.
+static sigjmp_buf s_fault;
+static volatile sig_atomic_t s_scanning = 0;
+static bool s_fault_handled = false;
+
+/**
+ * @brief Recover from a fault in a mapped file being scanned.
+ *
+ * @param sig The signal.
+ */
+static void on_fault(int sig) {
+    if (s_scanning) {
+        siglongjmp(s_fault, 1);
+    }
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+/**
+ * @brief Parse a byte count.
+ * @details A number with an optional k, m or g unit.
+ *
+ * @param value The text.
+ * @param end Receives the end of the count.
+ * @param bytes Receives the count.
+ * @return bool True if a count was found.
+ */
+static bool parse_bytes(const char *value, const char **end, uint64_t *bytes) {
+    char *stop;
+    const char *units = "kmg";
+
+    if (*value < '0' || *value > '9') {
+        return false;
+    }
+    *bytes = strtoull(value, &stop, 10);
+    const char *unit = *stop ? strchr(units, *stop | 0x20) : NULL;
+    if (unit) {
+        *bytes <<= 10 * (unit - units + 1);
+        stop++;
+    }
+    *end = stop;
+    return true;
+}
+
+/**
+ * @brief Parse a pair of byte counts, either of which may be left out.
+ *
+ * @param value The text, FIRST[:SECOND].
+ * @param first Receives the first count, unchanged if left out.
+ * @param second Receives the second count, unchanged if left out.
+ * @return bool True if the pair is valid.
+ */
+static bool parse_pair(const char *value, uint64_t *first, uint64_t *second) {
+    const char *end = value;
+
+    if (*end != ':' && !parse_bytes(end, &end, first)) {
+        return false;
+    }
+    if (*end == ':') {
+        end++;
+        if (*end && !parse_bytes(end, &end, second)) {
+            return false;
+        }
+    }
+    return *end == '\0' && end != value;
+}
+
+/**
+ * @brief Set a pattern the content must match.
+ *
+ * @param pred The predicate.
+ * @param value The extended regular expression.
+ * @return bool True if the pattern is valid.
+ */
+static bool set_match(predicate_t *pred, const char *value) {
+    char error[128];
+    regex_t regex;
+    bool literal = strpbrk(value, PATTERN_SPECIALS) == NULL;
+
+    if (*value == '\0') {
+        rule_error("--if-match needs a pattern\n");
+        return false;
+    }
+    if (!literal) {
+        int status = regcomp(&regex, value, REG_EXTENDED | REG_NOSUB | REG_NEWLINE);
+        if (status) {
+            regerror(status, &regex, error, sizeof(error));
+            rule_error("Invalid pattern '%s': %s\n", value, error);
+            return false;
+        }
+    }
+    char *match = strdup(value);
+    if (match == NULL) {
+        perror("Failed to set option");
+        if (!literal) {
+            regfree(&regex);
+        }
+        return false;
+    }
+    if (pred->match && !pred->literal) {
+        regfree(&pred->regex);
+    }
+    free(pred->match);
+    pred->match = match;
+    pred->literal = literal;
+    if (!literal) {
+        pred->regex = regex;
+    }
+    return true;
+}
+
+/**
+ * @brief Set a predicate option by name.
+ *
+ * @param pred The predicate.
+ * @param name The option name, as its long command line form.
+ * @param value The option value.
+ * @return bool True if the option and its value are valid.
+ */
+bool predicate_option(predicate_t *pred, const char *name, const char *value) {
+    if (strcmp(name, "if-size") == 0) {
+        pred->size_min = 0;
+        pred->size_max = UINT64_MAX;
+        if (!parse_pair(value, &pred->size_min, &pred->size_max) || pred->size_min > pred->size_max) {
+            rule_error("Invalid size range '%s', expected MIN[:MAX] or :MAX bytes with an optional k, m or g\n", value);
+            return false;
+        }
+        pred->sized = true;
+    }
+    else if (strcmp(name, "if-match") == 0) {
+        if (!set_match(pred, value)) {
+            return false;
+        }
+    }
+    else if (strcmp(name, "if-line") == 0) {
+        char *line = *value && strchr(value, '\n') == NULL ? strdup(value) : NULL;
+        if (line == NULL) {
+            rule_error("Invalid marker line '%s'\n", value);
+            return false;
+        }
+        free(pred->line);
+        pred->line = line;
+    }
+    else if (strcmp(name, "if-range") == 0) {
+        pred->range_offset = 0;
+        pred->range_length = 0;
+        if (!parse_pair(value, &pred->range_offset, &pred->range_length)) {
+            rule_error("Invalid byte range '%s', expected OFFSET[:LENGTH] bytes with an optional k, m or g\n", value);
+            return false;
+        }
+        pred->ranged = true;
+    }
+    else {
+        rule_error("Unknown rule option '%s'\n", name);
+        return false;
+    }
+    if (!s_fault_handled && (pred->match || pred->line || pred->ranged)) {
+        struct sigaction action = { .sa_handler = on_fault };
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGBUS, &action, NULL);
+        s_fault_handled = true;
+    }
+    pred->active = true;
+    return true;
+}
+
+/**
+ * @brief Hash some bytes.
+ *
+ * @param data The bytes.
+ * @param len The number of bytes.
+ * @return uint64_t The hash, never 0.
+ */
+static uint64_t hash_bytes(const unsigned char *data, size_t len) {
+    uint64_t hash = 0xcbf29ce484222325ULL ^ len;
+    size_t i = 0;
+
+    for (; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ word) * 0x9e3779b97f4a7c15ULL;
+        hash ^= hash >> 32;
+    }
+    for (; i < len; i++) {
+        hash = (hash ^ data[i]) * 0x100000001b3ULL;
+    }
+    return hash ? hash : 1;
+}
+
+/**
+ * @brief Find the entry of a path in the seen hashes.
+ *
+ * @param seen The seen hashes.
+ * @param path The path hash.
+ * @return seen_entry_t* The entry, or the empty slot for it.
+ */
+static seen_entry_t *seen_find(const predicate_seen_t *seen, uint64_t path) {
+    size_t mask = seen->capacity - 1;
+    size_t slot = (size_t)path & mask;
+
+    while (seen->entries[slot].path && seen->entries[slot].path != path) {
+        slot = (slot + 1) & mask;
+    }
+    return &seen->entries[slot];
+}
+
+/**
+ * @brief Record the hash of the byte range of a path.
+ *
+ * @param pred The predicate.
+ * @param path The path.
+ * @param content The hash of the range.
+ * @return bool True if the hash differs from the one last recorded.
+ */
+static bool seen_update(predicate_t *pred, const char *path, uint64_t content) {
+    predicate_seen_t *seen = pred->seen;
+    uint64_t key = hash_bytes((const unsigned char *)path, strlen(path));
+
+    if (seen == NULL) {
+        seen = pred->seen = calloc(1, sizeof(*seen));
+        if (seen == NULL) {
+            return true;
+        }
+    }
+    if ((seen->used + 1) * 2 > seen->capacity) {
+        size_t capacity = seen->capacity ? seen->capacity * 2 : SEEN_MIN_CAPACITY;
+        predicate_seen_t grown = { calloc(capacity, sizeof(seen_entry_t)), capacity, seen->used };
+        if (grown.entries == NULL) {
+            return true;
+        }
+        for (size_t slot = 0; slot < seen->capacity; slot++) {
+            if (seen->entries[slot].path) {
+                *seen_find(&grown, seen->entries[slot].path) = seen->entries[slot];
+            }
+        }
+        free(seen->entries);
+        *seen = grown;
+    }
+    seen_entry_t *entry = seen_find(seen, key);
+    bool changed = entry->content != content;
+    if (entry->path == 0) {
+        entry->path = key;
+        seen->used++;
+    }
+    entry->content = content;
+    return changed;
+}
+
+/**
+ * @brief Check if the content holds a line.
+ *
+ * @param data The content.
+ * @param size The content size.
+ * @param line The line, without its end.
+ * @return bool True if a whole line of the content is the line.
+ */
+static bool has_line(const char *data, size_t size, const char *line) {
+    size_t len = strlen(line);
+    const char *end = data + size;
+    const char *from = data;
+    const char *hit;
+
+    while ((hit = memmem(from, (size_t)(end - from), line, len)) != NULL) {
+        const char *after = hit + len;
+        if ((hit == data || hit[-1] == '\n') &&
+            (after == end || *after == '\n' || (*after == '\r' && (after + 1 == end || after[1] == '\n')))) {
+            return true;
+        }
+        from = hit + 1;
+    }
+    return false;
+}
+
+/**
+ * @brief Test the content conditions.
+ *
+ * @param pred The predicate.
+ * @param path The path, for the byte range.
+ * @param data The content.
+ * @param size The content size.
+ * @return bool True if the content passes.
+ */
+static bool content_test(predicate_t *pred, const char *path, const char *data, size_t size) {
+    // The range is recorded first so that it is up to date whatever the other tests find.
+    if (pred->ranged) {
+        uint64_t offset = pred->range_offset < size ? pred->range_offset : size;
+        uint64_t length = size - offset;
+        if (pred->range_length && pred->range_length < length) {
+            length = pred->range_length;
+        }
+        if (!seen_update(pred, path, hash_bytes((const unsigned char *)data + offset, (size_t)length))) {
+            return false;
+        }
+    }
+    if (pred->match) {
+        if (pred->literal) {
+            if (memmem(data, size, pred->match, strlen(pred->match)) == NULL) {
+                return false;
+            }
+        }
+        else {
+            regmatch_t span = { .rm_so = 0, .rm_eo = (regoff_t)size };
+            if (regexec(&pred->regex, data, 1, &span, REG_STARTEND) != 0) {
+                return false;
+            }
+        }
+    }
+    return pred->line == NULL || has_line(data, size, pred->line);
+}
+
+/**
+ * @brief Test a file against the conditions of a rule.
+ * @details Only a regular file can pass. The byte range of the file is
+ * recorded each time it is tested.
+ *
+ * @param pred The predicate.
+ * @param path The changed path.
+ * @return bool True if the file meets every condition.
+ */
+bool predicate_test(predicate_t *pred, const char *path) {
+    struct stat st;
+
+    if (!pred->active) {
+        return true;
+    }
+    int fd = open(path, O_RDONLY | O_CLOEXEC | O_NOCTTY | O_NONBLOCK);
+    if (fd == -1) {
+        return false;
+    }
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) ||
+        (pred->sized && ((uint64_t)st.st_size < pred->size_min || (uint64_t)st.st_size > pred->size_max))) {
+        close(fd);
+        return false;
+    }
+    if (pred->match == NULL && pred->line == NULL && !pred->ranged) {
+        close(fd);
+        return true;
+    }
+    size_t size = (size_t)st.st_size;
+    const char *data = "";
+    if (size) {
+        data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            close(fd);
+            return false;
+        }
+        madvise((void *)data, size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    volatile bool pass = false;
+    s_scanning = 1;
+    if (sigsetjmp(s_fault, 1) == 0) {
+        pass = content_test(pred, path, data, size);
+    }
+    s_scanning = 0;
+    if (size) {
+        munmap((void *)data, size);
+    }
+    return pass;
+}
+
+/**
+ * @brief Record the byte range of a file without testing it.
+ * @details Used for the target when the watch starts, so that its first
+ * change is measured against the content it had then.
+ *
+ * @param pred The predicate.
+ * @param path The file.
+ */
+void predicate_seed(predicate_t *pred, const char *path) {
+    struct stat st;
+
+    if (pred->ranged && stat(path, &st) == 0 && S_ISREG(st.st_mode)) {
+        predicate_test(pred, path);
+    }
+}
+
+/**
+ * @brief Release the conditions.
+ *
+ * @param pred The predicate.
+ */
+void predicate_free(predicate_t *pred) {
+    if (pred->match && !pred->literal) {
+        regfree(&pred->regex);
+    }
+    free(pred->match);
+    free(pred->line);
+    if (pred->seen) {
+        free(pred->seen->entries);
+        free(pred->seen);
+    }
+    memset(pred, 0, sizeof(*pred));
+}
+
+/* End. */
@@ -0,0 +1,57 @@
+/**
+ * @file predicate.h
+ * @author Mark Lehane (markdlehane@gmail.com)
+ * @brief Trigger predicate interface.
+ * @details Conditions on the changed files, tested in the watcher
+ * before a rule's command is started.
+ *
+ * @version 0.1
+ * @date 2025-12-26
+ *
+ * @copyright Copyright (c) 2025, Mark D Lehane.
+ *
+ */
+
+#ifndef PREDICATE_H
+#define PREDICATE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <regex.h>
+
+/**
+ * @brief The last seen content hashes of a byte range (opaque).
+ *
+ */
+typedef struct predicate_seen_s predicate_seen_t;
+
+/**
+ * @brief The conditions a changed file must meet for a run.
+ * @details Every condition that is set must hold.
+ *
+ */
+typedef struct predicate_s {
+    bool active;                // Any condition is set.
+    bool sized;                 // The size must lie within the bounds.
+    uint64_t size_min;          // Smallest size (bytes).
+    uint64_t size_max;          // Largest size (bytes).
+    char *match;                // Pattern the content must match, or NULL.
+    bool literal;               // The pattern has no special characters.
+    regex_t regex;              // The compiled pattern, when not literal.
+    char *line;                 // Line the content must hold, or NULL.
+    bool ranged;                // The byte range must have changed.
+    uint64_t range_offset;      // Start of the range (bytes).
+    uint64_t range_length;      // Length of the range, 0 to the end of the file.
+    predicate_seen_t *seen;     // The range hashes by path.
+
+} predicate_t;
+
+extern bool predicate_option(predicate_t *pred, const char *name, const char *value);
+extern void predicate_seed(predicate_t *pred, const char *path);
+extern bool predicate_test(predicate_t *pred, const char *path);
+extern void predicate_free(predicate_t *pred);
+
+#endif
+
+/* End. */
@@ -0,0 +1,418 @@
+/**
+ * @file procsignal.c
+ * @author Mark Lehane (markdlehane@gmail.com)
+ * @brief Process signal action functions.
+ * @details The most common command given to a watcher is one that tells
+ * a daemon to reload, such as kill -HUP $(cat /run/nginx.pid). This
+ * module sends the signal from the watcher itself, so the run creates
+ * no process. The process is found once, from its id, its pid file or
+ * its name, and held by a pidfd, so a signal can never reach another
+ * process that has been given a recycled id. If the process has gone
+ * (the daemon was restarted) it is found again and the signal retried.
+ *
+ * @version 0.1
+ * @date 2025-12-29
+ *
+ * @copyright Copyright (c) 2025, Mark D Lehane.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <sys/syscall.h>
+#include <dirent.h>
+#include <signal.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+
+#include "procsignal.h"
+#include "rules.h"
+
+/**
+ * @brief A signal name.
+ *
+ */
+typedef struct signal_name_s {
+    const char *name;
+    int signo;
+
+} signal_name_t;
+
+/**
+ * @brief A process with the name being looked for.
+ *
+ */
+typedef struct proc_match_s {
+    pid_t pid;
+    pid_t ppid;
+
+} proc_match_t;
+
+// Local constants.
+#define COMM_LEN 15                 // The most characters of a process name the kernel keeps.
+
+// Local data.
+static const signal_name_t s_signals[] = {
+    { "HUP", SIGHUP }, { "INT", SIGINT }, { "QUIT", SIGQUIT }, { "KILL", SIGKILL },
+    { "USR1", SIGUSR1 }, { "USR2", SIGUSR2 }, { "ALRM", SIGALRM }, { "TERM", SIGTERM },
+    { "CONT", SIGCONT }, { "STOP", SIGSTOP }, { "TSTP", SIGTSTP }, { "WINCH", SIGWINCH },
+    { "IO", SIGIO }, { "PWR", SIGPWR }
+};
+
+/**
+ * @brief Parse a signal.
+ * @details The form is a number or a name, with or without SIG.
+ *
+ * @param value The text.
+ * @param signo Receives the signal number.
+ * @return bool True if the signal is valid.
+ */
+static bool parse_signal(const char *value, int *signo) {
+    char *end;
+    long number = strtol(value, &end, 10);
+
+    if (end != value && *end == '\0' && number > 0 && number < NSIG) {
+        *signo = (int)number;
+        return true;
+    }
+    const char *name = strncasecmp(value, "SIG", 3) == 0 ? value + 3 : value;
+    for (size_t index = 0; index < sizeof(s_signals) / sizeof(s_signals[0]); index++) {
+        if (strcasecmp(name, s_signals[index].name) == 0) {
+            *signo = s_signals[index].signo;
+            return true;
+        }
+    }
+    rule_error("Invalid signal '%s', expected a number or a name such as HUP\n", value);
+    return false;
+}
+
+/**
+ * @brief Set the process to signal.
+ * @details A number is a process id, a path (holding a /) is a pid file
+ * and anything else is a process name.
+ *
+ * @param sig The signal action.
+ * @param value The text.
+ * @return bool True if the process is valid.
+ */
+static bool parse_process(procsignal_t *sig, const char *value) {
+    char *end;
+    long pid = strtol(value, &end, 10);
+    char *copy = NULL;
+
+    if (*value == '\0') {
+        rule_error("Invalid process '', expected a pid, a pid file or a name\n");
+        return false;
+    }
+    if (end == value || *end != '\0') {
+        copy = strdup(value);
+        if (copy == NULL) {
+            perror("Failed to set option");
+            return false;
+        }
+    }
+    else if (pid <= 0 || pid > INT_MAX) {
+        rule_error("Invalid process id '%s'\n", value);
+        return false;
+    }
+    procsignal_free(sig);
+    if (copy == NULL) {
+        sig->pid = (pid_t)pid;
+    }
+    else if (strchr(copy, '/')) {
+        sig->pidfile = copy;
+    }
+    else {
+        sig->name = copy;
+    }
+    return true;
+}
+
+/**
+ * @brief Set a signal option by name.
+ *
+ * @param sig The signal action.
+ * @param name The option name, "signal" or "signal-to".
+ * @param value The option value.
+ * @return bool True if the option and its value are valid.
+ */
+bool procsignal_option(procsignal_t *sig, const char *name, const char *value) {
+    if (value == NULL) {
+        rule_error("--%s needs a value\n", name);
+        return false;
+    }
+    if (strcmp(name, "signal") == 0) {
+        return parse_signal(value, &sig->signo);
+    }
+    if (strcmp(name, "signal-to") == 0) {
+        return parse_process(sig, value);
+    }
+    rule_error("Unknown rule option '%s'\n", name);
+    return false;
+}
+
+/**
+ * @brief Check that a signal and a process are given together.
+ *
+ * @param sig The signal action.
+ * @return bool True if both are given, or neither.
+ */
+bool procsignal_valid(const procsignal_t *sig) {
+    bool target = sig->pid || sig->pidfile || sig->name;
+
+    if (sig->signo && !target) {
+        rule_error("--signal needs --signal-to, the process to send SIG%s to\n", procsignal_name(sig->signo));
+        return false;
+    }
+    if (target && sig->signo == 0) {
+        rule_error("--signal-to needs --signal, the signal to send\n");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Read the process id from a pid file.
+ *
+ * @param path The pid file.
+ * @return pid_t The process id, or 0 if there is none.
+ */
+static pid_t read_pidfile(const char *path) {
+    long pid = 0;
+
+    FILE *fp = fopen(path, "r");
+    if (fp) {
+        if (fscanf(fp, "%ld", &pid) != 1 || pid <= 0 || pid > INT_MAX) {
+            pid = 0;
+        }
+        fclose(fp);
+    }
+    return (pid_t)pid;
+}
+
+/**
+ * @brief Read the name and parent of a process.
+ *
+ * @param pid The process id.
+ * @param comm Receives the name, COMM_LEN + 1 bytes.
+ * @param ppid Receives the parent process id.
+ * @return bool True if the process was read.
+ */
+static bool read_stat(pid_t pid, char *comm, pid_t *ppid) {
+    char path[64];
+    char line[256];
+    bool ok = false;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        return false;
+    }
+    // The name is in brackets and may hold anything, brackets included.
+    if (fgets(line, sizeof(line), fp)) {
+        char *open = strchr(line, '(');
+        char *close = strrchr(line, ')');
+        int parent;
+        if (open && close > open && sscanf(close + 1, " %*c %d", &parent) == 1) {
+            size_t len = (size_t)(close - open - 1);
+            len = len > COMM_LEN ? COMM_LEN : len;
+            memcpy(comm, open + 1, len);
+            comm[len] = '\0';
+            *ppid = (pid_t)parent;
+            ok = true;
+        }
+    }
+    fclose(fp);
+    return ok;
+}
+
+/**
+ * @brief Find a process by name.
+ * @details Of the processes with the name, the one whose parent does
+ * not have it is taken, such as the master of a daemon and not one of
+ * its workers; if there are several, the one with the lowest id.
+ *
+ * @param name The process name.
+ * @return pid_t The process id, or 0 if there is none.
+ */
+static pid_t find_process(const char *name) {
+    char comm[COMM_LEN + 1];
+    struct dirent *entry;
+    proc_match_t *matches = NULL;
+    size_t count = 0;
+    size_t cap = 0;
+    pid_t found = 0;
+
+    DIR *dir = opendir("/proc");
+    if (dir == NULL) {
+        return 0;
+    }
+    while ((entry = readdir(dir)) != NULL) {
+        char *end;
+        pid_t ppid;
+        long pid = strtol(entry->d_name, &end, 10);
+        if (end == entry->d_name || *end != '\0' || !read_stat((pid_t)pid, comm, &ppid) ||
+            strncmp(comm, name, COMM_LEN) != 0) {
+            continue;
+        }
+        if (count == cap) {
+            proc_match_t *grown = realloc(matches, (cap ? cap * 2 : 16) * sizeof(*grown));
+            if (grown == NULL) {
+                break;
+            }
+            matches = grown;
+            cap = cap ? cap * 2 : 16;
+        }
+        matches[count].pid = (pid_t)pid;
+        matches[count++].ppid = ppid;
+    }
+    closedir(dir);
+    for (size_t index = 0; index < count; index++) {
+        bool child = false;
+        for (size_t other = 0; other < count && !child; other++) {
+            child = matches[index].ppid == matches[other].pid;
+        }
+        if (!child && (found == 0 || matches[index].pid < found)) {
+            found = matches[index].pid;
+        }
+    }
+    free(matches);
+    return found;
+}
+
+/**
+ * @brief Let go of the resolved process.
+ *
+ * @param sig The signal action.
+ */
+static void release(procsignal_t *sig) {
+    if (sig->resolved && sig->pidfd != -1) {
+        close(sig->pidfd);
+    }
+    sig->resolved = 0;
+    sig->pidfd = -1;
+}
+
+/**
+ * @brief Find the process to signal and hold it by a pidfd.
+ * @details Without pidfds (before Linux 5.3) the id alone is held.
+ *
+ * @param sig The signal action.
+ * @return bool True if the process was found.
+ */
+static bool resolve(procsignal_t *sig) {
+    pid_t pid = sig->pid;
+
+    errno = 0;
+    if (sig->pidfile) {
+        pid = read_pidfile(sig->pidfile);
+    }
+    else if (sig->name) {
+        pid = find_process(sig->name);
+        errno = 0;
+    }
+    if (pid <= 0) {
+        return false;
+    }
+    sig->pidfd = -1;
+#ifdef SYS_pidfd_open
+    sig->pidfd = (int)syscall(SYS_pidfd_open, pid, 0);
+    if (sig->pidfd == -1 && errno != ENOSYS) {
+        return false;
+    }
+#endif
+    sig->resolved = pid;
+    return true;
+}
+
+/**
+ * @brief Signal the resolved process.
+ *
+ * @param sig The signal action.
+ * @return int 0 on success, otherwise -1 with errno set.
+ */
+static int send_signal(const procsignal_t *sig) {
+#ifdef SYS_pidfd_send_signal
+    if (sig->pidfd != -1) {
+        return (int)syscall(SYS_pidfd_send_signal, sig->pidfd, sig->signo, NULL, 0);
+    }
+#endif
+    return kill(sig->resolved, sig->signo);
+}
+
+/**
+ * @brief Send the signal.
+ * @details A process that has gone is found again, once.
+ *
+ * @param sig The signal action.
+ * @param verbose True if verbose output should be made.
+ * @return bool True if the signal was sent.
+ */
+bool procsignal_send(procsignal_t *sig, bool verbose) {
+    for (int attempt = 0; attempt < 2; attempt++) {
+        if (sig->resolved == 0 && !resolve(sig)) {
+            break;
+        }
+        if (send_signal(sig) == 0) {
+            if (verbose) {
+                printf("Sent SIG%s to process %d\n", procsignal_name(sig->signo), (int)sig->resolved);
+            }
+            return true;
+        }
+        int error = errno;
+        release(sig);
+        if (error != ESRCH) {
+            errno = error;
+            break;
+        }
+    }
+    if (sig->pidfile) {
+        fprintf(stderr, "Unable to send SIG%s to the process in '%s': %s\n", procsignal_name(sig->signo),
+            sig->pidfile, errno ? strerror(errno) : "no process id");
+    }
+    else if (sig->name) {
+        fprintf(stderr, "Unable to send SIG%s to process '%s': %s\n", procsignal_name(sig->signo),
+            sig->name, errno ? strerror(errno) : "not running");
+    }
+    else {
+        fprintf(stderr, "Unable to send SIG%s to process %d: %s\n", procsignal_name(sig->signo),
+            (int)sig->pid, strerror(errno));
+    }
+    return false;
+}
+
+/**
+ * @brief Return the name of a signal, without SIG.
+ *
+ * @param signo The signal number.
+ * @return const char* The name, or "?" for a signal without one here.
+ */
+const char *procsignal_name(int signo) {
+    for (size_t index = 0; index < sizeof(s_signals) / sizeof(s_signals[0]); index++) {
+        if (s_signals[index].signo == signo) {
+            return s_signals[index].name;
+        }
+    }
+    return "?";
+}
+
+/**
+ * @brief Release the process and the names held by a signal action.
+ * @details The signal itself is kept.
+ *
+ * @param sig The signal action.
+ */
+void procsignal_free(procsignal_t *sig) {
+    release(sig);
+    free(sig->pidfile);
+    free(sig->name);
+    sig->pidfile = NULL;
+    sig->name = NULL;
+    sig->pid = 0;
+}
+
+/* End. */
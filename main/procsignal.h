@@ -0,0 +1,45 @@
+/**
+ * @file procsignal.h
+ * @author Mark Lehane (markdlehane@gmail.com)
+ * @brief Process signal action interface.
+ * @details A rule action that signals a running process, such as a
+ * daemon that reloads its config on SIGHUP, without starting one.
+ *
+ * @version 0.1
+ * @date 2025-12-29
+ *
+ * @copyright Copyright (c) 2025, Mark D Lehane.
+ *
+ */
+
+#ifndef PROCSIGNAL_H
+#define PROCSIGNAL_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+/**
+ * @brief A signal to send to a process.
+ * @details The process is given by its id, by a pid file or by name,
+ * and is resolved when first signalled, then held by a pidfd.
+ *
+ */
+typedef struct procsignal_s {
+    int signo;                  // The signal, 0 when the rule sends none.
+    pid_t pid;                  // The process id given, or 0.
+    char *pidfile;              // The file holding the process id, or NULL.
+    char *name;                 // The process name, or NULL.
+    pid_t resolved;             // The process signalled, or 0 before it is resolved.
+    int pidfd;                  // The pidfd of the resolved process, -1 without pidfds.
+
+} procsignal_t;
+
+extern bool procsignal_option(procsignal_t *sig, const char *name, const char *value);
+extern bool procsignal_valid(const procsignal_t *sig);
+extern bool procsignal_send(procsignal_t *sig, bool verbose);
+extern const char *procsignal_name(int signo);
+extern void procsignal_free(procsignal_t *sig);
+
+#endif
+
+/* End. */
@@ -0,0 +1,372 @@
+/**
+ * @file profile.c
+ * @author Mark Lehane (markdlehane@gmail.com)
+ * @brief Self-profiling functions.
+ * @details With --profile the watcher measures itself by stage of the
+ * event pipeline: reading the events, decoding and routing them, the
+ * filters of a due rule, dispatching the run and forking its command.
+ * Each stage is charged the wall time and the counts of the hardware
+ * and software performance counters (perf_event_open) that the kernel
+ * allows for this thread: cycles, instructions, context switches and
+ * page faults.
+ *
+ * The counters are one group, read in one system call at each change
+ * of stage, and a stage that starts inside another is charged apart
+ * from it, so the stages add up. Where perf_event_paranoid does not
+ * allow the kernel side to be counted, cycles and instructions are
+ * counted in user space only and the context switches and page faults
+ * come from getrusage; where no counter can be opened at all, such as
+ * in a container or a VM without a PMU, the stages have their times
+ * only.
+ *
+ * @version 0.1
+ * @date 2026-01-02
+ *
+ * @copyright Copyright (c) 2025, Mark D Lehane.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#include "profile.h"
+
+/**
+ * @brief Enum used to identify where a counter comes from.
+ *
+ */
+typedef enum counter_source_e {
+    SOURCE_NONE = 0,
+    SOURCE_PERF,        // perf_event_open, user and kernel.
+    SOURCE_PERF_USER,   // perf_event_open, user space only.
+    SOURCE_RUSAGE       // getrusage for the thread.
+
+} COUNTER_SOURCE;
+
+/**
+ * @brief A performance counter.
+ *
+ */
+typedef struct profile_counter_s {
+    const char *name;
+    uint32_t type;              // The perf event type.
+    uint64_t config;            // The perf event.
+    bool kernel;                // Only worth counting with the kernel side.
+
+} profile_counter_t;
+
+// Local constants.
+#define PROFILE_COUNTERS 4
+#define PROFILE_MAX_DEPTH 8
+#define COUNTER_CONTEXT_SWITCHES 2
+#define COUNTER_PAGE_FAULTS 3
+
+/**
+ * @brief The totals of a stage.
+ *
+ */
+typedef struct profile_totals_s {
+    unsigned long calls;
+    uint64_t time;                          // Wall time (ns).
+    uint64_t counts[PROFILE_COUNTERS];
+
+} profile_totals_t;
+
+/**
+ * @brief The clock and the counters at a change of stage.
+ *
+ */
+typedef struct profile_sample_s {
+    uint64_t time;                          // Monotonic time (ns).
+    uint64_t counts[PROFILE_COUNTERS];
+
+} profile_sample_t;
+
+// Local data.
+static const profile_counter_t s_counters[PROFILE_COUNTERS] = {
+    { "cycles",           PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES,        false },
+    { "instructions",     PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS,      false },
+    { "context_switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES,  true  },
+    { "page_faults",      PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS,       true  }
+};
+static const char *s_stage_names[PROFILE_STAGES] = { "read", "decode", "filter", "dispatch", "spawn" };
+static const char *s_source_names[] = { "none", "perf", "perf:u", "rusage" };
+static bool s_enabled = false;
+static int s_leader = -1;
+static int s_fds[PROFILE_COUNTERS];
+static int s_slots[PROFILE_COUNTERS];       // Position of the counter in a group read.
+static int s_open = 0;
+static uint8_t s_sources[PROFILE_COUNTERS];
+static bool s_rusage = false;
+static profile_totals_t s_totals[PROFILE_STAGES];
+static PROFILE_STAGE s_stack[PROFILE_MAX_DEPTH];
+static int s_depth = 0;
+static profile_sample_t s_last;
+
+/**
+ * @brief Open a counter for this thread, in the group.
+ *
+ * @param counter The counter.
+ * @param user_only Count in user space only.
+ * @return int The counter handle, or -1 with errno set.
+ */
+static int open_counter(const profile_counter_t *counter, bool user_only) {
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = counter->type;
+    attr.config = counter->config;
+    attr.read_format = PERF_FORMAT_GROUP;
+    attr.exclude_kernel = user_only;
+    attr.exclude_hv = 1;
+    // The commands are not counted, only the watcher.
+    attr.inherit = 0;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, s_leader, PERF_FLAG_FD_CLOEXEC);
+}
+
+/**
+ * @brief Open the counters the kernel allows.
+ * @details The kernel side is tried first, as the system calls are
+ * much of a watcher's work.
+ *
+ * @return int The errno of the last counter that could not be opened, or 0.
+ */
+static int open_counters(void) {
+    int error = 0;
+
+    for (int pass = 0; pass < 2 && s_open == 0; pass++) {
+        bool user_only = pass == 1;
+        for (int index = 0; index < PROFILE_COUNTERS; index++) {
+            if (user_only && s_counters[index].kernel) {
+                continue;
+            }
+            int fd = open_counter(&s_counters[index], user_only);
+            if (fd == -1) {
+                error = errno;
+                continue;
+            }
+            if (s_leader == -1) {
+                s_leader = fd;
+            }
+            s_fds[index] = fd;
+            s_slots[index] = s_open++;
+            s_sources[index] = user_only ? SOURCE_PERF_USER : SOURCE_PERF;
+        }
+    }
+    return error;
+}
+
+/**
+ * @brief Start profiling the stages.
+ *
+ * @param verbose True if the counters in use should be reported.
+ */
+void profile_init(bool verbose) {
+    int error;
+
+    for (int index = 0; index < PROFILE_COUNTERS; index++) {
+        s_fds[index] = -1;
+        s_slots[index] = -1;
+        s_sources[index] = SOURCE_NONE;
+    }
+    error = open_counters();
+    s_rusage = false;
+    for (int index = COUNTER_CONTEXT_SWITCHES; index <= COUNTER_PAGE_FAULTS; index++) {
+        if (s_sources[index] == SOURCE_NONE) {
+            s_sources[index] = SOURCE_RUSAGE;
+            s_rusage = true;
+        }
+    }
+    memset(s_totals, 0, sizeof(s_totals));
+    s_depth = 0;
+    s_enabled = true;
+    if (verbose) {
+        fputs("Profiling the stages with", stdout);
+        for (int index = 0; index < PROFILE_COUNTERS; index++) {
+            if (s_sources[index] != SOURCE_NONE) {
+                printf(" %s (%s)", s_counters[index].name, s_source_names[s_sources[index]]);
+            }
+        }
+        if (error && s_sources[0] == SOURCE_NONE) {
+            printf(", no CPU counters: %s", strerror(error));
+        }
+        putchar('\n');
+    }
+}
+
+/**
+ * @brief Check if the stages are being profiled.
+ *
+ * @return bool True with --profile.
+ */
+bool profile_enabled(void) {
+    return s_enabled;
+}
+
+/**
+ * @brief Read the clock and the counters.
+ *
+ * @param sample Receives the readings.
+ */
+static void sample(profile_sample_t *sample) {
+    struct timespec now;
+    uint64_t values[1 + PROFILE_COUNTERS];
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    sample->time = (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+    memset(sample->counts, 0, sizeof(sample->counts));
+    // A group read is the number of counters, then their values.
+    if (s_open && read(s_leader, values, sizeof(uint64_t) * (size_t)(1 + s_open)) > 0) {
+        for (int index = 0; index < PROFILE_COUNTERS; index++) {
+            if (s_slots[index] >= 0) {
+                sample->counts[index] = values[1 + s_slots[index]];
+            }
+        }
+    }
+    if (s_rusage) {
+        struct rusage usage;
+        getrusage(RUSAGE_THREAD, &usage);
+        if (s_sources[COUNTER_CONTEXT_SWITCHES] == SOURCE_RUSAGE) {
+            sample->counts[COUNTER_CONTEXT_SWITCHES] = (uint64_t)(usage.ru_nvcsw + usage.ru_nivcsw);
+        }
+        if (s_sources[COUNTER_PAGE_FAULTS] == SOURCE_RUSAGE) {
+            sample->counts[COUNTER_PAGE_FAULTS] = (uint64_t)(usage.ru_minflt + usage.ru_majflt);
+        }
+    }
+}
+
+/**
+ * @brief Charge the stage in progress with what was used since the last change of stage.
+ *
+ * @param now The readings now.
+ */
+static void charge(const profile_sample_t *now) {
+    if (s_depth) {
+        profile_totals_t *totals = &s_totals[s_stack[(s_depth > PROFILE_MAX_DEPTH ? PROFILE_MAX_DEPTH : s_depth) - 1]];
+        totals->time += now->time - s_last.time;
+        for (int index = 0; index < PROFILE_COUNTERS; index++) {
+            totals->counts[index] += now->counts[index] - s_last.counts[index];
+        }
+    }
+    s_last = *now;
+}
+
+/**
+ * @brief Enter a stage.
+ * @details A stage entered inside another is charged apart from it
+ * until it ends.
+ *
+ * @param stage The stage.
+ */
+void profile_begin(PROFILE_STAGE stage) {
+    profile_sample_t now;
+
+    if (!s_enabled) {
+        return;
+    }
+    sample(&now);
+    charge(&now);
+    if (s_depth < PROFILE_MAX_DEPTH) {
+        s_stack[s_depth] = stage;
+    }
+    s_depth++;
+    s_totals[stage].calls++;
+}
+
+/**
+ * @brief Leave the latest stage entered.
+ *
+ */
+void profile_end(void) {
+    profile_sample_t now;
+
+    if (!s_enabled || s_depth == 0) {
+        return;
+    }
+    sample(&now);
+    charge(&now);
+    s_depth--;
+}
+
+/**
+ * @brief Write the totals of each stage as text.
+ *
+ * @param fp The output stream.
+ */
+void profile_dump(FILE *fp) {
+    fputs("profile", fp);
+    for (int index = 0; index < PROFILE_COUNTERS; index++) {
+        fprintf(fp, " %s=%s", s_counters[index].name, s_source_names[s_sources[index]]);
+    }
+    fputc('\n', fp);
+    for (int stage = 0; stage < PROFILE_STAGES; stage++) {
+        const profile_totals_t *totals = &s_totals[stage];
+        fprintf(fp, "stage %s calls=%lu time=%.3fms", s_stage_names[stage], totals->calls, (double)totals->time / 1e6);
+        for (int index = 0; index < PROFILE_COUNTERS; index++) {
+            if (s_sources[index] != SOURCE_NONE) {
+                fprintf(fp, " %s=%" PRIu64, s_counters[index].name, totals->counts[index]);
+            }
+        }
+        if (s_sources[0] != SOURCE_NONE && s_sources[1] != SOURCE_NONE && totals->counts[0]) {
+            fprintf(fp, " ipc=%.2f", (double)totals->counts[1] / (double)totals->counts[0]);
+        }
+        fputc('\n', fp);
+    }
+}
+
+/**
+ * @brief Write the totals of each stage as a JSON object.
+ * @details A counter that is not available is null.
+ *
+ * @param fp The output stream.
+ */
+void profile_json(FILE *fp) {
+    fputs("{\"sources\":{", fp);
+    for (int index = 0; index < PROFILE_COUNTERS; index++) {
+        fprintf(fp, "%s\"%s\":\"%s\"", index ? "," : "", s_counters[index].name, s_source_names[s_sources[index]]);
+    }
+    fputs("},\"stages\":{", fp);
+    for (int stage = 0; stage < PROFILE_STAGES; stage++) {
+        const profile_totals_t *totals = &s_totals[stage];
+        fprintf(fp, "%s\"%s\":{\"calls\":%lu,\"time_us\":%" PRIu64, stage ? "," : "", s_stage_names[stage],
+            totals->calls, totals->time / 1000);
+        for (int index = 0; index < PROFILE_COUNTERS; index++) {
+            if (s_sources[index] != SOURCE_NONE) {
+                fprintf(fp, ",\"%s\":%" PRIu64, s_counters[index].name, totals->counts[index]);
+            }
+            else {
+                fprintf(fp, ",\"%s\":null", s_counters[index].name);
+            }
+        }
+        fputc('}', fp);
+    }
+    fputs("}}", fp);
+}
+
+/**
+ * @brief Stop profiling and close the counters.
+ *
+ */
+void profile_shutdown(void) {
+    for (int index = 0; index < PROFILE_COUNTERS; index++) {
+        if (s_fds[index] != -1) {
+            close(s_fds[index]);
+            s_fds[index] = -1;
+        }
+    }
+    s_leader = -1;
+    s_open = 0;
+    s_enabled = false;
+}
+
+/* End. */
@@ -0,0 +1,45 @@
+/**
+ * @file profile.h
+ * @author Mark Lehane (markdlehane@gmail.com)
+ * @brief Self-profiling interface.
+ * @details Where the watcher's own time goes, by stage of the event
+ * pipeline, from performance counters where the kernel allows them.
+ *
+ * @version 0.1
+ * @date 2026-01-02
+ *
+ * @copyright Copyright (c) 2025, Mark D Lehane.
+ *
+ */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+/**
+ * @brief Enum used to identify the stages of the pipeline.
+ *
+ */
+typedef enum profile_stage_e {
+    PROFILE_READ = 0,   // Asking for the queue depth and reading the events.
+    PROFILE_DECODE,     // Walking the events and routing the changes to the rules.
+    PROFILE_FILTER,     // Predicates, tree hashes and changed ranges of a due rule.
+    PROFILE_DISPATCH,   // The rest of starting a run.
+    PROFILE_SPAWN,      // Forking the command.
+    PROFILE_STAGES
+
+} PROFILE_STAGE;
+
+extern void profile_init(bool verbose);
+extern bool profile_enabled(void);
+extern void profile_begin(PROFILE_STAGE stage);
+extern void profile_end(void);
+extern void profile_dump(FILE *fp);
+extern void profile_json(FILE *fp);
+extern void profile_shutdown(void);
+
+#endif
+
+/* End. */
@@ -0,0 +1,281 @@
+/**
+ * @file psi.c
+ * @author Mark Lehane (markdlehane@gmail.com)
+ * @brief Pressure stall information functions.
+ * @details This module reads the Linux pressure stall information in
+ * /proc/pressure. A threshold is a percentage of time some tasks were
+ * stalled on the resource, compared with the ten second average. For
+ * each threshold a PSI trigger is registered ("some" stall time over a
+ * two second window, the shortest window unprivileged users may ask
+ * for), which the kernel signals with POLLPRI, so rising pressure is
+ * seen at once. Triggers only fire on the way up, so while pressure is
+ * high the averages are read again every second to see it fall. Where
+ * triggers are not allowed the averages are read once a second.
+ *
+ * @version 0.1
+ * @date 2025-12-18
+ *
+ * @copyright Copyright (c) 2025, Mark D Lehane.
+ *
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "psi.h"
+
+/**
+ * @brief A monitored resource.
+ *
+ */
+typedef struct psi_source_s {
+    unsigned threshold;         // Percentage of stalled time, 0 if not monitored.
+    int fd;                     // The pressure file, -1 if not open.
+    bool trigger;               // A trigger is registered on the file.
+    double level;               // The latest ten second average (%).
+
+} psi_source_t;
+
+// Local constants.
+#define PSI_WINDOW_US 2000000
+#define PSI_RECHECK_US 1000000
+#define PSI_READ_SIZE 256
+
+// Local data.
+static const char *s_names[PSI_MAX] = { "cpu", "memory", "io" };
+static psi_source_t s_sources[PSI_MAX] = {
+    { .fd = -1 }, { .fd = -1 }, { .fd = -1 }
+};
+static bool s_enabled = false;
+static bool s_stale = true;
+static uint64_t s_read_at = 0;
+
+/**
+ * @brief Parse the pressure thresholds.
+ * @details The form is RESOURCE:PERCENT[,RESOURCE:PERCENT...], for
+ * example cpu:40,memory:10,io:30.
+ *
+ * @param spec The thresholds.
+ * @return bool True if the thresholds are valid.
+ */
+static bool parse_spec(const char *spec) {
+    const char *text = spec;
+
+    while (*text) {
+        int resource;
+        size_t len = strcspn(text, ":");
+        for (resource = 0; resource < PSI_MAX; resource++) {
+            if (strlen(s_names[resource]) == len && strncmp(text, s_names[resource], len) == 0) {
+                break;
+            }
+        }
+        char *end;
+        unsigned long percent = resource < PSI_MAX && text[len] == ':' ? strtoul(text + len + 1, &end, 10) : 0;
+        if (percent == 0 || percent > 100 || (*end != ',' && *end != '\0')) {
+            printf("Invalid pressure '%s', expected cpu|memory|io:PERCENT[,...]\n", spec);
+            return false;
+        }
+        s_sources[resource].threshold = (unsigned)percent;
+        text = *end == ',' ? end + 1 : end;
+    }
+    return true;
+}
+
+/**
+ * @brief Read the ten second "some" average of a resource.
+ *
+ * @param source The resource.
+ */
+static void read_level(psi_source_t *source) {
+    char buf[PSI_READ_SIZE];
+
+    if (lseek(source->fd, 0, SEEK_SET) != 0) {
+        return;
+    }
+    ssize_t len = read(source->fd, buf, sizeof(buf) - 1);
+    if (len > 0) {
+        buf[len] = '\0';
+        const char *avg = strstr(buf, "some avg10=");
+        if (avg) {
+            source->level = strtod(avg + strlen("some avg10="), NULL);
+        }
+    }
+}
+
+/**
+ * @brief Start monitoring pressure.
+ *
+ * @param spec The thresholds, or NULL to leave pressure alone.
+ * @param verbose True if verbose output should be made.
+ * @return bool False if the thresholds are invalid or pressure cannot be read.
+ */
+bool psi_init(const char *spec, bool verbose) {
+    char path[64];
+    char trigger[64];
+
+    if (spec == NULL) {
+        return true;
+    }
+    if (!parse_spec(spec)) {
+        return false;
+    }
+    for (int resource = 0; resource < PSI_MAX; resource++) {
+        psi_source_t *source = &s_sources[resource];
+        if (source->threshold == 0) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "/proc/pressure/%s", s_names[resource]);
+        source->fd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+        if (source->fd == -1) {
+            source->fd = open(path, O_RDONLY | O_CLOEXEC);
+        }
+        if (source->fd == -1) {
+            fprintf(stderr, "Failed to open '%s': '%s'\n", path, strerror(errno));
+            psi_shutdown();
+            return false;
+        }
+        int len = snprintf(trigger, sizeof(trigger), "some %u %u",
+            (unsigned)((uint64_t)PSI_WINDOW_US * source->threshold / 100), PSI_WINDOW_US);
+        source->trigger = write(source->fd, trigger, (size_t)len + 1) > 0;
+        if (verbose) {
+            printf("Deferring background rules above %u%% %s pressure (%s)\n", source->threshold,
+                s_names[resource], source->trigger ? "trigger" : "polled");
+        }
+    }
+    s_enabled = true;
+    s_stale = true;
+    return true;
+}
+
+/**
+ * @brief Check if pressure is being monitored.
+ *
+ * @return bool True if there are thresholds.
+ */
+bool psi_enabled(void) {
+    return s_enabled;
+}
+
+/**
+ * @brief Fill in the poll entries for the pressure triggers.
+ *
+ * @param fds Room for PSI_MAX entries.
+ * @return int The number of entries filled in.
+ */
+int psi_poll_fds(struct pollfd *fds) {
+    int count = 0;
+    for (int resource = 0; resource < PSI_MAX; resource++) {
+        if (s_sources[resource].trigger) {
+            fds[count].fd = s_sources[resource].fd;
+            fds[count].events = POLLPRI;
+            fds[count].revents = 0;
+            count++;
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief Note that a pressure trigger fired.
+ *
+ */
+void psi_triggered(void) {
+    s_stale = true;
+}
+
+/**
+ * @brief Check if a resource is under pressure.
+ *
+ * @param now The engine time in microseconds.
+ * @return int The first resource over its threshold, or -1 if none.
+ */
+int psi_high(uint64_t now) {
+    if (!s_enabled) {
+        return -1;
+    }
+    if (s_stale || now - s_read_at >= PSI_RECHECK_US) {
+        for (int resource = 0; resource < PSI_MAX; resource++) {
+            if (s_sources[resource].fd != -1) {
+                read_level(&s_sources[resource]);
+            }
+        }
+        s_read_at = now;
+        s_stale = false;
+    }
+    for (int resource = 0; resource < PSI_MAX; resource++) {
+        const psi_source_t *source = &s_sources[resource];
+        if (source->threshold && source->level >= source->threshold) {
+            return resource;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Return the time the pressure should next be read.
+ *
+ * @return uint64_t The time in microseconds.
+ */
+uint64_t psi_recheck(void) {
+    return s_read_at + PSI_RECHECK_US;
+}
+
+/**
+ * @brief Return the name of a resource.
+ *
+ * @param resource The resource.
+ * @return const char* The name.
+ */
+const char *psi_name(int resource) {
+    return resource >= 0 && resource < PSI_MAX ? s_names[resource] : "none";
+}
+
+/**
+ * @brief Return the latest pressure of a resource.
+ *
+ * @param resource The resource.
+ * @return double The ten second average (%).
+ */
+double psi_level(int resource) {
+    return resource >= 0 && resource < PSI_MAX ? s_sources[resource].level : 0.0;
+}
+
+/**
+ * @brief Report the pressure of each monitored resource.
+ *
+ * @param fp The output stream.
+ */
+void psi_dump(FILE *fp) {
+    if (!s_enabled) {
+        return;
+    }
+    fputs("pressure", fp);
+    for (int resource = 0; resource < PSI_MAX; resource++) {
+        const psi_source_t *source = &s_sources[resource];
+        if (source->threshold) {
+            fprintf(fp, " %s=%.2f%%/%u%%", s_names[resource], source->level, source->threshold);
+        }
+    }
+    fputc('\n', fp);
+}
+
+/**
+ * @brief Stop monitoring pressure.
+ *
+ */
+void psi_shutdown(void) {
+    for (int resource = 0; resource < PSI_MAX; resource++) {
+        if (s_sources[resource].fd != -1) {
+            close(s_sources[resource].fd);
+            s_sources[resource].fd = -1;
+        }
+        s_sources[resource].trigger = false;
+    }
+    s_enabled = false;
+}
+
+/* End. */
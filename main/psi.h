@@ -0,0 +1,48 @@
+/**
+ * @file psi.h
+ * @author Mark Lehane (markdlehane@gmail.com)
+ * @brief Pressure stall information interface.
+ * @details Tells the dispatcher when the host is under CPU, memory or
+ * I/O pressure.
+ *
+ * @version 0.1
+ * @date 2025-12-18
+ *
+ * @copyright Copyright (c) 2025, Mark D Lehane.
+ *
+ */
+
+#ifndef PSI_H
+#define PSI_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <poll.h>
+
+/**
+ * @brief Enum used to identify the pressure resources.
+ *
+ */
+typedef enum psi_resource_e {
+    PSI_CPU = 0,
+    PSI_MEMORY,
+    PSI_IO,
+    PSI_MAX
+
+} PSI_RESOURCE;
+
+extern bool psi_init(const char *spec, bool verbose);
+extern bool psi_enabled(void);
+extern int psi_poll_fds(struct pollfd *fds);
+extern void psi_triggered(void);
+extern int psi_high(uint64_t now);
+extern uint64_t psi_recheck(void);
+extern const char *psi_name(int resource);
+extern double psi_level(int resource);
+extern void psi_dump(FILE *fp);
+extern void psi_shutdown(void);
+
+#endif
+
+/* End. */
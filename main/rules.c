@@ -0,0 +1,693 @@
+/**
+ * @file rules.c
+ * @author Mark Lehane (markdlehane@gmail.com)
+ * @brief Watch rule functions.
+ * @details This module owns the rule table. Each rule watches its own
+ * target and runs its own command under its own dispatch policy; rule
+ * options are set by name so that every source of rules (the command
+ * line and the config file) shares one parser, which reports a bad
+ * option once, with where it was read from. Rules from the config file
+ * come and go as it is reloaded; a rule that goes is retired and its
+ * slot reused once its commands have finished.
+ *
+ * The rate limit is a token bucket kept in its equivalent virtual
+ * scheduling form: a single time at which the bucket would be full
+ * again, from which the time the next token is available follows
+ * directly.
+ *
+ * @version 0.1
+ * @date 2025-12-14
+ *
+ * @copyright Copyright (c) 2025, Mark D Lehane.
+ *
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+
+#include "rules.h"
+
+/**
+ * @brief A rule option.
+ *
+ */
+typedef struct rule_name_s {
+    const char *name;           // The long command line name.
+    bool flag;                  // True if the option takes no value.
+
+} rule_name_t;
+
+// Local data.
+static const rule_name_t s_options[] = {
+    { "file", false }, { "exec", false }, { "name", false }, { "debounce", false }, { "max-latency", false },
+    { "jobs", false }, { "rate", false }, { "adaptive", false }, { "recursive", true }, { "follow-symlinks", true },
+    { "await", true }, { "background", true }, { "nice", false }, { "ioprio", false }, { "cpus", false },
+    { "cpu-max", false }, { "memory-max", false }, { "interactive", true }, { "priority", false },
+    { "weight", false }, { "changed-ranges", true }, { "if-tree-changed", true }, { "if-size", false },
+    { "if-match", false }, { "if-line", false }, { "if-range", false }, { "signal", false }, { "signal-to", false }
+};
+static watch_rule_t *s_rules[WATCH_MAX_RULES];
+static int s_rule_count = 0;
+static const char *s_where = NULL;      // Where options are being read, for their errors.
+static bool s_reported = false;
+
+// Forward declarations.
+static bool set_string(char **field, const char *value);
+
+/**
+ * @brief Release a rule.
+ *
+ * @param rule The rule, or NULL.
+ */
+void rule_destroy(watch_rule_t *rule) {
+    if (rule) {
+        pathwait_shutdown(rule->wait);
+        changeset_free(rule->changes);
+        free(rule->name);
+        free(rule->target);
+        free(rule->command);
+        free(rule->place.cpus);
+        predicate_free(&rule->predicate);
+        procsignal_free(&rule->signal);
+        chunks_free(rule->chunks);
+        free(rule);
+    }
+}
+
+/**
+ * @brief Create a rule with the default policy, outside the rule table.
+ * @details The rule has no name or index until it is adopted.
+ *
+ * @return watch_rule_t* The rule, or NULL if memory is exhausted.
+ */
+watch_rule_t *rule_alloc(void) {
+    watch_rule_t *rule = calloc(1, sizeof(*rule));
+    if (rule == NULL) {
+        perror("Failed to allocate a rule");
+        return NULL;
+    }
+    rule->index = -1;
+    rule->policy.debounce = WATCH_DEFAULT_DEBOUNCE;
+    rule->policy.max_latency = WATCH_DEFAULT_MAX_LATENCY;
+    rule->policy.jobs = WATCH_DEFAULT_JOBS;
+    rule->weight = 1;
+    rule->signal.pidfd = -1;
+    rule->changes = changeset_new();
+    if (rule->changes == NULL) {
+        perror("Failed to allocate a rule");
+        free(rule);
+        return NULL;
+    }
+    return rule;
+}
+
+/**
+ * @brief Add a rule to the rule table.
+ * @details The slot of a retired rule with no commands left running is
+ * reused, so its bit in the rule masks is free again. A rule without a
+ * name is named by its position.
+ *
+ * @param rule The rule.
+ * @return bool False if the table is full.
+ */
+bool rule_adopt(watch_rule_t *rule) {
+    char name[16];
+    int index = 0;
+
+    while (index < s_rule_count && !(s_rules[index]->retired && s_rules[index]->running == 0)) {
+        index++;
+    }
+    if (index == WATCH_MAX_RULES) {
+        printf("No more than %d rules can be given\n", WATCH_MAX_RULES);
+        return false;
+    }
+    if (rule->name == NULL) {
+        snprintf(name, sizeof(name), "%d", index + 1);
+        if (!set_string(&rule->name, name)) {
+            return false;
+        }
+    }
+    if (index < s_rule_count) {
+        rule_destroy(s_rules[index]);
+    }
+    else {
+        s_rule_count++;
+    }
+    rule->index = index;
+    s_rules[index] = rule;
+    return true;
+}
+
+/**
+ * @brief Create a rule with the default policy.
+ *
+ * @return watch_rule_t* The rule, or NULL if the table is full.
+ */
+watch_rule_t *rule_new(void) {
+    watch_rule_t *rule = rule_alloc();
+    if (rule && !rule_adopt(rule)) {
+        rule_destroy(rule);
+        rule = NULL;
+    }
+    return rule;
+}
+
+/**
+ * @brief Return a rule by index.
+ *
+ * @param index The rule index.
+ * @return watch_rule_t* The rule, or NULL if there is no such rule.
+ */
+watch_rule_t *rule_at(int index) {
+    return (index >= 0 && index < s_rule_count) ? s_rules[index] : NULL;
+}
+
+/**
+ * @brief Return the number of rules.
+ *
+ * @return int The rule count.
+ */
+int rule_count(void) {
+    return s_rule_count;
+}
+
+/**
+ * @brief Say where rule options are being read from.
+ * @details Errors in the options are then reported once each, on the
+ * standard error with where they were read, rather than as the command
+ * line reports them.
+ *
+ * @param where Such as the config file and line, or NULL for the command line.
+ */
+void rule_where(const char *where) {
+    s_where = where;
+    s_reported = false;
+}
+
+/**
+ * @brief Check if an option error was reported since rule_where.
+ *
+ * @return bool True if an error was reported.
+ */
+bool rule_reported(void) {
+    return s_reported;
+}
+
+/**
+ * @brief Report an error in a rule option.
+ *
+ * @param format The message format, ending in a new line.
+ */
+void rule_error(const char *format, ...) {
+    va_list args;
+
+    va_start(args, format);
+    if (s_where) {
+        fprintf(stderr, "%s: ", s_where);
+        vfprintf(stderr, format, args);
+    }
+    else {
+        vprintf(format, args);
+    }
+    va_end(args);
+    s_reported = true;
+}
+
+/**
+ * @brief Parse an unsigned number.
+ *
+ * @param value The text.
+ * @param end Receives the first character after the number, or NULL if it must be the whole text.
+ * @param number Receives the number.
+ * @return bool True if the number is valid.
+ */
+static bool parse_unsigned(const char *value, const char **end, unsigned *number) {
+    char *stop;
+    unsigned long parsed = strtoul(value, &stop, 10);
+    if (stop == value || (end == NULL && *stop != '\0')) {
+        rule_error("Invalid number '%s'\n", value);
+        return false;
+    }
+    if (end) {
+        *end = stop;
+    }
+    *number = (unsigned)parsed;
+    return true;
+}
+
+/**
+ * @brief Parse a rate limit.
+ * @details The form is RUNS/INTERVAL[:BURST], where the interval is a
+ * number of milliseconds with an optional ms, s or m unit, or just the
+ * unit for one of them. For example 2/s, 10/1m:20 or 1/500ms.
+ *
+ * @param value The text.
+ * @param rate Receives the rate limit.
+ * @return bool True if the rate is valid.
+ */
+static bool parse_rate(const char *value, rule_rate_t *rate) {
+    const char *text;
+    unsigned interval = 1;
+
+    if (!parse_unsigned(value, &text, &rate->runs) || *text++ != '/') {
+        rule_error("Invalid rate '%s', expected RUNS/INTERVAL[:BURST]\n", value);
+        return false;
+    }
+    if (*text >= '0' && *text <= '9' && !parse_unsigned(text, &text, &interval)) {
+        return false;
+    }
+    if (strncmp(text, "ms", 2) == 0) {
+        text += 2;
+    }
+    else if (*text == 's') {
+        interval *= 1000;
+        text++;
+    }
+    else if (*text == 'm') {
+        interval *= 60000;
+        text++;
+    }
+    rate->interval = interval;
+    rate->burst = rate->runs;
+    if (*text == ':' && !parse_unsigned(text + 1, &text, &rate->burst)) {
+        return false;
+    }
+    if (*text != '\0' || interval == 0 || (rate->runs && rate->burst == 0)) {
+        rule_error("Invalid rate '%s', expected RUNS/INTERVAL[:BURST]\n", value);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Parse the bounds of an adaptive debounce.
+ * @details The form is MIN:MAX in milliseconds.
+ *
+ * @param value The text.
+ * @param adapt Receives the bounds.
+ * @return bool True if the bounds are valid.
+ */
+static bool parse_bounds(const char *value, rule_adapt_t *adapt) {
+    const char *text;
+
+    if (!parse_unsigned(value, &text, &adapt->min) || *text != ':' ||
+        !parse_unsigned(text + 1, NULL, &adapt->max) || adapt->max == 0 || adapt->min > adapt->max) {
+        rule_error("Invalid bounds '%s', expected MIN:MAX\n", value);
+        adapt->max = 0;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Parse a nice value.
+ *
+ * @param value The text.
+ * @param place Receives the nice value.
+ * @return bool True if the value is valid.
+ */
+static bool parse_nice(const char *value, rule_place_t *place) {
+    char *end;
+    long nice = strtol(value, &end, 10);
+    if (end == value || *end != '\0' || nice < -20 || nice > 19) {
+        rule_error("Invalid nice value '%s', expected -20 to 19\n", value);
+        return false;
+    }
+    place->nice = (int)nice;
+    place->niced = true;
+    return true;
+}
+
+/**
+ * @brief Parse an I/O priority.
+ * @details The form is idle, be[:LEVEL] or rt[:LEVEL], where the level
+ * runs from 0 (highest) to 7 and defaults to 4.
+ *
+ * @param value The text.
+ * @param place Receives the encoded priority.
+ * @return bool True if the priority is valid.
+ */
+static bool parse_ioprio(const char *value, rule_place_t *place) {
+    static const char *classes[] = { "rt", "be", "idle" };
+    unsigned level = 4;
+    size_t len = strcspn(value, ":");
+
+    for (int class = 0; class < 3; class++) {
+        if (strlen(classes[class]) != len || strncmp(value, classes[class], len) != 0) {
+            continue;
+        }
+        if (value[len] == ':' && (class == 2 || !parse_unsigned(value + len + 1, NULL, &level) || level > 7)) {
+            break;
+        }
+        place->ioprio = ((class + 1) << 13) | (class == 2 ? 0 : (int)level);
+        return true;
+    }
+    rule_error("Invalid I/O priority '%s', expected idle, be[:0-7] or rt[:0-7]\n", value);
+    return false;
+}
+
+/**
+ * @brief Parse a CPU limit.
+ * @details The form is QUOTA[/PERIOD] in microseconds, the period
+ * defaulting to 100000, so 50000 is half of one CPU and 200000 is two.
+ *
+ * @param value The text.
+ * @param place Receives the limit.
+ * @return bool True if the limit is valid.
+ */
+static bool parse_cpu_max(const char *value, rule_place_t *place) {
+    const char *text;
+
+    place->cpu_period = 100000;
+    if (!parse_unsigned(value, &text, &place->cpu_quota) ||
+        (*text == '/' && !parse_unsigned(text + 1, &text, &place->cpu_period)) ||
+        *text != '\0' || place->cpu_quota < 1000 || place->cpu_period < 1000 || place->cpu_period > 1000000) {
+        rule_error("Invalid CPU limit '%s', expected QUOTA[/PERIOD] in us\n", value);
+        place->cpu_quota = 0;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Parse a memory limit.
+ * @details A number of bytes with an optional k, m or g unit.
+ *
+ * @param value The text.
+ * @param place Receives the limit.
+ * @return bool True if the limit is valid.
+ */
+static bool parse_memory_max(const char *value, rule_place_t *place) {
+    char *end;
+    unsigned long long bytes = strtoull(value, &end, 10);
+    const char *units = "kmg";
+    const char *unit = *end ? strchr(units, *end | 0x20) : NULL;
+
+    if (unit) {
+        bytes <<= 10 * (unit - units + 1);
+        end++;
+    }
+    if (end == value || *end != '\0' || bytes == 0) {
+        rule_error("Invalid memory limit '%s', expected BYTES[k|m|g]\n", value);
+        return false;
+    }
+    place->memory_max = bytes;
+    return true;
+}
+
+/**
+ * @brief Replace a string option.
+ *
+ * @param field The option to set.
+ * @param value The new value.
+ * @return bool False if memory is exhausted.
+ */
+static bool set_string(char **field, const char *value) {
+    char *copy = strdup(value);
+    if (copy == NULL) {
+        perror("Failed to set option");
+        return false;
+    }
+    free(*field);
+    *field = copy;
+    return true;
+}
+
+/**
+ * @brief Find a rule option by name.
+ *
+ * @param name The option name.
+ * @return const rule_name_t* The option, or NULL if there is none of that name.
+ */
+static const rule_name_t *find_option(const char *name) {
+    for (size_t index = 0; index < sizeof(s_options) / sizeof(s_options[0]); index++) {
+        if (strcmp(name, s_options[index].name) == 0) {
+            return &s_options[index];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Set a rule option by name.
+ * @details Flags take NULL (or "true"/"false") as their value.
+ *
+ * @param rule The rule.
+ * @param name The option name, as its long command line form.
+ * @param value The option value.
+ * @return bool True if the option and its value are valid.
+ */
+bool rule_option(watch_rule_t *rule, const char *name, const char *value) {
+    bool flag = value == NULL || strcmp(value, "true") == 0;
+
+    const rule_name_t *known = find_option(name);
+
+    if (known == NULL) {
+        rule_error("Unknown rule option '%s'\n", name);
+        return false;
+    }
+    if (value == NULL && !known->flag) {
+        rule_error("--%s needs a value\n", name);
+        return false;
+    }
+    if (strcmp(name, "file") == 0) {
+        // A trailing separator would stop paths matching the target.
+        size_t len = strlen(value);
+        while (len > 1 && value[len - 1] == '/') {
+            len--;
+        }
+        char *target = strndup(value, len);
+        if (target == NULL) {
+            perror("Failed to set option");
+            return false;
+        }
+        free(rule->target);
+        rule->target = target;
+        return true;
+    }
+    if (strcmp(name, "exec") == 0) {
+        return set_string(&rule->command, value);
+    }
+    if (strcmp(name, "name") == 0) {
+        return set_string(&rule->name, value);
+    }
+    if (strcmp(name, "debounce") == 0) {
+        return parse_unsigned(value, NULL, &rule->policy.debounce);
+    }
+    if (strcmp(name, "max-latency") == 0) {
+        return parse_unsigned(value, NULL, &rule->policy.max_latency);
+    }
+    if (strcmp(name, "jobs") == 0) {
+        if (!parse_unsigned(value, NULL, &rule->policy.jobs)) {
+            return false;
+        }
+        if (rule->policy.jobs == 0 || rule->policy.jobs > WATCH_MAX_JOBS) {
+            rule_error("--jobs must be between 1 and %d\n", WATCH_MAX_JOBS);
+            return false;
+        }
+        return true;
+    }
+    if (strcmp(name, "rate") == 0) {
+        return parse_rate(value, &rule->rate);
+    }
+    if (strcmp(name, "adaptive") == 0) {
+        return parse_bounds(value, &rule->adapt);
+    }
+    if (strcmp(name, "recursive") == 0) {
+        rule->recursive = flag;
+        return true;
+    }
+    if (strcmp(name, "follow-symlinks") == 0) {
+        rule->follow = flag;
+        return true;
+    }
+    if (strcmp(name, "await") == 0) {
+        rule->await = flag;
+        return true;
+    }
+    if (strcmp(name, "background") == 0) {
+        rule->background = flag;
+        return true;
+    }
+    if (strcmp(name, "nice") == 0) {
+        return parse_nice(value, &rule->place);
+    }
+    if (strcmp(name, "ioprio") == 0) {
+        return parse_ioprio(value, &rule->place);
+    }
+    if (strcmp(name, "cpus") == 0) {
+        return set_string(&rule->place.cpus, value);
+    }
+    if (strcmp(name, "cpu-max") == 0) {
+        return parse_cpu_max(value, &rule->place);
+    }
+    if (strcmp(name, "memory-max") == 0) {
+        return parse_memory_max(value, &rule->place);
+    }
+    if (strcmp(name, "interactive") == 0) {
+        rule->interactive = flag;
+        return true;
+    }
+    if (strcmp(name, "priority") == 0) {
+        if (!parse_unsigned(value, NULL, &rule->priority) || rule->priority > WATCH_MAX_PRIORITY) {
+            rule_error("--priority must be between 0 and %d\n", WATCH_MAX_PRIORITY);
+            return false;
+        }
+        return true;
+    }
+    if (strcmp(name, "weight") == 0) {
+        if (!parse_unsigned(value, NULL, &rule->weight) || rule->weight == 0 || rule->weight > WATCH_MAX_WEIGHT) {
+            rule_error("--weight must be between 1 and %d\n", WATCH_MAX_WEIGHT);
+            return false;
+        }
+        return true;
+    }
+    if (strcmp(name, "changed-ranges") == 0) {
+        rule->changed_ranges = flag;
+        return true;
+    }
+    if (strcmp(name, "if-tree-changed") == 0) {
+        rule->tree_check = flag;
+        return true;
+    }
+    if (strncmp(name, "if-", 3) == 0) {
+        return predicate_option(&rule->predicate, name, value);
+    }
+    if (strcmp(name, "signal") == 0 || strcmp(name, "signal-to") == 0) {
+        return procsignal_option(&rule->signal, name, value);
+    }
+    rule_error("Unknown rule option '%s'\n", name);
+    return false;
+}
+
+/**
+ * @brief Check if a path is watched by a rule.
+ *
+ * @param rule The rule.
+ * @param path The path.
+ * @return bool True if the path is the target, or lies within it.
+ */
+bool rule_covers(const watch_rule_t *rule, const char *path) {
+    size_t len = strlen(rule->target);
+
+    if (strncmp(path, rule->target, len) != 0) {
+        return false;
+    }
+    const char *rest = path + len;
+    if (*rest == '\0') {
+        return true;
+    }
+    if (strcmp(rule->target, "/") != 0) {
+        if (*rest != '/') {
+            return false;
+        }
+        rest++;
+    }
+    return rule->recursive || strchr(rest, '/') == NULL;
+}
+
+/**
+ * @brief Return the time the rate limit next allows a run.
+ *
+ * @param rule The rule.
+ * @return uint64_t The time in microseconds, 0 if a run is allowed at any time.
+ */
+uint64_t rule_rate_ready(const watch_rule_t *rule) {
+    const rule_rate_t *rate = &rule->rate;
+
+    if (rate->runs == 0) {
+        return 0;
+    }
+    uint64_t period = (uint64_t)rate->interval * 1000 / rate->runs;
+    uint64_t tolerance = period * (rate->burst - 1);
+    return rule->rate_tat > tolerance ? rule->rate_tat - tolerance : 0;
+}
+
+/**
+ * @brief Take a token from the bucket for a run.
+ *
+ * @param rule The rule.
+ * @param now The time of the run.
+ */
+void rule_rate_take(watch_rule_t *rule, uint64_t now) {
+    const rule_rate_t *rate = &rule->rate;
+
+    if (rate->runs) {
+        uint64_t period = (uint64_t)rate->interval * 1000 / rate->runs;
+        rule->rate_tat = (rule->rate_tat > now ? rule->rate_tat : now) + period;
+    }
+}
+
+/**
+ * @brief Check if two rules watch the same thing.
+ *
+ * @param rule The rule.
+ * @param other The rule to compare with.
+ * @return bool True if the target and the way it is watched are the same.
+ */
+bool rule_same_watch(const watch_rule_t *rule, const watch_rule_t *other) {
+    return rule->target && other->target && strcmp(rule->target, other->target) == 0 &&
+           rule->recursive == other->recursive && rule->follow == other->follow && rule->await == other->await;
+}
+
+/**
+ * @brief Take the configuration of another rule that watches the same thing.
+ * @details The command, signal, policy, limits, placement and predicate
+ * are swapped, so the other rule holds the old ones and can be destroyed.
+ * The pending changes, running commands and statistics stay with the
+ * rule. The adaptive measurements start again.
+ *
+ * @param rule The rule.
+ * @param from The rule with the new configuration.
+ */
+void rule_update(watch_rule_t *rule, watch_rule_t *from) {
+    char *command = rule->command;
+    rule_place_t place = rule->place;
+    predicate_t predicate = rule->predicate;
+    procsignal_t signal = rule->signal;
+
+    rule->command = from->command;
+    from->command = command;
+    rule->place = from->place;
+    from->place = place;
+    rule->predicate = from->predicate;
+    from->predicate = predicate;
+    rule->signal = from->signal;
+    from->signal = signal;
+    // The hashes of the same byte range still hold.
+    if (rule->predicate.ranged && predicate.ranged && rule->predicate.range_offset == predicate.range_offset &&
+        rule->predicate.range_length == predicate.range_length) {
+        rule->predicate.seen = predicate.seen;
+        from->predicate.seen = NULL;
+    }
+    rule->policy = from->policy;
+    rule->rate = from->rate;
+    rule->adapt = from->adapt;
+    rule->background = from->background;
+    rule->interactive = from->interactive;
+    rule->tree_check = from->tree_check;
+    // The chunks of the files at the last run still hold.
+    if (!from->changed_ranges) {
+        chunks_free(rule->chunks);
+        rule->chunks = NULL;
+    }
+    rule->changed_ranges = from->changed_ranges;
+    rule->priority = from->priority;
+    rule->weight = from->weight;
+}
+
+/**
+ * @brief Release every rule.
+ *
+ */
+void rules_free(void) {
+    for (int index = 0; index < s_rule_count; index++) {
+        rule_destroy(s_rules[index]);
+        s_rules[index] = NULL;
+    }
+    s_rule_count = 0;
+}
+
+/* End. */
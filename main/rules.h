@@ -0,0 +1,208 @@
+/**
+ * @file rules.h
+ * @author Mark Lehane (markdlehane@gmail.com)
+ * @brief Watch rule interface.
+ * @details A rule is a target, the command to run when it changes and
+ * the policy deciding when and how often it runs, together with the
+ * dispatch state and statistics of the rule.
+ *
+ * @version 0.1
+ * @date 2025-12-14
+ *
+ * @copyright Copyright (c) 2025, Mark D Lehane.
+ *
+ */
+
+#ifndef RULES_H
+#define RULES_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "watch.h"
+#include "changeset.h"
+#include "pathwait.h"
+#include "predicate.h"
+#include "procsignal.h"
+#include "chunks.h"
+
+// The bit for a rule in a rule mask.
+#define RULE_BIT(rule) (1ULL << (rule)->index)
+
+/**
+ * @brief Rate limit.
+ * @details A token bucket holding up to burst runs that refills at
+ * runs per interval. A rule with no limit has runs set to 0.
+ *
+ */
+typedef struct rule_rate_s {
+    unsigned runs;              // Runs allowed per interval, 0 for no limit.
+    unsigned interval;          // Refill interval (ms).
+    unsigned burst;             // Bucket size (runs).
+
+} rule_rate_t;
+
+/**
+ * @brief Adaptive policy.
+ * @details Smoothed measurements of a rule from which its debounce and
+ * concurrency are set, within the configured bounds.
+ *
+ */
+typedef struct rule_adapt_s {
+    unsigned min;               // Least debounce (ms).
+    unsigned max;               // Greatest debounce (ms), 0 when not adaptive.
+    unsigned max_jobs;          // Greatest concurrency, the configured --jobs.
+    uint64_t gap;               // Smoothed gap between the changes of a burst (us).
+    uint64_t runtime;           // Smoothed command run time (us).
+    uint64_t interval;          // Smoothed interval between wanted runs (us).
+    uint64_t last_event;        // Time of the previous change event, or 0.
+    uint64_t last_run;          // Time the previous run was wanted, or 0.
+    uint64_t waiting;           // Time the next run began to wait for one of the rule's slots, or 0.
+    bool waited;                // The latest run waited for a job slot.
+
+} rule_adapt_t;
+
+/**
+ * @brief Run placement.
+ * @details The scheduling and I/O priority, CPUs and cgroup limits the
+ * commands of a rule run with.
+ *
+ */
+typedef struct rule_place_s {
+    bool niced;                 // The nice value is set.
+    int nice;                   // Nice value (-20 to 19).
+    int ioprio;                 // I/O priority (class << 13 | level), 0 to inherit.
+    char *cpus;                 // CPUs the command may run on (a CPU list), or NULL for any.
+    unsigned cpu_quota;         // CPU time allowed per period (us), 0 for no limit.
+    unsigned cpu_period;        // CPU limit period (us).
+    unsigned long long memory_max; // Memory limit (bytes), 0 for no limit.
+
+} rule_place_t;
+
+/**
+ * @brief Resource usage of the runs of a rule.
+ * @details Totals over the completed runs, from the rusage reported
+ * when each command is reaped, which includes the processes the
+ * command waited for.
+ *
+ */
+typedef struct rule_usage_s {
+    unsigned long measured;     // Completed runs.
+    uint64_t wall;              // Total run time (us).
+    uint64_t wall_max;          // Longest run time (us).
+    uint64_t user;              // User CPU time (us).
+    uint64_t sys;               // System CPU time (us).
+    long maxrss;                // Largest resident set of a run (KiB).
+    unsigned long inblock;      // File system blocks read.
+    unsigned long oublock;      // File system blocks written.
+    unsigned long nvcsw;        // Voluntary context switches.
+    unsigned long nivcsw;       // Involuntary context switches.
+
+} rule_usage_t;
+
+// The number of bounded buckets in a rule histogram.
+#define RULE_BUCKETS 12
+
+/**
+ * @brief A histogram of times.
+ * @details Each bucket counts the observations at or under its bound
+ * and over the bound before; the bounds are set by the statistics.
+ *
+ */
+typedef struct rule_histogram_s {
+    unsigned long buckets[RULE_BUCKETS];
+    unsigned long count;        // All observations, including those over the last bound.
+    uint64_t sum;               // Sum of the observations (us).
+
+} rule_histogram_t;
+
+/**
+ * @brief Rule statistics.
+ *
+ */
+typedef struct rule_stats_s {
+    unsigned long events;       // Change events seen.
+    unsigned long runs;         // Commands dispatched.
+    unsigned long failures;     // Runs that exited with a non-zero status.
+    unsigned long suppressed;   // Runs held back by the rate limit.
+    unsigned long merged;       // Change events merged into a held run.
+    uint64_t held;              // Time runs were held by the rate limit (us).
+    unsigned long deferred;     // Runs deferred by host pressure.
+    unsigned long filtered;     // Runs skipped as no change met the predicate.
+    uint64_t deferred_time;     // Time runs were deferred by host pressure (us).
+    rule_usage_t usage;         // Resources used by the runs.
+    rule_histogram_t runtime;   // Command run times.
+    rule_histogram_t latency;   // Times from the first change to the run.
+    unsigned long queued;       // Due runs that waited for a job slot.
+    rule_histogram_t queue;     // Times due runs waited for a job slot.
+    unsigned long coarsened;    // Change sets cut down to directories at the memory cap.
+    unsigned long collapsed;    // Change sets given up for the whole target at the memory cap.
+
+} rule_stats_t;
+
+/**
+ * @brief A watch rule.
+ *
+ */
+typedef struct watch_rule_s {
+    int index;                  // Position in the rule table, the bit in rule masks.
+    char *name;                 // Name used in reports.
+    char *target;               // File or directory to watch.
+    char *command;              // Command to execute on change.
+    watch_policy_t policy;      // When and how often to run the command.
+    rule_rate_t rate;           // Most runs allowed per interval.
+    rule_adapt_t adapt;         // Adaptive debounce and concurrency.
+    rule_place_t place;         // Priority, CPUs and limits of the command.
+    predicate_t predicate;      // Conditions a changed file must meet for a run.
+    procsignal_t signal;        // Signal to send on change, with or instead of the command.
+    bool tree_check;            // Run only if the hash of the target's tree changed.
+    uint64_t tree_hash;         // The hash of the target's tree when it was last due.
+    bool changed_ranges;        // Give the command the byte ranges that changed.
+    chunks_t *chunks;           // The chunk hashes of the files at the last run.
+    bool recursive;             // Watch the whole directory tree.
+    bool follow;                // Follow symbolic links to directories in the tree.
+    bool await;                 // Wait for the target to be created.
+    bool background;            // Defer runs while the host is under pressure.
+    bool interactive;           // Run in the lane with a reserved job slot.
+    unsigned priority;          // Order among due rules, highest first.
+    unsigned weight;            // Share of the job slots when rules compete.
+    bool configured;            // Read from the config file, replaced when it is reloaded.
+    bool retired;               // Removed by a reload, kept until its commands finish.
+
+    int pending;                // Change events awaiting a run.
+    uint64_t first_event;       // Time of the oldest pending change event.
+    uint64_t last_event;        // Time of the most recent change event.
+    unsigned running;           // Commands currently running.
+    uint64_t rate_tat;          // Time the bucket is next full (theoretical arrival time).
+    uint64_t held_since;        // Time a due run was first held by the rate limit, or 0.
+    uint64_t deferred_since;    // Time a due run was first deferred by pressure, or 0.
+    uint64_t queued_since;      // Time a due run first waited for a job slot, or 0.
+    uint64_t finish_tag;        // Virtual time the latest run finishes, for fair queuing.
+    bool awaiting;              // Waiting for the target to be created.
+    pathwait_t *wait;           // The wait for the target, while awaiting.
+    changeset_t *changes;       // The paths changed since the last run.
+    rule_stats_t stats;
+
+} watch_rule_t;
+
+extern watch_rule_t *rule_new(void);
+extern watch_rule_t *rule_alloc(void);
+extern bool rule_adopt(watch_rule_t *rule);
+extern void rule_destroy(watch_rule_t *rule);
+extern watch_rule_t *rule_at(int index);
+extern int rule_count(void);
+extern void rule_where(const char *where);
+extern bool rule_reported(void);
+extern void rule_error(const char *format, ...) __attribute__((format(printf, 1, 2)));
+extern bool rule_option(watch_rule_t *rule, const char *name, const char *value);
+extern bool rule_covers(const watch_rule_t *rule, const char *path);
+extern bool rule_same_watch(const watch_rule_t *rule, const watch_rule_t *other);
+extern void rule_update(watch_rule_t *rule, watch_rule_t *from);
+extern uint64_t rule_rate_ready(const watch_rule_t *rule);
+extern void rule_rate_take(watch_rule_t *rule, uint64_t now);
+extern void rules_free(void);
+
+#endif
+
+/* End. */
@@ -0,0 +1,917 @@
+/**
+ * @file snapshot.c
+ * @author Mark Lehane (markdlehane@gmail.com)
+ * @brief Tree snapshot functions.
+ * @details This module keeps a snapshot of the watched targets: for
+ * every path its inode, size and modification time, in an open
+ * addressing hash table keyed by path. A rescan walks the targets again,
+ * reports each path that was added, removed or modified since the
+ * snapshot and brings the snapshot up to date. This is how the watcher
+ * catches up after it has stopped looking at individual events.
+ *
+ * A full rescan stats every path. An incremental rescan stats only the
+ * directories, as a directory's modification time changes when an entry
+ * is added, removed or renamed in it; it lists only the directories that
+ * changed or that the caller marked (a file written in place changes no
+ * directory, but its event names the directory), and stats only their
+ * entries. The number of entries each directory had when it was last
+ * listed tells whether any went, so the table is only searched for
+ * removed paths under the directories that lost some. The stats and
+ * listings of each pass are shared among threads, one per allowed CPU;
+ * the table itself is only touched by the calling thread.
+ *
+ * @version 0.1
+ * @date 2025-12-08
+ *
+ * @copyright Copyright (c) 2025, Mark D Lehane.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <linux/limits.h>
+
+#include "snapshot.h"
+#include "watch.h"
+
+/**
+ * @brief A snapshot entry.
+ *
+ */
+typedef struct snap_entry_s {
+    char *path;             // NULL for an empty slot.
+    uint64_t hash;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    int64_t mtime;          // Nanoseconds.
+    uint32_t seen;          // The pass that last found the path.
+    uint32_t listed;        // The pass that last listed the directory.
+    uint32_t count;         // Entries in the directory when it was last listed.
+    bool is_dir;
+    bool dirty;             // The directory has to be listed by the next rescan.
+    bool gone;              // To be dropped from the table.
+
+} snap_entry_t;
+
+/**
+ * @brief A target in the snapshot.
+ *
+ */
+typedef struct snap_root_s {
+    char *path;
+    bool recursive;
+    bool follow;            // Follow links to directories.
+
+} snap_root_t;
+
+/**
+ * @brief A path to stat or a directory to list, for the scan threads.
+ *
+ */
+typedef struct snap_job_s {
+    const char *path;       // Held by the table or the roots.
+    bool list;              // List the directory rather than stat the path.
+    bool root;              // The path is a target.
+    bool recursive;         // Walk the directories found in it.
+    bool follow;            // Follow links in it.
+    int status;             // 0 if the stat or listing succeeded.
+    struct stat st;         // The status, for a stat.
+    char *names;            // The entry names, each ending in a NUL.
+    size_t names_len;
+    size_t names_cap;
+    struct stat *stats;     // The status of each entry.
+    size_t count;           // The number of entries.
+    size_t cap;
+
+} snap_job_t;
+
+/**
+ * @brief A list of jobs.
+ *
+ */
+typedef struct snap_jobs_s {
+    snap_job_t *jobs;
+    size_t count;
+    size_t cap;
+
+} snap_jobs_t;
+
+/**
+ * @brief Jobs shared among the scan threads.
+ *
+ */
+typedef struct snap_pool_s {
+    snap_job_t *jobs;
+    size_t count;
+    atomic_size_t next;
+
+} snap_pool_t;
+
+// Local constants.
+#define SNAP_MIN_CAPACITY 1024
+#define SNAP_MAX_THREADS 8          // Most threads a pass is shared among.
+#define SNAP_THREAD_JOBS 16         // Fewest jobs worth another thread.
+#define SNAP_MAX_PRUNED 64          // Most directories searched for removed paths, then all are.
+
+// Local data.
+static snap_entry_t *s_table = NULL;
+static size_t s_capacity = 0;
+static size_t s_used = 0;
+static snap_root_t s_roots[WATCH_MAX_RULES];
+static int s_root_count = 0;
+static uint32_t s_pass = 1;
+static unsigned s_threads = 0;
+static unsigned long s_listed = 0;
+static unsigned long s_statted = 0;
+static const char *s_pruned[SNAP_MAX_PRUNED];
+static int s_pruned_count = 0;
+
+/**
+ * @brief Hash a path (64 bit FNV-1a).
+ *
+ * @param path The path.
+ * @return uint64_t The hash.
+ */
+static uint64_t hash_path(const char *path) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    while (*path) {
+        hash ^= (unsigned char)*path++;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/**
+ * @brief Find the slot for a path.
+ *
+ * @param table The table to search.
+ * @param capacity The table capacity (a power of two).
+ * @param path The path.
+ * @param hash The hash of the path.
+ * @return snap_entry_t* The entry holding the path, or the empty slot where it belongs.
+ */
+static snap_entry_t *find_slot(snap_entry_t *table, size_t capacity, const char *path, uint64_t hash) {
+    size_t mask = capacity - 1;
+    size_t slot = hash & mask;
+    while (table[slot].path && (table[slot].hash != hash || strcmp(table[slot].path, path) != 0)) {
+        slot = (slot + 1) & mask;
+    }
+    return &table[slot];
+}
+
+/**
+ * @brief Find the entry of a path.
+ *
+ * @param path The path.
+ * @return snap_entry_t* The entry, or NULL if the path is not in the snapshot.
+ */
+static snap_entry_t *find(const char *path) {
+    snap_entry_t *entry = find_slot(s_table, s_capacity, path, hash_path(path));
+    return entry->path ? entry : NULL;
+}
+
+/**
+ * @brief Resize the table, dropping the entries that have gone if asked.
+ * @details The paths of the entries kept do not move.
+ *
+ * @param capacity The new capacity (a power of two).
+ * @param drop_gone True to drop the entries marked as gone.
+ * @return bool False if memory is exhausted.
+ */
+static bool rebuild(size_t capacity, bool drop_gone) {
+    snap_entry_t *table = calloc(capacity, sizeof(*table));
+    if (table == NULL) {
+        return false;
+    }
+    s_used = 0;
+    for (size_t i = 0; i < s_capacity; i++) {
+        snap_entry_t *entry = &s_table[i];
+        if (entry->path == NULL) {
+            continue;
+        }
+        if (drop_gone && entry->gone) {
+            free(entry->path);
+            continue;
+        }
+        *find_slot(table, capacity, entry->path, entry->hash) = *entry;
+        s_used++;
+    }
+    free(s_table);
+    s_table = table;
+    s_capacity = capacity;
+    return true;
+}
+
+/**
+ * @brief Record a path, reporting a change if it differs from the snapshot.
+ * @details A directory that changed is marked to be listed.
+ *
+ * @param path The path.
+ * @param st The status of the path.
+ * @param on_change The change callback, NULL while taking the snapshot.
+ * @return long 1 if the path changed, otherwise 0.
+ */
+static long visit(const char *path, const struct stat *st, snap_change_fn on_change) {
+    if ((s_used + 1) * 2 > s_capacity && !rebuild(s_capacity * 2, false)) {
+        return 0;
+    }
+    uint64_t hash = hash_path(path);
+    snap_entry_t *entry = find_slot(s_table, s_capacity, path, hash);
+    int64_t mtime = (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+    bool is_dir = S_ISDIR(st->st_mode);
+    long changed = 0;
+
+    if (entry->path == NULL) {
+        entry->path = strdup(path);
+        if (entry->path == NULL) {
+            return 0;
+        }
+        entry->hash = hash;
+        s_used++;
+        if (on_change) {
+            on_change(path, is_dir, SNAP_ADDED);
+            changed = 1;
+        }
+    }
+    else if (entry->dev != st->st_dev || entry->ino != st->st_ino ||
+             entry->size != st->st_size || entry->mtime != mtime) {
+        // Directory times change with their content, which is reported in its own right.
+        if (on_change && !(is_dir && entry->is_dir && entry->ino == st->st_ino)) {
+            on_change(path, is_dir, SNAP_MODIFIED);
+            changed = 1;
+        }
+        entry->dirty = entry->dirty || is_dir;
+    }
+    entry->dev = st->st_dev;
+    entry->ino = st->st_ino;
+    entry->size = st->st_size;
+    entry->mtime = mtime;
+    entry->is_dir = is_dir;
+    entry->seen = s_pass;
+    entry->gone = false;
+    return changed;
+}
+
+/**
+ * @brief Check if a directory is already on its own path.
+ * @details The directories above it were visited before it, by this
+ * pass, so their entries hold what they are now.
+ *
+ * @param path The directory path.
+ * @param st The directory status.
+ * @return bool True if following the directory would be a cycle.
+ */
+static bool cycle(const char *path, const struct stat *st) {
+    char parent[PATH_MAX];
+    char *slash;
+
+    strcpy(parent, path);
+    while ((slash = strrchr(parent, '/')) != NULL && slash != parent) {
+        *slash = '\0';
+        const snap_entry_t *entry = find(parent);
+        if (entry == NULL) {
+            break;
+        }
+        if (entry->is_dir && entry->dev == st->st_dev && entry->ino == st->st_ino) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Add a job to a list.
+ *
+ * @param list The list.
+ * @param path The path, held for the life of the job.
+ * @param list_dir True to list the directory, false to stat the path.
+ * @param recursive True to walk the directories found in it.
+ * @param follow True to follow links in it.
+ * @return snap_job_t* The job, or NULL if memory is exhausted.
+ */
+static snap_job_t *push_job(snap_jobs_t *list, const char *path, bool list_dir, bool recursive, bool follow) {
+    if (list->count == list->cap) {
+        size_t cap = list->cap ? list->cap * 2 : 64;
+        snap_job_t *jobs = realloc(list->jobs, cap * sizeof(*jobs));
+        if (jobs == NULL) {
+            return NULL;
+        }
+        list->jobs = jobs;
+        list->cap = cap;
+    }
+    snap_job_t *job = &list->jobs[list->count++];
+    memset(job, 0, sizeof(*job));
+    job->path = path;
+    job->list = list_dir;
+    job->recursive = recursive;
+    job->follow = follow;
+    return job;
+}
+
+/**
+ * @brief Release a list of jobs.
+ *
+ * @param list The list.
+ */
+static void free_jobs(snap_jobs_t *list) {
+    for (size_t index = 0; index < list->count; index++) {
+        free(list->jobs[index].names);
+        free(list->jobs[index].stats);
+    }
+    free(list->jobs);
+    memset(list, 0, sizeof(*list));
+}
+
+/**
+ * @brief Add an entry to a directory listing.
+ *
+ * @param job The listing.
+ * @param name The entry name.
+ * @param st The entry status.
+ * @return bool False if memory is exhausted.
+ */
+static bool add_child(snap_job_t *job, const char *name, const struct stat *st) {
+    size_t len = strlen(name) + 1;
+
+    if (job->count == job->cap) {
+        size_t cap = job->cap ? job->cap * 2 : 32;
+        struct stat *stats = realloc(job->stats, cap * sizeof(*stats));
+        if (stats == NULL) {
+            return false;
+        }
+        job->stats = stats;
+        job->cap = cap;
+    }
+    if (job->names_len + len > job->names_cap) {
+        size_t cap = job->names_cap ? job->names_cap * 2 : 1024;
+        while (cap < job->names_len + len) {
+            cap *= 2;
+        }
+        char *names = realloc(job->names, cap);
+        if (names == NULL) {
+            return false;
+        }
+        job->names = names;
+        job->names_cap = cap;
+    }
+    memcpy(job->names + job->names_len, name, len);
+    job->names_len += len;
+    job->stats[job->count++] = *st;
+    return true;
+}
+
+/**
+ * @brief Stat a path or list a directory, on a scan thread.
+ * @details Links are seen as themselves unless the job follows them,
+ * in which case they are seen as what they point at. A target is always
+ * seen as what it points at. A listing that could not be completed fails
+ * as a whole, so that no entry is taken to have gone.
+ *
+ * @param job The job.
+ */
+static void run_job(snap_job_t *job) {
+    struct dirent *entry;
+    struct stat st;
+
+    if (!job->list) {
+        job->status = fstatat(AT_FDCWD, job->path, &job->st, job->root ? 0 : AT_SYMLINK_NOFOLLOW);
+        if (job->status == 0 && job->follow && S_ISLNK(job->st.st_mode)) {
+            // A dangling link is still a path.
+            fstatat(AT_FDCWD, job->path, &job->st, 0);
+        }
+        return;
+    }
+    DIR *dir = opendir(job->path);
+    if (dir == NULL) {
+        job->status = -1;
+        return;
+    }
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0 ||
+            fstatat(dirfd(dir), entry->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+            continue;
+        }
+        if (job->follow && S_ISLNK(st.st_mode)) {
+            fstatat(dirfd(dir), entry->d_name, &st, 0);
+        }
+        if (!add_child(job, entry->d_name, &st)) {
+            job->status = -1;
+            break;
+        }
+    }
+    closedir(dir);
+}
+
+/**
+ * @brief Run jobs until there are none left.
+ *
+ * @param arg The pool.
+ * @return void* NULL.
+ */
+static void *run_pool(void *arg) {
+    snap_pool_t *pool = arg;
+    size_t index;
+
+    while ((index = atomic_fetch_add(&pool->next, 1)) < pool->count) {
+        run_job(&pool->jobs[index]);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Run a list of jobs, shared among as many threads as help.
+ * @details The threads are those of the CPUs the watcher may run on,
+ * so a watcher pinned to one CPU scans on its own.
+ *
+ * @param list The jobs.
+ */
+static void run_jobs(snap_jobs_t *list) {
+    pthread_t threads[SNAP_MAX_THREADS];
+    snap_pool_t pool = { .jobs = list->jobs, .count = list->count };
+    unsigned started = 0;
+
+    if (s_threads == 0) {
+        cpu_set_t cpus;
+        s_threads = sched_getaffinity(0, sizeof(cpus), &cpus) == 0 ? (unsigned)CPU_COUNT(&cpus) : 1;
+        s_threads = s_threads > SNAP_MAX_THREADS ? SNAP_MAX_THREADS : s_threads ? s_threads : 1;
+    }
+    atomic_init(&pool.next, 0);
+    while (started + 1 < s_threads && (started + 1) * SNAP_THREAD_JOBS < list->count &&
+           pthread_create(&threads[started], NULL, run_pool, &pool) == 0) {
+        started++;
+    }
+    run_pool(&pool);
+    for (unsigned index = 0; index < started; index++) {
+        pthread_join(threads[index], NULL);
+    }
+    for (size_t index = 0; index < list->count; index++) {
+        if (list->jobs[index].list) {
+            s_listed++;
+            s_statted += list->jobs[index].count;
+        }
+        else {
+            s_statted++;
+        }
+    }
+}
+
+/**
+ * @brief Note a directory whose removed entries have to be found.
+ *
+ * @param path The directory, held by the table.
+ */
+static void prune(const char *path) {
+    if (s_pruned_count < SNAP_MAX_PRUNED) {
+        s_pruned[s_pruned_count] = path;
+    }
+    s_pruned_count++;
+}
+
+/**
+ * @brief Record a directory listing.
+ * @details New directories found in a recursive listing are added to
+ * the next jobs. A directory that was in the snapshot is left to the
+ * directory pass of an incremental rescan, which has already decided
+ * whether it needs listing; when an entry was there before but is no
+ * longer what it was, or there are fewer entries than before, the
+ * removed paths have to be found.
+ *
+ * @param job The listing.
+ * @param next Receives the directories to list next.
+ * @param on_change The change callback, NULL while taking the snapshot.
+ * @param incremental True for an incremental rescan.
+ * @return long The number of changed paths.
+ */
+static long merge(const snap_job_t *job, snap_jobs_t *next, snap_change_fn on_change, bool incremental) {
+    char child[PATH_MAX];
+    const char *name = job->names;
+    uint32_t kept = 0;
+    long changed = 0;
+
+    for (size_t index = 0; index < job->count; index++, name += strlen(name) + 1) {
+        const struct stat *st = &job->stats[index];
+        if (snprintf(child, sizeof(child), "%s/%s", job->path, name) >= (int)sizeof(child)) {
+            continue;
+        }
+        const snap_entry_t *before = find(child);
+        bool existed = before != NULL;
+        bool was_dir = existed && before->is_dir;
+        bool same = existed && before->dev == st->st_dev && before->ino == st->st_ino;
+        changed += visit(child, st, on_change);
+        const snap_entry_t *entry = find(child);
+        if (entry == NULL) {
+            continue;
+        }
+        if (existed) {
+            kept++;
+            if (incremental && was_dir && !(S_ISDIR(st->st_mode) && same)) {
+                prune(entry->path);
+            }
+        }
+        if (job->recursive && S_ISDIR(st->st_mode) && !(incremental && was_dir) && !cycle(child, st)) {
+            push_job(next, entry->path, true, true, job->follow);
+        }
+    }
+    snap_entry_t *dir = find(job->path);
+    if (dir) {
+        if (incremental && kept < dir->count) {
+            prune(dir->path);
+        }
+        dir->count = (uint32_t)job->count;
+        dir->listed = s_pass;
+        dir->dirty = false;
+    }
+    return changed;
+}
+
+/**
+ * @brief List directories and all the new directories below them.
+ *
+ * @param level The first directories to list, released on return.
+ * @param on_change The change callback, NULL while taking the snapshot.
+ * @param incremental True for an incremental rescan.
+ * @return long The number of changed paths.
+ */
+static long walk(snap_jobs_t *level, snap_change_fn on_change, bool incremental) {
+    long changed = 0;
+
+    while (level->count) {
+        snap_jobs_t next = { 0 };
+        run_jobs(level);
+        for (size_t index = 0; index < level->count; index++) {
+            if (level->jobs[index].status == 0) {
+                changed += merge(&level->jobs[index], &next, on_change, incremental);
+            }
+        }
+        free_jobs(level);
+        *level = next;
+    }
+    free_jobs(level);
+    return changed;
+}
+
+/**
+ * @brief Stat targets, adding those that are directories to a list.
+ *
+ * @param roots The targets.
+ * @param count The number of targets.
+ * @param level Receives the directories to list.
+ * @param on_change The change callback, NULL while taking the snapshot.
+ * @return long The number of changed paths.
+ */
+static long stat_roots(const snap_root_t *roots, int count, snap_jobs_t *level, snap_change_fn on_change) {
+    snap_jobs_t stats = { 0 };
+    long changed = 0;
+
+    for (int root = 0; root < count; root++) {
+        snap_job_t *job = push_job(&stats, roots[root].path, false, roots[root].recursive, roots[root].follow);
+        if (job) {
+            job->root = true;
+        }
+    }
+    run_jobs(&stats);
+    for (size_t index = 0; index < stats.count; index++) {
+        const snap_job_t *job = &stats.jobs[index];
+        if (job->status == 0) {
+            changed += visit(job->path, &job->st, on_change);
+            const snap_entry_t *entry = find(job->path);
+            if (entry && entry->is_dir) {
+                push_job(level, entry->path, true, job->recursive, job->follow);
+            }
+        }
+    }
+    free_jobs(&stats);
+    return changed;
+}
+
+/**
+ * @brief Walk the whole of some targets.
+ * @details Targets may overlap; a path seen twice in one pass is only
+ * reported once, as the first visit brings its entry up to date.
+ *
+ * @param roots The targets.
+ * @param count The number of targets.
+ * @param on_change The change callback, NULL while taking the snapshot.
+ * @return long The number of changed paths.
+ */
+static long walk_roots(const snap_root_t *roots, int count, snap_change_fn on_change) {
+    snap_jobs_t level = { 0 };
+    long changed = stat_roots(roots, count, &level, on_change);
+
+    return changed + walk(&level, on_change, false);
+}
+
+/**
+ * @brief Add a target to the snapshot.
+ *
+ * @param target The file or directory.
+ * @param recursive True to include the whole directory tree.
+ * @param follow True to follow links to directories in the tree.
+ * @return bool False if memory is exhausted.
+ */
+bool snapshot_take(const char *target, bool recursive, bool follow) {
+    if (s_root_count == WATCH_MAX_RULES || (s_table == NULL && !rebuild(SNAP_MIN_CAPACITY, false))) {
+        return false;
+    }
+    snap_root_t *root = &s_roots[s_root_count];
+    root->path = strdup(target);
+    if (root->path == NULL) {
+        return false;
+    }
+    root->recursive = recursive;
+    root->follow = follow;
+    s_root_count++;
+    walk_roots(root, 1, NULL);
+    return true;
+}
+
+/**
+ * @brief Check if a path lies within a target.
+ *
+ * @param root The target.
+ * @param path The path.
+ * @return bool True if a walk of the target would visit the path.
+ */
+static bool root_covers(const snap_root_t *root, const char *path) {
+    size_t len = strlen(root->path);
+
+    if (strncmp(path, root->path, len) != 0) {
+        return false;
+    }
+    if (path[len] == '\0') {
+        return true;
+    }
+    if (strcmp(root->path, "/") != 0 && path[len++] != '/') {
+        return false;
+    }
+    return root->recursive || strchr(path + len, '/') == NULL;
+}
+
+/**
+ * @brief Remove a target from the snapshot.
+ * @details The paths it shares with the other targets are kept, so the
+ * rest of the snapshot needs no walk.
+ *
+ * @param target The file or directory.
+ * @param recursive True if the whole directory tree was included.
+ * @param follow True if links to directories were followed.
+ */
+void snapshot_drop(const char *target, bool recursive, bool follow) {
+    int found = 0;
+
+    while (found < s_root_count && (strcmp(s_roots[found].path, target) != 0 ||
+           s_roots[found].recursive != recursive || s_roots[found].follow != follow)) {
+        found++;
+    }
+    if (found == s_root_count) {
+        return;
+    }
+    free(s_roots[found].path);
+    s_roots[found] = s_roots[--s_root_count];
+    for (size_t i = 0; i < s_capacity; i++) {
+        snap_entry_t *entry = &s_table[i];
+        entry->gone = entry->path != NULL;
+        for (int root = 0; entry->path && entry->gone && root < s_root_count; root++) {
+            entry->gone = !root_covers(&s_roots[root], entry->path);
+        }
+    }
+    rebuild(s_capacity, true);
+}
+
+/**
+ * @brief Mark a directory to be listed by the next incremental rescan.
+ * @details The caller marks the directories that had events, so files
+ * written in place are found without statting every file.
+ *
+ * @param path The directory.
+ */
+void snapshot_mark(const char *path) {
+    if (s_table) {
+        snap_entry_t *entry = find(path);
+        if (entry && entry->is_dir) {
+            entry->dirty = true;
+        }
+    }
+}
+
+/**
+ * @brief Check whether the targets list a directory.
+ *
+ * @param path The directory.
+ * @param recursive Receives true if its directories are walked.
+ * @param follow Receives true if the links in it are followed.
+ * @return bool True if a walk of the targets would list the directory.
+ */
+static bool listed_by_roots(const char *path, bool *recursive, bool *follow) {
+    bool listed = false;
+
+    *recursive = false;
+    *follow = false;
+    for (int root = 0; root < s_root_count; root++) {
+        const snap_root_t *target = &s_roots[root];
+        if (strcmp(target->path, path) == 0 || (target->recursive && root_covers(target, path))) {
+            listed = true;
+            *recursive = *recursive || target->recursive;
+            *follow = *follow || target->follow;
+        }
+    }
+    return listed;
+}
+
+/**
+ * @brief Check if a path that was not found by this pass has gone.
+ * @details It has gone if the nearest directory above it that was found
+ * was listed by this pass, or is no longer a directory. Otherwise it is
+ * in a directory that was not listed and is taken to be unchanged.
+ *
+ * @param path The path.
+ * @return bool True if the path has gone.
+ */
+static bool gone(const char *path) {
+    char parent[PATH_MAX];
+    char *slash;
+
+    strcpy(parent, path);
+    while ((slash = strrchr(parent, '/')) != NULL && slash != parent) {
+        *slash = '\0';
+        const snap_entry_t *entry = find(parent);
+        if (entry == NULL) {
+            // It was a target, or within one, that has gone.
+            return true;
+        }
+        if (entry->seen == s_pass) {
+            return entry->listed == s_pass || !entry->is_dir;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Check if a path lies within one of the directories that lost entries.
+ *
+ * @param path The path.
+ * @return bool True if the path may have gone.
+ */
+static bool pruned(const char *path) {
+    if (s_pruned_count > SNAP_MAX_PRUNED) {
+        return true;
+    }
+    for (int index = 0; index < s_pruned_count; index++) {
+        size_t len = strlen(s_pruned[index]);
+        if (strncmp(path, s_pruned[index], len) == 0 && (path[len] == '\0' || path[len] == '/')) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Stat the directories, then list those that changed.
+ *
+ * @param on_change The change callback.
+ * @return long The number of changed paths.
+ */
+static long rescan_dirs(snap_change_fn on_change) {
+    snap_jobs_t dirs = { 0 };
+    snap_jobs_t level = { 0 };
+    long changed = 0;
+
+    // The targets are statted as they are, then every directory they list.
+    for (int root = 0; root < s_root_count; root++) {
+        snap_job_t *job = push_job(&dirs, s_roots[root].path, false, s_roots[root].recursive, s_roots[root].follow);
+        if (job) {
+            job->root = true;
+        }
+    }
+    for (size_t i = 0; i < s_capacity; i++) {
+        bool recursive;
+        bool follow;
+        const snap_entry_t *entry = &s_table[i];
+        if (entry->path && entry->is_dir && listed_by_roots(entry->path, &recursive, &follow)) {
+            bool root = false;
+            for (int index = 0; index < s_root_count && !root; index++) {
+                root = strcmp(s_roots[index].path, entry->path) == 0;
+            }
+            if (!root) {
+                push_job(&dirs, entry->path, false, recursive, follow);
+            }
+        }
+    }
+    run_jobs(&dirs);
+    for (size_t index = 0; index < dirs.count; index++) {
+        const snap_job_t *job = &dirs.jobs[index];
+        const snap_entry_t *before = find(job->path);
+        if (job->status != 0) {
+            if (job->root && before) {
+                prune(before->path);
+            }
+            continue;
+        }
+        bool was_dir = before && before->is_dir;
+        bool same = before && before->dev == job->st.st_dev && before->ino == job->st.st_ino;
+        changed += visit(job->path, &job->st, on_change);
+        if (job->root && was_dir && !(S_ISDIR(job->st.st_mode) && same)) {
+            prune(find(job->path)->path);
+        }
+    }
+
+    // List the directories that changed, and walk the new ones below them.
+    for (size_t index = 0; index < dirs.count; index++) {
+        bool recursive;
+        bool follow;
+        const snap_job_t *job = &dirs.jobs[index];
+        const snap_entry_t *entry = job->status == 0 ? find(job->path) : NULL;
+        if (entry && entry->is_dir && entry->dirty && listed_by_roots(entry->path, &recursive, &follow)) {
+            push_job(&level, entry->path, true, recursive, follow);
+        }
+    }
+    free_jobs(&dirs);
+    return changed + walk(&level, on_change, true);
+}
+
+/**
+ * @brief Rescan the targets and bring the snapshot up to date.
+ * @details An incremental rescan relies on every directory that had an
+ * event being marked; when events were lost, ask for a full rescan.
+ *
+ * @param on_change Called for each added, removed or modified path.
+ * @param full True to stat every path, false to list only the
+ * directories that changed or were marked.
+ * @return long The number of changed paths.
+ */
+long snapshot_rescan(snap_change_fn on_change, bool full) {
+    if (s_table == NULL) {
+        return 0;
+    }
+    s_pass++;
+    s_listed = 0;
+    s_statted = 0;
+    s_pruned_count = 0;
+    long changed = full ? walk_roots(s_roots, s_root_count, on_change) : rescan_dirs(on_change);
+
+    // A path not found again has gone, if the walk would have found it.
+    long removed = 0;
+    for (size_t i = 0; (full || s_pruned_count) && i < s_capacity; i++) {
+        snap_entry_t *entry = &s_table[i];
+        if (entry->path && entry->seen != s_pass && (full || (pruned(entry->path) && gone(entry->path)))) {
+            on_change(entry->path, entry->is_dir, SNAP_REMOVED);
+            entry->gone = true;
+            removed++;
+        }
+    }
+    if (removed) {
+        rebuild(s_capacity, true);
+    }
+    return changed + removed;
+}
+
+/**
+ * @brief Return the work done by the latest rescan.
+ *
+ * @param listed Receives the number of directories listed.
+ * @param statted Receives the number of paths statted.
+ */
+void snapshot_work(unsigned long *listed, unsigned long *statted) {
+    *listed = s_listed;
+    *statted = s_statted;
+}
+
+/**
+ * @brief Return the number of paths in the snapshot.
+ *
+ * @return unsigned long The path count.
+ */
+unsigned long snapshot_count(void) {
+    return (unsigned long)s_used;
+}
+
+/**
+ * @brief Release the snapshot.
+ *
+ */
+void snapshot_free(void) {
+    for (size_t i = 0; i < s_capacity; i++) {
+        free(s_table[i].path);
+    }
+    free(s_table);
+    s_table = NULL;
+    s_capacity = 0;
+    s_used = 0;
+    for (int root = 0; root < s_root_count; root++) {
+        free(s_roots[root].path);
+    }
+    s_root_count = 0;
+}
+
+/* End. */
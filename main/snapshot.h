@@ -0,0 +1,52 @@
+/**
+ * @file snapshot.h
+ * @author Mark Lehane (markdlehane@gmail.com)
+ * @brief Tree snapshot interface.
+ * @details Records the identity, size and modification time of every
+ * path under a target so that a later rescan can tell what changed
+ * without having seen the individual events, listing only the
+ * directories that changed or were marked unless asked for all.
+ *
+ * @version 0.1
+ * @date 2025-12-08
+ *
+ * @copyright Copyright (c) 2025, Mark D Lehane.
+ *
+ */
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdbool.h>
+
+/**
+ * @brief Enum used to identify the kind of change found by a rescan.
+ *
+ */
+typedef enum snap_change_e {
+    SNAP_ADDED = 0,
+    SNAP_REMOVED,
+    SNAP_MODIFIED
+
+} SNAP_CHANGE;
+
+/**
+ * @brief Rescan change callback.
+ *
+ * @param path The changed path.
+ * @param is_dir True if the path is a directory.
+ * @param change The kind of change.
+ */
+typedef void (*snap_change_fn)(const char *path, bool is_dir, SNAP_CHANGE change);
+
+extern bool snapshot_take(const char *target, bool recursive, bool follow);
+extern void snapshot_drop(const char *target, bool recursive, bool follow);
+extern void snapshot_mark(const char *path);
+extern long snapshot_rescan(snap_change_fn on_change, bool full);
+extern void snapshot_work(unsigned long *listed, unsigned long *statted);
+extern unsigned long snapshot_count(void);
+extern void snapshot_free(void);
+
+#endif
+
+/* End. */
@@ -0,0 +1,459 @@
+/**
+ * @file stats.c
+ * @author Mark Lehane (markdlehane@gmail.com)
+ * @brief Watch statistics functions.
+ * @details This module holds the counters for the watch as a whole and
+ * reports them, with the counters of each rule, when the watcher is
+ * sent SIGUSR1. Each rule is one line of name=value pairs so the report
+ * is easy to read and easy to grep, followed by the rules ranked by the
+ * mean run time and by the CPU time of their commands, and the paths
+ * and directories that change most when they are tracked. The same figures
+ * can be written as a JSON document for other tools to collect.
+ *
+ * @version 0.1
+ * @date 2025-12-14
+ *
+ * @copyright Copyright (c) 2025, Mark D Lehane.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <linux/limits.h>
+
+#include "stats.h"
+#include "rules.h"
+#include "adapt.h"
+#include "psi.h"
+#include "hot.h"
+#include "profile.h"
+
+// Local constants.
+#define STATS_RANKED 3
+#define STATS_HOT 10
+
+// Local data.
+static watch_stats_t s_stats = {0};
+static stats_queue_fn s_queue_source = NULL;
+static const char *s_event_types[STATS_EVENT_TYPES] = {
+    "access", "modify", "attrib", "close_write", "close_nowrite", "open", "moved_from", "moved_to",
+    "create", "delete", "delete_self", "move_self", NULL, "unmount", "overflow", "ignored"
+};
+static const uint64_t s_bounds[RULE_BUCKETS] = {
+    10000, 50000, 100000, 250000, 500000, 1000000,
+    2500000, 5000000, 10000000, 30000000, 60000000, 300000000
+};
+
+/**
+ * @brief Return the watch statistics.
+ *
+ * @return watch_stats_t* The statistics.
+ */
+watch_stats_t *stats_global(void) {
+    return &s_stats;
+}
+
+/**
+ * @brief Set where the depth of the kernel queue is looked up.
+ *
+ * @param source Returns the bytes waiting, or NULL.
+ */
+void stats_queue_source(stats_queue_fn source) {
+    s_queue_source = source;
+}
+
+/**
+ * @brief Look at the depth of the kernel queue afresh.
+ * @details Every report calls this first, so that none shows the depth
+ * as it was at the last read.
+ *
+ */
+void stats_sample_queue(void) {
+    if (s_queue_source) {
+        s_stats.queued = s_queue_source();
+        if (s_stats.queued > s_stats.queued_max) {
+            s_stats.queued_max = s_stats.queued;
+        }
+    }
+}
+
+/**
+ * @brief Count the events in a buffer by type.
+ *
+ * @param buf The raw events buffer.
+ * @param len The number of bytes in the buffer.
+ */
+void stats_event_types(const char *buf, ssize_t len) {
+    ssize_t i = 0;
+
+    while (i < len) {
+        const struct inotify_event *event = (const struct inotify_event *)&buf[i];
+        for (uint32_t mask = event->mask & 0xffff; mask; mask &= mask - 1) {
+            s_stats.types[__builtin_ctz(mask)]++;
+        }
+        i += sizeof(struct inotify_event) + event->len;
+    }
+}
+
+/**
+ * @brief Return the name of an event type.
+ *
+ * @param bit The inotify mask bit.
+ * @return const char* The name, or NULL if the bit is not an event type.
+ */
+const char *stats_event_type(int bit) {
+    return bit >= 0 && bit < STATS_EVENT_TYPES ? s_event_types[bit] : NULL;
+}
+
+/**
+ * @brief Add a time to a histogram.
+ *
+ * @param histogram The histogram.
+ * @param value The time in microseconds.
+ */
+void stats_observe(rule_histogram_t *histogram, uint64_t value) {
+    for (int bucket = 0; bucket < RULE_BUCKETS; bucket++) {
+        if (value <= s_bounds[bucket]) {
+            histogram->buckets[bucket]++;
+            break;
+        }
+    }
+    histogram->count++;
+    histogram->sum += value;
+}
+
+/**
+ * @brief Return the upper bound of a histogram bucket.
+ *
+ * @param bucket The bucket.
+ * @return uint64_t The bound in microseconds.
+ */
+uint64_t stats_bucket_bound(int bucket) {
+    return s_bounds[bucket];
+}
+
+/**
+ * @brief Add the resources used by a run to its rule.
+ *
+ * @param rule The rule.
+ * @param runtime The run time in microseconds.
+ * @param usage The resources reported when the command was reaped, or NULL if unknown.
+ */
+void stats_usage(watch_rule_t *rule, uint64_t runtime, const struct rusage *usage) {
+    rule_usage_t *total = &rule->stats.usage;
+
+    stats_observe(&rule->stats.runtime, runtime);
+    total->measured++;
+    total->wall += runtime;
+    if (runtime > total->wall_max) {
+        total->wall_max = runtime;
+    }
+    if (usage) {
+        total->user += (uint64_t)usage->ru_utime.tv_sec * 1000000 + (uint64_t)usage->ru_utime.tv_usec;
+        total->sys += (uint64_t)usage->ru_stime.tv_sec * 1000000 + (uint64_t)usage->ru_stime.tv_usec;
+        if (usage->ru_maxrss > total->maxrss) {
+            total->maxrss = usage->ru_maxrss;
+        }
+        total->inblock += (unsigned long)usage->ru_inblock;
+        total->oublock += (unsigned long)usage->ru_oublock;
+        total->nvcsw += (unsigned long)usage->ru_nvcsw;
+        total->nivcsw += (unsigned long)usage->ru_nivcsw;
+    }
+}
+
+/**
+ * @brief Return the mean run time of a rule.
+ *
+ * @param rule The rule.
+ * @return uint64_t The mean in microseconds, 0 before any run completes.
+ */
+static uint64_t mean_wall(const watch_rule_t *rule) {
+    const rule_usage_t *usage = &rule->stats.usage;
+    return usage->measured ? usage->wall / usage->measured : 0;
+}
+
+/**
+ * @brief Return the CPU time used by the runs of a rule.
+ *
+ * @param rule The rule.
+ * @return uint64_t The user and system time in microseconds.
+ */
+static uint64_t cpu_time(const watch_rule_t *rule) {
+    return rule->stats.usage.user + rule->stats.usage.sys;
+}
+
+/**
+ * @brief Order rules by descending mean run time (qsort comparator).
+ *
+ */
+static int by_wall(const void *a, const void *b) {
+    uint64_t x = mean_wall(*(watch_rule_t * const *)a);
+    uint64_t y = mean_wall(*(watch_rule_t * const *)b);
+    return (x < y) - (x > y);
+}
+
+/**
+ * @brief Order rules by descending CPU time (qsort comparator).
+ *
+ */
+static int by_cpu(const void *a, const void *b) {
+    uint64_t x = cpu_time(*(watch_rule_t * const *)a);
+    uint64_t y = cpu_time(*(watch_rule_t * const *)b);
+    return (x < y) - (x > y);
+}
+
+/**
+ * @brief Rank the rules that have completed runs.
+ *
+ * @param ranked Receives the rules, most costly first.
+ * @param compare The ordering.
+ * @return int The number of ranked rules, at most STATS_RANKED.
+ */
+static int rank_rules(watch_rule_t **ranked, int (*compare)(const void *, const void *)) {
+    watch_rule_t *rules[WATCH_MAX_RULES];
+    int count = 0;
+
+    for (int index = 0; index < rule_count(); index++) {
+        if (rule_at(index)->stats.usage.measured && !rule_at(index)->retired) {
+            rules[count++] = rule_at(index);
+        }
+    }
+    qsort(rules, (size_t)count, sizeof(rules[0]), compare);
+    if (count > STATS_RANKED) {
+        count = STATS_RANKED;
+    }
+    memcpy(ranked, rules, (size_t)count * sizeof(rules[0]));
+    return count;
+}
+
+/**
+ * @brief Report the watch and rule statistics.
+ *
+ * @param fp The output stream.
+ * @param now The engine time in microseconds.
+ * @param watches The number of active watches.
+ */
+void stats_dump(FILE *fp, uint64_t now, unsigned watches) {
+    uint64_t up = now > s_stats.started ? now - s_stats.started : 0;
+
+    stats_sample_queue();
+
+    fprintf(fp, "watch up=%.1fs watches=%u reads=%lu events=%lu overflows=%lu storms=%lu rescans=%lu runs=%lu"
+        " lag=%lu lag_max=%lu behind=%lu\n",
+        (double)up / 1e6, watches, s_stats.reads, s_stats.events, s_stats.overflows,
+        s_stats.storms, s_stats.rescans, s_stats.runs, s_stats.queued, s_stats.queued_max, s_stats.behind);
+    psi_dump(fp);
+    for (int index = 0; index < rule_count(); index++) {
+        const watch_rule_t *rule = rule_at(index);
+        const rule_stats_t *stats = &rule->stats;
+        uint64_t held = stats->held + (rule->held_since ? now - rule->held_since : 0);
+        if (rule->retired) {
+            continue;
+        }
+        fprintf(fp, "rule %s target=%s events=%lu runs=%lu failures=%lu running=%u pending=%d",
+            rule->name, rule->target ? rule->target : "-", stats->events, stats->runs,
+            stats->failures, rule->running, rule->pending);
+        if (rule->rate.runs) {
+            fprintf(fp, " rate=%u/%ums:%u suppressed=%lu merged=%lu held=%.1fs",
+                rule->rate.runs, rule->rate.interval, rule->rate.burst,
+                stats->suppressed, stats->merged, (double)held / 1e6);
+        }
+        if (rule->background) {
+            uint64_t deferred = stats->deferred_time + (rule->deferred_since ? now - rule->deferred_since : 0);
+            fprintf(fp, " background deferred=%lu deferred_time=%.1fs", stats->deferred, (double)deferred / 1e6);
+        }
+        if (rule->interactive || rule->priority || rule->weight > 1 || stats->queued) {
+            fprintf(fp, " lane=%s priority=%u weight=%u queued=%lu queue~%.1fms",
+                rule->interactive ? "interactive" : "batch", rule->priority, rule->weight, stats->queued,
+                stats->queue.count ? (double)stats->queue.sum / (double)stats->queue.count / 1000.0 : 0.0);
+        }
+        if (rule->predicate.active) {
+            fprintf(fp, " filtered=%lu", stats->filtered);
+        }
+        if (stats->coarsened || stats->collapsed) {
+            fprintf(fp, " coarsened=%lu collapsed=%lu", stats->coarsened, stats->collapsed);
+        }
+        if (ADAPTIVE(rule)) {
+            fprintf(fp, " debounce=%ums jobs=%u/%u runtime~%.1fms gap~%.1fms interval~%.1fms",
+                rule->policy.debounce, rule->policy.jobs, rule->adapt.max_jobs,
+                (double)rule->adapt.runtime / 1000.0, (double)rule->adapt.gap / 1000.0,
+                (double)rule->adapt.interval / 1000.0);
+        }
+        if (stats->usage.measured) {
+            const rule_usage_t *usage = &stats->usage;
+            fprintf(fp, " wall~%.1fms wall_max=%.1fms user=%.2fs sys=%.2fs maxrss=%ldkB inblock=%lu oublock=%lu nvcsw=%lu nivcsw=%lu",
+                (double)mean_wall(rule) / 1000.0, (double)usage->wall_max / 1000.0,
+                (double)usage->user / 1e6, (double)usage->sys / 1e6, usage->maxrss,
+                usage->inblock, usage->oublock, usage->nvcsw, usage->nivcsw);
+        }
+        fputc('\n', fp);
+    }
+
+    watch_rule_t *ranked[STATS_RANKED];
+    int count = rank_rules(ranked, by_wall);
+    if (count) {
+        fputs("slowest", fp);
+        for (int index = 0; index < count; index++) {
+            fprintf(fp, " %s=%.1fms", ranked[index]->name, (double)mean_wall(ranked[index]) / 1000.0);
+        }
+        fputs("\ncostliest", fp);
+        count = rank_rules(ranked, by_cpu);
+        for (int index = 0; index < count; index++) {
+            fprintf(fp, " %s=%.2fs", ranked[index]->name, (double)cpu_time(ranked[index]) / 1e6);
+        }
+        fputc('\n', fp);
+    }
+    if (hot_enabled()) {
+        hot_dump(fp, STATS_HOT);
+    }
+    if (profile_enabled()) {
+        profile_dump(fp);
+    }
+    fflush(fp);
+}
+
+/**
+ * @brief Write a string as a JSON string literal.
+ *
+ * @param fp The output stream.
+ * @param text The string, may be NULL for null.
+ */
+void stats_json_string(FILE *fp, const char *text) {
+    if (text == NULL) {
+        fputs("null", fp);
+        return;
+    }
+    fputc('"', fp);
+    for (const unsigned char *c = (const unsigned char *)text; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            fprintf(fp, "\\%c", *c);
+        }
+        else if (*c < 0x20) {
+            fprintf(fp, "\\u%04x", *c);
+        }
+        else {
+            fputc(*c, fp);
+        }
+    }
+    fputc('"', fp);
+}
+
+/**
+ * @brief Write a ranking as a JSON array of rule names.
+ *
+ * @param fp The output stream.
+ * @param key The member name.
+ * @param compare The ordering.
+ */
+static void json_ranking(FILE *fp, const char *key, int (*compare)(const void *, const void *)) {
+    watch_rule_t *ranked[STATS_RANKED];
+    int count = rank_rules(ranked, compare);
+
+    fprintf(fp, ",\"%s\":[", key);
+    for (int index = 0; index < count; index++) {
+        if (index) {
+            fputc(',', fp);
+        }
+        stats_json_string(fp, ranked[index]->name);
+    }
+    fputc(']', fp);
+}
+
+/**
+ * @brief Report the watch and rule statistics as a JSON document.
+ * @details Times are in microseconds.
+ *
+ * @param fp The output stream.
+ * @param now The engine time in microseconds.
+ * @param watches The number of active watches.
+ */
+void stats_json(FILE *fp, uint64_t now, unsigned watches) {
+    uint64_t up = now > s_stats.started ? now - s_stats.started : 0;
+
+    stats_sample_queue();
+
+    fprintf(fp, "{\"up\":%llu,\"watches\":%u,\"reads\":%lu,\"events\":%lu,\"overflows\":%lu,"
+        "\"storms\":%lu,\"rescans\":%lu,\"runs\":%lu,\"lag\":%lu,\"lag_max\":%lu,\"behind\":%lu,\"rules\":[",
+        (unsigned long long)up, watches, s_stats.reads, s_stats.events, s_stats.overflows,
+        s_stats.storms, s_stats.rescans, s_stats.runs, s_stats.queued, s_stats.queued_max, s_stats.behind);
+    bool first = true;
+    for (int index = 0; index < rule_count(); index++) {
+        const watch_rule_t *rule = rule_at(index);
+        const rule_stats_t *stats = &rule->stats;
+        const rule_usage_t *usage = &stats->usage;
+        uint64_t held = stats->held + (rule->held_since ? now - rule->held_since : 0);
+        uint64_t deferred = stats->deferred_time + (rule->deferred_since ? now - rule->deferred_since : 0);
+
+        if (rule->retired) {
+            continue;
+        }
+        fputs(first ? "{\"name\":" : ",{\"name\":", fp);
+        first = false;
+        stats_json_string(fp, rule->name);
+        fputs(",\"target\":", fp);
+        stats_json_string(fp, rule->target);
+        fprintf(fp, ",\"events\":%lu,\"runs\":%lu,\"failures\":%lu,\"running\":%u,\"pending\":%d,"
+            "\"suppressed\":%lu,\"merged\":%lu,\"held\":%llu,\"deferred\":%lu,\"deferred_time\":%llu,"
+            "\"filtered\":%lu,\"interactive\":%s,\"priority\":%u,\"weight\":%u,\"queued\":%lu,"
+            "\"queue_wait\":%llu,\"coarsened\":%lu,\"collapsed\":%lu,\"usage\":{\"measured\":%lu,\"wall\":%llu,\"wall_mean\":%llu,\"wall_max\":%llu,"
+            "\"user\":%llu,\"sys\":%llu,\"maxrss_kb\":%ld,\"inblock\":%lu,\"oublock\":%lu,"
+            "\"nvcsw\":%lu,\"nivcsw\":%lu}}",
+            stats->events, stats->runs, stats->failures, rule->running, rule->pending,
+            stats->suppressed, stats->merged, (unsigned long long)held, stats->deferred,
+            (unsigned long long)deferred, stats->filtered, rule->interactive ? "true" : "false",
+            rule->priority, rule->weight, stats->queued, (unsigned long long)stats->queue.sum,
+            stats->coarsened, stats->collapsed, usage->measured, (unsigned long long)usage->wall,
+            (unsigned long long)mean_wall(rule), (unsigned long long)usage->wall_max,
+            (unsigned long long)usage->user, (unsigned long long)usage->sys, usage->maxrss,
+            usage->inblock, usage->oublock, usage->nvcsw, usage->nivcsw);
+    }
+    fputc(']', fp);
+    json_ranking(fp, "slowest", by_wall);
+    json_ranking(fp, "costliest", by_cpu);
+    if (hot_enabled()) {
+        fputs(",\"hot\":", fp);
+        hot_json(fp, HOT_MAX_ENTRIES);
+    }
+    if (profile_enabled()) {
+        fputs(",\"profile\":", fp);
+        profile_json(fp);
+    }
+    fputs("}\n", fp);
+}
+
+/**
+ * @brief Write a statistics report to a file.
+ * @details The report is written beside the file and renamed over it,
+ * so a reader never sees a partial report.
+ *
+ * @param path The file path.
+ * @param writer Writes the report.
+ * @param now The engine time in microseconds.
+ * @param watches The number of active watches.
+ * @return bool True if the file was written.
+ */
+bool stats_save(const char *path, stats_writer_fn writer, uint64_t now, unsigned watches) {
+    char temp[PATH_MAX];
+
+    if (snprintf(temp, sizeof(temp), "%s.tmp", path) >= (int)sizeof(temp)) {
+        fprintf(stderr, "Statistics path too long '%s'\n", path);
+        return false;
+    }
+    FILE *fp = fopen(temp, "w");
+    if (fp == NULL) {
+        perror("Failed to write statistics");
+        return false;
+    }
+    writer(fp, now, watches);
+    if (fclose(fp) != 0 || rename(temp, path) != 0) {
+        perror("Failed to write statistics");
+        unlink(temp);
+        return false;
+    }
+    return true;
+}
+
+/* End. */
@@ -0,0 +1,74 @@
+/**
+ * @file stats.h
+ * @author Mark Lehane (markdlehane@gmail.com)
+ * @brief Watch statistics interface.
+ * @details Counters for the watch as a whole; each rule keeps its own.
+ *
+ * @version 0.1
+ * @date 2025-12-14
+ *
+ * @copyright Copyright (c) 2025, Mark D Lehane.
+ *
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+
+#include "rules.h"
+
+// The number of inotify mask bits counted by event type.
+#define STATS_EVENT_TYPES 16
+
+/**
+ * @brief Writes a statistics report.
+ *
+ */
+typedef void (*stats_writer_fn)(FILE *fp, uint64_t now, unsigned watches);
+
+/**
+ * @brief Returns the bytes waiting in the kernel queue.
+ *
+ */
+typedef unsigned long (*stats_queue_fn)(void);
+
+/**
+ * @brief Watch statistics.
+ *
+ */
+typedef struct watch_stats_s {
+    uint64_t started;           // Time the watch started (us).
+    unsigned long reads;        // Buffers read from the inotify handle.
+    unsigned long events;       // Change events seen.
+    unsigned long overflows;    // Kernel queue overflows.
+    unsigned long storms;       // Change storms seen.
+    unsigned long rescans;      // Rescans that ended a storm.
+    unsigned long runs;         // Commands dispatched.
+    unsigned long types[STATS_EVENT_TYPES]; // Events by inotify mask bit.
+    unsigned long queued;       // Bytes waiting in the kernel queue, when last looked at.
+    unsigned long queued_max;   // Most bytes seen waiting in the kernel queue.
+    unsigned long behind;       // Times the watcher fell behind the kernel queue.
+
+} watch_stats_t;
+
+extern watch_stats_t *stats_global(void);
+extern void stats_event_types(const char *buf, ssize_t len);
+extern const char *stats_event_type(int bit);
+extern void stats_queue_source(stats_queue_fn source);
+extern void stats_sample_queue(void);
+extern void stats_observe(rule_histogram_t *histogram, uint64_t value);
+extern uint64_t stats_bucket_bound(int bucket);
+extern void stats_usage(watch_rule_t *rule, uint64_t runtime, const struct rusage *usage);
+extern void stats_dump(FILE *fp, uint64_t now, unsigned watches);
+extern void stats_json(FILE *fp, uint64_t now, unsigned watches);
+extern void stats_json_string(FILE *fp, const char *text);
+extern bool stats_save(const char *path, stats_writer_fn writer, uint64_t now, unsigned watches);
+
+#endif
+
+/* End. */
@@ -0,0 +1,488 @@
+/**
+ * @file tree.c
+ * @author Mark Lehane (markdlehane@gmail.com)
+ * @brief Watch tree functions.
+ * @details This module owns the inotify watches. A file or directory
+ * target has a single watch; a recursive target has one watch per
+ * directory, and directories created or moved into the tree are added
+ * as their events arrive. Watch descriptors are small integers handed
+ * out in sequence, so the paths are kept in an array indexed by wd.
+ * Rules that watch the same inode share its watch descriptor, so each
+ * watch also keeps the mask of rules it serves.
+ *
+ * A rule that follows symbolic links walks into linked directories.
+ * The kernel hands out one descriptor per inode, so a directory reached
+ * by several paths still has one watch; the other paths are kept as
+ * aliases of the watch, and an event is reported under each of them.
+ * A link to a directory above it is a cycle and is not followed,
+ * which is found by comparing the device and inode of the link target
+ * with those of the directories on its path.
+ *
+ * @version 0.1
+ * @date 2025-12-08
+ *
+ * @copyright Copyright (c) 2025, Mark D Lehane.
+ *
+ */
+
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <linux/limits.h>
+
+#include "tree.h"
+#include "journal.h"
+#include "config.h"
+#include "pathwait.h"
+
+/**
+ * @brief A watch.
+ *
+ */
+typedef struct tree_watch_s {
+    char *path;                 // NULL for an unused descriptor.
+    uint64_t rules;             // Mask of the rules served by the watch.
+    uint32_t mask;              // Events asked for by those rules.
+    dev_t dev;                  // The watched inode, to put back the mask of the other holders.
+    ino_t ino;
+    char **aliases;             // Other paths to the watched inode.
+    int alias_count;
+
+} tree_watch_t;
+
+// Local constants.
+#define FILE_MASK (IN_MODIFY | IN_EXCL_UNLINK)
+#define TREE_MASK (IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_EXCL_UNLINK)
+
+// Local data.
+static int s_inotify_instance = -1;
+static bool s_verbose = false;
+static tree_watch_t *s_watches = NULL;
+static int s_watches_cap = 0;
+static unsigned s_count = 0;
+
+/**
+ * @brief Check if a path is already known for a watch descriptor.
+ *
+ * @param watch The watch.
+ * @param path The path.
+ * @return bool True if the path is the watch path or one of its aliases.
+ */
+static bool known_path(const tree_watch_t *watch, const char *path) {
+    if (strcmp(watch->path, path) == 0) {
+        return true;
+    }
+    for (int alias = 0; alias < watch->alias_count; alias++) {
+        if (strcmp(watch->aliases[alias], path) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Remember the path and rules of a watch descriptor.
+ * @details Also used by a replay to resolve the recorded descriptors.
+ * A different path for a known descriptor is an alias.
+ *
+ * @param wd The watch descriptor.
+ * @param path The watched path.
+ * @param rules The mask of rules served by the watch.
+ */
+void tree_remember(int wd, const char *path, uint64_t rules) {
+    if (wd >= s_watches_cap) {
+        int cap = s_watches_cap ? s_watches_cap : 64;
+        while (cap <= wd) {
+            cap *= 2;
+        }
+        tree_watch_t *watches = realloc(s_watches, (size_t)cap * sizeof(*watches));
+        if (watches == NULL) {
+            return;
+        }
+        memset(watches + s_watches_cap, 0, (size_t)(cap - s_watches_cap) * sizeof(*watches));
+        s_watches = watches;
+        s_watches_cap = cap;
+    }
+    tree_watch_t *watch = &s_watches[wd];
+    watch->rules = rules;
+    if (watch->path == NULL) {
+        watch->path = strdup(path);
+        s_count += watch->path != NULL;
+    }
+    else if (!known_path(watch, path)) {
+        char **aliases = realloc(watch->aliases, (size_t)(watch->alias_count + 1) * sizeof(*aliases));
+        if (aliases) {
+            watch->aliases = aliases;
+            aliases[watch->alias_count] = strdup(path);
+            watch->alias_count += aliases[watch->alias_count] != NULL;
+        }
+    }
+}
+
+/**
+ * @brief Forget a watch descriptor removed by the kernel.
+ *
+ * @param wd The watch descriptor.
+ */
+static void forget(int wd) {
+    if (wd >= 0 && wd < s_watches_cap && s_watches[wd].path) {
+        tree_watch_t *watch = &s_watches[wd];
+        for (int alias = 0; alias < watch->alias_count; alias++) {
+            free(watch->aliases[alias]);
+        }
+        free(watch->aliases);
+        free(watch->path);
+        memset(watch, 0, sizeof(*watch));
+        s_count--;
+    }
+}
+
+/**
+ * @brief Add watches to the subdirectories of a directory.
+ * @details Links to directories are followed when the rule asks.
+ *
+ * @param path The directory path.
+ * @param rule The rule the watches serve.
+ */
+static void add_children(const char *path, const watch_rule_t *rule) {
+    char child[PATH_MAX];
+    struct dirent *entry;
+
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        return;
+    }
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        bool is_dir = entry->d_type == DT_DIR;
+        if (entry->d_type == DT_UNKNOWN || (entry->d_type == DT_LNK && rule->follow)) {
+            struct stat st;
+            int flags = rule->follow ? 0 : AT_SYMLINK_NOFOLLOW;
+            is_dir = fstatat(dirfd(dir), entry->d_name, &st, flags) == 0 && S_ISDIR(st.st_mode);
+        }
+        if (is_dir && snprintf(child, sizeof(child), "%s/%s", path, entry->d_name) < (int)sizeof(child)) {
+            tree_add(child, rule, true);
+        }
+    }
+    closedir(dir);
+}
+
+/**
+ * @brief Check if a link leads back to a directory above it.
+ *
+ * @param path The path of the link.
+ * @return bool True if following the link would be a cycle.
+ */
+static bool link_cycle(const char *path) {
+    char above[PATH_MAX];
+    struct stat link, st;
+
+    if (lstat(path, &link) != 0 || !S_ISLNK(link.st_mode) || stat(path, &link) != 0 ||
+        snprintf(above, sizeof(above), "%s", path) >= (int)sizeof(above)) {
+        return false;
+    }
+    for (char *slash = strrchr(above, '/'); slash; slash = strrchr(above, '/')) {
+        if (slash == above) {
+            slash[1] = '\0';
+        }
+        else {
+            *slash = '\0';
+        }
+        if (stat(above, &st) == 0 && st.st_dev == link.st_dev && st.st_ino == link.st_ino) {
+            return true;
+        }
+        if (slash == above) {
+            break;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Add a watch for a path, and its subdirectories when recursive.
+ * @details The mask is added to any watch another rule already has on
+ * the same inode, which the kernel reports with the same descriptor.
+ * A directory is only walked when the watch is new to the rule or the
+ * path is a new alias, and a link to a directory above it never is.
+ *
+ * @param path The file or directory to watch.
+ * @param rule The rule the watch serves.
+ * @param recursive True if the path is a directory to watch as a tree.
+ * @return int The watch descriptor, or -1 on failure.
+ */
+int tree_add(const char *path, const watch_rule_t *rule, bool recursive) {
+    if (rule->follow && recursive && link_cycle(path)) {
+        if (s_verbose) {
+            printf("Not following cycle at '%s'\n", path);
+        }
+        return -1;
+    }
+    // A directory changes as its entries come and go, not only as they are written.
+    struct stat st;
+    uint32_t mask = FILE_MASK;
+    if (recursive) {
+        mask = TREE_MASK | IN_ONLYDIR;
+    }
+    else if (stat(path, &st) == 0 && S_ISDIR(st.st_mode)) {
+        mask = TREE_MASK;
+    }
+    int wd = inotify_add_watch(s_inotify_instance, path, mask | IN_MASK_ADD);
+    if (wd == -1) {
+        return -1;
+    }
+    uint64_t rules = tree_rules(wd);
+    bool walk = true;
+    if ((rules & RULE_BIT(rule)) == 0) {
+        if (s_verbose) {
+            printf("Begun monitoring of '%s' - %d\n", path, wd);
+        }
+        rules |= RULE_BIT(rule);
+        tree_remember(wd, path, rules);
+        journal_watch(wd, path, rules);
+        if (wd < s_watches_cap && stat(path, &st) == 0) {
+            s_watches[wd].dev = st.st_dev;
+            s_watches[wd].ino = st.st_ino;
+        }
+    }
+    else if (!known_path(&s_watches[wd], path)) {
+        if (s_verbose) {
+            printf("Aliased '%s' to '%s' - %d\n", path, s_watches[wd].path, wd);
+        }
+        tree_remember(wd, path, rules);
+        journal_watch(wd, path, rules);
+    }
+    else {
+        walk = false;
+    }
+    if (wd < s_watches_cap) {
+        s_watches[wd].mask |= mask;
+    }
+    if (recursive && walk) {
+        add_children(path, rule);
+    }
+    return wd;
+}
+
+/**
+ * @brief Initialise the inotify handle used for the watches.
+ *
+ * @param inf The inotify handle.
+ * @param verbose True if verbose output should be made.
+ */
+void tree_init(int inf, bool verbose) {
+    s_inotify_instance = inf;
+    s_verbose = verbose;
+}
+
+/**
+ * @brief Watch the target of a rule.
+ *
+ * @param rule The rule.
+ * @return bool True if the target is being watched.
+ */
+bool tree_watch_rule(const watch_rule_t *rule) {
+    struct stat st;
+
+    bool recursive = rule->recursive && stat(rule->target, &st) == 0 && S_ISDIR(st.st_mode);
+    if (tree_add(rule->target, rule, recursive) == -1) {
+        perror("Failed to create a watch on target");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Stop watching for a rule.
+ * @details Each watch drops the rule from its mask; a watch that serves
+ * no other rule is let go. The watches of the other rules are left as
+ * they are. A watch the config file or an await still holds is kept
+ * with their events only, as pathwait does when it moves on; if its
+ * path no longer names the watched inode the mask cannot be put back.
+ *
+ * @param rule The rule.
+ */
+void tree_drop_rule(const watch_rule_t *rule) {
+    struct stat st;
+
+    for (int wd = 0; wd < s_watches_cap; wd++) {
+        tree_watch_t *watch = &s_watches[wd];
+        if (watch->path == NULL || (watch->rules & RULE_BIT(rule)) == 0) {
+            continue;
+        }
+        watch->rules &= ~RULE_BIT(rule);
+        journal_watch(wd, watch->path, watch->rules);
+        if (watch->rules == 0) {
+            uint32_t mask = config_mask(wd) | pathwait_mask(wd);
+            if (s_verbose) {
+                printf("Ended monitoring of '%s' - %d\n", watch->path, wd);
+            }
+            if (mask == 0) {
+                inotify_rm_watch(s_inotify_instance, wd);
+            }
+            else if (stat(watch->path, &st) == 0 && st.st_dev == watch->dev && st.st_ino == watch->ino) {
+                inotify_add_watch(s_inotify_instance, watch->path, mask);
+            }
+            forget(wd);
+        }
+    }
+}
+
+/**
+ * @brief Watch a new entry of a watched directory, under each of its paths.
+ *
+ * @param wd The watch descriptor of the directory.
+ * @param name The name of the new entry.
+ * @param is_dir True if the entry is a directory, false if it may be a link to one.
+ */
+static void add_entry(int wd, const char *name, bool is_dir) {
+    char path[PATH_MAX];
+    const char *parent;
+    uint64_t rules = tree_rules(wd);
+    bool aliased = tree_alias(wd, 1) != NULL;
+    int paths = 1 + (aliased ? s_watches[wd].alias_count : 0);
+
+    // Adding the entry may alias this directory again, those paths are walked as they are added.
+    for (int alias = 0; alias < paths && (parent = tree_alias(wd, alias)) != NULL; alias++) {
+        struct stat st;
+        if (snprintf(path, sizeof(path), "%s/%s", parent, name) >= (int)sizeof(path) ||
+            (!is_dir && (stat(path, &st) != 0 || !S_ISDIR(st.st_mode)))) {
+            continue;
+        }
+        uint64_t mask = rules;
+        for (int index = 0; mask; index++, mask >>= 1) {
+            watch_rule_t *rule = rule_at(index);
+            if ((mask & 1) && rule && rule->recursive && (is_dir || rule->follow) &&
+                (!aliased || rule_covers(rule, path))) {
+                tree_add(path, rule, true);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Check if any rule served by a watch follows links.
+ *
+ * @param rules The mask of rules.
+ * @return bool True if one of them follows links.
+ */
+static bool rules_follow(uint64_t rules) {
+    for (int index = 0; rules; index++, rules >>= 1) {
+        if ((rules & 1) && rule_at(index) && rule_at(index)->follow) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Maintain the watches from a buffer of inotify events.
+ * @details New directories in a recursive tree are watched for each
+ * recursive rule the parent serves (with their content, which may have
+ * been populated before the watch existed), as are new links to
+ * directories for the rules that follow links, and watches removed by
+ * the kernel are forgotten.
+ *
+ * @param buf The raw events buffer.
+ * @param len The number of bytes in the buffer.
+ * @param add_dirs False to leave new directories to a later rescan.
+ */
+void tree_events(const char *buf, ssize_t len, bool add_dirs) {
+    ssize_t i = 0;
+
+    while (i < len) {
+        const struct inotify_event *event = (const struct inotify_event *)&buf[i];
+        if (event->mask & IN_IGNORED) {
+            forget(event->wd);
+        }
+        else if (add_dirs && (event->mask & (IN_CREATE | IN_MOVED_TO)) && event->len &&
+                 ((event->mask & IN_ISDIR) || rules_follow(tree_rules(event->wd)))) {
+            add_entry(event->wd, event->name, (event->mask & IN_ISDIR) != 0);
+        }
+        i += sizeof(struct inotify_event) + event->len;
+    }
+}
+
+/**
+ * @brief Return the path of a watch descriptor.
+ *
+ * @param wd The watch descriptor.
+ * @return const char* The watched path, or NULL if unknown.
+ */
+const char *tree_path(int wd) {
+    return (wd >= 0 && wd < s_watches_cap) ? s_watches[wd].path : NULL;
+}
+
+/**
+ * @brief Return one of the paths of a watch descriptor.
+ * @details Path 0 is the watched path, the rest are its aliases.
+ *
+ * @param wd The watch descriptor.
+ * @param alias The path number.
+ * @return const char* The path, or NULL if there is no such path.
+ */
+const char *tree_alias(int wd, int alias) {
+    const char *path = tree_path(wd);
+    if (path == NULL || alias == 0) {
+        return path;
+    }
+    return alias <= s_watches[wd].alias_count ? s_watches[wd].aliases[alias - 1] : NULL;
+}
+
+/**
+ * @brief Return the rules served by a watch descriptor.
+ *
+ * @param wd The watch descriptor.
+ * @return uint64_t The mask of rules, 0 if unknown.
+ */
+uint64_t tree_rules(int wd) {
+    return (wd >= 0 && wd < s_watches_cap) ? s_watches[wd].rules : 0;
+}
+
+/**
+ * @brief Return the events the rules ask for on a watch descriptor.
+ * @details Another module sharing the watch puts this mask back when it
+ * is done with the watch.
+ *
+ * @param wd The watch descriptor.
+ * @return uint32_t The inotify mask, 0 if the watch serves no rule.
+ */
+uint32_t tree_mask(int wd) {
+    return (wd >= 0 && wd < s_watches_cap && s_watches[wd].rules) ? s_watches[wd].mask : 0;
+}
+
+/**
+ * @brief Return the number of active watches.
+ *
+ * @return unsigned The watch count.
+ */
+unsigned tree_count(void) {
+    return s_count;
+}
+
+/**
+ * @brief Remove every watch.
+ *
+ */
+void tree_shutdown(void) {
+    for (int wd = 0; wd < s_watches_cap; wd++) {
+        if (s_watches[wd].path) {
+            if (s_inotify_instance != -1) {
+                inotify_rm_watch(s_inotify_instance, wd);
+            }
+            forget(wd);
+        }
+    }
+    free(s_watches);
+    s_watches = NULL;
+    s_watches_cap = 0;
+    s_count = 0;
+    s_inotify_instance = -1;
+}
+
+/* End. */
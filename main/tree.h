@@ -0,0 +1,40 @@
+/**
+ * @file tree.h
+ * @author Mark Lehane (markdlehane@gmail.com)
+ * @brief Watch tree interface.
+ * @details Maintains the set of inotify watches for a target, which is
+ * either a single file or directory or, when recursive, a directory
+ * tree, together with the path of each watch descriptor.
+ *
+ * @version 0.1
+ * @date 2025-12-08
+ *
+ * @copyright Copyright (c) 2025, Mark D Lehane.
+ *
+ */
+
+#ifndef TREE_H
+#define TREE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "rules.h"
+
+extern void tree_init(int inf, bool verbose);
+extern bool tree_watch_rule(const watch_rule_t *rule);
+extern int tree_add(const char *path, const watch_rule_t *rule, bool recursive);
+extern void tree_drop_rule(const watch_rule_t *rule);
+extern void tree_remember(int wd, const char *path, uint64_t rules);
+extern void tree_events(const char *buf, ssize_t len, bool add_dirs);
+extern const char *tree_path(int wd);
+extern const char *tree_alias(int wd, int alias);
+extern uint64_t tree_rules(int wd);
+extern uint32_t tree_mask(int wd);
+extern unsigned tree_count(void);
+extern void tree_shutdown(void);
+
+#endif
+
+/* End. */
@@ -0,0 +1,345 @@
+/**
+ * @file tune.c
+ * @author Mark Lehane (markdlehane@gmail.com)
+ * @brief Dispatch policy tuner.
+ * @details This module replays a journal recorded with --record
+ * through the dispatch engine (see watch_simulate()) for each
+ * combination of debounce, max-latency and concurrency in a grid, so
+ * the policies are judged by the same logic that dispatches a live
+ * watch. Runs take the median run time recorded for each rule in the
+ * journal. For each rule and policy it reports the number of runs, the
+ * wasted runs (those that had changes arrive while they were running,
+ * so their output was stale before it was finished) and the event to
+ * run latency percentiles.
+ *
+ * The journal keeps only the target of each rule, so every rule is
+ * simulated on the grid policy alone: no rate limit, adaptive policy,
+ * priority or weight, and no contention for shared job slots. The
+ * report says so, as a rule that relies on those may behave
+ * differently when watched.
+ *
+ * @version 0.1
+ * @date 2025-12-06
+ *
+ * @copyright Copyright (c) 2025, Mark D Lehane.
+ *
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "tune.h"
+#include "journal.h"
+#include "watch.h"
+
+/**
+ * @brief A growable array of times in microseconds.
+ *
+ */
+typedef struct tune_times_s {
+    uint64_t *at;
+    size_t count;
+    size_t cap;
+
+} tune_times_t;
+
+/**
+ * @brief What the simulation of one policy has seen of a rule.
+ * @details All the runs of a rule take the same time, so those that
+ * may still be running are the latest, as many as its jobs limit.
+ *
+ */
+typedef struct tune_rule_s {
+    tune_times_t pending;               // Changes waiting for a run.
+    tune_times_t latency;               // Change to run latency of each change run.
+    uint64_t starts[WATCH_MAX_JOBS];    // Start times of the latest runs.
+    bool stale[WATCH_MAX_JOBS];         // A change arrived during the run (or no run yet).
+    unsigned latest;                    // Slot of the next run.
+    unsigned long runs;
+    unsigned long wasted;
+    size_t events;
+    uint64_t first;                     // Time of the first change.
+    uint64_t last;                      // Time of the last change.
+
+} tune_rule_t;
+
+/**
+ * @brief The outcome of one simulated policy.
+ *
+ */
+typedef struct tune_result_s {
+    unsigned long runs;
+    unsigned long wasted;
+    uint64_t p50;
+    uint64_t p90;
+    uint64_t p99;
+    uint64_t max;
+
+} tune_result_t;
+
+// Local data.
+static const unsigned s_default_debounce[] = { 25, 50, 100, 250, 500, 1000 };
+static const unsigned s_default_max_latency[] = { 0, 1000, 5000 };
+static const unsigned s_default_jobs[] = { 1, 2 };
+static tune_rule_t s_rules[WATCH_MAX_RULES];
+static tune_times_t s_runtimes[WATCH_MAX_RULES];
+static uint64_t s_runtime[WATCH_MAX_RULES];
+static unsigned s_jobs = 1;
+static bool s_failed = false;
+
+/**
+ * @brief Append a time to an array.
+ *
+ * @param times The array.
+ * @param at The time to append.
+ * @return bool False if memory is exhausted.
+ */
+static bool times_add(tune_times_t *times, uint64_t at) {
+    if (times->count == times->cap) {
+        size_t cap = times->cap ? times->cap * 2 : 1024;
+        uint64_t *grown = realloc(times->at, cap * sizeof(*grown));
+        if (grown == NULL) {
+            return false;
+        }
+        times->at = grown;
+        times->cap = cap;
+    }
+    times->at[times->count++] = at;
+    return true;
+}
+
+/**
+ * @brief qsort comparison for times.
+ *
+ */
+static int compare_times(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Return a percentile of a sorted array.
+ *
+ * @param sorted The sorted values.
+ * @param count The number of values.
+ * @param pct The percentile (0-100).
+ * @return uint64_t The value at the percentile.
+ */
+static uint64_t percentile(const uint64_t *sorted, size_t count, unsigned pct) {
+    if (count == 0) {
+        return 0;
+    }
+    size_t index = (count * pct + 99) / 100;
+    return sorted[index ? index - 1 : 0];
+}
+
+/**
+ * @brief Take in a change or run of a rule from the simulation.
+ *
+ * @param what What happened.
+ * @param index The index of the rule.
+ * @param at The journal time in microseconds.
+ */
+static void observe(WATCH_SIM what, int index, uint64_t at) {
+    tune_rule_t *rule = &s_rules[index];
+
+    if (what == WATCH_SIM_EVENT) {
+        // A change that lands on a running command makes its output stale.
+        for (unsigned slot = 0; slot < s_jobs; slot++) {
+            if (!rule->stale[slot] && rule->starts[slot] < at && at < rule->starts[slot] + s_runtime[index]) {
+                rule->stale[slot] = true;
+                rule->wasted++;
+            }
+        }
+        if (rule->events++ == 0) {
+            rule->first = at;
+        }
+        rule->last = at;
+        s_failed |= !times_add(&rule->pending, at);
+    }
+    else if (what == WATCH_SIM_RUN) {
+        // The run covers every pending change.
+        for (size_t change = 0; change < rule->pending.count; change++) {
+            s_failed |= !times_add(&rule->latency, at - rule->pending.at[change]);
+        }
+        rule->pending.count = 0;
+        rule->starts[rule->latest] = at;
+        rule->stale[rule->latest] = false;
+        rule->latest = (rule->latest + 1) % s_jobs;
+        rule->runs++;
+    }
+    else {
+        rule->pending.count = 0;
+    }
+}
+
+/**
+ * @brief Simulate one policy over the journal.
+ *
+ * @param path The journal file name.
+ * @param policy The policy to simulate.
+ * @param results Receives the outcome for each rule.
+ * @return int The number of rules, or -1 on failure.
+ */
+static int simulate(const char *path, const watch_policy_t *policy, tune_result_t *results) {
+    for (int index = 0; index < WATCH_MAX_RULES; index++) {
+        tune_rule_t *rule = &s_rules[index];
+        rule->pending.count = 0;
+        rule->latency.count = 0;
+        rule->latest = 0;
+        rule->runs = 0;
+        rule->wasted = 0;
+        rule->events = 0;
+        for (unsigned slot = 0; slot < WATCH_MAX_JOBS; slot++) {
+            rule->stale[slot] = true;
+        }
+    }
+    s_jobs = policy->jobs;
+    int rules = watch_simulate(path, policy, s_runtime, observe);
+    if (rules < 0 || s_failed) {
+        return -1;
+    }
+    for (int index = 0; index < rules; index++) {
+        tune_rule_t *rule = &s_rules[index];
+        tune_result_t *result = &results[index];
+        size_t covered = rule->latency.count;
+        qsort(rule->latency.at, covered, sizeof(*rule->latency.at), compare_times);
+        result->runs = rule->runs;
+        result->wasted = rule->wasted;
+        result->p50 = percentile(rule->latency.at, covered, 50);
+        result->p90 = percentile(rule->latency.at, covered, 90);
+        result->p99 = percentile(rule->latency.at, covered, 99);
+        result->max = covered ? rule->latency.at[covered - 1] : 0;
+    }
+    return rules;
+}
+
+/**
+ * @brief Read the run times of each rule from a journal.
+ *
+ * @param reader The journal reader.
+ * @return int 0 at the end of the journal, -1 on error.
+ */
+static int read_journal(journal_reader_t *reader) {
+    journal_rec_t rec;
+    int rc = 0;
+
+    while (!s_failed && (rc = journal_read(reader, &rec)) > 0) {
+        if (rec.type == JR_EXIT) {
+            for (int index = 0; index < WATCH_MAX_RULES; index++) {
+                if ((rec.rules & (1ULL << index)) && !times_add(&s_runtimes[index], rec.runtime)) {
+                    s_failed = true;
+                }
+            }
+        }
+    }
+    // Runs take the median recorded run time.
+    for (int index = 0; index < WATCH_MAX_RULES; index++) {
+        tune_times_t *runtimes = &s_runtimes[index];
+        if (runtimes->count) {
+            qsort(runtimes->at, runtimes->count, sizeof(*runtimes->at), compare_times);
+            s_runtime[index] = runtimes->at[runtimes->count / 2];
+        }
+    }
+    return s_failed ? -1 : rc;
+}
+
+/**
+ * @brief Report the grid of policies for one rule.
+ *
+ * @param path The journal file name.
+ * @param target The recorded target of the rule.
+ * @param index The index of the rule.
+ * @param policies The policies simulated.
+ * @param results The outcome of each policy, for each of the rules.
+ * @param count The number of policies.
+ * @param rules The number of rules.
+ */
+static void tune_rule(const char *path, const char *target, int index, const watch_policy_t *policies,
+                      const tune_result_t *results, int count, int rules) {
+    const tune_rule_t *rule = &s_rules[index];
+    uint64_t span = rule->events ? rule->last - rule->first : 0;
+
+    printf("Journal '%s' (%s): %zu change events over %.1fs, %zu recorded runs, median run time %.1fms\n",
+        path, target, rule->events, (double)span / 1e6, s_runtimes[index].count, (double)s_runtime[index] / 1000.0);
+    printf("%8s %8s %4s %8s %8s %9s %9s %9s %9s\n",
+        "debounce", "max-lat", "jobs", "runs", "wasted", "p50(ms)", "p90(ms)", "p99(ms)", "max(ms)");
+    for (int point = 0; point < count; point++) {
+        const watch_policy_t *policy = &policies[point];
+        const tune_result_t *result = &results[point * rules + index];
+        printf("%8u %8u %4u %8lu %8lu %9.1f %9.1f %9.1f %9.1f\n",
+            policy->debounce, policy->max_latency, policy->jobs, result->runs, result->wasted,
+            (double)result->p50 / 1000.0, (double)result->p90 / 1000.0,
+            (double)result->p99 / 1000.0, (double)result->max / 1000.0);
+    }
+}
+
+/**
+ * @brief Simulate the dispatch engine over a journal and report each policy.
+ *
+ * @param path The journal file name.
+ * @param grid The policy values to simulate.
+ * @return int 0 on success.
+ */
+int tune_journal(const char *path, const tune_grid_t *grid) {
+    journal_reader_t reader;
+    int ret = EXIT_SUCCESS;
+
+    if (!journal_reader_open(&reader, path)) {
+        return EXIT_FAILURE;
+    }
+    if (read_journal(&reader) < 0) {
+        fprintf(stderr, "Failed to read journal '%s'\n", path);
+        journal_reader_close(&reader);
+        return EXIT_FAILURE;
+    }
+
+    const unsigned *debounce = grid->debounce_count ? grid->debounce : s_default_debounce;
+    const unsigned *max_latency = grid->max_latency_count ? grid->max_latency : s_default_max_latency;
+    const unsigned *jobs = grid->jobs_count ? grid->jobs : s_default_jobs;
+    int debounce_count = grid->debounce_count ? grid->debounce_count : (int)(sizeof(s_default_debounce) / sizeof(unsigned));
+    int max_latency_count = grid->max_latency_count ? grid->max_latency_count : (int)(sizeof(s_default_max_latency) / sizeof(unsigned));
+    int jobs_count = grid->jobs_count ? grid->jobs_count : (int)(sizeof(s_default_jobs) / sizeof(unsigned));
+    int count = debounce_count * max_latency_count * jobs_count;
+    int rules = reader.rules;
+
+    watch_policy_t *policies = malloc((size_t)count * sizeof(*policies));
+    tune_result_t *results = calloc((size_t)count * (size_t)(rules ? rules : 1), sizeof(*results));
+    if (policies == NULL || results == NULL) {
+        perror("Failed to allocate results");
+        ret = EXIT_FAILURE;
+    }
+    int point = 0;
+    for (int d = 0; d < debounce_count && ret == EXIT_SUCCESS; d++) {
+        for (int m = 0; m < max_latency_count && ret == EXIT_SUCCESS; m++) {
+            for (int j = 0; j < jobs_count && ret == EXIT_SUCCESS; j++, point++) {
+                policies[point] = (watch_policy_t){ debounce[d], max_latency[m], jobs[j] };
+                if (simulate(path, &policies[point], &results[point * rules]) != rules) {
+                    fprintf(stderr, "Failed to simulate journal '%s'\n", path);
+                    ret = EXIT_FAILURE;
+                }
+            }
+        }
+    }
+    if (rules && ret == EXIT_SUCCESS) {
+        puts("Rules are simulated without their --rate, --adaptive, --priority and --weight, which the journal\n"
+            "does not keep, and without contention for the shared --slots.");
+    }
+    for (int index = 0; index < rules && ret == EXIT_SUCCESS; index++) {
+        tune_rule(path, reader.targets[index], index, policies, results, count, rules);
+    }
+    free(policies);
+    free(results);
+    for (int index = 0; index < WATCH_MAX_RULES; index++) {
+        free(s_rules[index].pending.at);
+        free(s_rules[index].latency.at);
+        free(s_runtimes[index].at);
+    }
+    journal_reader_close(&reader);
+    return ret;
+}
+
+/* End. */
@@ -0,0 +1,47 @@
+/**
+ * @file tune.h
+ * @author Mark Lehane (markdlehane@gmail.com)
+ * @brief Dispatch policy tuner interface.
+ * @details Simulates the dispatch engine over a recorded event journal
+ * for a grid of policies.
+ *
+ * @version 0.1
+ * @date 2025-12-06
+ *
+ * @copyright Copyright (c) 2025, Mark D Lehane.
+ *
+ */
+
+#ifndef TUNE_H
+#define TUNE_H
+
+// Local constants.
+#define TUNE_MAX_VALUES 16
+
+/**
+ * @brief The grid of policy values to simulate.
+ * @details A list with no entries uses the tuner's default values.
+ *
+ */
+typedef struct tune_grid_s {
+    unsigned debounce[TUNE_MAX_VALUES];
+    unsigned max_latency[TUNE_MAX_VALUES];
+    unsigned jobs[TUNE_MAX_VALUES];
+    int debounce_count;
+    int max_latency_count;
+    int jobs_count;
+
+} tune_grid_t;
+
+/**
+ * @brief Simulate the dispatch engine over a journal and report each policy.
+ *
+ * @param path The journal file name.
+ * @param grid The policy values to simulate.
+ * @return int 0 on success.
+ */
+extern int tune_journal(const char *path, const tune_grid_t *grid);
+
+#endif
+
+/* End. */
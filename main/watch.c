@@ -12,8 +12,14 @@
  * 
  */
 
+#define _GNU_SOURCE
+
 #include <sys/signalfd.h>
 #include <sys/inotify.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include <string.h>
 #include <stdlib.h>
@@ -23,6 +29,28 @@
 #include <poll.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <time.h>
+#include <linux/limits.h>
+
+#include "watch.h"
+#include "rules.h"
+#include "adapt.h"
+#include "stats.h"
+#include "psi.h"
+#include "placement.h"
+#include "control.h"
+#include "changelog.h"
+#include "hot.h"
+#include "metrics.h"
+#include "journal.h"
+#include "tree.h"
+#include "snapshot.h"
+#include "merkle.h"
+#include "chunks.h"
+#include "profile.h"
+#include "changeset.h"
+#include "pathwait.h"
+#include "config.h"
 
 /**
  * @brief Enum used to identify event types.
@@ -31,16 +59,128 @@
 typedef enum poll_fd_e {
     FD_POLL_SIGNAL = 0,
     FD_POLL_INOTIFY,
-    FD_POLL_MAX
+    FD_POLL_PSI,
+    FD_POLL_MAX = FD_POLL_PSI + PSI_MAX + CONTROL_MAX_FDS
 
 } POLL_FDE;
 
+/**
+ * @brief A running command.
+ *
+ */
+typedef struct engine_job_s {
+    pid_t pid;                  // Child process id, 0 if the slot is free.
+    uint64_t start;             // Time the command started.
+    watch_rule_t *rule;         // The rule the command belongs to.
+    uint64_t run;               // The run number, for control clients waiting on it.
+
+} engine_job_t;
+
+/**
+ * @brief The changes of a rule being tested against its predicate.
+ *
+ */
+typedef struct engine_test_s {
+    predicate_t *predicate;
+    bool pass;                  // A change met the predicate.
+
+} engine_test_t;
+
+/**
+ * @brief The changes of a rule being hashed into its tree.
+ *
+ */
+typedef struct engine_hash_s {
+    MERKLE_SCOPE scope;         // How much of each changed path to hash again.
+    bool known;                 // Every change lay in the hashed tree.
+
+} engine_hash_t;
+
+/**
+ * @brief The changes of a rule being compared by their chunks.
+ *
+ */
+typedef struct engine_ranges_s {
+    watch_rule_t *rule;
+    FILE *fp;                   // Receives the changed ranges.
+
+} engine_ranges_t;
+
+/**
+ * @brief Dispatch engine state.
+ * @details The engine is driven by a clock that is either the monotonic
+ * clock (live) or the journal time (replay), so the same debounce and
+ * dispatch logic runs in both cases; the tuner's simulated replay has
+ * each run hold a job slot for its run time rather than run anything.
+ * The pending changes and the policy belong to each rule; the job
+ * slots, change storms and the single scan timeout are shared by all
+ * of them.
+ *
+ */
+typedef struct engine_s {
+    const watch_opts_t *opts;
+    uint64_t now;               // Engine time in microseconds.
+    unsigned running;           // Commands currently running, over all rules.
+    unsigned slots;             // Job slots shared by all rules.
+    bool reserve;               // A slot is kept for the interactive lane.
+    uint64_t vclock;            // Fair queuing virtual time, the start tag of the latest run.
+    engine_job_t jobs[WATCH_MAX_JOBS];
+    bool storm;                 // A change storm is in progress.
+    uint64_t storm_last;        // Time of the latest read during the storm.
+    bool storm_lost;            // Events were lost, the rescan has to stat every path.
+    uint64_t window_start;      // Start of the event rate window.
+    unsigned window_events;     // Change events in the rate window.
+    unsigned full_reads;        // Consecutive reads that filled the buffer.
+    unsigned long lag;          // Bytes waiting in the kernel queue at the latest read.
+    unsigned long lag_behind;   // Lag at which per-event work is put off.
+    unsigned long lag_storm;    // Lag at which a change storm begins.
+    size_t batch;               // Bytes read at a time, grown with the lag.
+    bool behind;                // The lag is over lag_behind.
+    uint64_t rescan_rules;      // Mask of the rules with changes found by a rescan.
+    uint64_t timeout_at;        // Time a single scan gives up waiting, or 0.
+    uint64_t metrics_at;        // Time the metrics file is next written, or 0.
+    int exit_code;              // Exit status decided by the engine, or -1.
+    bool track_paths;           // Resolve the path of each change.
+    bool replaying;             // Events are read from a journal.
+    const uint64_t *runtimes;   // Run time of each rule in a simulated replay, or NULL.
+    watch_sim_fn report;        // Told of the changes and runs of a simulated replay.
+    bool stop;                  // Leave the watch loop.
+
+} engine_t;
+
 // Local constants.
-#define EVENT_BUF_LEN (sizeof(struct inotify_event) * 16)
+#define EVENT_MAX_SIZE (sizeof(struct inotify_event) + NAME_MAX + 1)
+#define EVENT_BUF_LEN (EVENT_MAX_SIZE * 16)
+#define IDLE_TIMEOUT_MS 1000
+#define STORM_FULL_READS 16
+#define LAG_BUF_LEN WATCH_MAX_READ
+#define LAG_EVENT_SIZE (sizeof(struct inotify_event) + 16)
+#define MAX_QUEUED_EVENTS "/proc/sys/fs/inotify/max_queued_events"
+#define DEFAULT_QUEUED_EVENTS 16384
+#define RUN_COST_MIN 1000           // Fair queuing charge of a run not yet measured (us).
+#define SIM_PID ((pid_t)-1)         // The process of a simulated run.
+#define CHANGE_MASK (IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)
 
 // Local data.
-static int s_watch_instance = -1;
 static int s_inotify_instance = -1;
+static engine_t s_engine = { .exit_code = -1, .batch = EVENT_BUF_LEN };
+static char s_events[LAG_BUF_LEN] __attribute__((aligned(8)));
+
+// Forward declarations.
+static void engine_arrived(watch_rule_t *rule);
+static void engine_reload(void);
+static void engine_slot_wait(watch_rule_t *rule);
+
+/**
+ * @brief Read the monotonic clock.
+ *
+ * @return uint64_t The monotonic time in microseconds.
+ */
+uint64_t watch_clock_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
 
 /**
  * @brief Report event types.
@@ -101,57 +241,462 @@ static void report_event(struct inotify_event *event) {
 }
 
 /**
- * @brief Monitor a target for file/directory update events.
+ * @brief Filter a buffer of inotify events.
+ * @details A change is a write, or in a tree a path created, deleted or
+ * renamed, so that a save by rename or a removal is seen as well as a
+ * write in place. Only events on the watches of rules count: the
+ * watches on the ancestors of an awaited target and on the directory
+ * of the config file report creations and writes of their own.
  * 
- * @param inf Inotiy interface handle.
- * @return int Return the number of "MODIFY" events that occurred.
+ * @param buf The raw events buffer.
+ * @param len The number of bytes in the buffer.
+ * @param verbose True if each event should be reported.
+ * @param overflow If not NULL, set true if the kernel queue overflowed.
+ * @param on_change If not NULL, called for each change event.
+ * @return int Return the number of change events in the buffer.
  */
-static int watch_handler(int inf, bool verbose) {
-    char buf[EVENT_BUF_LEN] __attribute__((aligned(4)));
-    ssize_t len = EVENT_BUF_LEN, i = 0;
+int watch_filter_events(const char *buf, ssize_t len, bool verbose, bool *overflow, watch_change_fn on_change) {
+    ssize_t i = 0;
 
     int events = 0;
-    len = read(inf, buf, len);
     while (i < len) {
         struct inotify_event *event = (struct inotify_event*)&buf[i];
 
-        // If a modify event occurs, add it to the "events" counter.
-        if (event->mask & IN_MODIFY) {
+        // Events were lost, only a rescan can tell what changed.
+        if ((event->mask & IN_Q_OVERFLOW) && overflow) {
+            *overflow = true;
+        }
+
+        // If a change event occurs, add it to the "events" counter.
+        if ((event->mask & CHANGE_MASK) && tree_rules(event->wd)) {
             if (verbose) {
                 report_event(event);
             }
+            if (on_change) {
+                on_change(event);
+            }
             events++;
         }
         i += sizeof(struct inotify_event) + event->len;
     }
-    // Return the number of "MODIFY" events that occurred.
+    // Return the number of change events that occurred.
     return events;
 }
 
+
+/**
+ * @brief Count a change set that has reached its memory cap.
+ * 
+ * @param rule The rule.
+ */
+static void engine_degraded(watch_rule_t *rule) {
+    bool all = changeset_level(rule->changes) == CHANGESET_ALL;
+
+    if (all) {
+        rule->stats.collapsed++;
+    }
+    else {
+        rule->stats.coarsened++;
+    }
+    if (s_engine.opts->verbose) {
+        printf("Rule %s changes over %lukB, %s\n", rule->name, (unsigned long)(s_engine.opts->changes_max >> 10),
+            all ? "the whole target is taken as changed" : "keeping their directories");
+    }
+}
+
+/**
+ * @brief Add a change event to the pending set of a rule.
+ * 
+ * @param rule The rule.
+ * @param path The changed path, or NULL if paths are not tracked.
+ */
+static void engine_event(watch_rule_t *rule, const char *path) {
+    if (rule == NULL || rule->awaiting || rule->retired) {
+        return;
+    }
+    if (s_engine.report) {
+        s_engine.report(WATCH_SIM_EVENT, rule->index, s_engine.now);
+    }
+    engine_slot_wait(rule);
+    if (rule->pending == 0) {
+        rule->first_event = s_engine.now;
+    }
+    rule->pending++;
+    rule->last_event = s_engine.now;
+    rule->stats.events++;
+    if (ADAPTIVE(rule)) {
+        adapt_event(rule, s_engine.now);
+    }
+    if (rule->held_since) {
+        // The run is held by the rate limit, the change goes with it.
+        rule->stats.merged++;
+    }
+    if (path) {
+        CHANGESET_LEVEL level = changeset_level(rule->changes);
+        changeset_add(rule->changes, path);
+        if (changeset_level(rule->changes) != level) {
+            engine_degraded(rule);
+        }
+    }
+}
+
+/**
+ * @brief Hand a change event to each rule its watch serves.
+ * @details A directory reached through links has several paths; the
+ * event is handed on under each of them, to the rules that cover it.
+ * 
+ * @param event The change event.
+ */
+static void route_change(const struct inotify_event *event) {
+    char path[PATH_MAX];
+    const char *changed = NULL;
+    const char *parent = NULL;
+    uint64_t rules = tree_rules(event->wd);
+    bool aliased = s_engine.track_paths && tree_alias(event->wd, 1) != NULL;
+    int alias = 0;
+
+    do {
+        if (s_engine.track_paths) {
+            parent = tree_alias(event->wd, alias);
+            if (parent && event->len == 0) {
+                changed = parent;
+            }
+            else if (parent && snprintf(path, sizeof(path), "%s/%s", parent, event->name) < (int)sizeof(path)) {
+                changed = path;
+            }
+            else {
+                changed = NULL;
+            }
+        }
+        if (alias == 0 && !s_engine.behind) {
+            hot_event(changed);
+        }
+        changelog_add(changed);
+        uint64_t mask = rules;
+        for (int index = 0; mask; index++, mask >>= 1) {
+            if ((mask & 1) && (!aliased || (changed && rule_covers(rule_at(index), changed)))) {
+                engine_event(rule_at(index), changed);
+            }
+        }
+    } while (aliased && tree_alias(event->wd, ++alias) != NULL);
+}
+
+/**
+ * @brief Enter a change storm.
+ * 
+ * @param reason Why the storm was detected.
+ */
+static void storm_begin(const char *reason) {
+    s_engine.storm = true;
+    s_engine.storm_last = s_engine.now;
+    s_engine.storm_lost = false;
+    stats_global()->storms++;
+    if (s_engine.opts->verbose) {
+        printf("Change storm detected (%s), waiting for quiet\n", reason);
+    }
+}
+
+/**
+ * @brief Mark the directories named by a buffer of events drained in a storm.
+ * @details The rescan then lists only these and the directories whose
+ * times changed. An overflow means some were never named, so the rescan
+ * has to stat every path.
+ * 
+ * @param buf The raw events buffer.
+ * @param len The number of bytes in the buffer.
+ */
+static void storm_mark(const char *buf, ssize_t len) {
+    ssize_t i = 0;
+    int last = -1;
+
+    while (i < len) {
+        const struct inotify_event *event = (const struct inotify_event *)&buf[i];
+        i += sizeof(struct inotify_event) + event->len;
+        if (event->mask & IN_Q_OVERFLOW) {
+            s_engine.storm_lost = true;
+            stats_global()->overflows++;
+        }
+        else if (event->wd != last) {
+            const char *path;
+            last = event->wd;
+            for (int alias = 0; (path = tree_alias(event->wd, alias)) != NULL; alias++) {
+                snapshot_mark(path);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Decode a buffer of events, watching for change storms.
+ * @details A storm is a high change rate, a run of reads that fill the
+ * buffer (the kernel queue is backing up) or a queue overflow. During a
+ * storm the buffers are drained, only noting the directories the events
+ * are in; once it is quiet, a single rescan against the snapshot finds
+ * what changed.
+ * 
+ * @param buf The raw events buffer.
+ * @param len The number of bytes in the buffer.
+ * @param verbose True if each event should be reported.
+ */
+static void engine_read(const char *buf, ssize_t len, bool verbose) {
+    const watch_opts_t *opts = s_engine.opts;
+    watch_stats_t *stats = stats_global();
+    bool overflow = false;
+
+    if (s_engine.storm) {
+        s_engine.storm_last = s_engine.now;
+        storm_mark(buf, len);
+        return;
+    }
+    stats_event_types(buf, len);
+    int events = watch_filter_events(buf, len, verbose, &overflow, route_change);
+    stats->events += (unsigned long)events;
+    if (overflow) {
+        stats->overflows++;
+    }
+    if (opts->storm_rate == 0) {
+        return;
+    }
+
+    // Track the change rate over one second windows and the queue depth.
+    if (s_engine.now - s_engine.window_start >= 1000000) {
+        s_engine.window_start = s_engine.now;
+        s_engine.window_events = 0;
+    }
+    s_engine.window_events += (unsigned)events;
+    s_engine.full_reads = (size_t)len > s_engine.batch - EVENT_MAX_SIZE ? s_engine.full_reads + 1 : 0;
+
+    if (overflow) {
+        storm_begin("queue overflow");
+        s_engine.storm_lost = true;
+    }
+    else if (s_engine.window_events >= opts->storm_rate) {
+        storm_begin("change rate");
+    }
+    else if (s_engine.lag >= s_engine.lag_storm) {
+        storm_begin("queue lag");
+    }
+    else if (s_engine.full_reads >= STORM_FULL_READS) {
+        storm_begin("queue depth");
+    }
+}
+
+/**
+ * @brief Set the lag thresholds from the size of the kernel queue.
+ * @details The watcher is behind once an eighth of the queue is in use
+ * and a storm begins at half, well before the queue overflows.
+ * 
+ */
+static void lag_init(void) {
+    unsigned long events = DEFAULT_QUEUED_EVENTS;
+
+    FILE *fp = fopen(MAX_QUEUED_EVENTS, "r");
+    if (fp) {
+        if (fscanf(fp, "%lu", &events) != 1 || events == 0) {
+            events = DEFAULT_QUEUED_EVENTS;
+        }
+        fclose(fp);
+    }
+    s_engine.lag_behind = events * LAG_EVENT_SIZE / 8;
+    s_engine.lag_storm = events * LAG_EVENT_SIZE / 2;
+}
+
+/**
+ * @brief Take in the depth of the kernel queue before a read.
+ * @details The next read takes everything waiting, up to the largest
+ * buffer. While behind, the per-event work that can wait (reporting
+ * each event and counting the heaviest paths) is skipped, so the
+ * watcher catches up; the changes themselves are all still handled.
+ * 
+ * @param lag The bytes waiting in the kernel queue.
+ */
+static void engine_lag(unsigned long lag) {
+    watch_stats_t *stats = stats_global();
+
+    if (lag != s_engine.lag) {
+        journal_lag(lag);
+    }
+    s_engine.lag = lag;
+    stats->queued = lag;
+    if (lag > stats->queued_max) {
+        stats->queued_max = lag;
+    }
+    s_engine.batch = EVENT_BUF_LEN;
+    while (s_engine.batch < lag && s_engine.batch < LAG_BUF_LEN) {
+        s_engine.batch *= 2;
+    }
+    if (s_engine.batch > LAG_BUF_LEN) {
+        s_engine.batch = LAG_BUF_LEN;
+    }
+    bool behind = s_engine.lag_behind && lag >= s_engine.lag_behind;
+    if (behind != s_engine.behind && s_engine.opts->verbose) {
+        if (behind) {
+            printf("Behind by %lu bytes, reading %zu at a time\n", lag, s_engine.batch);
+        }
+        else {
+            puts("Caught up with the kernel queue");
+        }
+    }
+    if (behind && !s_engine.behind) {
+        stats->behind++;
+    }
+    s_engine.behind = behind;
+}
+
+/**
+ * @brief Return the depth of the kernel queue, for the statistics.
+ * @details A replay has no queue to look at, so it reports the depth
+ * last journaled.
+ *
+ * @return unsigned long The bytes waiting.
+ */
+static unsigned long engine_queued(void) {
+    int queued = 0;
+
+    if (s_engine.replaying || s_inotify_instance == -1 || ioctl(s_inotify_instance, FIONREAD, &queued) == -1) {
+        return s_engine.lag;
+    }
+    return (unsigned long)queued;
+}
+
+/**
+ * @brief Monitor the targets for file/directory update events.
+ * @details The raw buffer is journaled before it is filtered so that
+ * a replay sees exactly what the kernel delivered. The queue depth is
+ * looked at first to size the read. A change to the config file
+ * reloads it once the buffer has been dealt with.
+ * 
+ * @param inf Inotiy interface handle.
+ * @param verbose True if each event should be reported.
+ */
+static void watch_handler(int inf, bool verbose) {
+    char *buf = s_events;
+    int lag = 0;
+
+    profile_begin(PROFILE_READ);
+    if (ioctl(inf, FIONREAD, &lag) == -1) {
+        lag = 0;
+    }
+    engine_lag((unsigned long)lag);
+    ssize_t len = read(inf, buf, s_engine.batch);
+    profile_end();
+    if (len <= 0) {
+        return;
+    }
+    stats_global()->reads++;
+    journal_events(buf, (size_t)len);
+    profile_begin(PROFILE_DECODE);
+    for (int index = 0; index < rule_count(); index++) {
+        watch_rule_t *rule = rule_at(index);
+        if (rule->awaiting && pathwait_events(rule->wait, buf, len)) {
+            engine_arrived(rule);
+        }
+    }
+    engine_read(buf, len, verbose && !s_engine.behind);
+    tree_events(buf, len, !s_engine.storm);
+    profile_end();
+    if (s_engine.opts->config && config_events(buf, len)) {
+        engine_reload();
+    }
+}
+
+/**
+ * @brief Hash the tree of a rule that runs only when it changes.
+ * @details An awaited target hashes as missing, so its arrival is a
+ * change.
+ *
+ * @param rule The rule.
+ */
+static void hash_rule(watch_rule_t *rule) {
+    const watch_opts_t *opts = s_engine.opts;
+
+    if (!rule->tree_check || !merkle_take(rule->target, rule->recursive)) {
+        return;
+    }
+    merkle_hash(rule->target, &rule->tree_hash);
+    if (opts->verbose) {
+        printf("Tree of '%s' hashed, %lu paths in all\n", rule->target, merkle_count());
+    }
+}
+
+/**
+ * @brief Record the chunks of the files of a rule that reports changed ranges.
+ * @details An awaited target has no files yet, so the whole of it is
+ * new when it arrives.
+ *
+ * @param rule The rule.
+ */
+static void chunk_rule(watch_rule_t *rule) {
+    if (rule->changed_ranges) {
+        chunks_seed(&rule->chunks, rule->target, rule->recursive);
+    }
+}
+
+/**
+ * @brief Watch the target of a rule.
+ * 
+ * @param rule The rule.
+ * @return bool True if the target is being watched.
+ */
+static bool watch_rule(watch_rule_t *rule) {
+    const watch_opts_t *opts = s_engine.opts;
+
+    if (!tree_watch_rule(rule)) {
+        return false;
+    }
+    predicate_seed(&rule->predicate, rule->target);
+    // The snapshot lets a change storm end with a single rescan. It has to
+    // show the tree before a storm begins, so it cannot wait for one.
+    if (opts->storm_rate && !snapshot_take(rule->target, rule->recursive, rule->follow)) {
+        fprintf(stderr, "Unable to take a snapshot of '%s'\n", rule->target);
+    }
+    else if (opts->verbose && opts->storm_rate) {
+        printf("Snapshot of %lu paths taken\n", snapshot_count());
+    }
+    return true;
+}
+
 /**
  * @brief Initialise the watcher mechanism.
+ * @details An awaited target is not watched until it arrives.
  * 
- * @param target The file or directory to watch.
- * @param verbose True if verbose output should be made.
+ * @param opts A pointer to the watcher options.
  * @return int inotify handle.
  */
-static int initialise_watcher(const char *target, const bool verbose) {
+static int initialise_watcher(const watch_opts_t *opts) {
     // Create an inotify interface.
     int inf = inotify_init();
     if (inf == -1) {
         perror("Failed to initalise iNotify");
+        return inf;
     }
-    else {
-        int wd = inotify_add_watch(inf, target, IN_MODIFY | IN_EXCL_UNLINK);
-        if (wd == -1) {
-            perror("Failed to create a watch on target");
-        }
-        else {
-            if (verbose) {
-                printf("Begun monitoring of '%s' - %d\n", target, wd);
+    s_inotify_instance = inf;
+    tree_init(inf, opts->verbose);
+    if (opts->config && !config_watch(inf, opts->config, opts->verbose)) {
+        close(inf);
+        s_inotify_instance = -1;
+        return -1;
+    }
+    for (int index = 0; index < rule_count(); index++) {
+        watch_rule_t *rule = rule_at(index);
+        hash_rule(rule);
+        chunk_rule(rule);
+        if (rule->await) {
+            rule->wait = pathwait_init(inf, rule->target, opts->verbose);
+            rule->awaiting = rule->wait != NULL;
+            if (!rule->awaiting) {
+                inf = -1;
             }
-            s_inotify_instance = inf;
-            s_watch_instance = wd;
+        }
+        else if (!watch_rule(rule)) {
+            inf = -1;
+        }
+        if (inf == -1) {
+            config_shutdown();
+            tree_shutdown();
+            close(s_inotify_instance);
+            s_inotify_instance = -1;
+            break;
         }
     }
     return inf;
@@ -163,10 +708,13 @@ static int initialise_watcher(const char *target, const bool verbose) {
  */
 static void shutdown_watcher(void) {
     if (s_inotify_instance != -1) {
-        if (s_watch_instance != -1) {
-            inotify_rm_watch(s_inotify_instance, s_watch_instance);
-            s_watch_instance = -1;
+        for (int index = 0; index < rule_count(); index++) {
+            watch_rule_t *rule = rule_at(index);
+            pathwait_shutdown(rule->wait);
+            rule->wait = NULL;
         }
+        config_shutdown();
+        tree_shutdown();
         close(s_inotify_instance);
         s_inotify_instance = -1;
     }
@@ -181,10 +729,13 @@ static int initialize_signals (void) {
     int signal_fd;
     sigset_t sigmask;
 
-    /* We want to handle SIGINT and SIGTERM in the signal_fd, so we block them. */
+    /* We want to handle SIGINT, SIGTERM, SIGCHLD, SIGUSR1 and SIGHUP in the signal_fd, so we block them. */
     sigemptyset (&sigmask);
     sigaddset (&sigmask, SIGINT);
     sigaddset (&sigmask, SIGTERM);
+    sigaddset (&sigmask, SIGCHLD);
+    sigaddset (&sigmask, SIGUSR1);
+    sigaddset (&sigmask, SIGHUP);
     
     // Can we block the signals?
     if (sigprocmask (SIG_BLOCK, &sigmask, NULL) < 0) {
@@ -211,78 +762,1407 @@ static int execute_command(const char *command, const bool verbose) {
     if (verbose) {
         printf("Notify event - executing '%s'\n", command);
     }
+    fflush(stdout);
     return (WIFEXITED(system(command)) == 0) ? 0 : -1;
 }
 
 /**
- * @brief Watch a file, files or a directory for changes.
- * @details The routine wathes a file, files or directory for changes
- * and executes a command for each change.
+ * @brief Start the watcher update command in a child process.
+ * @details The child restores the default signal mask (the watcher
+ * blocks its signals for the signalfd) and runs the command through
+ * the shell, as system() would, placed as the rule asks. Its exit is
+ * picked up via SIGCHLD.
  * 
- * @param watch_target A pointer to the file pattern to scan for changes.
- * @param command A pointer to the command to execute.
- * @param continuous If true the program scans continuously, otherwise scans once.
- * @param verbose Report events and debug information.
- * @return int 0 on success.
+ * @param rule The rule whose command to execute.
+ * @param input The file for the command's standard input, or -1 to
+ * leave it as the watcher's.
+ * @param verbose If true report each action.
+ * @return pid_t The child process id, or -1 on failure.
  */
-int watch_for_changes(const char *watch_target, const char *command, bool continuous, bool verbose) {
-    int ret = EXIT_FAILURE;
-    int signal_fd;
-    int inotify_fd;
+static pid_t spawn_command(const watch_rule_t *rule, int input, const bool verbose) {
+    const char *command = rule->command;
 
-    // Initialise the signals interface.
-    signal_fd = initialize_signals();
-    if (signal_fd == -1) {
-        fprintf(stderr, "Unable to initialise signal handler\n");
-        ret = EXIT_FAILURE;
+    if (verbose) {
+        printf("Notify event - executing '%s'\n", command);
     }
-    else if ((inotify_fd = initialise_watcher(watch_target, verbose)) == -1) {
-        close(signal_fd);
-        fprintf(stderr, "Unable to initialise watch handler\n");
-        ret = EXIT_FAILURE;
+    fflush(stdout);
+    profile_begin(PROFILE_SPAWN);
+    pid_t pid = fork();
+    if (pid == 0) {
+        sigset_t sigmask;
+        sigemptyset(&sigmask);
+        sigprocmask(SIG_SETMASK, &sigmask, NULL);
+        if (input != -1) {
+            dup2(input, STDIN_FILENO);
+        }
+        placement_apply(rule);
+        execl("/bin/sh", "sh", "-c", command, (char *)NULL);
+        _exit(127);
     }
-    else {
-        // Assume this is going to work (and use this as an error flag).
-        ret = EXIT_SUCCESS;
+    profile_end();
+    if (pid < 0) {
+        fprintf(stderr, "Couldn't start command: '%s'\n", strerror(errno));
+    }
+    return pid;
+}
 
-        // Setup a structure of the event handles that we'll watch.
-        struct pollfd poll_handles[] = {
-            { .fd = signal_fd, .events = POLLIN },
-            { .fd = inotify_fd, .events = POLLIN }
-        };
+/**
+ * @brief Return the time at which the pending changes of a rule settle.
+ * 
+ * @param rule The rule.
+ * @return uint64_t The time the debounce or the latency limit ends.
+ */
+static uint64_t engine_settled(const watch_rule_t *rule) {
+    const watch_policy_t *policy = &rule->policy;
 
-        // Now loop through the handles.
-        int watch_events = 0;
-        for (;;) {
-            // Set the timeout to a low value if there are watch events, otherwise 1s.
-            int timeout = watch_events ? 100 : 1000;
-            
-            // Wait for a second.
-            int npoll = poll(poll_handles, FD_POLL_MAX, timeout);
-            if (npoll == 0) {
-                if (watch_events > 0) {
-                    watch_events = 0;
-                    if (verbose) {
-                        printf("Notify event - executing '%s'\n", command);
-                    }
-                    int rc = system(command);
-                    if (verbose) {
-                        fprintf(stdout, "return code %x\n", rc);
-                    }
-                    if (rc != 0) {
-                        if (WIFEXITED(rc) != 0) {
-                            break;
-                        }
-                    }
-                }
+    uint64_t deadline = rule->last_event + (uint64_t)policy->debounce * 1000;
+    if (policy->max_latency) {
+        // A steady stream of changes must not hold the run off forever.
+        uint64_t latest = rule->first_event + (uint64_t)policy->max_latency * 1000;
+        if (latest < deadline) {
+            deadline = latest;
+        }
+    }
+    return deadline;
+}
+
+/**
+ * @brief Tell an adaptive rule when its changes began to wait for a slot.
+ * @details Changes that settled with every slot of the rule busy are
+ * waiting for one. This is looked at before a change is added, which
+ * would put off the settling, and as a command of the rule ends.
+ *
+ * @param rule The rule.
+ */
+static void engine_slot_wait(watch_rule_t *rule) {
+    if (ADAPTIVE(rule) && rule->pending && rule->running >= rule->policy.jobs &&
+        engine_settled(rule) <= s_engine.now) {
+        adapt_wait(rule, engine_settled(rule));
+    }
+}
+
+/**
+ * @brief Return the time at which the pending changes of a rule are due.
+ * 
+ * @param rule The rule.
+ * @return uint64_t The due time, or 0 if there is nothing to dispatch.
+ */
+static uint64_t engine_due(const watch_rule_t *rule) {
+    if (rule->pending == 0 || rule->running >= rule->policy.jobs) {
+        return 0;
+    }
+    return engine_settled(rule);
+}
+
+/**
+ * @brief Return the time at which the pending changes should be dispatched.
+ * @details During a change storm this is the time the storm ends.
+ * Otherwise it is the earliest time a rule is due, or, for a rule that
+ * is already held by its rate limit, the time its bucket has a token,
+ * or, for a rule deferred by pressure, the time to look at it again.
+ * 
+ * @return uint64_t The dispatch time, or 0 if there is nothing to dispatch.
+ */
+static uint64_t engine_deadline(void) {
+    uint64_t deadline = 0;
+
+    if (s_engine.storm) {
+        // A replayed storm ends at its recorded rescan.
+        return s_engine.replaying ? 0 : s_engine.storm_last + (uint64_t)s_engine.opts->storm_quiet * 1000;
+    }
+    for (int index = 0; index < rule_count(); index++) {
+        const watch_rule_t *rule = rule_at(index);
+        uint64_t due = engine_due(rule);
+        if (due && rule->held_since) {
+            uint64_t ready = rule_rate_ready(rule);
+            if (ready > due) {
+                due = ready;
             }
-            else if (npoll < 0) {
-                fprintf(stderr, "Couldn't poll: '%s'\n", strerror(errno));
-                ret = EXIT_FAILURE;
-                break;
+        }
+        if (due && rule->deferred_since && psi_recheck() > due) {
+            due = psi_recheck();
+        }
+        if (rule->queued_since) {
+            // A queued rule is woken by a command exiting.
+            continue;
+        }
+        if (due && (deadline == 0 || due < deadline)) {
+            deadline = due;
+        }
+    }
+    return deadline;
+}
+
+/**
+ * @brief Return the next time the engine needs to act.
+ * 
+ * @return uint64_t The wake time, or 0 if there is nothing to wait for.
+ */
+static uint64_t engine_wake(void) {
+    uint64_t deadline = engine_deadline();
+    if (s_engine.timeout_at && (deadline == 0 || s_engine.timeout_at < deadline)) {
+        deadline = s_engine.timeout_at;
+    }
+    for (unsigned slot = 0; s_engine.runtimes && slot < WATCH_MAX_JOBS; slot++) {
+        const engine_job_t *job = &s_engine.jobs[slot];
+        // A simulated run ends once its run time is up.
+        if (job->pid == SIM_PID) {
+            uint64_t end = job->start + s_engine.runtimes[job->rule->index];
+            if (deadline == 0 || end < deadline) {
+                deadline = end;
             }
-            else if (npoll > 0) {
-                // Check for an interrupt signal.
+        }
+    }
+    if (s_engine.metrics_at && (deadline == 0 || s_engine.metrics_at < deadline)) {
+        deadline = s_engine.metrics_at;
+    }
+    return deadline;
+}
+
+/**
+ * @brief Test one changed path against the predicate of a rule.
+ * 
+ * @param path The changed path.
+ * @param context The test.
+ */
+static void test_change(const char *path, void *context) {
+    engine_test_t *test = context;
+
+    // Once a change passes, only the byte ranges still need recording.
+    if ((!test->pass || test->predicate->ranged) && predicate_test(test->predicate, path)) {
+        test->pass = true;
+    }
+}
+
+/**
+ * @brief Hash one changed path of a rule again.
+ * 
+ * @param path The changed path.
+ * @param context The hashing.
+ */
+static void hash_change(const char *path, void *context) {
+    engine_hash_t *hash = context;
+
+    hash->known &= merkle_update(path, hash->scope);
+}
+
+/**
+ * @brief Check if the changes of a rule changed the hash of its tree.
+ * @details Directories kept for the changes at the memory cap have
+ * their files hashed again, and the whole tree is when the changes
+ * were given up. A change that could not be hashed counts as one.
+ * 
+ * @param rule The rule.
+ * @return bool True if the command should run.
+ */
+static bool engine_tree_changed(watch_rule_t *rule) {
+    engine_hash_t hash = { .scope = MERKLE_PATH, .known = true };
+    CHANGESET_LEVEL level = changeset_level(rule->changes);
+    uint64_t before = rule->tree_hash;
+
+    if (level == CHANGESET_ALL) {
+        hash.known = merkle_update(rule->target, MERKLE_TREE);
+    }
+    else if (changeset_count(rule->changes)) {
+        hash.scope = level == CHANGESET_DIRS ? MERKLE_DIR : MERKLE_PATH;
+        changeset_each(rule->changes, hash_change, &hash);
+    }
+    else {
+        hash.known = merkle_update(rule->target, MERKLE_PATH);
+    }
+    if (!merkle_hash(rule->target, &rule->tree_hash)) {
+        return true;
+    }
+    return !hash.known || rule->tree_hash != before;
+}
+
+/**
+ * @brief Check if any change of a rule meets its predicate.
+ * 
+ * @param rule The rule.
+ * @return bool True if the command should run.
+ */
+static bool engine_predicate(watch_rule_t *rule) {
+    engine_test_t test = { .predicate = &rule->predicate };
+
+    // Without the changed files there is nothing to test, the rule runs.
+    if (changeset_level(rule->changes) != CHANGESET_PATHS) {
+        return true;
+    }
+    if (changeset_count(rule->changes)) {
+        changeset_each(rule->changes, test_change, &test);
+    }
+    else {
+        test_change(rule->target, &test);
+    }
+    return test.pass;
+}
+
+/**
+ * @brief Report the changed byte ranges of one changed path of a rule.
+ * 
+ * @param path The changed path.
+ * @param context The output stream.
+ */
+static void range_change(const char *path, void *context) {
+    const engine_ranges_t *ranges = context;
+
+    chunks_update(&ranges->rule->chunks, path, ranges->fp);
+}
+
+/**
+ * @brief Work out the changed byte ranges of a rule's changes.
+ * @details The lines are printed in place of the changed paths, and
+ * are the standard input of the command, from an in-memory file that
+ * the command can read at its own pace.
+ * 
+ * @param rule The rule.
+ * @return int The file holding the lines, at its start, or -1 if there is no command.
+ */
+static int engine_ranges(watch_rule_t *rule) {
+    const watch_opts_t *opts = s_engine.opts;
+    engine_ranges_t ranges = { .rule = rule };
+    char *text = NULL;
+    size_t len = 0;
+    int fd = -1;
+
+    ranges.fp = open_memstream(&text, &len);
+    if (ranges.fp == NULL) {
+        return -1;
+    }
+    // Without the changed paths, the target stands for them.
+    if (changeset_level(rule->changes) != CHANGESET_ALL && changeset_count(rule->changes)) {
+        changeset_each(rule->changes, range_change, &ranges);
+    }
+    else {
+        range_change(rule->target, &ranges);
+    }
+    fclose(ranges.fp);
+    if (opts->print_changes) {
+        fwrite(text, 1, len, stdout);
+        fflush(stdout);
+    }
+    if (rule->command && !s_engine.replaying) {
+        fd = memfd_create("watchf-ranges", MFD_CLOEXEC);
+        if (fd != -1 && (write(fd, text, len) != (ssize_t)len || lseek(fd, 0, SEEK_SET) != 0)) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    free(text);
+    return fd;
+}
+
+/**
+ * @brief Give a run that has started one of the job slots.
+ *
+ * @param rule The rule.
+ * @param pid The command process, or SIM_PID for a simulated run.
+ */
+static void engine_job(watch_rule_t *rule, pid_t pid) {
+    for (unsigned slot = 0; slot < WATCH_MAX_JOBS; slot++) {
+        if (s_engine.jobs[slot].pid == 0) {
+            s_engine.jobs[slot].pid = pid;
+            s_engine.jobs[slot].start = s_engine.now;
+            s_engine.jobs[slot].rule = rule;
+            s_engine.jobs[slot].run = pid == SIM_PID ? 0 : control_run_begin();
+            s_engine.running++;
+            rule->running++;
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Run the command of a rule for its pending changes.
+ * @details A rule whose changes leave its tree hash as it was, or all
+ * fail its predicate, is not run, and a single scan goes on waiting.
+ * Otherwise the run is charged to the rule's fair queuing finish tag
+ * at its expected run time over its weight.
+ * 
+ * @param rule The rule.
+ */
+static void engine_dispatch(watch_rule_t *rule) {
+    const watch_opts_t *opts = s_engine.opts;
+
+    rule->pending = 0;
+    if (rule->held_since) {
+        rule->stats.held += s_engine.now - rule->held_since;
+        rule->held_since = 0;
+    }
+    // The tree is hashed first so that it takes in every change.
+    profile_begin(PROFILE_FILTER);
+    bool pass = (!rule->tree_check || engine_tree_changed(rule)) && (!rule->predicate.active || engine_predicate(rule));
+    profile_end();
+    if (!pass) {
+        rule->stats.filtered++;
+        rule->queued_since = 0;
+        rule->adapt.waiting = 0;
+        changeset_clear(rule->changes);
+        if (s_engine.report) {
+            s_engine.report(WATCH_SIM_SKIP, rule->index, s_engine.now);
+        }
+        if (opts->verbose) {
+            printf("Rule %s not run, no change met its conditions\n", rule->name);
+        }
+        return;
+    }
+    s_engine.timeout_at = 0;
+    uint64_t queued = rule->queued_since;
+    stats_observe(&rule->stats.queue, queued ? s_engine.now - queued : 0);
+    if (queued) {
+        rule->stats.queued++;
+        rule->queued_since = 0;
+    }
+    uint64_t start = rule->finish_tag > s_engine.vclock ? rule->finish_tag : s_engine.vclock;
+    uint64_t cost = rule->stats.usage.measured ? rule->stats.usage.wall / rule->stats.usage.measured : 0;
+    s_engine.vclock = start;
+    rule->finish_tag = start + (cost > RUN_COST_MIN ? cost : RUN_COST_MIN) / rule->weight;
+    int input = -1;
+    if (rule->changed_ranges) {
+        // The ranges are printed with their paths.
+        profile_begin(PROFILE_FILTER);
+        input = engine_ranges(rule);
+        profile_end();
+    }
+    else if (opts->print_changes && changeset_level(rule->changes) == CHANGESET_ALL) {
+        printf("%s\n", rule->target);
+        fflush(stdout);
+    }
+    else if (opts->print_changes) {
+        changeset_print(rule->changes, stdout);
+    }
+    if (hot_enabled() && changeset_level(rule->changes) == CHANGESET_PATHS) {
+        hot_run_begin();
+        changeset_each(rule->changes, hot_ran, NULL);
+    }
+    changeset_clear(rule->changes);
+    if (!opts->continuous && rule->command == NULL && rule->signal.signo == 0) {
+        // A wait without a command is over once the changes settle.
+        s_engine.exit_code = EXIT_SUCCESS;
+        s_engine.stop = true;
+        return;
+    }
+    rule_rate_take(rule, s_engine.now);
+    if (ADAPTIVE(rule)) {
+        adapt_run(rule, s_engine.now, queued);
+    }
+    stats_observe(&rule->stats.latency, s_engine.now - rule->first_event);
+    rule->stats.runs++;
+    stats_global()->runs++;
+    if (rule->signal.signo) {
+        // A replay never signals a live process.
+        bool sent = s_engine.replaying || procsignal_send(&rule->signal, opts->verbose);
+        if (!sent) {
+            rule->stats.failures++;
+        }
+        if (rule->command == NULL) {
+            control_run_end(rule->name, control_run_begin(), sent ? EXIT_SUCCESS : EXIT_FAILURE, 0);
+            if (!opts->continuous) {
+                s_engine.exit_code = sent ? EXIT_SUCCESS : EXIT_FAILURE;
+                s_engine.stop = true;
+            }
+            return;
+        }
+    }
+    if (s_engine.runtimes) {
+        // A simulated run holds its slot for the run time of the rule.
+        engine_job(rule, SIM_PID);
+        s_engine.report(WATCH_SIM_RUN, rule->index, s_engine.now);
+    }
+    else if (s_engine.replaying) {
+        // A replay only runs the command when one was given.
+        if (rule->command) {
+            execute_command(rule->command, opts->verbose);
+        }
+        if (!opts->continuous) {
+            s_engine.stop = true;
+        }
+    }
+    else {
+        pid_t pid = spawn_command(rule, input, opts->verbose);
+        if (input != -1) {
+            close(input);
+        }
+        if (pid == -1) {
+            s_engine.stop = true;
+            return;
+        }
+        engine_job(rule, pid);
+    }
+}
+
+/**
+ * @brief Apply the outcome of a storm rescan.
+ * @details Changes found by the rescan, and any left pending from
+ * before the storm, are run straight away.
+ * 
+ * @param changed The number of changed paths.
+ */
+static void engine_rescanned(long changed) {
+    s_engine.storm = false;
+    s_engine.full_reads = 0;
+    s_engine.window_start = s_engine.now;
+    s_engine.window_events = 0;
+    stats_global()->rescans++;
+    if (s_engine.opts->verbose) {
+        printf("Change storm over, rescan found %ld changes\n", changed);
+    }
+    for (int index = 0; index < rule_count(); index++) {
+        watch_rule_t *rule = rule_at(index);
+        uint64_t debounce = (uint64_t)rule->policy.debounce * 1000;
+        if (rule->pending) {
+            rule->last_event = s_engine.now > debounce ? s_engine.now - debounce : 0;
+        }
+    }
+}
+
+/**
+ * @brief Handle the arrival of the awaited target of a rule.
+ * @details The target is watched from now on and the arrival itself
+ * runs straight away, as a change.
+ * 
+ * @param rule The rule.
+ */
+static void engine_arrived(watch_rule_t *rule) {
+    const watch_opts_t *opts = s_engine.opts;
+    uint64_t debounce = (uint64_t)rule->policy.debounce * 1000;
+
+    rule->awaiting = false;
+    journal_arrived(rule->index);
+    changelog_add(rule->target);
+    if (opts->verbose) {
+        printf("'%s' has arrived\n", rule->target);
+    }
+    if (!s_engine.replaying) {
+        pathwait_shutdown(rule->wait);
+        rule->wait = NULL;
+        if (!watch_rule(rule)) {
+            // It went again, wait for the next one.
+            rule->wait = pathwait_init(s_inotify_instance, rule->target, opts->verbose);
+            rule->awaiting = rule->wait != NULL;
+            s_engine.stop = !rule->awaiting;
+            return;
+        }
+    }
+    engine_event(rule, s_engine.track_paths ? rule->target : NULL);
+    rule->last_event = s_engine.now > debounce ? s_engine.now - debounce : 0;
+}
+
+/**
+ * @brief Report a change found by a rescan to each rule that covers it.
+ * @details New directories in a recursive tree are watched.
+ * 
+ * @param path The changed path.
+ * @param is_dir True if the path is a directory.
+ * @param change The kind of change.
+ */
+static void rescan_changed(const char *path, bool is_dir, SNAP_CHANGE change) {
+    static const char *s_change_names[] = { "added", "removed", "modified" };
+
+    if (s_engine.opts->verbose) {
+        printf("Rescan: %s %s\n", path, s_change_names[change]);
+    }
+    changelog_add(path);
+    for (int index = 0; index < rule_count(); index++) {
+        watch_rule_t *rule = rule_at(index);
+        if (rule->awaiting || rule->retired || !rule_covers(rule, path)) {
+            continue;
+        }
+        s_engine.rescan_rules |= RULE_BIT(rule);
+        engine_event(rule, s_engine.track_paths ? path : NULL);
+        if (is_dir && change == SNAP_ADDED && rule->recursive) {
+            tree_add(path, rule, true);
+        }
+    }
+}
+
+/**
+ * @brief Defer a due background rule while the host is under pressure.
+ * 
+ * @param rule The rule.
+ * @return bool True if the rule has to wait.
+ */
+static bool engine_deferred(watch_rule_t *rule) {
+    int resource = rule->background ? psi_high(s_engine.now) : -1;
+
+    if (resource >= 0) {
+        if (rule->deferred_since == 0) {
+            rule->deferred_since = s_engine.now;
+            rule->stats.deferred++;
+            if (s_engine.opts->verbose) {
+                printf("Rule %s deferred, %s pressure %.2f%%\n", rule->name, psi_name(resource), psi_level(resource));
+            }
+        }
+        return true;
+    }
+    if (rule->deferred_since) {
+        rule->stats.deferred_time += s_engine.now - rule->deferred_since;
+        rule->deferred_since = 0;
+        if (s_engine.opts->verbose) {
+            printf("Rule %s released\n", rule->name);
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Check if a rule may take one of the shared job slots.
+ * @details With an interactive rule about, the other rules leave the
+ * last free slot to it.
+ * 
+ * @param rule The rule.
+ * @return bool True if a slot is free for the rule.
+ */
+static bool engine_slot_free(const watch_rule_t *rule) {
+    unsigned interactive = 0;
+
+    if (s_engine.running >= s_engine.slots) {
+        return false;
+    }
+    if (!s_engine.reserve || rule->interactive) {
+        return true;
+    }
+    for (int index = 0; index < rule_count(); index++) {
+        if (rule_at(index)->interactive) {
+            interactive += rule_at(index)->running;
+        }
+    }
+    return s_engine.running - interactive < s_engine.slots - 1;
+}
+
+/**
+ * @brief Check if one due rule should run before another.
+ * @details The interactive lane goes first, then the higher priority
+ * and then the smaller fair queuing start tag, which is the later of
+ * the virtual time and the finish tag of the rule's previous run.
+ * 
+ * @param rule The rule.
+ * @param other The rule to compare with.
+ * @return bool True if the rule goes first.
+ */
+static bool engine_before(const watch_rule_t *rule, const watch_rule_t *other) {
+    if (rule->interactive != other->interactive) {
+        return rule->interactive;
+    }
+    if (rule->priority != other->priority) {
+        return rule->priority > other->priority;
+    }
+    uint64_t start = rule->finish_tag > s_engine.vclock ? rule->finish_tag : s_engine.vclock;
+    uint64_t other_start = other->finish_tag > s_engine.vclock ? other->finish_tag : s_engine.vclock;
+    return start < other_start;
+}
+
+/**
+ * @brief Dispatch the due rules into the free job slots.
+ * @details Each pass picks the rule to go first among those that are
+ * due and may take a slot, so a rule that changes constantly cannot
+ * keep the others waiting. A due rule without a slot is queued until a
+ * command exits.
+ * 
+ */
+static void engine_schedule(void) {
+    while (!s_engine.stop) {
+        watch_rule_t *next = NULL;
+        for (int index = 0; index < rule_count(); index++) {
+            watch_rule_t *rule = rule_at(index);
+            uint64_t due = engine_due(rule);
+            if (due == 0 || s_engine.now < due || engine_deferred(rule)) {
+                continue;
+            }
+            if (s_engine.now < rule_rate_ready(rule)) {
+                if (rule->held_since == 0) {
+                    rule->held_since = s_engine.now;
+                    rule->stats.suppressed++;
+                    if (s_engine.opts->verbose) {
+                        printf("Rule %s rate limited, run held for %.0fms\n", rule->name,
+                            (double)(rule_rate_ready(rule) - s_engine.now) / 1000.0);
+                    }
+                }
+                continue;
+            }
+            // A signal alone takes no job slot, nothing is started.
+            if ((rule->command || rule->signal.signo == 0) && !engine_slot_free(rule)) {
+                if (rule->queued_since == 0) {
+                    rule->queued_since = s_engine.now;
+                    if (s_engine.opts->verbose) {
+                        printf("Rule %s queued, %u of %u slots busy\n", rule->name, s_engine.running, s_engine.slots);
+                    }
+                }
+                continue;
+            }
+            if (next == NULL || engine_before(rule, next)) {
+                next = rule;
+            }
+        }
+        if (next == NULL) {
+            break;
+        }
+        profile_begin(PROFILE_DISPATCH);
+        engine_dispatch(next);
+        profile_end();
+    }
+}
+
+/**
+ * @brief Dispatch the pending changes once the debounce period expires.
+ * @details A storm that has gone quiet is ended with a rescan, a
+ * background rule that is due while the host is under pressure is
+ * deferred until the pressure falls, a rule that is due but has used up
+ * its rate limit is held (its later changes merge into the held run),
+ * the rest are scheduled into the job slots and a single scan that has
+ * waited too long gives up.
+ * 
+ */
+static void engine_tick(void) {
+    if (s_engine.storm) {
+        uint64_t deadline = engine_deadline();
+        if (deadline && s_engine.now >= deadline) {
+            s_engine.rescan_rules = 0;
+            long changed = snapshot_rescan(rescan_changed, s_engine.storm_lost);
+            if (s_engine.opts->verbose) {
+                unsigned long listed;
+                unsigned long statted;
+                snapshot_work(&listed, &statted);
+                printf("%s rescan listed %lu directories and statted %lu paths\n",
+                    s_engine.storm_lost ? "Full" : "Incremental", listed, statted);
+            }
+            journal_rescan(changed, s_engine.rescan_rules);
+            engine_rescanned(changed);
+        }
+    }
+    else {
+        engine_schedule();
+    }
+    if (!s_engine.stop && s_engine.timeout_at && s_engine.now >= s_engine.timeout_at) {
+        if (s_engine.opts->verbose) {
+            puts("Timed out waiting for changes to settle.");
+        }
+        s_engine.exit_code = WATCH_EXIT_TIMEOUT;
+        s_engine.stop = true;
+    }
+}
+
+/**
+ * @brief Handle the exit of the command process.
+ * 
+ * @param pid The child process id.
+ * @param status The child wait status.
+ * @param usage The resources used by the child and the processes it waited for.
+ */
+static void child_exited(pid_t pid, int status, const struct rusage *usage) {
+    engine_job_t *job = NULL;
+    for (unsigned slot = 0; slot < WATCH_MAX_JOBS; slot++) {
+        if (s_engine.jobs[slot].pid == pid) {
+            job = &s_engine.jobs[slot];
+            break;
+        }
+    }
+    uint64_t runtime = job ? s_engine.now - job->start : 0;
+    journal_exit(pid, status, runtime, job ? job->rule->index : 0);
+    if (job) {
+        watch_rule_t *rule = job->rule;
+        if (ADAPTIVE(rule)) {
+            adapt_exit(rule, runtime);
+            engine_slot_wait(rule);
+        }
+        stats_usage(rule, runtime, usage);
+        control_run_end(rule->name, job->run,
+            WIFEXITED(status) ? WEXITSTATUS(status) : WIFSIGNALED(status) ? 128 + WTERMSIG(status) : EXIT_FAILURE,
+            runtime);
+        job->pid = 0;
+        job->rule = NULL;
+        s_engine.running--;
+        rule->running--;
+        if (status != 0) {
+            rule->stats.failures++;
+        }
+        if (s_engine.opts->verbose) {
+            fprintf(stdout, "return code %x\n", status);
+            fprintf(stdout, "Rule %s run took %.1fms, %.1fms user, %.1fms sys, %ldkB rss\n", rule->name,
+                (double)runtime / 1000.0,
+                (double)usage->ru_utime.tv_sec * 1000.0 + (double)usage->ru_utime.tv_usec / 1000.0,
+                (double)usage->ru_stime.tv_sec * 1000.0 + (double)usage->ru_stime.tv_usec / 1000.0,
+                usage->ru_maxrss);
+        }
+        // A single scan ends with the command, returning its status.
+        if (!s_engine.opts->continuous) {
+            s_engine.exit_code = WIFEXITED(status) ? WEXITSTATUS(status) : EXIT_FAILURE;
+            s_engine.stop = true;
+        }
+        // A command that fails ends the watch.
+        else if (status != 0) {
+            if (WIFEXITED(status) != 0) {
+                s_engine.stop = true;
+            }
+        }
+    }
+}
+
+/**
+ * @brief End the simulated runs whose run time is up.
+ * 
+ */
+static void simulated_exits(void) {
+    for (unsigned slot = 0; slot < WATCH_MAX_JOBS; slot++) {
+        engine_job_t *job = &s_engine.jobs[slot];
+        if (job->pid == SIM_PID && job->start + s_engine.runtimes[job->rule->index] <= s_engine.now) {
+            job->rule->running--;
+            job->pid = 0;
+            job->rule = NULL;
+            s_engine.running--;
+        }
+    }
+}
+
+/**
+ * @brief Collect all exited child processes.
+ * @details wait4 also reports the resources each command used.
+ * 
+ */
+static void reap_children(void) {
+    struct rusage usage;
+    int status;
+    pid_t pid;
+    while ((pid = wait4(-1, &status, WNOHANG, &usage)) > 0) {
+        child_exited(pid, status, &usage);
+    }
+}
+
+/**
+ * @brief Work out the engine settings that follow from the rules.
+ * @details The interactive lane keeps a slot back only if it has a
+ * rule, and the path of each change is needed to print it, count it,
+ * log it or test it against a predicate.
+ * 
+ */
+static void engine_configure(void) {
+    const watch_opts_t *opts = s_engine.opts;
+
+    s_engine.reserve = false;
+    s_engine.track_paths = opts->print_changes || hot_enabled() || changelog_enabled();
+    for (int index = 0; index < rule_count(); index++) {
+        const watch_rule_t *rule = rule_at(index);
+        if (rule->retired) {
+            continue;
+        }
+        // With one slot there is nothing to keep back.
+        s_engine.reserve |= rule->interactive && s_engine.slots > 1;
+        s_engine.track_paths |= rule->predicate.active || rule->tree_check || rule->changed_ranges;
+    }
+}
+
+/**
+ * @brief Stop a rule watching, leaving its running commands to finish.
+ * @details Its watches and snapshot paths are dropped unless another
+ * rule shares them, and its pending changes are discarded.
+ * 
+ * @param rule The rule.
+ */
+static void engine_retire(watch_rule_t *rule) {
+    rule->retired = true;
+    rule->pending = 0;
+    rule->held_since = 0;
+    rule->deferred_since = 0;
+    rule->queued_since = 0;
+    changeset_clear(rule->changes);
+    if (rule->awaiting) {
+        pathwait_shutdown(rule->wait);
+        rule->wait = NULL;
+        rule->awaiting = false;
+    }
+    else {
+        tree_drop_rule(rule);
+        snapshot_drop(rule->target, rule->recursive, rule->follow);
+    }
+    if (rule->tree_check) {
+        merkle_drop(rule->target);
+    }
+}
+
+/**
+ * @brief Start a rule added by a reload.
+ * 
+ * @param rule The rule.
+ * @return bool True if the rule is watching, or waiting for its target.
+ */
+static bool engine_start(watch_rule_t *rule) {
+    const watch_opts_t *opts = s_engine.opts;
+
+    if (ADAPTIVE(rule)) {
+        adapt_init(rule);
+    }
+    hash_rule(rule);
+    chunk_rule(rule);
+    if (!placement_update(rule, opts->verbose)) {
+        return false;
+    }
+    if (!rule->await) {
+        return watch_rule(rule);
+    }
+    rule->wait = pathwait_init(s_inotify_instance, rule->target, opts->verbose);
+    if (rule->wait == NULL) {
+        return false;
+    }
+    rule->awaiting = true;
+    if (pathwait_arrived(rule->wait)) {
+        engine_arrived(rule);
+    }
+    return true;
+}
+
+/**
+ * @brief Apply the config file again.
+ * @details The new rules are matched to the configured rules by name.
+ * A rule that watches the same target in the same way keeps its
+ * watches, snapshot, pending changes, running commands and statistics
+ * and takes the new command, policy and placement. Any other rule that
+ * has gone or changed its target is retired, and the new ones are
+ * watched, so only the difference is walked. A config with a mistake
+ * in it changes nothing.
+ * 
+ */
+static void engine_reload(void) {
+    const watch_opts_t *opts = s_engine.opts;
+    watch_rule_t *rules[WATCH_MAX_RULES];
+    uint64_t started = watch_clock_us();
+    int count;
+    int kept = 0;
+    int added = 0;
+    int removed = 0;
+    bool ok;
+
+    if (opts->config == NULL) {
+        return;
+    }
+    ok = config_load(opts->config, rules, &count);
+    for (int index = 0; ok && index < count; index++) {
+        if (rules[index]->command == NULL && rules[index]->signal.signo == 0 && opts->continuous) {
+            fprintf(stderr, "Config rule [%s] has no command or signal\n", rules[index]->name);
+            ok = false;
+        }
+        ok = ok && placement_check(rules[index], opts->cgroup);
+    }
+    if (!ok) {
+        for (int index = 0; index < count; index++) {
+            rule_destroy(rules[index]);
+        }
+        fprintf(stderr, "Config '%s' not reloaded, the rules are unchanged\n", opts->config);
+        return;
+    }
+
+    // Update the rules that stay, retire those that go.
+    for (int index = 0; index < rule_count(); index++) {
+        watch_rule_t *rule = rule_at(index);
+        int match = 0;
+        if (!rule->configured || rule->retired) {
+            continue;
+        }
+        while (match < count && (rules[match] == NULL || strcmp(rules[match]->name, rule->name) != 0)) {
+            match++;
+        }
+        if (match < count && rule_same_watch(rule, rules[match])) {
+            bool hashed = rule->tree_check;
+            bool chunked = rule->changed_ranges;
+            rule_update(rule, rules[match]);
+            rule_destroy(rules[match]);
+            rules[match] = NULL;
+            if (ADAPTIVE(rule)) {
+                adapt_init(rule);
+            }
+            predicate_seed(&rule->predicate, rule->target);
+            if (rule->tree_check && !hashed) {
+                hash_rule(rule);
+            }
+            else if (hashed && !rule->tree_check) {
+                merkle_drop(rule->target);
+            }
+            if (rule->changed_ranges && !chunked) {
+                chunk_rule(rule);
+            }
+            placement_update(rule, opts->verbose);
+            kept++;
+        }
+        else {
+            engine_retire(rule);
+            removed++;
+        }
+    }
+
+    // Watch the new ones.
+    for (int index = 0; index < count; index++) {
+        watch_rule_t *rule = rules[index];
+        if (rule == NULL) {
+            continue;
+        }
+        if (!rule_adopt(rule)) {
+            rule_destroy(rule);
+            continue;
+        }
+        if (!engine_start(rule)) {
+            fprintf(stderr, "Unable to watch '%s' for rule %s\n", rule->target, rule->name);
+            engine_retire(rule);
+            continue;
+        }
+        added++;
+    }
+    engine_configure();
+    if (opts->verbose) {
+        printf("Config reloaded in %.1fms: %d rules kept, %d added, %d removed, %u watches\n",
+            (double)(watch_clock_us() - started) / 1000.0, kept, added, removed, tree_count());
+    }
+}
+
+/**
+ * @brief Handle a signal read from the signal handle or the journal.
+ * 
+ * @param signo The signal number.
+ */
+static void handle_signal(int signo) {
+    bool verbose = s_engine.opts->verbose;
+
+    /* Break loop if we got the expected signal, a hangup only ends a watch without a config. */
+    if (signo == SIGINT || signo == SIGTERM || (signo == SIGHUP && s_engine.opts->config == NULL)) {
+        if (verbose) {
+            fprintf(stdout, "Received shutdown signal!\n");
+        }
+        s_engine.stop = true;
+    }
+    else if (signo == SIGCHLD) {
+        // Recorded child exits are replayed from their own records.
+        if (!s_engine.replaying) {
+            reap_children();
+        }
+    }
+    else if (signo == SIGHUP) {
+        // A recorded reload shows in the recorded watches.
+        if (!s_engine.replaying) {
+            engine_reload();
+        }
+    }
+    else if (signo == SIGUSR1) {
+        stats_dump(stderr, s_engine.now, tree_count());
+        if (s_engine.opts->stats_json) {
+            stats_save(s_engine.opts->stats_json, stats_json, s_engine.now, tree_count());
+        }
+    }
+    else if (verbose) {
+        fprintf (stderr, "Received unexpected signal\n");            
+    }
+}
+
+/**
+ * @brief Sleep until a monotonic clock time.
+ * 
+ * @param when The wake time in microseconds.
+ */
+static void sleep_until(uint64_t when) {
+    struct timespec ts = {
+        .tv_sec = (time_t)(when / 1000000),
+        .tv_nsec = (long)(when % 1000000) * 1000
+    };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+}
+
+/**
+ * @brief Advance the replay clock, acting on any deadlines on the way.
+ * 
+ * @param when The journal time to advance to.
+ * @param base The monotonic time at which the replay started.
+ */
+static void replay_advance(uint64_t when, uint64_t base) {
+    bool fast = s_engine.opts->replay_fast;
+    uint64_t wake;
+
+    while (!s_engine.stop && (wake = engine_wake()) != 0 && wake <= when) {
+        if (!fast) {
+            sleep_until(base + wake);
+        }
+        s_engine.now = wake;
+        if (s_engine.runtimes) {
+            simulated_exits();
+        }
+        engine_tick();
+    }
+    if (!fast) {
+        sleep_until(base + when);
+    }
+    if (when > s_engine.now) {
+        s_engine.now = when;
+    }
+}
+
+/**
+ * @brief Match the rules to those recorded in a journal.
+ * @details Rules given with the replay take the recorded target of the
+ * rule in the same position when they have none of their own; recorded
+ * rules beyond those given are replayed with the default policy.
+ * 
+ * @param reader The journal reader.
+ * @return bool False if a rule could not be created.
+ */
+static bool replay_rules(const journal_reader_t *reader) {
+    for (int index = 0; index < reader->rules; index++) {
+        watch_rule_t *rule = rule_at(index);
+        if (rule == NULL && (rule = rule_new()) == NULL) {
+            return false;
+        }
+        if (rule->target == NULL && !rule_option(rule, "file", reader->targets[index])) {
+            return false;
+        }
+        rule->awaiting = rule->await;
+    }
+    return true;
+}
+
+/**
+ * @brief Start adapting the policy of each adaptive rule.
+ * 
+ */
+static void adapt_rules(void) {
+    for (int index = 0; index < rule_count(); index++) {
+        if (ADAPTIVE(rule_at(index))) {
+            adapt_init(rule_at(index));
+        }
+    }
+}
+
+/**
+ * @brief Feed the records of a journal to the engine.
+ * @details The engine clock follows the journal, acting on each
+ * deadline on the way, and then goes on until the changes left at the
+ * end have reached their runs. A simulated replay is not sent the
+ * recorded signals.
+ * 
+ * @param reader The journal reader.
+ * @param base The monotonic time at which the replay started.
+ * @param records Receives the number of records read.
+ * @param recorded_runs Receives the number of runs recorded.
+ * @return int 0 at the end of the journal, -1 on error.
+ */
+static int replay_records(journal_reader_t *reader, uint64_t base, unsigned long *records, unsigned long *recorded_runs) {
+    const watch_opts_t *opts = s_engine.opts;
+    watch_stats_t *stats = stats_global();
+    journal_rec_t rec;
+    uint64_t wake;
+    uint64_t last = 0;
+    int rc = 0;
+
+    while (!s_engine.stop && (rc = journal_read(reader, &rec)) > 0) {
+        (*records)++;
+        replay_advance(rec.ts, base);
+        switch (rec.type) {
+            case JR_EVENTS:
+                stats->reads++;
+                engine_read(rec.data, (ssize_t)rec.len, opts->verbose && !s_engine.behind);
+                break;
+            case JR_LAG:
+                engine_lag((unsigned long)rec.value);
+                break;
+            case JR_RESCAN:
+                for (int index = 0; index < rule_count(); index++) {
+                    if (rec.rules & (1ULL << index)) {
+                        engine_event(rule_at(index), NULL);
+                    }
+                }
+                engine_rescanned((long)rec.value);
+                break;
+            case JR_ARRIVED:
+                for (int index = 0; index < rule_count(); index++) {
+                    if ((rec.rules & (1ULL << index)) && rule_at(index)->awaiting) {
+                        engine_arrived(rule_at(index));
+                    }
+                }
+                break;
+            case JR_SIGNAL:
+                if (s_engine.runtimes == NULL) {
+                    handle_signal((int)rec.value);
+                }
+                break;
+            case JR_EXIT:
+                // The recorded run times keep an adaptive policy on track.
+                for (int index = 0; index < rule_count(); index++) {
+                    if (rec.rules & (1ULL << index)) {
+                        if (ADAPTIVE(rule_at(index))) {
+                            adapt_exit(rule_at(index), rec.runtime);
+                        }
+                        stats_usage(rule_at(index), rec.runtime, NULL);
+                    }
+                }
+                (*recorded_runs)++;
+                break;
+            case JR_WATCH:
+                // Rules added by a reload are not replayed.
+                rec.rules &= rule_count() < WATCH_MAX_RULES ? (1ULL << rule_count()) - 1 : ~0ULL;
+                tree_remember((int)rec.value, rec.data, rec.rules);
+                if (opts->verbose && rec.rules) {
+                    printf("Begun monitoring of '%s' - %d\n", rec.data, (int)rec.value);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    // Let any trailing changes reach their run, after the runs before them end.
+    while (!s_engine.stop && (wake = engine_wake()) > last) {
+        last = wake;
+        replay_advance(wake, base);
+    }
+    return rc;
+}
+
+/**
+ * @brief Drive the filter, debounce and dispatch pipeline from a journal.
+ * 
+ * @param opts A pointer to the watcher options.
+ * @return int 0 on success.
+ */
+static int replay_journal(const watch_opts_t *opts) {
+    journal_reader_t reader;
+    unsigned long records = 0;
+    unsigned long recorded_runs = 0;
+    watch_stats_t *stats = stats_global();
+
+    if (!journal_reader_open(&reader, opts->replay_file)) {
+        return EXIT_FAILURE;
+    }
+    if (!replay_rules(&reader)) {
+        journal_reader_close(&reader);
+        return EXIT_FAILURE;
+    }
+    adapt_rules();
+    if (opts->verbose) {
+        for (int index = 0; index < reader.rules; index++) {
+            printf("Replaying '%s' recorded from '%s'\n", opts->replay_file, reader.targets[index]);
+        }
+    }
+    s_engine.replaying = true;
+    s_engine.timeout_at = opts->continuous ? 0 : (uint64_t)opts->timeout * 1000;
+    uint64_t base = watch_clock_us();
+    int rc = replay_records(&reader, base, &records, &recorded_runs);
+    double elapsed = (double)(watch_clock_us() - base) / 1e6;
+    journal_reader_close(&reader);
+
+    printf("Replayed %lu records, %lu events in %.3fs (%.0f events/s): %lu runs, %lu recorded\n",
+        records, stats->events, elapsed,
+        elapsed > 0 ? (double)stats->events / elapsed : 0.0,
+        stats->runs, recorded_runs
+    );
+    if (opts->verbose) {
+        stats_dump(stdout, s_engine.now, tree_count());
+    }
+    if (opts->stats_json) {
+        stats_save(opts->stats_json, stats_json, s_engine.now, tree_count());
+    }
+    tree_shutdown();
+    if (rc < 0) {
+        fprintf(stderr, "Failed to read journal '%s'\n", opts->replay_file);
+        return EXIT_FAILURE;
+    }
+    return s_engine.exit_code >= 0 ? s_engine.exit_code : EXIT_SUCCESS;
+}
+
+/**
+ * @brief Replay a journal through the dispatch engine under one policy.
+ * @details For the tuner, so that what it reports comes from the same
+ * debounce, scheduling and limits as a live watch. Each rule has job
+ * slots enough to run to its own jobs limit, as the tuner looks at the
+ * rules one at a time. Change storms are not detected again, each
+ * change is dispatched as it came.
+ * 
+ * @param path The journal file name.
+ * @param policy The policy of every rule.
+ * @param runtimes The simulated run time of each rule (us).
+ * @param report Told of each change, run and dropped run.
+ * @return int The number of recorded rules, or -1 on failure.
+ */
+int watch_simulate(const char *path, const watch_policy_t *policy, const uint64_t *runtimes, watch_sim_fn report) {
+    watch_opts_t opts = { .replay_file = path, .continuous = true, .replay_fast = true };
+    journal_reader_t reader;
+    unsigned long records = 0;
+    unsigned long recorded_runs = 0;
+
+    if (!journal_reader_open(&reader, path)) {
+        return -1;
+    }
+    rules_free();
+    s_engine = (engine_t){
+        .opts = &opts, .exit_code = -1, .batch = EVENT_BUF_LEN, .slots = WATCH_MAX_JOBS,
+        .replaying = true, .runtimes = runtimes, .report = report
+    };
+    bool ok = replay_rules(&reader);
+    for (int index = 0; ok && index < rule_count(); index++) {
+        rule_at(index)->policy = *policy;
+    }
+    if (ok && replay_records(&reader, watch_clock_us(), &records, &recorded_runs) < 0) {
+        ok = false;
+    }
+    int rules = reader.rules;
+    journal_reader_close(&reader);
+    tree_shutdown();
+    rules_free();
+    s_engine = (engine_t){ .exit_code = -1, .batch = EVENT_BUF_LEN };
+    return ok ? rules : -1;
+}
+
+/**
+ * @brief Open the journal to record to.
+ * 
+ * @param path The journal file name.
+ * @return bool True if the journal was opened.
+ */
+static bool record_journal(const char *path) {
+    const char *targets[WATCH_MAX_RULES];
+
+    for (int index = 0; index < rule_count(); index++) {
+        targets[index] = rule_at(index)->target;
+    }
+    return journal_open(path, targets, rule_count());
+}
+
+/**
+ * @brief Rewrite the metrics file.
+ * 
+ */
+static void write_metrics(void) {
+    const watch_opts_t *opts = s_engine.opts;
+
+    stats_save(opts->metrics_file, metrics_write, s_engine.now, tree_count());
+    s_engine.metrics_at = s_engine.now + (uint64_t)opts->metrics_interval * 1000;
+}
+
+/**
+ * @brief Watch a file, files or a directory for changes.
+ * @details The routine wathes a file, files or directory for changes
+ * and executes a command for each change.
+ * 
+ * @param opts A pointer to the watcher options.
+ * @return int 0 on success, WATCH_EXIT_TIMEOUT if a wait timed out.
+ */
+int watch_for_changes(const watch_opts_t *opts) {
+    int ret = EXIT_FAILURE;
+    int signal_fd;
+    int inotify_fd;
+    bool verbose = opts->verbose;
+
+    s_engine.opts = opts;
+    lag_init();
+    s_engine.slots = opts->slots ? opts->slots : WATCH_MAX_JOBS;
+    changeset_limit(opts->changes_max);
+    if (opts->top && !hot_init(opts->top)) {
+        return EXIT_FAILURE;
+    }
+    // Only control clients ask for the change log.
+    if (opts->control && opts->change_log && !changelog_init(opts->change_log)) {
+        hot_free();
+        return EXIT_FAILURE;
+    }
+    if (opts->profile) {
+        profile_init(verbose);
+    }
+    engine_configure();
+    stats_global()->started = watch_clock_us();
+    stats_queue_source(engine_queued);
+    if (opts->replay_file) {
+        ret = replay_journal(opts);
+        hot_free();
+        changelog_free();
+        profile_shutdown();
+        return ret;
+    }
+    adapt_rules();
+
+    // Initialise the signals interface.
+    signal_fd = initialize_signals();
+    if (signal_fd == -1) {
+        fprintf(stderr, "Unable to initialise signal handler\n");
+        ret = EXIT_FAILURE;
+    }
+    else if (!psi_init(opts->pressure, verbose)) {
+        close(signal_fd);
+        ret = EXIT_FAILURE;
+    }
+    else if (!placement_init(opts->pin, opts->cgroup, verbose)) {
+        close(signal_fd);
+        psi_shutdown();
+        placement_shutdown();
+        ret = EXIT_FAILURE;
+    }
+    else if (!control_init(opts->control, verbose)) {
+        close(signal_fd);
+        psi_shutdown();
+        placement_shutdown();
+        ret = EXIT_FAILURE;
+    }
+    else if (opts->record_file && !record_journal(opts->record_file)) {
+        close(signal_fd);
+        psi_shutdown();
+        placement_shutdown();
+        control_shutdown();
+        ret = EXIT_FAILURE;
+    }
+    else if ((inotify_fd = initialise_watcher(opts)) == -1) {
+        close(signal_fd);
+        journal_close();
+        psi_shutdown();
+        placement_shutdown();
+        control_shutdown();
+        fprintf(stderr, "Unable to initialise watch handler\n");
+        ret = EXIT_FAILURE;
+    }
+    else {
+        // Assume this is going to work (and use this as an error flag).
+        ret = EXIT_SUCCESS;
+
+        // Setup a structure of the event handles that we'll watch.
+        struct pollfd poll_handles[FD_POLL_MAX] = {
+            { .fd = signal_fd, .events = POLLIN },
+            { .fd = inotify_fd, .events = POLLIN }
+        };
+        nfds_t psi_end = FD_POLL_PSI + (nfds_t)psi_poll_fds(&poll_handles[FD_POLL_PSI]);
+
+        // Now loop through the handles.
+        s_engine.now = watch_clock_us();
+        if (!opts->continuous && opts->timeout) {
+            s_engine.timeout_at = s_engine.now + (uint64_t)opts->timeout * 1000;
+        }
+        for (int index = 0; index < rule_count(); index++) {
+            watch_rule_t *rule = rule_at(index);
+            if (rule->awaiting && pathwait_arrived(rule->wait)) {
+                engine_arrived(rule);
+            }
+        }
+        if (opts->metrics_file) {
+            s_engine.now = watch_clock_us();
+            write_metrics();
+        }
+        while (!s_engine.stop) {
+            // Wake at the debounce deadline if there are watch events, otherwise 1s.
+            s_engine.now = watch_clock_us();
+            uint64_t deadline = engine_wake();
+            int timeout = IDLE_TIMEOUT_MS;
+            if (deadline) {
+                timeout = deadline <= s_engine.now ? 0 : (int)((deadline - s_engine.now + 999) / 1000);
+            }
+
+            // The control clients come and go, their handles follow the fixed ones.
+            nfds_t poll_count = psi_end + (nfds_t)control_poll_fds(&poll_handles[psi_end], s_engine.now);
+            int npoll = poll(poll_handles, poll_count, timeout);
+            s_engine.now = watch_clock_us();
+            if (npoll == 0) {
+                journal_flush();
+            }
+            else if (npoll < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                fprintf(stderr, "Couldn't poll: '%s'\n", strerror(errno));
+                ret = EXIT_FAILURE;
+                break;
+            }
+            else if (npoll > 0) {
+                // Check for an interrupt signal.
                 if (poll_handles[FD_POLL_SIGNAL].revents & POLLIN) {
                     struct signalfd_siginfo fdsi;
                     if (read (poll_handles[FD_POLL_SIGNAL].fd, &fdsi, sizeof (fdsi)) != sizeof (fdsi)) {
@@ -290,31 +2170,60 @@ int watch_for_changes(const char *watch_target, const char *command, bool contin
                         ret = EXIT_FAILURE;
                         break;
                     }
-                    /* Break loop if we got the expected signal */
-                    if (fdsi.ssi_signo == SIGINT || fdsi.ssi_signo == SIGTERM) {
-                        if (verbose) {
-                            fprintf(stdout, "Received shutdown signal!\n");
-                        }
+                    journal_signal((int)fdsi.ssi_signo);
+                    handle_signal((int)fdsi.ssi_signo);
+                    if (s_engine.stop) {
                         break;
                     }
-                    else if (verbose) {
-                        fprintf (stderr, "Received unexpected signal\n");            
-                    }
                 }
 
                 // Now check for an inotify (file/directory) event.
                 if (poll_handles[FD_POLL_INOTIFY].revents & POLLIN) {
-                    if (watch_handler(poll_handles[FD_POLL_INOTIFY].fd, verbose) > 0) {
-                        watch_events++;
+                    watch_handler(poll_handles[FD_POLL_INOTIFY].fd, verbose);
+                }
+
+                // A pressure trigger fired, read the pressure afresh.
+                for (nfds_t psi = FD_POLL_PSI; psi < psi_end; psi++) {
+                    if (poll_handles[psi].revents & POLLPRI) {
+                        psi_triggered();
                     }
                 }
+
+                // Answer any control requests.
+                control_events(&poll_handles[psi_end], (int)(poll_count - psi_end), s_engine.now, tree_count());
+            }
+            engine_tick();
+            if (s_engine.metrics_at && s_engine.now >= s_engine.metrics_at) {
+                write_metrics();
             }
         }
         if (verbose) {
             puts("Closing down.");
         }
+        reap_children();
+        if (verbose) {
+            stats_dump(stdout, s_engine.now, tree_count());
+        }
+        if (opts->stats_json) {
+            stats_save(opts->stats_json, stats_json, s_engine.now, tree_count());
+        }
+        if (opts->metrics_file) {
+            write_metrics();
+        }
+        snapshot_free();
+        merkle_free();
         shutdown_watcher();
+        journal_close();
+        psi_shutdown();
+        placement_shutdown();
+        control_shutdown();
+        hot_free();
+        changelog_free();
+        profile_shutdown();
         close(signal_fd);
+        if (ret == EXIT_SUCCESS && s_engine.exit_code >= 0) {
+            ret = s_engine.exit_code;
+        }
     }
     return ret;
 }
@@ -0,0 +1,161 @@
+/**
+ * @file watch.h
+ * @author Mark Lehane (markdlehane@gmail.com)
+ * @brief Watch interface.
+ * @details Shared declarations for the watcher: the option block that
+ * main.c fills in from the command line and the entry point that runs
+ * the watch loop.
+ *
+ * @version 0.1
+ * @date 2025-12-04
+ *
+ * @copyright Copyright (c) 2025, Mark D Lehane.
+ *
+ */
+
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/inotify.h>
+
+// Dispatch defaults and limits.
+#define WATCH_DEFAULT_DEBOUNCE 100
+#define WATCH_DEFAULT_MAX_LATENCY 0
+#define WATCH_DEFAULT_JOBS 1
+#define WATCH_MAX_JOBS 64
+#define WATCH_MAX_PRIORITY 9
+#define WATCH_MAX_WEIGHT 1000
+#define WATCH_MAX_RULES 64
+#define WATCH_DEFAULT_STORM_RATE 1000
+#define WATCH_DEFAULT_STORM_QUIET 500
+#define WATCH_DEFAULT_METRICS_INTERVAL 15000
+
+// Largest inotify read, made while the kernel queue is backed up.
+#define WATCH_MAX_READ ((sizeof(struct inotify_event) + NAME_MAX + 1) * 1024)
+
+// Exit status of a wait (--once without a command) that timed out.
+#define WATCH_EXIT_TIMEOUT 2
+
+/**
+ * @brief Dispatch policy.
+ *
+ */
+typedef struct watch_policy_s {
+    unsigned debounce;          // Quiet period before a run (ms).
+    unsigned max_latency;       // Longest a change may wait for a run (ms), 0 for no limit.
+    unsigned jobs;              // Maximum number of concurrent runs.
+
+} watch_policy_t;
+
+/**
+ * @brief Watcher options container structure.
+ * @details The targets, commands and their policies are the rules (see
+ * rules.h); these options apply to the watch as a whole.
+ *
+ */
+typedef struct watch_opts_s {
+    const char *record_file;    // Event journal to record to (or NULL).
+    const char *replay_file;    // Event journal to replay from (or NULL).
+    unsigned storm_rate;        // Events per second that start a change storm, 0 to disable.
+    unsigned storm_quiet;       // Quiet period that ends a change storm (ms).
+    unsigned timeout;           // Longest a single scan waits for changes to settle (ms), 0 for ever.
+    unsigned slots;             // Job slots shared by all rules, 0 for WATCH_MAX_JOBS.
+    const char *pressure;       // Pressure thresholds that defer background rules (or NULL).
+    const char *stats_json;     // File to write JSON statistics to (or NULL).
+    const char *cgroup;         // Delegated cgroup v2 directory for the runs (or NULL).
+    int pin;                    // CPU reserved for the watcher, or -1.
+    unsigned top;               // Heaviest paths and directories to track, 0 for none.
+    const char *control;        // Control socket path (or NULL).
+    const char *metrics_file;   // Prometheus textfile to rewrite (or NULL).
+    unsigned metrics_interval;  // Time between metrics file rewrites (ms).
+    const char *config;         // Config file of rules, reloaded when it changes (or NULL).
+    size_t changes_max;         // Most memory the changed paths of a rule may hold (bytes).
+    unsigned change_log;        // Most changed paths kept for 'since' queries, 0 for none.
+    bool print_changes;         // Print the changed paths when they settle.
+    bool profile;               // Measure the watcher's own stages.
+    bool continuous;            // Scan continuously rather than once.
+    bool verbose;               // Report events and debug information.
+    bool replay_fast;           // Replay as fast as possible, not in real time.
+
+} watch_opts_t;
+
+/**
+ * @brief Change event callback.
+ *
+ * @param event The change event.
+ */
+typedef void (*watch_change_fn)(const struct inotify_event *event);
+
+/**
+ * @brief Enum used to identify what a simulated replay reports.
+ *
+ */
+typedef enum watch_sim_e {
+    WATCH_SIM_EVENT = 0,        // A change reached a rule.
+    WATCH_SIM_RUN,              // A rule ran for its pending changes.
+    WATCH_SIM_SKIP              // A rule's pending changes were dropped without a run.
+
+} WATCH_SIM;
+
+/**
+ * @brief Simulated replay callback.
+ *
+ * @param what What happened.
+ * @param rule The index of the rule.
+ * @param at The journal time in microseconds.
+ */
+typedef void (*watch_sim_fn)(WATCH_SIM what, int rule, uint64_t at);
+
+/**
+ * @brief Read the monotonic clock.
+ *
+ * @return uint64_t The monotonic time in microseconds.
+ */
+extern uint64_t watch_clock_us(void);
+
+/**
+ * @brief Filter a buffer of inotify events.
+ *
+ * @param buf The raw events buffer.
+ * @param len The number of bytes in the buffer.
+ * @param verbose True if each event should be reported.
+ * @param overflow If not NULL, set true if the kernel queue overflowed.
+ * @param on_change If not NULL, called for each change event.
+ * @return int The number of change events in the buffer.
+ */
+extern int watch_filter_events(const char *buf, ssize_t len, bool verbose, bool *overflow, watch_change_fn on_change);
+
+/**
+ * @brief Watch a file, files or a directory for changes.
+ * @details The routine watches the target of each rule for changes
+ * and executes its command for each change. When a replay file is given
+ * the events are read from the journal rather than from inotify. A
+ * single scan without a command just waits for the changes to settle.
+ *
+ * @param opts A pointer to the watcher options.
+ * @return int 0 on success, WATCH_EXIT_TIMEOUT if a wait timed out.
+ */
+extern int watch_for_changes(const watch_opts_t *opts);
+
+/**
+ * @brief Replay a journal through the dispatch engine under one policy.
+ * @details The recorded rules replace the rule table, each with the
+ * policy. A run holds a job slot for the run time of its rule instead
+ * of running anything, and each change and run is reported as the
+ * engine comes to it.
+ *
+ * @param path The journal file name.
+ * @param policy The policy of every rule.
+ * @param runtimes The simulated run time of each rule (us).
+ * @param report Told of each change, run and dropped run.
+ * @return int The number of recorded rules, or -1 on failure.
+ */
+extern int watch_simulate(const char *path, const watch_policy_t *policy, const uint64_t *runtimes, watch_sim_fn report);
+
+#endif
+
+/* End. */